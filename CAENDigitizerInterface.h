@@ -18,6 +18,17 @@
 
 // my includes
 #include "file_helpers.h"
+#include "analysis_executor.h"
+#include "baseline_tracker.h"
+#include "crosstalk.h"
+#include "dark_count.h"
+#include "event_batch.h"
+#include "flight_recorder.h"
+#include "histogram.h"
+#include "pe_spectrum.h"
+#include "pulse_template.h"
+#include "rollover_helpers.h"
+#include "run_catalog.h"
 #include "caen_helper.h"
 #include "implot_helpers.h"
 #include "include/caen_helper.h"
@@ -44,6 +55,49 @@ namespace SBCQueens {
 		std::string RunDir = "";
 		std::string RunName =  "";
 		std::string SiPMParameters = "";
+		// Saved in the run catalog with each run, ex: Teensy setpoints
+		std::vector<RunCatalogParameter> RunParameters;
+
+		// How the SiPM pulse files are written to disk
+		FileOptions PulseFileOptions;
+		// When to move to a new pulse file during a run
+		RolloverPolicy PulseFileRollover;
+		// Format options of the pulse files, ex: trace compression
+		SBCFileConfig PulseFileConfig;
+
+		// Recent events kept while not taking data, see flight_recorder.h
+		FlightRecorderConfig FlightRecorder;
+		// Set to save the flight recorder, ex: by the GUI
+		bool SaveFlightRecorder = false;
+
+		// Pulses looked for in the statistics and run modes, see
+		// pulse_finder.h
+		PulseFinderConfig PulseFinder;
+		// Running baseline of every channel for the pulses and the rest,
+		// see baseline_tracker.h
+		BaselineTrackerConfig Baseline;
+		// Their charge spectrum for the gain, see pe_spectrum.h
+		PESpectrumConfig PESpectrum;
+		// Dark count rate from the pulses before the trigger, see
+		// dark_count.h
+		DarkCountConfig DarkCount;
+		// Crosstalk and afterpulses from the same pulses, see crosstalk.h
+		CrosstalkConfig Crosstalk;
+		// Filter for the small pulses, see optimal_filter.h
+		OptimalFilterConfig OptimalFilter;
+		// Average 1 PE pulse of each channel, see pulse_template.h
+		PulseTemplateConfig PulseTemplate;
+		// Live histograms, see histogram.h. The time between triggers
+		// is in seconds.
+		HistogramAxis AmplitudeHistogram
+			= {HistogramBinning::Linear, 200, 0.0, 1000.0};
+		// Of the amplitudes from the optimal filters
+		HistogramAxis FilteredAmplitudeHistogram
+			= {HistogramBinning::Linear, 200, 0.0, 1000.0};
+		HistogramAxis TriggerTimeHistogram
+			= {HistogramBinning::Log, 100, 1e-6, 10.0};
+		// Threads that do all of the above, see analysis_executor.h
+		AnalysisConfig Analysis;
 
 		CAENDigitizerModel Model;
 		CAENGlobalConfig GlobalConfig;
@@ -69,6 +123,47 @@ namespace SBCQueens {
 		CAENInterfaceData state_of_everything;
 
 		DataFile<CAENEvent> _pulseFile;
+		FileRollover<CAENEvent> _pulseRollover;
+		// Index of the current pulse file segment
+		SBCFileIndex _pulseIndex;
+		// Or its chunks if it is columnar
+		SBCColumnarChunk _pulseChunk;
+		// What goes to the run catalog of the current run
+		RunCatalogEntry _run;
+		// Last events of the oscilloscope and statistics modes
+		flightRecorder _recorder;
+		// Rates of the pulse file for the GUI and for the log
+		fileMetricsMonitor _pulseMonitor;
+		fileMetricsMonitor _pulseLogMonitor;
+		// How many pulses and events since the last time they were sent
+		uint64_t _numPulses = 0;
+		uint64_t _numAnalyzedEvents = 0;
+		// Baselines of the analysis, learned once per connection, and the
+		// ones last sent to tell when they leave their window
+		baselineTracker _baselines;
+		std::vector<BaselineState> _baselineStates;
+		// Gain and dark count rate from the pulses, restart with every run
+		peSpectrum _peSpectrum;
+		darkCountEstimator _darkCount;
+		crosstalkEstimator _crosstalk;
+		// Learns the optimal filters once per connection
+		optimalFilterBuilder _filterBuilder;
+		// Average pulse shapes, restart with every run
+		pulseTemplates _templates;
+		// Filled by any thread, restart with every run
+		std::unique_ptr<concurrentHistogram> _amplitudes;
+		std::unique_ptr<concurrentHistogram> _filteredAmplitudes;
+		std::unique_ptr<concurrentHistogram> _triggerTimes;
+		TimeTagUnwrapper _triggerUnwrapper;
+		uint64_t _lastTrigger = 0;
+		bool _hasLastTrigger = false;
+		double _timeTagPeriod = 0.0;
+		// The pulses are found in other threads while this one reads.
+		// Everything above is only touched by its ordered kernel or
+		// inside _analysis.lock_ordered(...)
+		PulseFinderConfig _pulseConfig;
+		std::unique_ptr<EventBatch> _batch;
+		analysisExecutor<EventBatch> _analysis;
 
 		IndicatorSender<IndicatorNames> _plotSender;
 
@@ -146,6 +241,48 @@ public:
 				std::chrono::milliseconds(1),
 				std::bind(&CAENDigitizerInterface::closing_mode, this)
 			);
+
+			_analysis.add_kernel([&](EventBatch& batch) {
+				batch_pulses(batch, _pulseConfig, _baselines);
+				auto& amplitudes = _amplitudes->local();
+				for(const auto& pulse : batch.Pulses) {
+					amplitudes.fill(pulse.Amplitude);
+				}
+
+				if(_filterBuilder.IsEnabled()) {
+					// One per worker
+					thread_local OptimalFilterWorkspace workspace;
+					batch_filter(batch, *_filterBuilder.GetFilters(),
+						workspace);
+					auto& filtered = _filteredAmplitudes->local();
+					for(const auto& pulse : batch.Filtered) {
+						if(pulse.Valid) {
+							filtered.fill(pulse.Amplitude);
+						}
+					}
+				}
+			});
+
+			_analysis.add_ordered_kernel([&](EventBatch& batch) {
+				_numPulses += batch.Pulses.size();
+				_numAnalyzedEvents += batch.Events.size();
+				for(const auto& pulse : batch.Pulses) {
+					_peSpectrum.add(pulse);
+				}
+
+				for(const auto& event : batch.Events) {
+					fill_trigger_time(event.TriggerTimeTag);
+					track_baselines(batch, event);
+					_darkCount.add(event.TriggerTimeTag,
+						batch.Pulses.data() + event.FirstPulse,
+						event.NumPulses);
+					_crosstalk.add(event.TriggerTimeTag,
+						batch.Pulses.data() + event.FirstPulse,
+						event.NumPulses);
+					add_templates(batch, event);
+					learn_filters(batch, event);
+				}
+			});
 		}
 
 		// No copying
@@ -166,21 +303,458 @@ public:
 
 private:
 
-		double extract_frequency(CAENEvent& evt) {
-			auto buf = evt->Data->DataChannel[0];
-			auto size = evt->Data->ChSize[0];
+		// Pulses per second of trace of all the channels together
+		// since the last call
+		double extract_frequency() {
+			const double trace_time = static_cast<double>(_numAnalyzedEvents)
+				*Port->GlobalConfig.RecordLength / Port->GetSampleRate();
+			const double frequency = trace_time > 0.0 ?
+				_numPulses / trace_time : 0.0;
+
+			_numPulses = 0;
+			_numAnalyzedEvents = 0;
+			return frequency;
+		}
+
+		// Copies evt to the batch that goes to the analysis
+		void analyze_event(CAENEvent& evt) {
+			if(!_batch) {
+				_batch = _analysis.get_batch();
+			}
+
+			batch_add_event(*_batch, evt, Port);
+		}
+
+		// Sends the events of analyze_event(...) to be analyzed. If the
+		// analysis is behind, they are dropped instead of waiting.
+		void submit_analysis() {
+			if(!_batch || _batch->Events.empty()) {
+				return;
+			}
+
+			_analysis.submit(std::move(_batch));
+		}
+
+		// Everything it needs is set before the threads start
+		void configure_analysis() {
+			_analysis.stop();
+			_batch.reset();
+
+			_pulseConfig = state_of_everything.PulseFinder;
+			_pulseConfig.Polarity = pulse_polarity(Port);
+			_peSpectrum.configure(state_of_everything.PESpectrum);
+			configure_dark_count();
+			configure_baselines();
+			_crosstalk.configure(state_of_everything.Crosstalk,
+				dark_count_trace(), Port->GlobalConfig.RecordLength);
+			_filterBuilder.configure(state_of_everything.OptimalFilter,
+				Port->GlobalConfig.RecordLength, _pulseConfig);
+			_templates.configure(state_of_everything.PulseTemplate,
+				_pulseConfig, enabled_channels(Port));
+			_amplitudes = std::make_unique<concurrentHistogram>("Amplitude",
+				state_of_everything.AmplitudeHistogram);
+			_filteredAmplitudes = std::make_unique<concurrentHistogram>(
+				"FilteredAmplitude",
+				state_of_everything.FilteredAmplitudeHistogram);
+			_triggerTimes = std::make_unique<concurrentHistogram>(
+				"TriggerTime", state_of_everything.TriggerTimeHistogram);
+			_triggerUnwrapper.reset();
+			_hasLastTrigger = false;
+			_timeTagPeriod = Port->GetTimeTagPeriod();
+			_numPulses = 0;
+			_numAnalyzedEvents = 0;
+
+			_analysis.start(state_of_everything.Analysis);
+			spdlog::info("Analyzing the events with {0} threads",
+				_analysis.GetNumThreads());
+		}
+
+		void fill_trigger_time(const uint32_t& ttt) {
+			const uint64_t time = _triggerUnwrapper(ttt);
+			if(_hasLastTrigger) {
+				_triggerTimes->fill((time - _lastTrigger)*_timeTagPeriod);
+			}
+
+			_lastTrigger = time;
+			_hasLastTrigger = true;
+		}
+
+		// The samples before the trigger go to the running baselines
+		void track_baselines(const EventBatch& batch,
+			const EventBatch::Event& event) {
+			if(!_baselines.IsEnabled()) {
+				return;
+			}
+
+			for(uint32_t i = 0; i < event.NumTraces; i++) {
+				const auto& trace = batch.Traces[event.FirstTrace + i];
+				_baselines.add(trace.Channel, batch.data(trace), trace.Size);
+			}
+		}
+
+		void add_templates(const EventBatch& batch,
+			const EventBatch::Event& event) {
+			if(!_templates.IsEnabled()) {
+				return;
+			}
+
+			for(uint32_t i = 0; i < event.NumTraces; i++) {
+				const auto& trace = batch.Traces[event.FirstTrace + i];
+				_templates.add(trace.Channel, batch.data(trace), trace.Size,
+					trace.Baseline, batch.Pulses.data() + event.FirstPulse,
+					event.NumPulses);
+			}
+		}
+
+		// Noise and template of the optimal filters until they are made.
+		// If the pulse templates are on, the filters use theirs.
+		void learn_filters(const EventBatch& batch,
+			const EventBatch::Event& event) {
+			if(!_filterBuilder.IsEnabled()) {
+				return;
+			}
+
+			const auto& of_config = state_of_everything.OptimalFilter;
+			for(uint32_t i = 0; i < event.NumTraces; i++) {
+				const auto& trace = batch.Traces[event.FirstTrace + i];
+				if(_templates.IsEnabled()
+					&& !_filterBuilder.HasTemplate(trace.Channel)
+					&& _templates.GetCount(trace.Channel)
+						>= of_config.TemplateTraces) {
+					_filterBuilder.SetTemplate(trace.Channel,
+						_templates.GetSampledTemplate(trace.Channel,
+							_filterBuilder.GetSize(), of_config.TemplatePeak));
+				}
+
+				if(!_filterBuilder.add(trace.Channel, batch.data(trace),
+					trace.Size, trace.Baseline,
+					batch.Pulses.data() + event.FirstPulse, event.NumPulses)) {
+					continue;
+				}
+
+				const auto& filter
+					= (*_filterBuilder.GetFilters())[trace.Channel];
+				spdlog::info("Optimal filter of channel {0} ready, amplitude "
+					"resolution {1:.2f} counts", trace.Channel,
+					filter->GetResolution());
+			}
+		}
+
+		// Waits for everything submitted and stops the threads
+		void stop_analysis() {
+			if(!_analysis.IsRunning()) {
+				return;
+			}
+
+			submit_analysis();
+			_analysis.stop();
+			_batch.reset();
+			if(_analysis.GetDropped() > 0) {
+				spdlog::warn("The analysis could not keep up, {0} batches "
+					"of events were not analyzed.", _analysis.GetDropped());
+			}
+		}
+
+		// The samples between the baseline and the trigger
+		DarkCountTrace dark_count_trace() {
+			const auto& g_config = Port->GlobalConfig;
+			const auto& dc_config = state_of_everything.DarkCount;
+			const uint32_t trigger = static_cast<uint32_t>(
+				static_cast<uint64_t>(g_config.RecordLength)
+				*(100 - std::min(g_config.PostTriggerPorcentage, 100u)) / 100);
+
+			DarkCountTrace trace;
+			trace.Channels = enabled_channels(Port);
+			trace.WindowStart = state_of_everything.PulseFinder.BaselineSamples;
+			trace.WindowEnd = trigger > dc_config.GuardSamples ?
+				trigger - dc_config.GuardSamples : 0;
+			trace.SamplePeriod = 1.0 / Port->GetSampleRate();
+			trace.TimeTagPeriod = Port->GetTimeTagPeriod();
+			return trace;
+		}
+
+		// Counts the pulses between the baseline and the trigger
+		void configure_dark_count() {
+			_darkCount.configure(state_of_everything.DarkCount,
+				dark_count_trace());
+
+			if(_darkCount.GetWindowSamples() == 0) {
+				spdlog::warn("There are no samples between the baseline and "
+					"the trigger, the dark count rate will not be calculated.");
+			}
+		}
+
+		// Tracks the baselines with the same samples as the dark count
+		void configure_baselines() {
+			const auto trace = dark_count_trace();
+			_baselines.configure(state_of_everything.Baseline, trace.Channels,
+				trace.WindowEnd, Port->GetADCResolution());
+			_baselineStates = _baselines.GetStates();
+
+			if(_baselines.IsEnabled() && trace.WindowEnd == 0) {
+				spdlog::warn("There are no samples before the trigger, the "
+					"baselines will not be tracked.");
+			}
+		}
+
+		// Tells when a baseline leaves its window or comes back
+		void publish_baselines() {
+			if(!_baselines.IsEnabled()) {
+				return;
+			}
+
+			const auto states = _baselines.GetStates();
+			double out_of_window = 0.0;
+			double max_rms = 0.0;
+			for(size_t k = 0; k < states.size(); k++) {
+				const auto& state = states[k];
+				if(!state.IsReady) {
+					continue;
+				}
+
+				max_rms = std::max(max_rms,
+					static_cast<double>(state.NoiseRMS));
+				out_of_window += !state.InWindow;
+				if(state.InWindow == _baselineStates[k].InWindow) {
+					continue;
+				}
+
+				if(!state.InWindow) {
+					spdlog::warn("Channel {0}: the baseline ({1:.1f}, noise "
+						"{2:.2f} rms) is out of its window", state.Channel,
+						state.Baseline, state.NoiseRMS);
+				} else {
+					spdlog::info("Channel {0}: the baseline ({1:.1f}, noise "
+						"{2:.2f} rms) is back in its window", state.Channel,
+						state.Baseline, state.NoiseRMS);
+				}
+			}
+
+			_baselineStates = states;
+			_plotSender(IndicatorNames::BASELINE_ALERTS, out_of_window);
+			_plotSender(IndicatorNames::NOISE_RMS, max_rms);
+		}
+
+		void publish_pulse_statistics() {
+			_analysis.lock_ordered([&]() {
+				_plotSender(IndicatorNames::FREQUENCY, extract_frequency());
+				_plotSender(IndicatorNames::DARK_NOISE_RATE,
+					_darkCount.GetWindowRate().Rate);
+				// The fits are done in another thread
+				if(_peSpectrum.update()) {
+					_plotSender(IndicatorNames::GAIN, _peSpectrum.GetGain());
+					_crosstalk.set_gains(_peSpectrum.GetFits());
+				}
+
+				if(_crosstalk.update()) {
+					_plotSender(IndicatorNames::CROSSTALK,
+						100.0*_crosstalk.GetCrosstalk());
+					_plotSender(IndicatorNames::AFTERPULSE,
+						100.0*_crosstalk.GetAfterpulse());
+				}
+
+				publish_baselines();
+				publish_templates();
+			});
+
+			publish_histograms();
+		}
+
+		// Merges the histograms and sends them as stairs
+		void publish_histograms() {
+			if(!_amplitudes) {
+				return;
+			}
+
+			std::vector<double> x, y;
+			for(const auto& [hist, plot] : {
+				std::make_pair(_amplitudes.get(),
+					IndicatorNames::AMPLITUDE_HISTOGRAM),
+				std::make_pair(_filteredAmplitudes.get(),
+					IndicatorNames::FILTERED_AMPLITUDE_HISTOGRAM),
+				std::make_pair(_triggerTimes.get(),
+					IndicatorNames::TRIGGER_TIME_HISTOGRAM)}) {
+				hist->merge();
+				histogram_stairs(*hist->GetSnapshot(), x, y);
+				_plotSender(plot, x.data(), y.data(), x.size());
+			}
+		}
+
+		// Saves the histograms of the run next to its files
+		void save_histograms() {
+			if(!_amplitudes) {
+				return;
+			}
+
+			std::vector<histogramSnapshot> hists;
+			for(auto* hist : {_amplitudes.get(), _filteredAmplitudes.get(),
+				_triggerTimes.get()}) {
+				hist->merge();
+				hists.push_back(*hist->GetSnapshot());
+			}
+
+			const auto file_name = state_of_everything.RunDir + "/"
+				+ state_of_everything.RunName + "/" + _run.FilePrefix
+				+ "_histograms.sbch";
+			if(!histograms_save(file_name, hists)) {
+				spdlog::warn("Could not save the histograms to {0}",
+					file_name);
+			}
+		}
+
+		// The templates of the first 4 channels, in ns from the pulse time
+		void publish_templates() {
+			if(!_templates.IsEnabled()) {
+				return;
+			}
+
+			const std::array<IndicatorNames, 4> plots = {
+				IndicatorNames::SiPM_Template_ZERO,
+				IndicatorNames::SiPM_Template_ONE,
+				IndicatorNames::SiPM_Template_TWO,
+				IndicatorNames::SiPM_Template_THREE};
+			const auto& config = _templates.GetConfig();
+			const auto& channels = _templates.GetChannels();
+			const double ns_per_sample = 1e9 / Port->GetSampleRate();
+			for(size_t k = 0; k < std::min(channels.size(), plots.size()); k++) {
+				if(_templates.GetCount(channels[k]) == 0) {
+					continue;
+				}
+
+				const auto shape = _templates.GetTemplate(channels[k]);
+				std::vector<double> x(shape.size()), y(shape.size());
+				for(size_t g = 0; g < shape.size(); g++) {
+					x[g] = (static_cast<double>(g) / config.Oversampling
+						- config.PreSamples)*ns_per_sample;
+					y[g] = shape[g];
+				}
+
+				_plotSender(plots[k], x.data(), y.data(), x.size());
+			}
+		}
+
+		// Fits the PE spectrum of the whole run and adds it to its
+		// results
+		void pe_spectrum_results() {
+			if(!_peSpectrum.IsEnabled()) {
+				return;
+			}
+
+			_peSpectrum.finish();
+			for(const auto& fit : _peSpectrum.GetFits()) {
+				if(!fit.IsValid()) {
+					spdlog::warn("Could not find the gain of channel {0} "
+						"({1} pulses)", fit.Channel, fit.Entries);
+					continue;
+				}
+
+				spdlog::info("Channel {0}: gain {1:.2f} +- {2:.2f}, pedestal "
+					"{3:.2f}, resolution {4:.3f} from {5} peaks", fit.Channel,
+					fit.Gain, fit.GainError, fit.Pedestal, fit.Resolution,
+					fit.Peaks.size());
+
+				const auto ch = std::to_string(fit.Channel);
+				_run.Results.push_back({"Gain" + ch, fit.Gain});
+				_run.Results.push_back({"GainError" + ch, fit.GainError});
+				_run.Results.push_back({"Pedestal" + ch, fit.Pedestal});
+				_run.Results.push_back({"Resolution" + ch, fit.Resolution});
+			}
+		}
+
+		// Fits the crosstalk and afterpulses of the whole run, with the
+		// gains of pe_spectrum_results(), and adds them to its results
+		void crosstalk_results() {
+			if(!_crosstalk.IsEnabled()) {
+				return;
+			}
+
+			_crosstalk.set_gains(_peSpectrum.GetFits());
+			_crosstalk.finish();
+			for(const auto& result : _crosstalk.GetResults()) {
+				const auto ch = std::to_string(result.Channel);
+				if(result.HasCrosstalk()) {
+					spdlog::info("Channel {0}: crosstalk {1:.4f} +- {2:.4f} "
+						"({3} dark pulses)", result.Channel, result.Crosstalk,
+						result.CrosstalkError, result.DarkPulses);
+					_run.Results.push_back({"Crosstalk" + ch,
+						result.Crosstalk});
+					_run.Results.push_back({"CrosstalkError" + ch,
+						result.CrosstalkError});
+				}
+
+				if(!result.HasAfterpulse()) {
+					spdlog::warn("Could not fit the afterpulses of channel "
+						"{0} ({1} primaries)", result.Channel,
+						result.Primaries);
+					continue;
+				}
+
+				spdlog::info("Channel {0}: afterpulses {1:.4f} +- {2:.4f}, "
+					"tau {3:.4g} +- {4:.2g} s ({5} primaries)", result.Channel,
+					result.Afterpulse, result.AfterpulseError,
+					result.AfterpulseTau, result.AfterpulseTauError,
+					result.Primaries);
+				_run.Results.push_back({"Afterpulse" + ch, result.Afterpulse});
+				_run.Results.push_back({"AfterpulseError" + ch,
+					result.AfterpulseError});
+				_run.Results.push_back({"AfterpulseTau" + ch,
+					result.AfterpulseTau});
+			}
 
-			double counter = 0;
-			auto offset =
-				Port->GroupConfigs[0].TriggerThreshold;
-			for(uint32_t i = 1; i < size; i++) {
-				if((buf[i] > offset) && (buf[i-1] < offset)) {
-					counter++;
+			const auto& trigger = _crosstalk.GetTriggerAfterpulse();
+			if(trigger.IsValid()) {
+				_run.Results.push_back({"TriggerAfterpulse",
+					trigger.Probability});
+				_run.Results.push_back({"TriggerAfterpulseError",
+					trigger.Error});
+			}
+		}
+
+		// Adds the baselines at the end of the run to its results
+		void baseline_results() {
+			for(const auto& state : _baselines.GetStates()) {
+				if(!state.IsReady) {
+					continue;
 				}
+
+				const auto ch = std::to_string(state.Channel);
+				_run.Results.push_back({"Baseline" + ch, state.Baseline});
+				_run.Results.push_back({"NoiseRMS" + ch, state.NoiseRMS});
 			}
+		}
 
-			return Port->GetSampleRate()*counter /
-				(Port->GlobalConfig.RecordLength);
+		// Adds the expected error of the filtered amplitudes to the results
+		void optimal_filter_results() {
+			const auto filters = _filterBuilder.GetFilters();
+			for(size_t ch = 0; ch < filters->size(); ch++) {
+				if((*filters)[ch]) {
+					_run.Results.push_back({
+						"FilterResolution" + std::to_string(ch),
+						(*filters)[ch]->GetResolution()});
+				}
+			}
+		}
+
+		// Adds the dark count rate of the whole run to its results
+		void dark_count_results() {
+			if(_darkCount.GetWindowSamples() == 0) {
+				return;
+			}
+
+			const auto& channels = _darkCount.GetChannels();
+			for(size_t k = 0; k < channels.size(); k++) {
+				const auto rate = _darkCount.GetRate(k);
+				spdlog::info("Channel {0}: dark count rate {1:.4g} +- {2:.2g} Hz "
+					"({3} pulses in {4:.4g} s)", channels[k], rate.Rate,
+					rate.Error, rate.Counts, rate.LiveTime);
+
+				const auto ch = std::to_string(channels[k]);
+				_run.Results.push_back({"DCR" + ch, rate.Rate});
+				_run.Results.push_back({"DCRError" + ch, rate.Error});
+			}
+
+			_run.Results.push_back({"TriggerRate",
+				_darkCount.GetTriggerRate()});
 		}
 		
 		// Local error checking. Checks if there was an error and prints it
@@ -299,10 +873,15 @@ private:
 				evt = std::make_shared<caenEvent>(Port->Handle);
 			}
 
+			_recorder.configure(state_of_everything.FlightRecorder, Port);
+			configure_analysis();
+
 			auto failed = lec();
 
 			if(failed) {
 				spdlog::warn("Failed to setup CAEN");
+				stop_analysis();
+				_recorder.clear();
 				err = disconnect(Port);
 				check_error(err, [](const std::string& cmd) {
 					spdlog::error(cmd);
@@ -337,6 +916,7 @@ private:
 				// spdlog::info("Data size: {0}", Port->Data.DataSize);
 				// spdlog::info("Num events: {0}", Port->Data.NumEvents);
 
+				_recorder.add_all(Port);
 				extract_event(Port, 0, osc_event);
 				// spdlog::info("Event size: {0}", osc_event->Info.EventSize);
 				// spdlog::info("Event counter: {0}", osc_event->Info.EventCounter);
@@ -358,6 +938,7 @@ private:
 			// Clear events in buffer
 			clear_data(Port);
 
+			update_flight_recorder();
 			lec();
 			change_state();
 			return true;
@@ -377,13 +958,23 @@ private:
 					return;
 				}
 
-				//double frequency = 0.0;
+				// The recorder decodes them into its ring
+				if(_recorder.IsEnabled()) {
+					_recorder.add_all(Port, [&](CAENEvent& evt) {
+						analyze_event(evt);
+					});
+					submit_analysis();
+					return;
+				}
+
 				for(uint32_t i = 0; i < Port->Data.NumEvents; i++) {
 
 					// Extract event i
 					extract_event(Port, i, processing_evts[i]);
+					analyze_event(processing_evts[i]);
 				}
 
+				submit_analysis();
 			};
 
 			static auto extract_for_gui_nb = make_total_timed_event(
@@ -396,21 +987,175 @@ private:
 				std::bind(&CAENDigitizerInterface::lec, this)
 			);
 
+			static auto publish_pulse_statistics_nb = make_total_timed_event(
+				std::chrono::seconds(1),
+				std::bind(&CAENDigitizerInterface::publish_pulse_statistics,
+					this)
+			);
+
 
 			process_events();
 			checkerror();
+			publish_pulse_statistics_nb();
 			extract_for_gui_nb();
 			//extract_for_gui_nb();
+			update_flight_recorder();
 			change_state();
 			return true;
 		}
 
+		// Saves the flight recorder if the GUI asked or it triggered
+		void update_flight_recorder() {
+			if(state_of_everything.SaveFlightRecorder) {
+				state_of_everything.SaveFlightRecorder = false;
+				if(_recorder.IsEnabled()) {
+					_recorder.request_save("the GUI");
+				} else {
+					spdlog::warn("The flight recorder is disabled.");
+				}
+			}
+
+			_recorder.update(Port, state_of_everything.PulseFileConfig,
+				state_of_everything.RunDir + "/" + state_of_everything.RunName);
+		}
+
+		// Saves everything in the pulse file queue and adds it to the index
+		void save_pulses() {
+			const auto& config = state_of_everything.PulseFileConfig;
+			if(config.Layout == SBCFileLayout::Columnar) {
+				save(_pulseFile, [&](CAENEvent& evt) {
+					return sbc_columnar_save_func(_pulseChunk, evt, Port,
+						config, _pulseFile->GetBytesWritten());
+				});
+				return;
+			}
+
+			save(_pulseFile, [&](CAENEvent& evt) {
+				// Nothing of evt is written yet, so this is where it starts
+				sbc_index_event(_pulseIndex, evt, _pulseFile->GetBytesWritten());
+				return sbc_save_func(evt, Port, config);
+			});
+		}
+
+		std::string run_catalog_name() {
+			return catalog_name(state_of_everything.RunDir
+				+ "/" + state_of_everything.RunName);
+		}
+
+		// Adds the run that just started to the catalog
+		void catalog_start(const std::string& filePrefix) {
+			_run = RunCatalogEntry();
+			_run.StartTime = std::chrono::duration_cast<
+				std::chrono::milliseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+			_run.ConfigHash = caen_config_hash(Port);
+			_run.SiPMParameters = state_of_everything.SiPMParameters;
+			_run.FilePrefix = filePrefix;
+			_run.Parameters = state_of_everything.RunParameters;
+
+			if(!catalog_add_start(run_catalog_name(), _run)) {
+				spdlog::warn("Could not add the run to the catalog {0}",
+					run_catalog_name());
+			}
+		}
+
+		// Adds how the run ended to the catalog. Call it after the
+		// rollover finished so all the segments are there.
+		void catalog_stop() {
+			// It never started
+			if(_run.StartTime == 0) {
+				return;
+			}
+
+			_run.EndTime = std::chrono::duration_cast<
+				std::chrono::milliseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+			_run.Results.clear();
+			// Everything of this run has to be analyzed first
+			submit_analysis();
+			_analysis.wait();
+			_analysis.lock_ordered([&]() {
+				pe_spectrum_results();
+				crosstalk_results();
+				dark_count_results();
+				baseline_results();
+				optimal_filter_results();
+			});
+			save_histograms();
+			_run.Events = 0;
+			_run.Segments.clear();
+			for(const auto& seg : _pulseRollover->GetSegments()) {
+				_run.Events += seg.Events;
+				_run.Segments.push_back(RunCatalogSegment{
+					std::filesystem::path(seg.FileName).filename().string(),
+					seg.Events, seg.Bytes});
+			}
+
+			if(!catalog_add_stop(run_catalog_name(), _run)) {
+				spdlog::warn("Could not add the end of the run to the "
+					"catalog {0}", run_catalog_name());
+			}
+
+			_run = RunCatalogEntry();
+		}
+
+		// Sends how the pulse file is doing to the GUI
+		void publish_file_metrics() {
+			if(!_pulseFile || !_pulseRollover) {
+				return;
+			}
+
+			const auto& metrics = _pulseFile->GetMetrics();
+			const auto rates = _pulseMonitor(metrics);
+			_plotSender(IndicatorNames::FILE_WRITE_RATE,
+				rates.BytesPerSecond / 1e6);
+			_plotSender(IndicatorNames::FILE_EVENT_RATE,
+				rates.ItemsPerSecond);
+			_plotSender(IndicatorNames::FILE_QUEUE_DEPTH,
+				static_cast<double>(metrics.QueueDepth));
+			_plotSender(IndicatorNames::FILE_MAX_QUEUE_DEPTH,
+				static_cast<double>(metrics.MaxQueueDepth));
+			_plotSender(IndicatorNames::FILE_FORMAT_TIME,
+				100.0*rates.FormatFraction);
+			_plotSender(IndicatorNames::FILE_WRITE_TIME,
+				100.0*rates.WriteFraction);
+			_plotSender(IndicatorNames::FILE_SAVE_LATENCY,
+				metrics.SaveLatency.quantile_ms(0.99));
+			_plotSender(IndicatorNames::FILE_SYNC_LATENCY,
+				_pulseRollover->GetSyncLatency().quantile_ms(0.99));
+		}
+
+		// Same but to the log, averaged since the last time
+		void log_file_metrics() {
+			if(!_pulseFile || !_pulseRollover) {
+				return;
+			}
+
+			const auto& metrics = _pulseFile->GetMetrics();
+			const auto sync = _pulseRollover->GetSyncLatency();
+			spdlog::info(format_file_metrics(_pulseFile->GetFileName(),
+				metrics, _pulseLogMonitor(metrics), &sync));
+		}
+
 		bool run_mode() {
 			static bool isFileOpen = false;
 			static auto extract_for_gui_nb = make_total_timed_event(
 				std::chrono::milliseconds(200),
 				std::bind(&CAENDigitizerInterface::rdm_extract_for_gui, this)
 			);
+			static auto publish_file_metrics_nb = make_total_timed_event(
+				std::chrono::seconds(1),
+				std::bind(&CAENDigitizerInterface::publish_file_metrics, this)
+			);
+			static auto log_file_metrics_nb = make_total_timed_event(
+				std::chrono::seconds(60),
+				std::bind(&CAENDigitizerInterface::log_file_metrics, this)
+			);
+			static auto publish_pulse_statistics_nb = make_total_timed_event(
+				std::chrono::seconds(1),
+				std::bind(&CAENDigitizerInterface::publish_pulse_statistics,
+					this)
+			);
 			static auto process_events = [&]() {
 				bool isData = retrieve_data_until_n_events(Port, 
 					Port->GlobalConfig.MaxEventsPerRead);
@@ -424,6 +1169,7 @@ private:
 				for(uint32_t i = 0; i < Port->Data.NumEvents; i++) {
 					// Extract event i
 					extract_event(Port, i, processing_evts[i]);
+					analyze_event(processing_evts[i]);
 
 					if(_pulseFile) {
 						// Copy event to the file buffer
@@ -431,11 +1177,16 @@ private:
 					}
 				}
 
+				submit_analysis();
 			};
 
 			if(isFileOpen) {
 				// spdlog::info("Saving SIPM data");
-				save(_pulseFile, sbc_save_func, Port);
+				save_pulses();
+				publish_file_metrics_nb();
+				log_file_metrics_nb();
+				// Moves to the next file segment if it is time to
+				(*_pulseRollover)(_pulseFile);
 			} else {
 				
 				// Get current date and time, e.g. 202201051103
@@ -445,23 +1196,96 @@ private:
     			std::strftime(filename, sizeof(filename), "%Y%m%d%H%M", 
     				std::localtime(&now_t));
 
-				open(_pulseFile,
+				// sbc_init_file is a function that saves the header
+				// of the sbc data format as a function of record length
+				// and number of channels. Every segment gets the same one.
+				const auto& config = state_of_everything.PulseFileConfig;
+				const bool is_columnar
+					= config.Layout == SBCFileLayout::Columnar;
+				std::string extension = is_columnar ? ".sbcc" : ".bin";
+
+				// The chunk directory points to the bytes in the file,
+				// so columnar files are never framed
+				auto options = state_of_everything.PulseFileOptions;
+				if(is_columnar && options.Framing) {
+					spdlog::warn("Block framing is not available for "
+						"columnar files, it will be disabled.");
+					options.Framing = false;
+				}
+
+				// The readers, sbc_convert, sbc_recover and the line count
+				// patched at the end all need the bytes of the file as
+				// they are, so the SiPM files are never compressed. The
+				// slow control files still are.
+				if(options.Compress) {
+					spdlog::warn("Compression is not available for the "
+						"SiPM files (the SBC readers and tools cannot "
+						"read them), it will be disabled for them.");
+					options.Compress = false;
+				}
+
+				_pulseRollover = std::make_unique<fileRollover<CAENEvent>>(
+					state_of_everything.PulseFileRollover,
+					options,
 					state_of_everything.RunDir
 					+ "/" + state_of_everything.RunName
-					+ "/" + filename + ".bin",
-					// + state_of_everything.SiPMParameters + ".bin",
+					+ "/" + filename,
+					// + state_of_everything.SiPMParameters,
+					extension,
+					is_columnar ? sbc_columnar_init_file(Port, config)
+						: sbc_init_file(Port, config));
+
+				// Every segment gets its own index (or chunk directory) at
+				// the end and the real number of lines in its header once
+				// it is closed.
+				_pulseIndex.reset();
+				_pulseIndex.Interval = config.IndexInterval;
+				_pulseChunk.reset();
+				_pulseRollover->SetOnClose(
+					[&, is_columnar](DataFile<CAENEvent>& file) {
+					if(is_columnar) {
+						(*file) << sbc_columnar_footer(_pulseChunk,
+							file->GetBytesWritten());
+						_pulseChunk.reset();
+					} else {
+						// The index goes after the last block
+						file->end_framing();
+						(*file) << sbc_index_footer(_pulseIndex);
+						_pulseIndex.reset();
+					}
+				});
+				_pulseRollover->SetOnClosed(
+					[is_columnar](const RolloverSegment& seg) {
+					if(!is_columnar) {
+						sbc_finalize_file(seg.FileName, seg.Events);
+					}
+				});
 
-					// sbc_init_file is a function that saves the header
-					// of the sbc data format as a function of record length
-					// and number of channels
-					sbc_init_file,
-					Port);
+				_pulseRollover->start(_pulseFile);
 
 				isFileOpen = _pulseFile > 0;
+				if(isFileOpen) {
+					// The events before the run do not count
+					submit_analysis();
+					_analysis.wait();
+					_analysis.lock_ordered([&]() {
+						_peSpectrum.clear();
+						_darkCount.reset();
+						_crosstalk.reset();
+						_templates.reset();
+						_amplitudes->reset();
+						_filteredAmplitudes->reset();
+						_triggerTimes->reset();
+					});
+					catalog_start(filename);
+					_pulseMonitor = fileMetricsMonitor();
+					_pulseLogMonitor = fileMetricsMonitor();
+				}
 			}
 
 			process_events();
 			extract_for_gui_nb();
+			publish_pulse_statistics_nb();
 			if(change_state()) {
 				// save remaining data
 				retrieve_data(Port);
@@ -470,11 +1294,16 @@ private:
 						extract_event(Port, i, processing_evts[i]);
 						_pulseFile->Add(processing_evts[i]);
 					}
-					save(_pulseFile, sbc_save_func, Port);
+					save_pulses();
+					log_file_metrics();
 				}
 
 				isFileOpen = false;
-				close(_pulseFile);
+				if(_pulseRollover) {
+					_pulseRollover->finish(_pulseFile);
+					catalog_stop();
+					_pulseRollover.reset();
+				}
 			}
 			return true;
 		}
@@ -483,9 +1312,11 @@ private:
 			spdlog::warn("Manually losing connection to the "
 							"CAEN digitizer.");
 
+			stop_analysis();
 			for(CAENEvent& evt : processing_evts) {
 				evt.reset();
 			}
+			_recorder.clear();
 
 			osc_event.reset();
 			adj_osc_event.reset();
@@ -501,9 +1332,20 @@ private:
 
 		bool closing_mode() {
 			spdlog::info("Going to close the CAEN thread.");
+
+			// If it was still saving, the files are closed properly
+			if(_pulseRollover) {
+				save_pulses();
+				_pulseRollover->finish(_pulseFile);
+				catalog_stop();
+				_pulseRollover.reset();
+			}
+
+			stop_analysis();
 			for(CAENEvent& evt : processing_evts) {
 				evt.reset();
 			}
+			_recorder.clear();
 
 			osc_event.reset();
 			adj_osc_event.reset();
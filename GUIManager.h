@@ -99,6 +99,213 @@ public:
 			cgui_state.RunDir = i_run_dir;
 			cgui_state.RunName = i_run_name;
 			cgui_state.SiPMParameters = file_conf["SiPMParameters"].value_or("default");
+			cgui_state.PulseFileOptions.DirectIO = file_conf["DirectIO"].value_or(false);
+			cgui_state.PulseFileOptions.DirectConfig.PreallocationSize
+				= file_conf["PreallocationMB"].value_or(256ull) << 20;
+			cgui_state.PulseFileRollover.MaxBytes
+				= file_conf["RolloverMB"].value_or(0ull) << 20;
+			cgui_state.PulseFileRollover.MaxEvents
+				= file_conf["RolloverEvents"].value_or(0ull);
+			cgui_state.PulseFileRollover.MaxDuration = std::chrono::minutes(
+				file_conf["RolloverMinutes"].value_or(0ll));
+			cgui_state.PulseFileConfig.TraceEncoding = SBCTraceEncoding_map.at(
+				file_conf["TraceEncoding"].value_or("Raw"));
+			cgui_state.PulseFileConfig.ROI.Threshold = static_cast<uint16_t>(
+				file_conf["ROIThreshold"].value_or(20u));
+			cgui_state.PulseFileConfig.ROI.PadBefore
+				= file_conf["ROIPadBefore"].value_or(16u);
+			cgui_state.PulseFileConfig.ROI.PadAfter
+				= file_conf["ROIPadAfter"].value_or(32u);
+			cgui_state.PulseFileConfig.ROI.BaselineSamples
+				= file_conf["ROIBaselineSamples"].value_or(64u);
+			cgui_state.PulseFileConfig.IndexInterval
+				= file_conf["IndexInterval"].value_or(1000u);
+			cgui_state.PulseFileConfig.Layout = SBCFileLayout_map.at(
+				file_conf["Layout"].value_or("Rows"));
+			cgui_state.PulseFileConfig.ChunkEvents
+				= file_conf["ChunkEvents"].value_or(1000u);
+
+			cgui_state.PulseFileOptions.Framing
+				= file_conf["BlockFraming"].value_or(false);
+			cgui_state.PulseFileOptions.Compress
+				= file_conf["Compress"].value_or(false);
+			cgui_state.PulseFileOptions.Compression.Level
+				= file_conf["CompressionLevel"].value_or(3);
+			cgui_state.PulseFileOptions.Compression.NumThreads
+				= file_conf["CompressionThreads"].value_or(0u);
+
+			// The slow control files are tiny, smaller chunks so less
+			// is lost if the program crashes.
+			tgui_state.SlowControlFileOptions.Compress
+				= cgui_state.PulseFileOptions.Compress;
+			tgui_state.SlowControlFileOptions.Compression
+				= cgui_state.PulseFileOptions.Compression;
+			tgui_state.SlowControlFileOptions.Compression.NumThreads = 1;
+			tgui_state.SlowControlFileOptions.Compression.ChunkSize = 64 << 10;
+			tgui_state.SlowControlFileFormat = SlowControlFormat_map.at(
+				file_conf["SlowControlFormat"].value_or("Binary"));
+			tgui_state.SlowControlIndexInterval
+				= file_conf["SlowControlIndexInterval"].value_or(1000u);
+			tgui_state.SlowControlTextPrecision
+				= file_conf["SlowControlTextPrecision"].value_or(6);
+
+			auto fr_conf = config_file["FlightRecorder"];
+			cgui_state.FlightRecorder.Enabled = fr_conf["Enabled"].value_or(false);
+			cgui_state.FlightRecorder.Seconds = fr_conf["Seconds"].value_or(10.0);
+			cgui_state.FlightRecorder.MaxMB = fr_conf["MaxMB"].value_or(256.0);
+			cgui_state.FlightRecorder.RateThreshold
+				= fr_conf["RateThreshold"].value_or(0.0);
+			cgui_state.FlightRecorder.AmplitudeThreshold = static_cast<uint16_t>(
+				fr_conf["AmplitudeThreshold"].value_or(0u));
+			cgui_state.FlightRecorder.BaselineSamples
+				= fr_conf["BaselineSamples"].value_or(16u);
+			cgui_state.FlightRecorder.PostTriggerSeconds
+				= fr_conf["PostTriggerSeconds"].value_or(1.0);
+			cgui_state.FlightRecorder.HoldOffSeconds
+				= fr_conf["HoldOffSeconds"].value_or(60.0);
+
+			// The polarity is the one of the trigger
+			auto pf_conf = config_file["PulseFinder"];
+			cgui_state.PulseFinder.Threshold = static_cast<uint16_t>(
+				pf_conf["Threshold"].value_or(20u));
+			cgui_state.PulseFinder.Hysteresis = static_cast<uint16_t>(
+				pf_conf["Hysteresis"].value_or(5u));
+			cgui_state.PulseFinder.BaselineSamples
+				= pf_conf["BaselineSamples"].value_or(16u);
+			cgui_state.PulseFinder.PreSamples
+				= pf_conf["PreSamples"].value_or(2u);
+			cgui_state.PulseFinder.PostSamples
+				= pf_conf["PostSamples"].value_or(8u);
+			cgui_state.PulseFinder.MaxPulses
+				= pf_conf["MaxPulses"].value_or(64u);
+
+			auto bl_conf = config_file["Baseline"];
+			cgui_state.Baseline.Enabled = bl_conf["Enabled"].value_or(false);
+			cgui_state.Baseline.Estimator = BaselineEstimator_map.at(
+				bl_conf["Estimator"].value_or("Mode"));
+			cgui_state.Baseline.HistogramCodes
+				= bl_conf["HistogramCodes"].value_or(256u);
+			cgui_state.Baseline.HalfLifeSamples
+				= bl_conf["HalfLifeSamples"].value_or(1048576ull);
+			cgui_state.Baseline.MinSamples
+				= bl_conf["MinSamples"].value_or(10000ull);
+			cgui_state.Baseline.MinBaseline
+				= bl_conf["MinBaseline"].value_or(0.0f);
+			cgui_state.Baseline.MaxBaseline
+				= bl_conf["MaxBaseline"].value_or(65535.0f);
+			cgui_state.Baseline.SaturationMargin
+				= bl_conf["SaturationMargin"].value_or(100.0f);
+			cgui_state.Baseline.MaxNoiseRMS
+				= bl_conf["MaxNoiseRMS"].value_or(0.0f);
+
+			auto pe_conf = config_file["PESpectrum"];
+			cgui_state.PESpectrum.Enabled = pe_conf["Enabled"].value_or(false);
+			cgui_state.PESpectrum.MaxCharge
+				= pe_conf["MaxCharge"].value_or(2000.0);
+			cgui_state.PESpectrum.NumBins = pe_conf["NumBins"].value_or(500u);
+			cgui_state.PESpectrum.FitSeconds
+				= pe_conf["FitSeconds"].value_or(10.0);
+			cgui_state.PESpectrum.MinEntries
+				= pe_conf["MinEntries"].value_or(1000ull);
+			cgui_state.PESpectrum.MaxPeaks = pe_conf["MaxPeaks"].value_or(5u);
+			cgui_state.PESpectrum.MinPeakHeight
+				= pe_conf["MinPeakHeight"].value_or(0.01);
+
+			auto dc_conf = config_file["DarkCount"];
+			cgui_state.DarkCount.GuardSamples
+				= dc_conf["GuardSamples"].value_or(10u);
+			cgui_state.DarkCount.WindowSeconds
+				= dc_conf["WindowSeconds"].value_or(60.0);
+			cgui_state.DarkCount.BinSeconds
+				= dc_conf["BinSeconds"].value_or(1.0);
+
+			auto xt_conf = config_file["Crosstalk"];
+			cgui_state.Crosstalk.Enabled = xt_conf["Enabled"].value_or(false);
+			cgui_state.Crosstalk.Gain = xt_conf["Gain"].value_or(0.0);
+			cgui_state.Crosstalk.Pedestal = xt_conf["Pedestal"].value_or(0.0);
+			cgui_state.Crosstalk.MaxCharge
+				= xt_conf["MaxCharge"].value_or(2000.0);
+			cgui_state.Crosstalk.NumBins = xt_conf["NumBins"].value_or(500u);
+			cgui_state.Crosstalk.MinDelay = xt_conf["MinDelay"].value_or(10u);
+			cgui_state.Crosstalk.MaxDelay
+				= xt_conf["MaxDelay"].value_or(1000u);
+			cgui_state.Crosstalk.DelayBins
+				= xt_conf["DelayBins"].value_or(100u);
+			cgui_state.Crosstalk.TriggerWindow
+				= xt_conf["TriggerWindow"].value_or(1e-5);
+			cgui_state.Crosstalk.FitSeconds
+				= xt_conf["FitSeconds"].value_or(10.0);
+			cgui_state.Crosstalk.MinPrimaries
+				= xt_conf["MinPrimaries"].value_or(1000ull);
+
+			auto of_conf = config_file["OptimalFilter"];
+			cgui_state.OptimalFilter.Enabled
+				= of_conf["Enabled"].value_or(false);
+			cgui_state.OptimalFilter.NoiseTraces
+				= of_conf["NoiseTraces"].value_or(1000u);
+			cgui_state.OptimalFilter.TemplateTraces
+				= of_conf["TemplateTraces"].value_or(1000u);
+			cgui_state.OptimalFilter.TemplateMinAmplitude
+				= of_conf["TemplateMinAmplitude"].value_or(0.0f);
+			cgui_state.OptimalFilter.TemplateMaxAmplitude
+				= of_conf["TemplateMaxAmplitude"].value_or(65535.0f);
+			cgui_state.OptimalFilter.TemplatePeak
+				= of_conf["TemplatePeak"].value_or(32u);
+
+			auto pt_conf = config_file["PulseTemplate"];
+			cgui_state.PulseTemplate.Enabled
+				= pt_conf["Enabled"].value_or(false);
+			cgui_state.PulseTemplate.Alignment
+				= TemplateAlignment_map.at(
+					pt_conf["Alignment"].value_or("Peak"));
+			cgui_state.PulseTemplate.MinAmplitude
+				= pt_conf["MinAmplitude"].value_or(0.0f);
+			cgui_state.PulseTemplate.MaxAmplitude
+				= pt_conf["MaxAmplitude"].value_or(65535.0f);
+			cgui_state.PulseTemplate.Samples
+				= pt_conf["Samples"].value_or(256u);
+			cgui_state.PulseTemplate.PreSamples
+				= pt_conf["PreSamples"].value_or(32u);
+			cgui_state.PulseTemplate.Oversampling
+				= pt_conf["Oversampling"].value_or(4u);
+
+			auto hist_conf = config_file["Histograms"];
+			cgui_state.AmplitudeHistogram.Binning = HistogramBinning_map.at(
+				hist_conf["AmplitudeBinning"].value_or("Linear"));
+			cgui_state.AmplitudeHistogram.NumBins
+				= hist_conf["AmplitudeBins"].value_or(200u);
+			cgui_state.AmplitudeHistogram.Min
+				= hist_conf["AmplitudeMin"].value_or(0.0);
+			cgui_state.AmplitudeHistogram.Max
+				= hist_conf["AmplitudeMax"].value_or(1000.0);
+			cgui_state.FilteredAmplitudeHistogram.Binning
+				= HistogramBinning_map.at(
+				hist_conf["FilteredAmplitudeBinning"].value_or("Linear"));
+			cgui_state.FilteredAmplitudeHistogram.NumBins
+				= hist_conf["FilteredAmplitudeBins"].value_or(200u);
+			cgui_state.FilteredAmplitudeHistogram.Min
+				= hist_conf["FilteredAmplitudeMin"].value_or(0.0);
+			cgui_state.FilteredAmplitudeHistogram.Max
+				= hist_conf["FilteredAmplitudeMax"].value_or(1000.0);
+			cgui_state.TriggerTimeHistogram.Binning = HistogramBinning_map.at(
+				hist_conf["TriggerTimeBinning"].value_or("Log"));
+			cgui_state.TriggerTimeHistogram.NumBins
+				= hist_conf["TriggerTimeBins"].value_or(100u);
+			cgui_state.TriggerTimeHistogram.Min
+				= hist_conf["TriggerTimeMin"].value_or(1e-6);
+			cgui_state.TriggerTimeHistogram.Max
+				= hist_conf["TriggerTimeMax"].value_or(10.0);
+
+			auto an_conf = config_file["Analysis"];
+			cgui_state.Analysis.NumThreads
+				= an_conf["NumThreads"].value_or(0u);
+			cgui_state.Analysis.MaxBatches
+				= an_conf["MaxBatches"].value_or(64u);
+			if(toml::array* arr = an_conf["CPUs"].as_array()) {
+				for(toml::node& elem : *arr) {
+					cgui_state.Analysis.CPUs.push_back(elem.value_or(0));
+				}
+			}
 
 			cgui_state.Model = CAENDigitizerModels_map.at(CAEN_conf["Model"].value_or("DT5730B"));
 			cgui_state.PortNum = CAEN_conf["Port"].value_or(0u);
@@ -205,6 +412,17 @@ public:
 							state.CurrentState == CAENInterfaceStates::StatisticsMode) {
 							state.CurrentState = CAENInterfaceStates::RunMode;
 							state.SiPMParameters = cgui_state.SiPMParameters;
+							// For the run catalog
+							state.RunParameters = {
+								{"PeltierTempSetpoint",
+									tgui_state.PIDTempValues.SetPoint},
+								{"PeltierPIDState",
+									tgui_state.PeltierPIDState ? 1.0 : 0.0},
+								{"NTempSetpoint",
+									tgui_state.NTempValues.SetPoint},
+								{"LN2PIDState",
+									tgui_state.LN2PIDState ? 1.0 : 0.0}
+							};
 						}
 						return true;
 					});
@@ -218,6 +436,18 @@ public:
 						}
 						return true;
 					});
+
+					// Saves the last events seen in the oscilloscope or
+					// statistics mode, see flight_recorder.h
+					CAENControlFac.Button(
+						"Save Flight Recorder",
+						[=](CAENInterfaceData& state) {
+						if(state.CurrentState == CAENInterfaceStates::OscilloscopeMode ||
+							state.CurrentState == CAENInterfaceStates::StatisticsMode) {
+							state.SaveFlightRecorder = true;
+						}
+						return true;
+					});
 						// _teensyQueueF([=](TeensyControllerState& oldState) {
 						// 	// There is nothing to do here technically
 						// 	// but I am including it just in case
@@ -356,7 +586,10 @@ public:
 
 
 			ImGui::Begin("SiPM Plot");  
-			if (ImPlot::BeginPlot("SiPM Trace", ImVec2(-1,0))) {
+			// Half of the window each, the template at the right
+			const float half_width = 0.5f*ImGui::GetContentRegionAvail().x
+				- ImGui::GetStyle().ItemSpacing.x;
+			if (ImPlot::BeginPlot("SiPM Trace", ImVec2(half_width,0))) {
 
 				ImPlot::SetupAxes("time [ns]", "Counts", g_axis_flags, g_axis_flags);
 
@@ -367,6 +600,53 @@ public:
 
 				ImPlot::EndPlot();
 			}
+
+			ImGui::SameLine();
+			if (ImPlot::BeginPlot("Pulse Template", ImVec2(-1,0))) {
+
+				ImPlot::SetupAxes("time from pulse [ns]", "Counts", g_axis_flags, g_axis_flags);
+
+				_indicatorReceiver.plot(IndicatorNames::SiPM_Template_ZERO, "Template 1", true);
+				_indicatorReceiver.plot(IndicatorNames::SiPM_Template_ONE, "Template 2", true);
+				_indicatorReceiver.plot(IndicatorNames::SiPM_Template_TWO, "Template 3", true);
+				_indicatorReceiver.plot(IndicatorNames::SiPM_Template_THREE, "Template 4", true);
+
+				ImPlot::EndPlot();
+			}
+			ImGui::End();
+
+			ImGui::Begin("SiPM Histograms");
+			const float hist_width = (ImGui::GetContentRegionAvail().x
+				- 2.0f*ImGui::GetStyle().ItemSpacing.x) / 3.0f;
+			if (ImPlot::BeginPlot("Pulse Amplitudes", ImVec2(hist_width,0))) {
+
+				ImPlot::SetupAxes("amplitude [counts]", "Pulses", g_axis_flags, g_axis_flags);
+
+				_indicatorReceiver.plot(IndicatorNames::AMPLITUDE_HISTOGRAM, "Amplitude", true, PlotStyle::Stairs);
+
+				ImPlot::EndPlot();
+			}
+
+			ImGui::SameLine();
+			if (ImPlot::BeginPlot("Filtered Amplitudes", ImVec2(hist_width,0))) {
+
+				ImPlot::SetupAxes("amplitude [counts]", "Pulses", g_axis_flags, g_axis_flags);
+
+				_indicatorReceiver.plot(IndicatorNames::FILTERED_AMPLITUDE_HISTOGRAM, "Amplitude", true, PlotStyle::Stairs);
+
+				ImPlot::EndPlot();
+			}
+
+			ImGui::SameLine();
+			if (ImPlot::BeginPlot("Time Between Triggers", ImVec2(-1,0))) {
+
+				ImPlot::SetupAxes("time [s]", "Triggers", g_axis_flags, g_axis_flags);
+				ImPlot::SetupAxisScale(ImAxis_X1, ImPlotScale_Log10);
+
+				_indicatorReceiver.plot(IndicatorNames::TRIGGER_TIME_HISTOGRAM, "Time", true, PlotStyle::Stairs);
+
+				ImPlot::EndPlot();
+			}
 			ImGui::End();
 			/// !SiPM Plots
 			//// !Plots
@@ -397,7 +677,36 @@ public:
 			ImGui::SameLine(); ImGui::Text("Hz");
 			_indicatorReceiver.indicator(IndicatorNames::GAIN, "Gain", 3, NumericFormat::Scientific);
 			ImGui::SameLine(); ImGui::Text("[counts x ns]");
+			_indicatorReceiver.indicator(IndicatorNames::CROSSTALK, "Crosstalk", 3);
+			ImGui::SameLine(); ImGui::Text("[%]");
+			_indicatorReceiver.indicator(IndicatorNames::AFTERPULSE, "Afterpulses", 3);
+			ImGui::SameLine(); ImGui::Text("[%]");
+			_indicatorReceiver.indicator(IndicatorNames::BASELINE_ALERTS, "Baselines out of window", 2);
+			ImGui::SameLine(); ImGui::Text("Channels");
+			_indicatorReceiver.indicator(IndicatorNames::NOISE_RMS, "Noise", 3);
+			ImGui::SameLine(); ImGui::Text("[counts rms]");
 			// End CAEN
+
+			// SiPM file, only while taking data
+			ImGui::Text("SiPM File");
+
+			_indicatorReceiver.indicator(IndicatorNames::FILE_WRITE_RATE, "Write rate", 3);
+			ImGui::SameLine(); ImGui::Text("[MB/s]");
+			_indicatorReceiver.indicator(IndicatorNames::FILE_EVENT_RATE, "Event rate", 4);
+			ImGui::SameLine(); ImGui::Text("[Hz]");
+			_indicatorReceiver.indicator(IndicatorNames::FILE_QUEUE_DEPTH, "Events to save", 6);
+			ImGui::SameLine(); ImGui::Text("Counts");
+			_indicatorReceiver.indicator(IndicatorNames::FILE_MAX_QUEUE_DEPTH, "Max events to save", 6);
+			ImGui::SameLine(); ImGui::Text("Counts");
+			_indicatorReceiver.indicator(IndicatorNames::FILE_FORMAT_TIME, "Formatting", 3);
+			ImGui::SameLine(); ImGui::Text("[%% of time]");
+			_indicatorReceiver.indicator(IndicatorNames::FILE_WRITE_TIME, "Writing", 3);
+			ImGui::SameLine(); ImGui::Text("[%% of time]");
+			_indicatorReceiver.indicator(IndicatorNames::FILE_SAVE_LATENCY, "Save latency p99", 3);
+			ImGui::SameLine(); ImGui::Text("[ms]");
+			_indicatorReceiver.indicator(IndicatorNames::FILE_SYNC_LATENCY, "fsync latency p99", 3);
+			ImGui::SameLine(); ImGui::Text("[ms]");
+			// End SiPM file
 			ImGui::End();
 		}
 
@@ -406,7 +715,9 @@ public:
 			// The only action to take is that we let the 
 			// Teensy Thread to close, too.
 			TeensyInQueue& tq = std::get<TeensyInQueue&>(_queues);
-		 	tq.try_enqueue(
+		 	// enqueue, not try_enqueue, so they always get the message
+		 	// and main() can wait for them
+		 	tq.enqueue(
 		 		[](TeensyControllerState& oldState) {
 					oldState.CurrentState = TeensyControllerStates::Closing;
 					return true;
@@ -414,7 +725,7 @@ public:
 			);
 
 		 	CAENQueue& cq = std::get<CAENQueue&>(_queues);
-			cq.try_enqueue(
+			cq.enqueue(
 				[](CAENInterfaceData& state) {
 					state.CurrentState = CAENInterfaceStates::Closing;
 					return true;
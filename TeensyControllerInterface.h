@@ -17,6 +17,7 @@
 // STD includes
 #include "include/timing_events.h"
 #include <cstdint>
+#include <filesystem>
 #include <inttypes.h>
 #include <string>
 #include <chrono>
@@ -47,6 +48,8 @@ using json = nlohmann::json;
 #include "imgui_helpers.h"
 #include "implot_helpers.h"
 #include "file_helpers.h"
+#include "slow_control_file.h"
+#include "text_format.h"
 #include "timing_events.h"
 #include "indicators.h"
 
@@ -195,6 +198,40 @@ namespace SBCQueens {
     void to_json(json& j, const BMEs& p);
     void from_json(const json& j, BMEs& p);
 
+	// Columns of the binary slow control files (see slow_control_file.h)
+	const SlowControlSchema<Peltiers> PeltiersSchema {
+		{"time", [](const Peltiers& p) { return p.time; }},
+		{"PID_Current", [](const Peltiers& p) { return p.PID.Current; }}
+	};
+
+	const SlowControlSchema<RTDs> RTDsSchema {
+		{"time", [](const RTDs& r) { return r.time; }},
+		{"RTD_1", [](const RTDs& r) { return r.RTD_1.Temperature; }},
+		{"RTD_2", [](const RTDs& r) { return r.RTD_2.Temperature; }}
+	};
+
+	const SlowControlSchema<Pressures> PressuresSchema {
+		{"time", [](const Pressures& p) { return p.time; }},
+		{"Vacuum", [](const Pressures& p) { return p.Vacuum.Pressure; }},
+		{"N2Line", [](const Pressures& p) { return p.N2Line.Pressure; }}
+	};
+
+	const SlowControlSchema<BMEs> BMEsSchema {
+		{"time", [](const BMEs& b) { return b.time; }},
+		{"LocalBME_Temperature",
+			[](const BMEs& b) { return b.LocalBME.Temperature; }},
+		{"LocalBME_Pressure",
+			[](const BMEs& b) { return b.LocalBME.Pressure; }},
+		{"LocalBME_Humidity",
+			[](const BMEs& b) { return b.LocalBME.Humidity; }},
+		{"BoxBME_Temperature",
+			[](const BMEs& b) { return b.BoxBME.Temperature; }},
+		{"BoxBME_Pressure",
+			[](const BMEs& b) { return b.BoxBME.Pressure; }},
+		{"BoxBME_Humidity",
+			[](const BMEs& b) { return b.BoxBME.Humidity; }}
+	};
+
 
 	// end Sensors structs
 
@@ -273,12 +310,33 @@ namespace SBCQueens {
 
 
 
+	// How the slow control files are saved
+	enum class SlowControlFormat {
+		// Comma separated values, see text_format.h
+		Text = 0,
+		// SBC binary, see slow_control_file.h
+		Binary
+	};
+
+	const std::unordered_map<std::string, SlowControlFormat>
+		SlowControlFormat_map {
+			{"Text", SlowControlFormat::Text},
+			{"Binary", SlowControlFormat::Binary}
+	};
+
 	// It holds everything the outside world can modify or use.
 	// So far, I do not like teensy_serial is here.
 	struct TeensyControllerState {
 
 		std::string RunDir 		= "";
 		std::string RunName 	= "";
+		// How the slow control files are written to disk
+		FileOptions SlowControlFileOptions;
+		SlowControlFormat SlowControlFileFormat = SlowControlFormat::Binary;
+		// Lines between time index entries of the binary files
+		uint32_t SlowControlIndexInterval = 1000;
+		// Digits after the decimal point of the text files
+		int SlowControlTextPrecision = 6;
 
 		std::string Port 		= "COM4";
 
@@ -329,6 +387,22 @@ namespace SBCQueens {
 		DataFile<RTDs> _RTDsFile;
 		DataFile<BMEs> _BMEsFile;
 
+		SlowControlIndex _PeltiersIndex;
+		SlowControlIndex _PressuresIndex;
+		SlowControlIndex _RTDsIndex;
+		SlowControlIndex _BMEsIndex;
+
+		csvFormatter<Peltiers> _PeltiersText {PeltiersSchema};
+		csvFormatter<Pressures> _PressuresText {PressuresSchema};
+		csvFormatter<RTDs> _RTDsText {RTDsSchema};
+		csvFormatter<BMEs> _BMEsText {BMEsSchema};
+
+		// Rates of the files for the log
+		fileMetricsMonitor _PeltiersMonitor;
+		fileMetricsMonitor _PressuresMonitor;
+		fileMetricsMonitor _RTDsMonitor;
+		fileMetricsMonitor _BMEsMonitor;
+
 		serial_ptr port;
 
 	public:
@@ -403,6 +477,7 @@ namespace SBCQueens {
 							"Teensy with port {}", state_of_everything.Port);
 
 						disconnect(port);
+						close_files();
 
 						// Move to standby
 						state_of_everything.CurrentState 
@@ -425,29 +500,21 @@ namespace SBCQueens {
 								_init_time = get_current_time_epoch();
 
 								// Open files to start saving!
-								open(_PeltiersFile,
-									state_of_everything.RunDir
-									+ "/" + state_of_everything.RunName
-									+ "/Peltiers.txt");
-						 		bool s = _PeltiersFile > 0;
-
-								open(_PressuresFile,
-									state_of_everything.RunDir
-									+ "/" + state_of_everything.RunName
-									+ "/Pressures.txt");
-						 		s &= _PeltiersFile > 0;
-
-								open(_RTDsFile,
-									state_of_everything.RunDir
-									+ "/" + state_of_everything.RunName
-									+ "/RTDs.txt");
-						 		s &= _RTDsFile > 0;
-
-								open(_BMEsFile,
-									state_of_everything.RunDir
-									+ "/" + state_of_everything.RunName
-									+ "/BMEs.txt");
-								s &= _BMEsFile > 0;
+								const int precision =
+									state_of_everything.SlowControlTextPrecision;
+								_PeltiersText.Precision = precision;
+								_PressuresText.Precision = precision;
+								_RTDsText.Precision = precision;
+								_BMEsText.Precision = precision;
+
+								bool s = open_sc_file(_PeltiersFile,
+									_PeltiersIndex, PeltiersSchema, "Peltiers");
+								s &= open_sc_file(_PressuresFile,
+									_PressuresIndex, PressuresSchema, "Pressures");
+								s &= open_sc_file(_RTDsFile,
+									_RTDsIndex, RTDsSchema, "RTDs");
+								s &= open_sc_file(_BMEsFile,
+									_BMEsIndex, BMEsSchema, "BMEs");
 
 								if(!s) {
 									spdlog::error("Failed to open files.");
@@ -481,6 +548,7 @@ namespace SBCQueens {
 
 					case TeensyControllerStates::Closing:
 						spdlog::info("Going to close the Teensy thread.");
+						close_files();
 						return false;
 
 					case TeensyControllerStates::NullState:
@@ -507,6 +575,89 @@ namespace SBCQueens {
 		} // here port should get deleted
 
 private:
+		// Opens RunDir/RunName/name + extension. Binary files get their
+		// header and, as they cannot be appended to once closed, a new
+		// name if they already exist.
+		template<typename T>
+		bool open_sc_file(DataFile<T>& file, SlowControlIndex& index,
+			const SlowControlSchema<T>& schema, const std::string& name) {
+
+			close_sc_file(file, index, schema);
+
+			const auto& opts = state_of_everything.SlowControlFileOptions;
+			const bool is_binary = state_of_everything.SlowControlFileFormat
+				== SlowControlFormat::Binary;
+			const std::string extension = std::string(is_binary ?
+				".bin" : ".txt") + (opts.Compress ? ".zst" : "");
+			const std::string base = state_of_everything.RunDir
+				+ "/" + state_of_everything.RunName + "/" + name;
+
+			if(!is_binary) {
+				open(file, opts, base + extension);
+				return file->IsOpen();
+			}
+
+			std::string file_name = base + extension;
+			for(int i = 1; std::filesystem::exists(file_name); i++) {
+				file_name = base + "_" + std::to_string(i) + extension;
+			}
+
+			index.Interval = state_of_everything.SlowControlIndexInterval;
+			open(file, opts, file_name, sc_init_file<T>, schema, index);
+			return file->IsOpen();
+		}
+
+		// Saves what is left, then the index and the number of lines
+		// of binary files. Text files are just closed.
+		template<typename T>
+		void close_sc_file(DataFile<T>& file, SlowControlIndex& index,
+			const SlowControlSchema<T>& schema) {
+
+			if(!file || !file->IsOpen() || index.DataStart == 0) {
+				close(file);
+				return;
+			}
+
+			save_sc_file(file, index, schema);
+			(*file) << sc_index_footer(index);
+
+			const std::string file_name = file->GetFileName();
+			close(file);
+			if(!sc_finalize_file(file_name, index)
+				&& !state_of_everything.SlowControlFileOptions.Compress) {
+				spdlog::warn("Could not write the number of lines of {0}",
+					file_name);
+			}
+
+			index.reset();
+		}
+
+		template<typename T>
+		void save_sc_file(DataFile<T>& file, SlowControlIndex& index,
+			const SlowControlSchema<T>& schema) {
+			async_save(file, [&](std::vector<T>& data) {
+				return sc_save_func(data, schema, index);
+			});
+		}
+
+		template<typename T>
+		void log_file_metrics(DataFile<T>& file, fileMetricsMonitor& monitor) {
+			if(!file || !file->IsOpen()) {
+				return;
+			}
+
+			const auto& metrics = file->GetMetrics();
+			spdlog::info(format_file_metrics(file->GetFileName(), metrics,
+				monitor(metrics)));
+		}
+
+		void close_files() {
+			close_sc_file(_PeltiersFile, _PeltiersIndex, PeltiersSchema);
+			close_sc_file(_PressuresFile, _PressuresIndex, PressuresSchema);
+			close_sc_file(_RTDsFile, _RTDsIndex, RTDsSchema);
+			close_sc_file(_BMEsFile, _BMEsIndex, BMEsSchema);
+		}
+
 		void send_initial_config() {
 
 			auto send_ts_cmd_b = make_blocking_total_timed_event(
@@ -755,45 +906,32 @@ private:
 				[&]() {
 
 					spdlog::info("Saving teensy data...");
-					async_save(_PeltiersFile,
-						[](const Peltiers& pid) {
-							return 	std::to_string(pid.time) + "," +
-									std::to_string(pid.PID.Current) + "\n";
-
-						}
-					);
-
-					async_save(_RTDsFile,
-						[](const RTDs& rtds) {
-							return 	std::to_string(rtds.time) + "," +
-									std::to_string(rtds.RTD_1.Temperature) + "," +
-									std::to_string(rtds.RTD_2.Temperature) + "\n";
-
-						}
-					);
-
-					async_save(_PressuresFile,
-						[](const Pressures& press) {
-							return 	std::to_string(press.time) + "," +
-									std::to_string(press.Vacuum.Pressure) + "," +
-									std::to_string(press.N2Line.Pressure) + "\n";
-
-						}
-					);
-
-					async_save(_BMEsFile, 
-						[](const BMEs& bme) {
+					if(state_of_everything.SlowControlFileFormat
+						== SlowControlFormat::Binary) {
+						save_sc_file(_PeltiersFile, _PeltiersIndex,
+							PeltiersSchema);
+						save_sc_file(_RTDsFile, _RTDsIndex, RTDsSchema);
+						save_sc_file(_PressuresFile, _PressuresIndex,
+							PressuresSchema);
+						save_sc_file(_BMEsFile, _BMEsIndex, BMEsSchema);
+						return;
+					}
 
-							return 	std::to_string(bme.time) + "," +
-									std::to_string(bme.LocalBME.Temperature) + "," +
-									std::to_string(bme.LocalBME.Pressure) + "," +
-									std::to_string(bme.LocalBME.Humidity) + "," +
-									std::to_string(bme.BoxBME.Temperature) + "," +
-									std::to_string(bme.BoxBME.Pressure) + "," +
-									std::to_string(bme.BoxBME.Humidity) + "\n";
+					async_save(_PeltiersFile, _PeltiersText);
+					async_save(_RTDsFile, _RTDsText);
+					async_save(_PressuresFile, _PressuresText);
+					async_save(_BMEsFile, _BMEsText);
+				}
+			);
 
-						}
-					);
+			// How the files are doing since the last time
+			static auto log_files_metrics = make_total_timed_event(
+				std::chrono::minutes(10),
+				[&]() {
+					log_file_metrics(_PeltiersFile, _PeltiersMonitor);
+					log_file_metrics(_RTDsFile, _RTDsMonitor);
+					log_file_metrics(_PressuresFile, _PressuresMonitor);
+					log_file_metrics(_BMEsFile, _BMEsMonitor);
 				}
 			);
 
@@ -810,6 +948,7 @@ private:
 
 			// These should be called every 30 seconds
 			save_files();
+			log_files_metrics();
 
 		}
 
@@ -0,0 +1,399 @@
+#pragma once
+
+/*
+
+	Pool of threads for the analysis of the events, so the thread that
+	reads the digitizer only copies them.
+
+	Work comes in batches (ex: the events of one read). Every batch goes
+	through the kernels in two steps:
+
+	- the kernels, in parallel: each worker takes the oldest batch of
+	its own queue or, if it has nothing, steals the newest one of
+	another worker,
+	- then the ordered kernels, one batch at a time in the order they
+	were submitted, ex: to fill histograms or use the time stamps. One
+	worker at a time runs them, the others go back to the kernels.
+
+		analysisExecutor<EventBatch> executor;
+		executor.add_kernel([](EventBatch& b) { ... });
+		executor.add_ordered_kernel([](EventBatch& b) { ... });
+		executor.start(config);
+
+		auto batch = executor.get_batch(); 	// empty, reused
+		// ... fill it ...
+		executor.submit(std::move(batch));
+
+	submit(...) never blocks: if there are already MaxBatches batches
+	in the pool, the batch is dropped and counted. Whatever the ordered
+	kernels change can be read safely inside lock_ordered(...).
+
+	Batch needs a clear() that empties it without freeing its memory.
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// 3rd party includes
+#include <spdlog/spdlog.h>
+
+namespace SBCQueens {
+
+	struct AnalysisConfig {
+		// Worker threads, 0 = one per core minus the one reading
+		unsigned int NumThreads = 0;
+		// CPUs the workers are pinned to, worker i to CPUs[i % size].
+		// Empty = any. Linux only.
+		std::vector<int> CPUs;
+		// Batches in the pool at the same time, the rest are dropped
+		size_t MaxBatches = 64;
+	};
+
+	template<typename Batch>
+	class analysisExecutor {
+public:
+		using Kernel = std::function<void(Batch&)>;
+
+private:
+		struct task {
+			uint64_t Number = 0;
+			std::unique_ptr<Batch> Data;
+		};
+
+		// Each worker has its own queue
+		struct taskQueue {
+			std::deque<task> Tasks;
+			std::mutex Mutex;
+		};
+
+		AnalysisConfig _config;
+		std::vector<Kernel> _kernels;
+		std::vector<Kernel> _orderedKernels;
+
+		std::vector<std::unique_ptr<taskQueue>> _queues;
+		std::vector<std::thread> _workers;
+		bool _running = false;
+
+		// Only touched by the thread that submits
+		uint64_t _nextNumber = 0;
+		size_t _nextQueue = 0;
+
+		// Protected by _mutex
+		size_t _queued = 0;
+		bool _stop = false;
+		std::vector<std::unique_ptr<Batch>> _free;
+		std::mutex _mutex;
+		std::condition_variable _cv;
+
+		// Submitted and not through the ordered kernels yet
+		std::atomic<size_t> _inFlight{0};
+		std::atomic<uint64_t> _dropped{0};
+
+		// Protected by _doneMutex
+		std::map<uint64_t, std::unique_ptr<Batch>> _done;
+		uint64_t _nextOrdered = 0;
+		uint64_t _processed = 0;
+		std::mutex _doneMutex;
+		std::condition_variable _doneCv;
+
+		// If a worker is running the ordered kernels
+		std::atomic<bool> _draining{false};
+		// Held while they run, so lock_ordered(...) waits for them
+		std::mutex _orderedMutex;
+
+		void recycle(std::unique_ptr<Batch> batch) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			if(_free.size() < _config.MaxBatches) {
+				_free.push_back(std::move(batch));
+			}
+		}
+
+		// The oldest of its own queue or the newest of another one
+		bool take(const size_t& w, task& out) {
+			for(size_t i = 0; i < _queues.size(); i++) {
+				auto& queue = *_queues[(w + i) % _queues.size()];
+				std::lock_guard<std::mutex> lock(queue.Mutex);
+				if(queue.Tasks.empty()) {
+					continue;
+				}
+
+				if(i == 0) {
+					out = std::move(queue.Tasks.front());
+					queue.Tasks.pop_front();
+				} else {
+					out = std::move(queue.Tasks.back());
+					queue.Tasks.pop_back();
+				}
+
+				std::lock_guard<std::mutex> q_lock(_mutex);
+				_queued--;
+				return true;
+			}
+
+			return false;
+		}
+
+		// The next batch in line, if it is done
+		std::unique_ptr<Batch> next_done() {
+			std::lock_guard<std::mutex> lock(_doneMutex);
+			if(_done.empty() || _done.begin()->first != _nextOrdered) {
+				return nullptr;
+			}
+
+			auto batch = std::move(_done.begin()->second);
+			_done.erase(_done.begin());
+			return batch;
+		}
+
+		bool is_next_done() {
+			std::lock_guard<std::mutex> lock(_doneMutex);
+			return !_done.empty() && _done.begin()->first == _nextOrdered;
+		}
+
+		// Leaves the batch for the ordered kernels. If no other worker is
+		// running them, this one runs them for every batch that is next
+		// in line. Otherwise it returns right away and the one running
+		// them will get to it.
+		void finish(task& t) {
+			{
+				std::lock_guard<std::mutex> lock(_doneMutex);
+				_done.emplace(t.Number, std::move(t.Data));
+			}
+
+			// Not a try_lock, it can fail even if nobody has it and then
+			// the last batch would wait forever
+			while(!_draining.exchange(true)) {
+				while(auto batch = next_done()) {
+					{
+						std::lock_guard<std::mutex> lock(_orderedMutex);
+						for(auto& kernel : _orderedKernels) {
+							kernel(*batch);
+						}
+					}
+
+					recycle(std::move(batch));
+					{
+						std::lock_guard<std::mutex> lock(_doneMutex);
+						_nextOrdered++;
+						_processed++;
+						_inFlight--;
+					}
+					_doneCv.notify_all();
+				}
+
+				_draining = false;
+				// Another worker could have left the next one after this
+				// one looked and before it stopped draining
+				if(!is_next_done()) {
+					return;
+				}
+			}
+		}
+
+		void worker_loop(const size_t w) {
+			while(true) {
+				task t;
+				if(!take(w, t)) {
+					std::unique_lock<std::mutex> lock(_mutex);
+					_cv.wait(lock, [&]() { return _stop || _queued > 0; });
+					if(_stop && _queued == 0) {
+						return;
+					}
+					continue;
+				}
+
+				for(auto& kernel : _kernels) {
+					kernel(*t.Data);
+				}
+
+				finish(t);
+			}
+		}
+
+		void pin(std::thread& thread, const int& cpu) {
+#ifdef __linux__
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			if(pthread_setaffinity_np(thread.native_handle(),
+				sizeof(cpu_set_t), &set) != 0) {
+				spdlog::warn("Could not pin an analysis thread to CPU {0}",
+					cpu);
+			}
+#endif
+		}
+
+public:
+		analysisExecutor() = default;
+
+		// No copying nor moving, the threads point to it
+		analysisExecutor(analysisExecutor&&) = delete;
+		analysisExecutor(const analysisExecutor&) = delete;
+
+		~analysisExecutor() { stop(); }
+
+		// Kernels can only be added while it is stopped
+		void add_kernel(Kernel kernel) {
+			if(!_running) {
+				_kernels.push_back(std::move(kernel));
+			}
+		}
+
+		void add_ordered_kernel(Kernel kernel) {
+			if(!_running) {
+				_orderedKernels.push_back(std::move(kernel));
+			}
+		}
+
+		bool IsRunning() const { return _running; }
+
+		unsigned int GetNumThreads() const {
+			return static_cast<unsigned int>(_workers.size());
+		}
+
+		void start(const AnalysisConfig& config) {
+			stop();
+
+			_config = config;
+			_config.MaxBatches = std::max<size_t>(_config.MaxBatches, 1);
+			unsigned int num_threads = _config.NumThreads;
+			if(num_threads == 0) {
+				num_threads = std::max(std::thread::hardware_concurrency(),
+					2u) - 1;
+			}
+
+#ifndef __linux__
+			if(!_config.CPUs.empty()) {
+				spdlog::warn("The analysis threads can only be pinned to "
+					"CPUs in Linux.");
+			}
+#endif
+
+			_stop = false;
+			_nextNumber = 0;
+			_nextOrdered = 0;
+			_processed = 0;
+			_dropped = 0;
+			for(unsigned int i = 0; i < num_threads; i++) {
+				_queues.push_back(std::make_unique<taskQueue>());
+			}
+
+			for(unsigned int i = 0; i < num_threads; i++) {
+				_workers.emplace_back(&analysisExecutor::worker_loop, this,
+					static_cast<size_t>(i));
+				if(!_config.CPUs.empty()) {
+					pin(_workers.back(),
+						_config.CPUs[i % _config.CPUs.size()]);
+				}
+			}
+
+			_running = true;
+		}
+
+		// Finishes everything submitted and stops the threads
+		void stop() {
+			if(!_running) {
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stop = true;
+			}
+			_cv.notify_all();
+
+			for(auto& worker : _workers) {
+				worker.join();
+			}
+
+			_workers.clear();
+			_queues.clear();
+			_running = false;
+		}
+
+		// An empty batch, reused if possible so it does not allocate
+		std::unique_ptr<Batch> get_batch() {
+			std::unique_ptr<Batch> batch;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if(!_free.empty()) {
+					batch = std::move(_free.back());
+					_free.pop_back();
+				}
+			}
+
+			if(!batch) {
+				batch = std::make_unique<Batch>();
+			}
+
+			batch->clear();
+			return batch;
+		}
+
+		// Returns false if it was dropped, ex: the pool is full
+		bool submit(std::unique_ptr<Batch> batch) {
+			if(!_running || !batch) {
+				return false;
+			}
+
+			if(_inFlight >= _config.MaxBatches) {
+				_dropped++;
+				recycle(std::move(batch));
+				return false;
+			}
+
+			_inFlight++;
+			task t{_nextNumber++, std::move(batch)};
+			auto& queue = *_queues[_nextQueue++ % _queues.size()];
+			{
+				std::lock_guard<std::mutex> lock(queue.Mutex);
+				queue.Tasks.push_back(std::move(t));
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_queued++;
+			}
+			_cv.notify_one();
+			return true;
+		}
+
+		// Waits until everything submitted went through all the kernels
+		void wait() {
+			std::unique_lock<std::mutex> lock(_doneMutex);
+			_doneCv.wait(lock, [&]() { return _inFlight == 0; });
+		}
+
+		// Calls f() while no ordered kernel is running
+		template<typename Func>
+		void lock_ordered(Func f) {
+			std::lock_guard<std::mutex> lock(_orderedMutex);
+			f();
+		}
+
+		// Batches through all the kernels and dropped since start(...)
+		uint64_t GetProcessed() {
+			std::lock_guard<std::mutex> lock(_doneMutex);
+			return _processed;
+		}
+
+		uint64_t GetDropped() const { return _dropped; }
+	};
+
+} // namespace SBCQueens
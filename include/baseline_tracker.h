@@ -0,0 +1,157 @@
+#pragma once
+
+/*
+
+	Running baseline of every channel, for when it drifts during the
+	data taking (ex: with the temperature while the cryostat cools).
+
+	The samples of each trace before the trigger go to a histogram of
+	the ADC codes around the current baseline, HistogramCodes of them.
+	Adding a sample is an increment, so it is O(1). The codes outside
+	go to the first or last bin: they are the pulses and only move the
+	tails. Every HalfLifeSamples samples all the counts are halved, so
+	the old samples weigh less and less and the histogram follows the
+	drift. If the baseline gets close to an edge, the histogram is moved
+	so it is in the middle again, and if it jumps outside (half of the
+	samples are in the first or last bin) it starts again.
+
+	From the histogram:
+
+		Mode 		peak, interpolated as a gaussian with its neighbours
+		Median 		interpolated inside its code
+		NoiseRMS 	half the distance between the 15.9% and 84.1%
+					quantiles, the sigma of a gaussian. The pulses only
+					move it if they are more than ~16% of the samples.
+
+	They are calculated every 16 histograms worth of samples, so that is
+	O(1) per sample too.
+
+	The analysis threads (see analysis_executor.h) use the Mode or the
+	Median as the baseline of every trace once a channel has MinSamples,
+	instead of the mean of the first samples of each trace. It is
+	updated by one thread (the ordered kernel) and read by any, so the
+	traces being analyzed at the same time use the one of a few batches
+	before, nothing for a drift that takes minutes.
+
+		baselineTracker baselines;
+		baselines.configure(config, channels, pre_trigger, adc_bits);
+		baselines.add(ch, data, size); 		// one thread
+		baselines.GetBaseline(ch); 			// any thread, NaN until it knows
+
+	A channel is out of its window if its baseline is outside
+	[MinBaseline, MaxBaseline], closer than SaturationMargin to 0 or the
+	ADC full scale, or its noise is larger than MaxNoiseRMS.
+
+*/
+
+// STD includes
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace SBCQueens {
+
+	enum class BaselineEstimator { Mode, Median };
+
+	const std::unordered_map<std::string, BaselineEstimator>
+		BaselineEstimator_map = {
+		{"Mode", BaselineEstimator::Mode},
+		{"Median", BaselineEstimator::Median}
+	};
+
+	struct BaselineTrackerConfig {
+		bool Enabled = false;
+		// Which one the analysis uses as the baseline
+		BaselineEstimator Estimator = BaselineEstimator::Mode;
+		// ADC codes around the baseline in the histogram
+		uint32_t HistogramCodes = 256;
+		// Samples of a channel after which the old ones weigh half
+		uint64_t HalfLifeSamples = 1 << 20;
+		// Samples a channel needs before its baseline is used
+		uint64_t MinSamples = 10000;
+		// The window, in ADC counts
+		float MinBaseline = 0.0f;
+		float MaxBaseline = 65535.0f;
+		float SaturationMargin = 100.0f;
+		// 0 = no limit
+		float MaxNoiseRMS = 0.0f;
+	};
+
+	// In ADC counts
+	struct BaselineState {
+		uint8_t Channel = 0;
+		// Since the last reset
+		uint64_t Samples = 0;
+		float Mode = 0.0f;
+		float Median = 0.0f;
+		float NoiseRMS = 0.0f;
+		// The one the analysis uses
+		float Baseline = 0.0f;
+		bool InWindow = true;
+
+		// If it has MinSamples
+		bool IsReady = false;
+	};
+
+	class baselineTracker {
+		struct channelData {
+			// Counts of the codes Offset to Offset + HistogramCodes - 1
+			std::vector<uint32_t> Counts;
+			int32_t Offset = 0;
+			bool HasOffset = false;
+			// Until the next halving and the next estimate
+			uint64_t ToHalve = 0;
+			uint64_t ToUpdate = 0;
+			BaselineState State;
+		};
+
+		BaselineTrackerConfig _config;
+		uint32_t _numSamples = 0;
+		float _fullScale = 65535.0f;
+		// Index of each channel number in _channels, -1 if not there
+		std::array<int, 256> _channelIndex;
+		std::vector<channelData> _channels;
+		// Of every channel number, NaN if it is not ready
+		std::array<std::atomic<float>, 256> _baselines;
+
+		void update(channelData& channel) noexcept;
+		// Moves the histogram so code is in its middle
+		void recenter(channelData& channel, const int32_t& code) noexcept;
+
+public:
+		baselineTracker();
+
+		// No copying, the analysis threads read it
+		baselineTracker(const baselineTracker&) = delete;
+
+		// Anything learned is lost. The first numSamples samples of every
+		// trace of channels are used. adcBits is the ADC resolution.
+		void configure(const BaselineTrackerConfig& config,
+			const std::vector<uint8_t>& channels, const uint32_t& numSamples,
+			const uint32_t& adcBits);
+
+		// Starts learning again
+		void reset();
+
+		bool IsEnabled() const { return _config.Enabled; }
+
+		// Adds the samples before the trigger of a trace of ch. Only one
+		// thread at a time.
+		void add(const uint8_t& ch, const uint16_t* data,
+			const uint32_t& size) noexcept;
+
+		// The baseline of ch for the analysis, NaN if it is not ready or
+		// disabled. Any thread.
+		float GetBaseline(const uint8_t& ch) const noexcept {
+			return _baselines[ch].load(std::memory_order_relaxed);
+		}
+
+		// Of every channel, in the order of configure(...). Same thread as
+		// add(...).
+		std::vector<BaselineState> GetStates() const;
+	};
+
+} // namespace SBCQueens
@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+
+	Block framing of data files.
+
+	When enabled (FileOptions::Framing), everything written after the
+	header is grouped in blocks of whole items (events) and each block
+	is saved with a small header in front:
+
+	uint32 				"SBCB"
+	uint32 				payload size in bytes
+	uint32 				number of items in the payload
+	uint32 				CRC32C of the 3 numbers above and the payload
+
+	A block is only written once it is complete, so if the program or
+	the PC dies, every block before the last one is known to be good.
+	The payload is the same as an unframed file, just cut in pieces.
+
+*/
+
+// STD includes
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// my includes
+#include "crc32c.h"
+
+namespace SBCQueens {
+
+	// "SBCB" in little endian
+	constexpr uint32_t SBCBlockMagic = 0x42434253;
+
+	struct BlockFrameHeader {
+		uint32_t Magic = SBCBlockMagic;
+		uint32_t Size = 0;
+		uint32_t Items = 0;
+		uint32_t CRC = 0;
+	};
+
+	constexpr size_t BlockFrameHeaderSize = 4*sizeof(uint32_t);
+
+	// CRC of a block: its size, items and payload
+	inline uint32_t block_crc(const char* payload, const uint32_t& size,
+		const uint32_t& items) noexcept {
+		const uint32_t numbers[2] = {size, items};
+		auto crc = crc32c(reinterpret_cast<const char*>(numbers),
+			sizeof(numbers));
+		return crc32c(payload, size, crc);
+	}
+
+	// Header to be written before payload
+	inline std::string block_frame_header(const char* payload,
+		const uint32_t& size, const uint32_t& items) noexcept {
+		const uint32_t header[4] = {SBCBlockMagic, size, items,
+			block_crc(payload, size, items)};
+		return std::string(reinterpret_cast<const char*>(header),
+			sizeof(header));
+	}
+
+	// Reads the header at ptr. It does not check the payload.
+	inline bool read_block_frame_header(const char* ptr,
+		const uint64_t& available, BlockFrameHeader& header) noexcept {
+		if(available < BlockFrameHeaderSize) {
+			return false;
+		}
+
+		std::memcpy(&header.Magic, ptr, sizeof(uint32_t));
+		std::memcpy(&header.Size, ptr + 4, sizeof(uint32_t));
+		std::memcpy(&header.Items, ptr + 8, sizeof(uint32_t));
+		std::memcpy(&header.CRC, ptr + 12, sizeof(uint32_t));
+
+		return header.Magic == SBCBlockMagic
+			&& header.Size <= available - BlockFrameHeaderSize;
+	}
+
+} // namespace SBCQueens
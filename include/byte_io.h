@@ -0,0 +1,74 @@
+#pragma once
+
+/*
+
+	Little helpers to write and read binary payloads (ex: the records of
+	the run catalog and the histogram files). The numbers are copied as
+	they are in memory, and the strings are a uint16 size followed by
+	their characters.
+
+		std::string out;
+		append_num(out, uint32_t(7));
+		append_str(out, "Amplitude");
+
+		payloadReader in{out.data(), out.data() + out.size()};
+		auto n = in.num<uint32_t>();
+		auto name = in.str();
+		if(!in.Ok) { ... it was too short ... }
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+
+namespace SBCQueens {
+
+	inline void append_str(std::string& out, const std::string& str) {
+		const auto size = static_cast<uint16_t>(std::min<size_t>(
+			str.size(), std::numeric_limits<uint16_t>::max()));
+		out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+		out.append(str.data(), size);
+	}
+
+	template<typename N>
+	void append_num(std::string& out, const N& num) {
+		out.append(reinterpret_cast<const char*>(&num), sizeof(num));
+	}
+
+	// Reads a payload in order. Any read past its end makes it not Ok
+	// and returns zeros.
+	struct payloadReader {
+		const char* Ptr;
+		const char* End;
+		bool Ok = true;
+
+		template<typename N>
+		N num() {
+			N out = 0;
+			if(End - Ptr < static_cast<std::ptrdiff_t>(sizeof(N))) {
+				Ok = false;
+				return out;
+			}
+			std::memcpy(&out, Ptr, sizeof(N));
+			Ptr += sizeof(N);
+			return out;
+		}
+
+		std::string str() {
+			const auto size = num<uint16_t>();
+			if(End - Ptr < size) {
+				Ok = false;
+				return "";
+			}
+			std::string out(Ptr, size);
+			Ptr += size;
+			return out;
+		}
+	};
+
+} // namespace SBCQueens
@@ -17,7 +17,9 @@
 #include <CAENDigitizer.h>
 
 // my includes
-
+#include "roi_codec.h"
+#include "sbc_columnar.h"
+#include "time_tag.h"
 
 namespace SBCQueens {
 
@@ -50,6 +52,9 @@ namespace SBCQueens {
 
 		float NLOCToRecordLength = 1;
 
+		// In s per count of the trigger time tag
+		double TimeTagPeriod = 8e-9;
+
 		std::vector<double> VoltageRanges;
 	};
 
@@ -72,6 +77,7 @@ namespace SBCQueens {
 				.NumberOfGroups = 0,
 				.NumChannelsPerGroup = 8,
 				.NLOCToRecordLength = 10,
+				.TimeTagPeriod = 8e-9,
 				.VoltageRanges = {0.5, 2.0}
 			}},
 			{CAENDigitizerModel::DT5740D, CAENDigitizerModelConstants{
@@ -82,6 +88,7 @@ namespace SBCQueens {
 				.NumberOfGroups = 4,
 				.NumChannelsPerGroup = 8,
 				.NLOCToRecordLength = 1.5,
+				.TimeTagPeriod = 16e-9,
 				.VoltageRanges = {2.0, 10.0}
 			}}
 	};
@@ -262,6 +269,9 @@ private:
 		CAENGlobalConfig GlobalConfig;
 		std::map<uint8_t, CAENGroupConfig> GroupConfigs;
 		uint32_t CurrentMaxBuffers;
+		// The run constants saved in every line of the SBC files, made
+		// once per file by sbc_init_file(...) so the saves only copy them
+		std::string RunConstants;
 
 		CAEN_DGTZ_ConnectionType ConnectionType;
 		int LinkNum;
@@ -283,6 +293,10 @@ private:
 			return ModelConstants.AcquisitionRate;
 		}
 
+		uint32_t GetADCResolution() const {
+			return ModelConstants.ADCResolution;
+		}
+
 		uint32_t GetMemoryPerChannel() const {
 			return ModelConstants.MemoryPerChannel;
 		}
@@ -311,6 +325,10 @@ private:
 			return ModelConstants.NLOCToRecordLength;
 		}
 
+		double GetTimeTagPeriod() const {
+			return ModelConstants.TimeTagPeriod;
+		}
+
 		// Returns the channel voltage range. If channel does not exist
 		// returns 0
 		double GetVoltageRange(int ch) const {
@@ -499,13 +517,198 @@ private:
 	//
 	/// File functions
 
+	// How the sipm_traces are stored in the file.
+	enum class SBCTraceEncoding {
+		// uint16 per sample
+		Raw = 0,
+		// Lossless, see trace_codec.h. Each line has the sipm_traces
+		// as a uint32 with the number of bytes followed by the bitpack16
+		// data of every channel
+		BitPacked,
+		// Lossy, see roi_codec.h. Only the regions around pulses are
+		// kept. Same line layout as BitPacked, with roi16 data.
+		ROI
+	};
+
+	// This is here so we can transform string to enums
+	const std::unordered_map<std::string, SBCTraceEncoding>
+		SBCTraceEncoding_map {
+			{"Raw", SBCTraceEncoding::Raw},
+			{"BitPacked", SBCTraceEncoding::BitPacked},
+			{"ROI", SBCTraceEncoding::ROI}
+	};
+
+	// How the events are laid out in the file.
+	enum class SBCFileLayout {
+		// One line per event, see sbc_save_func
+		Rows = 0,
+		// Chunks of events saved column by column, see sbc_columnar.h
+		Columnar
+	};
+
+	const std::unordered_map<std::string, SBCFileLayout>
+		SBCFileLayout_map {
+			{"Rows", SBCFileLayout::Rows},
+			{"Columnar", SBCFileLayout::Columnar}
+	};
+
+	// Options of the SBC binary file that can change between runs
+	struct SBCFileConfig {
+		SBCTraceEncoding TraceEncoding = SBCTraceEncoding::Raw;
+		// Only used if TraceEncoding = ROI
+		ROIConfig ROI;
+
+		// An index entry is saved every IndexInterval events at the end
+		// of the file. 0 = no index. Only for the Rows layout.
+		uint32_t IndexInterval = 0;
+
+		SBCFileLayout Layout = SBCFileLayout::Rows;
+		// Events per chunk of the Columnar layout
+		uint32_t ChunkEvents = 1000;
+	};
+
+	// "SBCI" in little endian. Last 4 bytes of a file with an index.
+	constexpr uint32_t SBCIndexMagic = 0x49434253;
+
+	struct SBCIndexEntry {
+		// Event number in this file, starting from 0
+		uint64_t Event = 0;
+		// Byte where its line starts. If the file is saved in blocks,
+		// the block headers are not counted.
+		uint64_t Offset = 0;
+		// Unwrapped trigger time tag
+		uint64_t TimeStamp = 0;
+	};
+
+	// Index of a SBC binary file. Saved as a footer after the last line:
+	//
+	// SBCIndexEntry[n] 	(3 uint64 each)
+	// uint64 				n
+	// uint64 				number of events
+	// uint32 				interval
+	// uint32 				"SBCI"
+	struct SBCFileIndex {
+		uint32_t Interval = 0;
+		uint64_t NumEvents = 0;
+		std::vector<SBCIndexEntry> Entries;
+		TimeTagUnwrapper Unwrapper;
+
+		void reset() noexcept {
+			NumEvents = 0;
+			Entries.clear();
+			Unwrapper.reset();
+		}
+	};
+
+	// Size in bytes of the footer (without entries)
+	constexpr size_t SBCIndexTrailerSize = 2*sizeof(uint64_t)
+		+ 2*sizeof(uint32_t);
+
 	// Saves the digitizer data in the Binary format SBC collboration is using
 	// This only writes the header at the beginning of the file.
 	// Meant to be written once.
-	std::string sbc_init_file(CAEN&) noexcept;
+	std::string sbc_init_file(CAEN&, const SBCFileConfig&) noexcept;
 
 	// Saves the digitizer data in the Binary format SBC collboration is using
-	std::string sbc_save_func(CAENEvent& evt, CAEN& res) noexcept;
+	std::string sbc_save_func(CAENEvent& evt, CAEN& res,
+		const SBCFileConfig& config) noexcept;
+
+	// Adds evt, whose line starts at offset, to the index.
+	// Call it once per event in the same order they are saved.
+	void sbc_index_event(SBCFileIndex& index, const CAENEvent& evt,
+		const uint64_t& offset) noexcept;
+
+	// Returns the footer with the index to be written after the last line.
+	// Empty if the index interval is 0.
+	std::string sbc_index_footer(const SBCFileIndex& index) noexcept;
+
+	// Writes the real number of lines in the header of a closed file.
+	// Returns false if it could not, ex: if the file is compressed or
+	// there are more lines than what an int32 can hold.
+	bool sbc_finalize_file(const std::string& fileName,
+		const uint64_t& numEvents) noexcept;
+
+	// Reads the index footer of an uncompressed SBC binary file.
+	// Returns false if there is none.
+	bool sbc_read_index(const std::string& fileName,
+		SBCFileIndex& index) noexcept;
+
+	// Events of the chunk being filled and the directory of a columnar
+	// file. One per file.
+	struct SBCColumnarChunk {
+		uint64_t NumEvents = 0;
+		uint64_t EventsInChunk = 0;
+		uint64_t FirstTime = 0;
+		uint64_t LastTime = 0;
+		// One buffer per column that is not a run constant
+		std::vector<std::string> Columns;
+		std::vector<SBCChunkEntry> Directory;
+		TimeTagUnwrapper Unwrapper;
+
+		void reset() noexcept {
+			NumEvents = 0;
+			EventsInChunk = 0;
+			Columns.clear();
+			Directory.clear();
+			Unwrapper.reset();
+		}
+	};
+
+	// Header and run constants of a columnar file (see sbc_columnar.h)
+	// Meant to be written once.
+	std::string sbc_columnar_init_file(CAEN&, const SBCFileConfig&) noexcept;
+
+	// Adds evt to the chunk. Once the chunk has config.ChunkEvents, it
+	// returns it to be saved at offset (bytes written so far), otherwise
+	// it returns an empty string.
+	std::string sbc_columnar_save_func(SBCColumnarChunk& chunk,
+		CAENEvent& evt, CAEN& res, const SBCFileConfig& config,
+		const uint64_t& offset) noexcept;
+
+	// Returns the events left in chunk and the directory, to be written
+	// at offset (bytes written so far) as the end of the file.
+	std::string sbc_columnar_footer(SBCColumnarChunk& chunk,
+		const uint64_t& offset) noexcept;
+
+	// Largest distance of any sample of evt from the baseline of its
+	// trace (mean of its first baselineSamples), in ADC counts
+	uint16_t event_max_amplitude(CAENEvent& evt, CAEN& res,
+		const uint32_t& baselineSamples) noexcept;
+
+	// Numbers of the channels that are saved in every event
+	std::vector<uint8_t> enabled_channels(CAEN& res) noexcept;
+
+	// Calls f(ch, data, size) with the trace of every enabled channel of
+	// evt, where ch is the channel number
+	template<typename Func>
+	void sbc_for_each_channel(CAENEvent& evt, CAEN& res, Func f) noexcept {
+		const uint8_t ch_per_group = res->GetNumberOfChannelsPerGroup();
+		const bool has_groups = res->GetNumberOfGroups() > 0;
+
+		auto& evtdata = evt->Data;
+		for(auto gr_pair : res->GroupConfigs){
+			auto gr = gr_pair.second.Number;
+
+			if(has_groups){
+				for(int ch = 0; ch < ch_per_group; ch++) {
+					if (gr_pair.second.AcquisitionMask & (1<<ch)){
+						const int n = gr*ch_per_group + ch;
+						f(static_cast<uint8_t>(n), evtdata->DataChannel[n],
+							evtdata->ChSize[n]);
+					}
+				}
+			} else {
+				if(evtdata->ChSize[gr] > 0) {
+					f(static_cast<uint8_t>(gr), evtdata->DataChannel[gr],
+						evtdata->ChSize[gr]);
+				}
+			}
+		}
+	}
+
+	// Hash of everything in the digitizer configuration that changes the
+	// data, ex: to find runs with the same configuration.
+	uint64_t caen_config_hash(CAEN& res) noexcept;
 
 	/// End File functions
 
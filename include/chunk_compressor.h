@@ -0,0 +1,170 @@
+#pragma once
+
+/*
+
+	Parallel chunked zstd compression.
+
+	Everything written is cut into chunks of ChunkSize bytes. Each chunk
+	is compressed as an independent zstd frame by a pool of worker
+	threads and the frames are written in order through the sink
+	function. When closed, a zstd skippable frame with the index of all
+	the chunks is added at the end:
+
+		uint32 			0x184D2A50 (skippable frame magic)
+		uint32 			size of what follows
+		CompressedChunk[n]
+		uint32 			n
+		uint32 			"SBCZ"
+
+	As the file is just a list of zstd frames, "zstd -d file.zst" gives
+	back the original file. The index lets a reader jump to any chunk
+	without decompressing everything before it.
+
+*/
+
+// STD includes
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace SBCQueens {
+
+	struct CompressionConfig {
+		// zstd compression level. 1 to 3 are fast enough for all our
+		// data rates, higher levels are much slower for a little gain.
+		int Level = 3;
+
+		// Uncompressed size of each chunk. Bigger chunks compress better
+		// but more data is lost if the program crashes.
+		size_t ChunkSize = 4 << 20;
+
+		// Number of worker threads, 0 = one per core
+		unsigned int NumThreads = 0;
+	};
+
+	// Where each chunk is. Offsets are from the start of the file.
+	struct CompressedChunk {
+		uint64_t Offset = 0;
+		uint64_t CompressedSize = 0;
+		uint64_t UncompressedOffset = 0;
+		uint64_t UncompressedSize = 0;
+	};
+
+	// "SBCZ" in little endian. Last 4 bytes of a file with an index
+	constexpr uint32_t SBCZIndexMagic = 0x5A434253;
+	// zstd skippable frame magic number, decoders ignore these frames
+	constexpr uint32_t ZSTDSkippableMagic = 0x184D2A50;
+
+	// What happened during the life of a compressor
+	struct CompressionReport {
+		uint64_t BytesIn = 0;
+		uint64_t BytesOut = 0;
+		uint64_t NumChunks = 0;
+		unsigned int NumThreads = 0;
+		// Sum of the time every thread spent compressing
+		double CompressionSeconds = 0.0;
+
+		double Ratio() const {
+			return BytesOut > 0 ? static_cast<double>(BytesIn) / BytesOut : 0.0;
+		}
+
+		// Speed of a single thread in MB/s. All threads together
+		// can do NumThreads times this.
+		double ThreadThroughput() const {
+			return CompressionSeconds > 0.0 ?
+				BytesIn / CompressionSeconds / 1e6 : 0.0;
+		}
+	};
+
+	class chunkCompressor {
+		using SinkFunc = std::function<void(const char*, const size_t&)>;
+
+		struct job {
+			uint64_t Number = 0;
+			uint64_t UncompressedOffset = 0;
+			std::string Data;
+		};
+
+		std::string _name;
+		CompressionConfig _config;
+		SinkFunc _sink;
+
+		bool _open;
+		// Read by HasError() from any thread
+		std::atomic<bool> _error;
+
+		// Chunk being filled by write(...)
+		std::string _current;
+		uint64_t _bytesIn;
+		uint64_t _nextNumber;
+
+		// All protected by _mutex
+		std::deque<job> _jobs;
+		std::map<uint64_t, std::pair<job, std::string>> _done;
+		size_t _inFlight;
+		bool _stop;
+		double _compressionSeconds;
+
+		std::mutex _mutex;
+		std::condition_variable _cv;
+
+		// Only touched by whoever holds _outMutex
+		uint64_t _nextOut;
+		uint64_t _outOffset;
+		std::vector<CompressedChunk> _index;
+		std::mutex _outMutex;
+
+		std::vector<std::thread> _workers;
+
+		void worker_loop();
+		void write_ready();
+		void submit_current();
+
+public:
+		// sink: function that writes to the actual file, it is called from
+		// the worker threads but never by two of them at the same time.
+		// name: used for the logs
+		// startOffset: size of the file before anything is written
+		chunkCompressor(SinkFunc sink, const std::string& name,
+			const uint64_t& startOffset,
+			const CompressionConfig& config = CompressionConfig());
+
+		// No copying nor moving
+		chunkCompressor(chunkCompressor&&) = delete;
+		chunkCompressor(const chunkCompressor&) = delete;
+
+		~chunkCompressor();
+
+		bool IsOpen() const { return _open; }
+
+		bool HasError() const { return _error; }
+
+		// Copies data into the current chunk. Only blocks if the workers
+		// have too many chunks waiting.
+		void write(const char* data, const size_t& size);
+
+		// Waits until every full chunk is written. The current chunk
+		// stays in memory so flushing often does not ruin the ratio.
+		void flush();
+
+		// Compresses and writes everything left, adds the index and
+		// logs the report.
+		void close();
+
+		CompressionReport GetReport();
+	};
+
+	// Reads the chunk index at the end of fileName.
+	// Returns an empty vector if the file has no index.
+	std::vector<CompressedChunk> read_chunk_index(
+		const std::string& fileName) noexcept;
+
+} // namespace SBCQueens
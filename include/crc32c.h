@@ -0,0 +1,153 @@
+#pragma once
+
+/*
+
+	CRC32C (Castagnoli), the same one used by iSCSI, ext4 and zstd.
+
+	In x86-64 it uses the SSE4.2 crc32 instruction if the CPU has it,
+	which is checked once at run time so it does not need any compiler
+	flags. Otherwise, or in other CPUs, it uses a table 8 bytes at a time.
+
+		uint32_t crc = crc32c(data, size);
+		// or in pieces
+		crc = crc32c(more_data, more_size, crc);
+
+*/
+
+// STD includes
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define SBC_CRC32C_X86
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define SBC_CRC32C_X86
+#endif
+
+namespace SBCQueens {
+
+	namespace crc32c_internal {
+
+		constexpr uint32_t Polynomial = 0x82F63B78;
+
+		// table[k][b] = crc of byte b followed by k zero bytes
+		constexpr std::array<std::array<uint32_t, 256>, 8> make_tables() {
+			std::array<std::array<uint32_t, 256>, 8> table = {};
+			for(uint32_t b = 0; b < 256; b++) {
+				uint32_t crc = b;
+				for(int i = 0; i < 8; i++) {
+					crc = (crc >> 1) ^ (crc & 1 ? Polynomial : 0);
+				}
+				table[0][b] = crc;
+			}
+
+			for(uint32_t b = 0; b < 256; b++) {
+				for(size_t k = 1; k < 8; k++) {
+					const uint32_t prev = table[k - 1][b];
+					table[k][b] = (prev >> 8) ^ table[0][prev & 0xFF];
+				}
+			}
+
+			return table;
+		}
+
+		inline constexpr auto Tables = make_tables();
+
+		inline uint32_t software(uint32_t crc, const char* data,
+			size_t size) noexcept {
+			auto ptr = reinterpret_cast<const uint8_t*>(data);
+
+			while(size >= 8) {
+				uint64_t word;
+				std::memcpy(&word, ptr, sizeof(word));
+				word ^= crc;
+				crc = Tables[7][word & 0xFF]
+					^ Tables[6][(word >> 8) & 0xFF]
+					^ Tables[5][(word >> 16) & 0xFF]
+					^ Tables[4][(word >> 24) & 0xFF]
+					^ Tables[3][(word >> 32) & 0xFF]
+					^ Tables[2][(word >> 40) & 0xFF]
+					^ Tables[1][(word >> 48) & 0xFF]
+					^ Tables[0][word >> 56];
+				ptr += 8;
+				size -= 8;
+			}
+
+			while(size-- > 0) {
+				crc = (crc >> 8) ^ Tables[0][(crc ^ *ptr++) & 0xFF];
+			}
+
+			return crc;
+		}
+
+#ifdef SBC_CRC32C_X86
+#ifndef _MSC_VER
+		__attribute__((target("sse4.2")))
+#endif
+		inline uint32_t hardware(uint32_t crc, const char* data,
+			size_t size) noexcept {
+			uint64_t crc64 = crc;
+			while(size >= 8) {
+				uint64_t word;
+				std::memcpy(&word, data, sizeof(word));
+				crc64 = _mm_crc32_u64(crc64, word);
+				data += 8;
+				size -= 8;
+			}
+
+			crc = static_cast<uint32_t>(crc64);
+			while(size-- > 0) {
+				crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*data++));
+			}
+
+			return crc;
+		}
+
+		inline bool has_hardware() noexcept {
+			static const bool has = []() {
+#ifdef _MSC_VER
+				int info[4];
+				__cpuid(info, 1);
+				return (info[2] & (1 << 20)) != 0;
+#else
+				unsigned int eax, ebx, ecx, edx;
+				if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+					return false;
+				}
+				return (ecx & bit_SSE4_2) != 0;
+#endif
+			}();
+
+			return has;
+		}
+#endif
+
+	} // namespace crc32c_internal
+
+	// True if crc32c(...) uses the CPU instruction
+	inline bool crc32c_is_hardware() noexcept {
+#ifdef SBC_CRC32C_X86
+		return crc32c_internal::has_hardware();
+#else
+		return false;
+#endif
+	}
+
+	// CRC32C of size bytes of data. Pass the crc of the previous
+	// data to continue it.
+	inline uint32_t crc32c(const char* data, const size_t& size,
+		const uint32_t& crc = 0) noexcept {
+#ifdef SBC_CRC32C_X86
+		if(crc32c_internal::has_hardware()) {
+			return ~crc32c_internal::hardware(~crc, data, size);
+		}
+#endif
+		return ~crc32c_internal::software(~crc, data, size);
+	}
+
+} // namespace SBCQueens
@@ -0,0 +1,232 @@
+#pragma once
+
+/*
+
+	Optical crosstalk and afterpulse probabilities of every channel,
+	from the pulses found while taking data (see pulse_finder.h).
+
+	- Crosstalk: the dark pulses (the ones between the baseline and the
+	trigger, see dark_count.h) start as 1 PE, so the ones of 2 PE or
+	more fired other cells. Their integrals go to a histogram and, with
+	the gain and pedestal of the PE spectrum (pe_spectrum.h),
+
+		crosstalk = N(>= 1.5 PE) / N(>= 0.5 PE)
+
+	with a binomial error.
+
+	- Afterpulses: every 1 PE pulse of a trace is a primary, and the
+	delays of the pulses after it in the same trace go to a histogram
+	in [MinDelay, MaxDelay) samples. Each primary can only see the
+	delays that fit in the rest of its trace, so it is counted in the
+	bins it could see (its exposure). The counts are fitted to
+
+		exposure*(r w + P (e^-t/tau - e^-(t + w)/tau))
+
+	per bin of width w that starts at t: the dark pulses at random (r
+	per sample) and P afterpulses per primary with time constant tau.
+	It is a poisson likelihood: for every tau of a grid r and P are
+	found by EM and then the best tau is refined. The errors come from
+	the inverse of the Fisher matrix. P counts the afterpulses of the
+	afterpulses too: if each pulse makes one with probability p, P is
+	p/(1 - p), and tau comes out a little longer.
+
+	- Afterpulses of the triggers: if the digitizer triggers on the
+	dark pulses, the time between triggers is exponential (rate R)
+	except for the ones that come from the one before. Of the times
+	longer than the dead time (the record length), the fraction shorter
+	than TriggerWindow more than the exponential says is the
+	probability that a trigger makes another one.
+
+	Everything is kept in fixed histograms and sums, so the memory does
+	not grow with the run. Every FitSeconds they are copied and fitted
+	in another thread, same as pe_spectrum.h:
+
+		crosstalkEstimator crosstalk;
+		crosstalk.configure(config, trace, record_length);
+		crosstalk.add(ttt, pulses, num_pulses); 	// O(pulses)
+		crosstalk.set_gains(pe_spectrum.GetFits()); 	// when there are new
+		if(crosstalk.update()) {
+			crosstalk.GetResults();
+		}
+
+	The pulses of each channel have to be in the order they are in the
+	trace, as find_pulses(...) gives them.
+
+*/
+
+// STD includes
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+// my includes
+#include "dark_count.h"
+#include "pe_spectrum.h"
+#include "pulse_finder.h"
+#include "time_tag.h"
+
+namespace SBCQueens {
+
+	struct CrosstalkConfig {
+		bool Enabled = false;
+		// Of the integrals, counts*samples. 0 = from the PE spectrum fits
+		double Gain = 0.0;
+		double Pedestal = 0.0;
+		// Integrals of the dark pulses in [0, MaxCharge) in NumBins bins
+		double MaxCharge = 2000.0;
+		uint32_t NumBins = 500;
+		// Delays of the afterpulses, in samples. Closer than MinDelay the
+		// pulse finder cannot tell two pulses apart.
+		uint32_t MinDelay = 10;
+		uint32_t MaxDelay = 1000;
+		uint32_t DelayBins = 100;
+		// Triggers closer than this (s) after the dead time can be
+		// afterpulses
+		double TriggerWindow = 1e-5;
+		// Time between fits
+		double FitSeconds = 10.0;
+		// Primaries a channel needs for its afterpulse fit
+		uint64_t MinPrimaries = 1000;
+	};
+
+	// Fit of the delays, in samples
+	struct AfterpulseFit {
+		// Per primary
+		double Probability = 0.0;
+		double ProbabilityError = 0.0;
+		double Tau = 0.0;
+		double TauError = 0.0;
+		// Of the dark pulses, per sample
+		double DarkRate = 0.0;
+
+		bool IsValid() const { return Tau > 0.0; }
+	};
+
+	// Fits the counts of DelayBins bins of width binWidth that start at
+	// minDelay, each seen by exposure primaries
+	AfterpulseFit fit_afterpulses(const std::vector<uint64_t>& counts,
+		const std::vector<double>& exposure, const double& minDelay,
+		const double& binWidth) noexcept;
+
+	struct CrosstalkResult {
+		uint8_t Channel = 0;
+
+		// Dark pulses of 1 PE or more, 0 without a gain
+		uint64_t DarkPulses = 0;
+		double Crosstalk = 0.0;
+		double CrosstalkError = 0.0;
+
+		// 1 PE pulses that were followed. Tau in s.
+		uint64_t Primaries = 0;
+		double Afterpulse = 0.0;
+		double AfterpulseError = 0.0;
+		double AfterpulseTau = 0.0;
+		double AfterpulseTauError = 0.0;
+
+		bool HasCrosstalk() const { return DarkPulses > 0; }
+		bool HasAfterpulse() const { return AfterpulseTau > 0.0; }
+	};
+
+	struct TriggerAfterpulse {
+		// Times between triggers longer than the dead time
+		uint64_t Intervals = 0;
+		// That a trigger comes from the one before it
+		double Probability = 0.0;
+		double Error = 0.0;
+		// Of the ones at random, in Hz
+		double Rate = 0.0;
+
+		bool IsValid() const { return Rate > 0.0; }
+	};
+
+	class crosstalkEstimator {
+		using clock = std::chrono::steady_clock;
+
+		struct channelData {
+			// NumBins and the overflow
+			std::vector<uint64_t> Charges;
+			std::vector<uint64_t> Delays;
+			// How many primaries could see up to bin k (not included)
+			std::vector<uint64_t> ExposureEnds;
+			uint64_t Primaries = 0;
+			double Gain = 0.0;
+			double Pedestal = 0.0;
+		};
+
+		struct triggerSums {
+			uint64_t Short = 0;
+			uint64_t Long = 0;
+			// Of the long ones, minus the dead time and the window, in s
+			double LongTime = 0.0;
+		};
+
+		CrosstalkConfig _config;
+		DarkCountTrace _trace;
+		uint32_t _recordLength = 0;
+		double _chargeBinWidth = 1.0;
+		double _delayBinWidth = 1.0;
+		// Index of each channel number in Channels, -1 if not there
+		std::vector<int> _channelIndex;
+		std::vector<channelData> _channels;
+
+		TimeTagUnwrapper _unwrapper;
+		bool _hasLastTrigger = false;
+		uint64_t _lastTrigger = 0;
+		triggerSums _triggers;
+
+		std::future<std::pair<std::vector<CrosstalkResult>,
+			TriggerAfterpulse>> _fitting;
+		clock::time_point _lastFit;
+		std::vector<CrosstalkResult> _results;
+		TriggerAfterpulse _triggerResult;
+
+		void add_trigger(const uint32_t& ttt) noexcept;
+		void start_fit();
+
+public:
+		crosstalkEstimator() = default;
+
+		// No copying, it could be fitting
+		crosstalkEstimator(const crosstalkEstimator&) = delete;
+
+		// Anything added is lost. trace is the same as the one of the
+		// dark count.
+		void configure(const CrosstalkConfig& config,
+			const DarkCountTrace& trace, const uint32_t& recordLength);
+
+		// Empties everything and forgets the fits, keeps the gains
+		void reset();
+
+		bool IsEnabled() const { return _config.Enabled; }
+
+		// Gains and pedestals of the channels with a good fit. Only if
+		// they are not in the config.
+		void set_gains(const std::vector<PESpectrumFit>& fits) noexcept;
+
+		// Adds an event with trigger time tag ttt and all its pulses
+		void add(const uint32_t& ttt, const SiPMPulse* pulses,
+			const size_t& numPulses) noexcept;
+
+		// Picks up the fits if they are done and starts new ones if it
+		// is time. Returns true if there are new fits.
+		bool update();
+
+		// Waits for the fits running and fits everything added until now
+		void finish();
+
+		// Of every channel, in the order of Channels
+		const std::vector<CrosstalkResult>& GetResults() const {
+			return _results;
+		}
+
+		const TriggerAfterpulse& GetTriggerAfterpulse() const {
+			return _triggerResult;
+		}
+
+		// Means of the channels that have them, 0 if none
+		double GetCrosstalk() const;
+		double GetAfterpulse() const;
+	};
+
+} // namespace SBCQueens
@@ -0,0 +1,284 @@
+#pragma once
+
+/*
+
+	Dark count rate (DCR) of the SiPMs from the pulses of every event.
+
+	The pulse that triggered and whatever follows it (afterpulses,
+	crosstalk) are not dark counts, so only the pulses that start in the
+	pre-trigger region are counted: after the samples used for the
+	baseline and up to GuardSamples before the trigger. While a pulse
+	is over threshold no other can be found, so the samples it takes
+	from the region are not live time:
+
+		live time = (region samples - samples inside pulses)*sample period
+		DCR = pulses / live time
+		error = sqrt(pulses) / live time
+
+	Events are placed in time with their unwrapped trigger time tags,
+	which also give the trigger rate over the real (digitizer) time.
+	The totals of the run and the last WindowSeconds, in bins of
+	BinSeconds, are kept per channel, so the memory does not grow with
+	the run.
+
+		darkCountEstimator dcr;
+		dcr.configure(config, trace);
+		dcr.add(evt->Info.TriggerTimeTag, pulses);
+		dcr.GetWindowRate(); 	// mean of the channels, last WindowSeconds
+
+	A roll over of the time tag is missed if two triggers are more than
+	one period (~17 s in the x730) apart, see TimeTagUnwrapper.
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// my includes
+#include "pulse_finder.h"
+#include "time_tag.h"
+
+namespace SBCQueens {
+
+	struct DarkCountConfig {
+		// Samples before the trigger that are not used
+		uint32_t GuardSamples = 10;
+		// For the trend, the last WindowSeconds in bins of BinSeconds
+		double WindowSeconds = 60.0;
+		double BinSeconds = 1.0;
+	};
+
+	// What the traces look like
+	struct DarkCountTrace {
+		// Channel numbers saved in every event
+		std::vector<uint8_t> Channels;
+		// Pulses that start in [WindowStart, WindowEnd) are counted
+		uint32_t WindowStart = 0;
+		uint32_t WindowEnd = 0;
+		// In s
+		double SamplePeriod = 1.0;
+		double TimeTagPeriod = 8e-9;
+	};
+
+	struct DarkCountRate {
+		uint64_t Counts = 0;
+		// In s
+		double LiveTime = 0.0;
+		// In Hz
+		double Rate = 0.0;
+		double Error = 0.0;
+	};
+
+	class darkCountEstimator {
+		DarkCountConfig _config;
+		DarkCountTrace _trace;
+		// Index of each channel number in Channels, -1 if not there
+		std::vector<int> _channelIndex;
+
+		// Whole run per channel, live time in samples
+		std::vector<uint64_t> _counts;
+		std::vector<uint64_t> _live;
+		// Of the event being added
+		std::vector<uint64_t> _eventLive;
+
+		// Ring of bins x channels and which bin (in time) each one is
+		size_t _numBins = 1;
+		std::vector<uint64_t> _binCounts;
+		std::vector<uint64_t> _binLive;
+		std::vector<int64_t> _binTime;
+		int64_t _lastBin = 0;
+
+		TimeTagUnwrapper _unwrapper;
+		uint64_t _numEvents = 0;
+		uint64_t _firstTime = 0;
+		uint64_t _lastTime = 0;
+
+		DarkCountRate make_rate(const uint64_t& counts,
+			const uint64_t& live) const noexcept {
+			DarkCountRate rate;
+			rate.Counts = counts;
+			rate.LiveTime = live*_trace.SamplePeriod;
+			if(rate.LiveTime > 0.0) {
+				rate.Rate = counts / rate.LiveTime;
+				// So nothing seen is not 0 +- 0
+				rate.Error = std::sqrt(std::max<double>(counts, 1.0))
+					/ rate.LiveTime;
+			}
+			return rate;
+		}
+
+		// Sums of channel k (or all of them if k < 0) of the bins in the
+		// window
+		void window_sums(const int& k, uint64_t& counts,
+			uint64_t& live) const noexcept {
+			counts = 0;
+			live = 0;
+			const size_t num_ch = _trace.Channels.size();
+			for(size_t b = 0; b < _numBins; b++) {
+				if(_binTime[b] < 0
+					|| _lastBin - _binTime[b] >= static_cast<int64_t>(_numBins)) {
+					continue;
+				}
+
+				for(size_t c = 0; c < num_ch; c++) {
+					if(k < 0 || static_cast<size_t>(k) == c) {
+						counts += _binCounts[b*num_ch + c];
+						live += _binLive[b*num_ch + c];
+					}
+				}
+			}
+		}
+
+public:
+		darkCountEstimator() = default;
+
+		// Anything added is lost
+		void configure(const DarkCountConfig& config,
+			const DarkCountTrace& trace) {
+			_config = config;
+			_trace = trace;
+			_trace.WindowEnd = std::max(_trace.WindowStart, _trace.WindowEnd);
+
+			_channelIndex.assign(256, -1);
+			for(size_t c = 0; c < _trace.Channels.size(); c++) {
+				_channelIndex[_trace.Channels[c]] = static_cast<int>(c);
+			}
+
+			const size_t num_ch = _trace.Channels.size();
+			_counts.assign(num_ch, 0);
+			_live.assign(num_ch, 0);
+			_eventLive.assign(num_ch, 0);
+
+			_config.BinSeconds = _config.BinSeconds > 0.0 ?
+				_config.BinSeconds : 1.0;
+			_numBins = std::max<size_t>(1, static_cast<size_t>(std::ceil(
+				_config.WindowSeconds / _config.BinSeconds)));
+			_binCounts.assign(_numBins*num_ch, 0);
+			_binLive.assign(_numBins*num_ch, 0);
+			_binTime.assign(_numBins, -1);
+			reset();
+		}
+
+		// Starts over, ex: for a new run
+		void reset() noexcept {
+			std::fill(_counts.begin(), _counts.end(), 0);
+			std::fill(_live.begin(), _live.end(), 0);
+			std::fill(_binCounts.begin(), _binCounts.end(), 0);
+			std::fill(_binLive.begin(), _binLive.end(), 0);
+			std::fill(_binTime.begin(), _binTime.end(), -1);
+			_lastBin = 0;
+			_unwrapper.reset();
+			_numEvents = 0;
+			_firstTime = 0;
+			_lastTime = 0;
+		}
+
+		// Number of samples that are counted per trace
+		uint32_t GetWindowSamples() const {
+			return _trace.WindowEnd - _trace.WindowStart;
+		}
+
+		// Adds an event with trigger time tag ttt and all its pulses
+		void add(const uint32_t& ttt,
+			const std::vector<SiPMPulse>& pulses) noexcept {
+			add(ttt, pulses.data(), pulses.size());
+		}
+
+		void add(const uint32_t& ttt, const SiPMPulse* pulses,
+			const size_t& num_pulses) noexcept {
+			const size_t num_ch = _trace.Channels.size();
+			if(num_ch == 0 || GetWindowSamples() == 0) {
+				return;
+			}
+
+			const uint64_t time = _unwrapper(ttt);
+			if(_numEvents == 0) {
+				_firstTime = time;
+			}
+			_lastTime = time;
+			_numEvents++;
+
+			// Bin of this event, emptied if it had an older one
+			const auto bin = static_cast<int64_t>(time*_trace.TimeTagPeriod
+				/ _config.BinSeconds);
+			const size_t slot = static_cast<size_t>(bin % _numBins);
+			if(_binTime[slot] != bin) {
+				_binTime[slot] = bin;
+				std::fill_n(_binCounts.begin() + slot*num_ch, num_ch, 0);
+				std::fill_n(_binLive.begin() + slot*num_ch, num_ch, 0);
+			}
+			_lastBin = std::max(_lastBin, bin);
+
+			std::fill(_eventLive.begin(), _eventLive.end(),
+				GetWindowSamples());
+			for(size_t i = 0; i < num_pulses; i++) {
+				const auto& pulse = pulses[i];
+				const int k = _channelIndex[pulse.Channel];
+				if(k < 0) {
+					continue;
+				}
+
+				// The part of the region it takes is dead
+				const uint64_t start = std::max<uint64_t>(pulse.Start,
+					_trace.WindowStart);
+				const uint64_t end = std::min<uint64_t>(
+					uint64_t(pulse.Start) + pulse.Width, _trace.WindowEnd);
+				if(end > start) {
+					_eventLive[k] -= std::min(end - start, _eventLive[k]);
+				}
+
+				if(pulse.Start >= _trace.WindowStart
+					&& pulse.Start < _trace.WindowEnd) {
+					_counts[k]++;
+					_binCounts[slot*num_ch + k]++;
+				}
+			}
+
+			for(size_t k = 0; k < num_ch; k++) {
+				_live[k] += _eventLive[k];
+				_binLive[slot*num_ch + k] += _eventLive[k];
+			}
+		}
+
+		const std::vector<uint8_t>& GetChannels() const {
+			return _trace.Channels;
+		}
+
+		// Of the k-th channel of GetChannels() since the start
+		DarkCountRate GetRate(const size_t& k) const noexcept {
+			if(k >= _counts.size()) {
+				return DarkCountRate();
+			}
+			return make_rate(_counts[k], _live[k]);
+		}
+
+		// Of the k-th channel in the last WindowSeconds
+		DarkCountRate GetWindowRate(const size_t& k) const noexcept {
+			uint64_t counts, live;
+			window_sums(static_cast<int>(k), counts, live);
+			return make_rate(counts, live);
+		}
+
+		// Mean of all the channels in the last WindowSeconds
+		DarkCountRate GetWindowRate() const noexcept {
+			uint64_t counts, live;
+			window_sums(-1, counts, live);
+			return make_rate(counts, live);
+		}
+
+		// Time between the first and last trigger, in s
+		double GetElapsedTime() const noexcept {
+			return (_lastTime - _firstTime)*_trace.TimeTagPeriod;
+		}
+
+		// Triggers per second of digitizer time
+		double GetTriggerRate() const noexcept {
+			const double t = GetElapsedTime();
+			return t > 0.0 ? (_numEvents - 1) / t : 0.0;
+		}
+	};
+
+} // namespace SBCQueens
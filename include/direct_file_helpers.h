@@ -0,0 +1,132 @@
+#pragma once
+
+/*
+
+	Unbuffered (O_DIRECT) file writer.
+
+	The page cache is bypassed completely: data is copied into a small pool
+	of 4KiB aligned buffers, and a background thread writes each full buffer
+	with pwrite(...) at its final position in the file. The file is
+	preallocated in large extents with fallocate(...) so the filesystem does
+	not need to allocate blocks during the run.
+
+	Only Linux supports this. On any other platform the writer never opens
+	and dataFile falls back to the buffered std::ofstream.
+
+*/
+
+// STD includes
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace SBCQueens {
+
+	struct DirectIOConfig {
+		// O_DIRECT requires offsets, sizes and memory to be aligned to the
+		// logical block size of the device. 4KiB works for everything
+		// we have used so far.
+		size_t BlockSize = 4096;
+
+		// Size of each buffer in the pool. Must be a multiple of BlockSize
+		size_t BufferSize = 4 << 20;
+
+		// Number of buffers. While the writer thread is busy with one,
+		// the rest can be filled. If all are full, write(...) waits.
+		size_t NumBuffers = 4;
+
+		// The file is grown in extents of this size using fallocate(...)
+		// 0 disables preallocation.
+		uint64_t PreallocationSize = 256 << 20;
+	};
+
+	class directFileWriter {
+		struct buffer {
+			char* Data = nullptr;
+			size_t Size = 0;
+			uint64_t Offset = 0;
+		};
+
+		std::string _fileName;
+		DirectIOConfig _config;
+
+		int _fd;
+		bool _open;
+		// Read by HasError() from any thread
+		std::atomic<bool> _error;
+		bool _wasEmpty;
+
+		// Bytes that the file will have once everything is written
+		uint64_t _logicalSize;
+		// Position in the file where the current buffer starts
+		uint64_t _bufferOffset;
+		// How many bytes of the file are already preallocated
+		uint64_t _allocatedSize;
+
+		std::vector<char*> _pool;
+		buffer _current;
+
+		// Both protected by _mutex
+		std::deque<buffer> _free;
+		std::deque<buffer> _full;
+		bool _stop;
+		bool _busy;
+
+		std::mutex _mutex;
+		std::condition_variable _cv;
+		std::thread _writerThread;
+
+		void writer_loop();
+		bool write_buffer(const buffer& buf, const size_t& size);
+		void preallocate(const uint64_t& upTo);
+		void submit_current();
+
+public:
+		// fileName: relative or absolute file dir. If the file already
+		// exists, new data is appended to it.
+		directFileWriter(const std::string& fileName,
+			const DirectIOConfig& config = DirectIOConfig());
+
+		// No copying nor moving
+		directFileWriter(directFileWriter&&) = delete;
+		directFileWriter(const directFileWriter&) = delete;
+
+		~directFileWriter();
+
+		bool IsOpen() const { return _open; }
+
+		// True if there was an error while writing. The writer keeps
+		// accepting data, but nothing else gets to the disk.
+		bool HasError() const { return _error; }
+
+		// True if the file did not exist or had nothing in it when opened
+		bool WasEmpty() const { return _wasEmpty; }
+
+		// Size the file will have after close()
+		uint64_t Size() const { return _logicalSize; }
+
+		// Copies data into the buffer pool. Only blocks if all the
+		// buffers are waiting to be written.
+		void write(const char* data, const size_t& size);
+
+		// Waits until all full buffers are on disk. The unaligned tail
+		// stays in memory until close() as O_DIRECT cannot write it
+		// without padding.
+		void flush();
+
+		// Writes everything left, including the unaligned tail, trims
+		// the preallocated space and closes the file.
+		void close();
+	};
+
+	// Asks the OS to write everything it holds of fileName to disk
+	// (fsync). Meant for files that are already closed.
+	// Returns false if the file could not be opened or synced.
+	bool sync_file(const std::string& fileName) noexcept;
+
+} // namespace SBCQueens
@@ -0,0 +1,97 @@
+#pragma once
+
+/*
+
+	What the analysis threads (see analysis_executor.h) work on: a copy
+	of the traces of some events, and the pulses and filtered pulses
+	found in them. It sits between the digitizer (caen_helper.h) and the
+	analysis (pulse_finder.h, optimal_filter.h, baseline_tracker.h...),
+	so neither of them depends on the other.
+
+		auto batch = executor.get_batch();
+		batch_add_event(*batch, evt, Port); 	// the CAEN thread
+		batch_pulses(*batch, config, baselines); 	// any thread
+		batch_filter(*batch, filters, workspace);
+
+*/
+
+// STD includes
+#include <cstdint>
+#include <vector>
+
+// my includes
+#include "baseline_tracker.h"
+#include "caen_helper.h"
+#include "optimal_filter.h"
+#include "pulse_finder.h"
+
+namespace SBCQueens {
+
+	// Adds the pulses of every enabled channel of evt to out and returns
+	// how many. The polarity of the pulses is the one of the trigger.
+	uint32_t event_pulses(CAENEvent& evt, CAEN& res,
+		const PulseFinderConfig& config,
+		std::vector<SiPMPulse>& out) noexcept;
+
+	// Polarity of the pulses, the same as the trigger
+	PulsePolarity pulse_polarity(CAEN& res) noexcept;
+
+	// Copy of the traces of some events, so they can be analyzed in other
+	// threads (see analysis_executor.h) while the digitizer reuses them.
+	// clear() keeps the memory, so a reused batch does not allocate.
+	struct EventBatch {
+		struct Trace {
+			uint8_t Channel = 0;
+			uint32_t Size = 0;
+			// In Samples
+			size_t Offset = 0;
+			// The one of the pulses, filled by batch_pulses(...)
+			float Baseline = 0.0f;
+		};
+
+		struct Event {
+			uint32_t TriggerTimeTag = 0;
+			// Its traces in Traces and its pulses in Pulses
+			uint32_t FirstTrace = 0;
+			uint32_t NumTraces = 0;
+			uint32_t FirstPulse = 0;
+			uint32_t NumPulses = 0;
+		};
+
+		std::vector<Event> Events;
+		std::vector<Trace> Traces;
+		std::vector<uint16_t> Samples;
+		// Filled by batch_pulses(...)
+		std::vector<SiPMPulse> Pulses;
+		// One per trace, filled by batch_filter(...)
+		std::vector<FilteredPulse> Filtered;
+
+		const uint16_t* data(const Trace& trace) const {
+			return Samples.data() + trace.Offset;
+		}
+
+		void clear() noexcept {
+			Events.clear();
+			Traces.clear();
+			Samples.clear();
+			Pulses.clear();
+			Filtered.clear();
+		}
+	};
+
+	// Copies the traces of every enabled channel of evt to the batch
+	void batch_add_event(EventBatch& batch, CAENEvent& evt,
+		CAEN& res) noexcept;
+
+	// Finds the pulses of every event of the batch. Unlike event_pulses,
+	// the polarity is the one of config. The baseline of each trace is
+	// the one of baselines if it has it, or the one of the pulse finder.
+	void batch_pulses(EventBatch& batch, const PulseFinderConfig& config,
+		const baselineTracker& baselines) noexcept;
+
+	// Filters every trace of the batch with the filter of its channel.
+	// The baseline is the one of batch_pulses(...).
+	void batch_filter(EventBatch& batch, const OptimalFilters& filters,
+		OptimalFilterWorkspace& workspace) noexcept;
+
+} // namespace SBCQueens
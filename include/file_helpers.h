@@ -1,6 +1,7 @@
 #pragma once
 
 // STD includes
+#include <algorithm>
 #include <atomic>
 #include <exception>
 #include <fstream>
@@ -10,13 +11,45 @@
 #include <string>
 #include <type_traits>
 #include <filesystem>
+#include <chrono>
+#include <sstream>
+#include <string_view>
+#include <vector>
 #include <spdlog/spdlog.h>
 
 // 3rd party includes
 #include <concurrentqueue.h>
 
+// my includes
+#include "block_framing.h"
+#include "chunk_compressor.h"
+#include "direct_file_helpers.h"
+#include "file_metrics.h"
+
 namespace SBCQueens {
 
+	// How the file is written to disk.
+	struct FileOptions {
+		// If true, the page cache is bypassed using O_DIRECT and the file
+		// is preallocated in large extents. Linux only, if it is not
+		// possible it falls back to a normal buffered file.
+		bool DirectIO = false;
+		DirectIOConfig DirectConfig;
+
+		// If true, everything is compressed with zstd in chunks using
+		// all the cores, see chunk_compressor.h
+		bool Compress = false;
+		CompressionConfig Compression;
+
+		// If true, everything after the header is saved in blocks with
+		// their size, number of items and a CRC so a file cut short can
+		// be recovered (see block_framing.h and tools/sbc_recover.cpp).
+		// A block is written every FramingBlockSize bytes or every
+		// save(...), whatever comes first.
+		bool Framing = false;
+		size_t FramingBlockSize = 1 << 20;
+	};
+
 	// This is just to let the programmer (or idiot me) that
 	// this file is going to be used to write the data files
 	// No reading allowed
@@ -27,25 +60,45 @@ private:
 		bool _open;
 		std::string _fullFileDir;
 		std::ofstream _stream;
-
+		std::unique_ptr<directFileWriter> _direct;
+		std::unique_ptr<chunkCompressor> _compressor;
+
+		// Block being filled, only if framing
+		bool _framing = false;
+		size_t _blockSize = 0;
+		std::string _block;
+		uint32_t _blockItems = 0;
+
+		// Add(...) can be called by any number of threads, each one gets
+		// its own implicit producer in the queue. save(...) by only one
+		// thread at a time (it also uses _data), so it keeps a token.
 		moodycamel::ConcurrentQueue<T> _queue;
+		moodycamel::ConsumerToken _consumerToken{_queue};
+		// Items taken out of the queue, kept to not allocate every save
+		std::vector<T> _data;
+
+		// Counters since the file was opened
+		DataFileMetrics _metrics;
+		std::chrono::steady_clock::time_point _openTime;
 
 public:
 		using type = T;
 
-		dataFile() : _open(false) { }
+		// Items per slice of consume(...) and save(...)
+		static constexpr size_t DefaultSliceSize = 4096;
 
-		// FileName: is the relative or absolute file dir
-		explicit dataFile(const std::string& fileName) {
+		dataFile() : _open(false), _openTime(std::chrono::steady_clock::now()) { }
 
-			_fullFileDir = fileName;
-			_stream.open(_fullFileDir,
-				std::ofstream::app | std::ofstream::binary);
+		// FileName: is the relative or absolute file dir
+		explicit dataFile(const std::string& fileName)
+			: dataFile(FileOptions(), fileName) { }
 
-			if(_stream.is_open()) {
-				_open = true;
-			}
-			
+		// opts: how the file is written, see FileOptions
+		// FileName: is the relative or absolute file dir
+		dataFile(const FileOptions& opts, const std::string& fileName)
+			: _open(false) {
+			open_file(opts, fileName);
+			_framing = _open && opts.Framing;
 		}
 
 		template<typename InitWriteFunc, typename... Args>
@@ -53,23 +106,29 @@ public:
 		// f -> function that takes args and returns string
 		// that is written at the start of the file only if
 		// the file did not exist before
-		dataFile(const std::string& fileName, InitWriteFunc&& f, Args&&... args) {
+		dataFile(const std::string& fileName, InitWriteFunc&& f, Args&&... args)
+			: dataFile(FileOptions(), fileName,
+				std::forward<InitWriteFunc>(f), std::forward<Args>(args)...) { }
 
-			_fullFileDir = fileName;
-			_stream.open(_fullFileDir,
-				std::ofstream::app | std::ofstream::binary);
+		template<typename InitWriteFunc, typename... Args>
+		// Same as above but with the FileOptions opts
+		dataFile(const FileOptions& opts, const std::string& fileName,
+			InitWriteFunc&& f, Args&&... args) : _open(false) {
 
-			if(_stream.is_open()) {
-				_open = true;
+			open_file(opts, fileName);
 
+			if(_open) {
 				// TODO(Hector): create directories between file and
 				// current directory?
 				if(std::filesystem::is_empty(fileName)) {
-					_stream << f(std::forward<Args>(args)...);
+					(*this) << f(std::forward<Args>(args)...);
 				}
 
 			}
 
+			// The header is never framed
+			_framing = _open && opts.Framing;
+
 		}
 
 		// No copying nor moving
@@ -79,20 +138,77 @@ public:
 		// It is very likely these two things are happening anyways when
 		// the Datafile is out of the scope but I want to make sure.
 		~dataFile() {
-			_stream.close();
-			_open = false;
+			close();
 		}
 
 		bool IsOpen() const {
 			return _open;
 		}
 
-		auto GetData() {
-			auto approx_length = _queue.size_approx();
-			auto data = std::vector< T >(approx_length);
-			_queue.try_dequeue_bulk(data.data(), approx_length);
+		const std::string& GetFileName() const {
+			return _fullFileDir;
+		}
+
+		// Bytes written since the file was opened (before compression
+		// and without the block frames)
+		uint64_t GetBytesWritten() const {
+			return _metrics.BytesWritten;
+		}
+
+		// Number of items taken out of the queue to be saved
+		uint64_t GetItemsRetrieved() const {
+			return _metrics.ItemsWritten;
+		}
+
+		// Everything it counts, see file_metrics.h
+		const DataFileMetrics& GetMetrics() const {
+			return _metrics;
+		}
+
+		// Adds how long a save took to write, see save(...)
+		void add_save_latency(const std::chrono::nanoseconds& t) {
+			_metrics.SaveLatency.add(t);
+		}
+
+		// Time since the file was opened
+		template<typename Y = std::chrono::seconds>
+		Y GetTimeOpen() const {
+			return std::chrono::duration_cast<Y>(
+				std::chrono::steady_clock::now() - _openTime);
+		}
 
-			return data;
+		// Takes everything out of the queue. The vector is reused by the
+		// next call, and it only has the items that were taken out.
+		std::vector<T>& GetData() {
+			dequeue(queue_depth());
+			return _data;
+		}
+
+		// Takes the items in the queue out in slices of up to sliceSize
+		// and calls f(std::vector<T>&) with each one, so a large backlog
+		// does not need a large buffer. Only the items that were in the
+		// queue when it was called are taken, so it always ends.
+		// Returns the number of items.
+		template<typename Func>
+		uint64_t consume(Func&& f, const size_t& sliceSize = DefaultSliceSize) {
+			const size_t slice = std::max<size_t>(sliceSize, 1);
+			uint64_t left = queue_depth();
+			uint64_t total = 0;
+			while(left > 0 && dequeue(std::min<uint64_t>(left, slice)) > 0) {
+				left -= std::min<uint64_t>(left, _data.size());
+				total += _data.size();
+
+				// Whatever f does that is not writing is formatting
+				const auto write_time = _metrics.WriteTime;
+				const auto start = std::chrono::steady_clock::now();
+				f(_data);
+				_metrics.FormatTime += std::chrono::steady_clock::now()
+					- start - (_metrics.WriteTime - write_time);
+			}
+
+			// So the items are not kept alive until the next call
+			_data.clear();
+			return total;
 		}
 
 		// Adds element as a copy to current buffer
@@ -118,17 +234,174 @@ public:
 		// Saves string to the file
 		template <typename DATA>
 		void operator<<(const DATA& fmt) {
-			_stream << fmt;
+			if constexpr (std::is_convertible_v<const DATA&, std::string_view>) {
+				std::string_view str = fmt;
+				write(str.data(), str.size());
+			} else {
+				std::ostringstream out;
+				out << fmt;
+				auto str = out.str();
+				write(str.data(), str.size());
+			}
+		}
+
+		// Saves size bytes of data to the file
+		void write(const char* data, const size_t& size) {
+			if(_framing) {
+				_block.append(data, size);
+			} else {
+				write_out(data, size);
+			}
+
+			_metrics.BytesWritten += size;
+		}
+
+		// Tells the file that n whole items were written. If framing,
+		// the block is written once it is big enough.
+		void end_item(const uint64_t& n = 1) {
+			if(!_framing) {
+				return;
+			}
+
+			_blockItems += static_cast<uint32_t>(n);
+			if(_block.size() >= _blockSize) {
+				flush_block();
+			}
+		}
+
+		// Writes the block being filled, if any
+		void flush_block() {
+			if(_block.empty()) {
+				return;
+			}
+
+			const auto size = static_cast<uint32_t>(_block.size());
+			const auto header = block_frame_header(_block.data(), size,
+				_blockItems);
+			write_out(header.data(), header.size());
+			write_out(_block.data(), _block.size());
+
+			_block.clear();
+			_blockItems = 0;
+		}
+
+		// Writes the last block and everything after is not framed,
+		// ex: a footer.
+		void end_framing() {
+			flush_block();
+			_framing = false;
 		}
 
 		// Flush the buffer to file
 		void flush() {
-			_stream.flush();
+			const auto start = std::chrono::steady_clock::now();
+			flush_block();
+			if(_compressor) {
+				_compressor->flush();
+			}
+
+			if(_direct) {
+				_direct->flush();
+			} else {
+				_stream.flush();
+			}
+			_metrics.FlushLatency.add(std::chrono::steady_clock::now() - start);
 		}
 
 		// Closes the file
 		void close() {
-			_stream.close();
+			flush_block();
+
+			// Before the file, it still has to write the rest
+			if(_compressor) {
+				_compressor->close();
+				_compressor.reset();
+			}
+
+			if(_direct) {
+				_direct->close();
+			} else {
+				_stream.close();
+			}
+			_open = false;
+		}
+
+private:
+		// Items waiting to be saved, also counted in the metrics
+		uint64_t queue_depth() {
+			_metrics.QueueDepth = _queue.size_approx();
+			_metrics.MaxQueueDepth = std::max(_metrics.MaxQueueDepth,
+				_metrics.QueueDepth);
+			return _metrics.QueueDepth;
+		}
+
+		// Takes up to n items out of the queue into _data
+		size_t dequeue(const size_t& n) {
+			_data.resize(n);
+			const size_t taken = _queue.try_dequeue_bulk(_consumerToken,
+				_data.begin(), n);
+			_data.resize(taken);
+			_metrics.ItemsWritten += taken;
+			return taken;
+		}
+
+		// The compressor writes to the disk from its own threads, so
+		// only the time it takes it is counted.
+		void write_out(const char* data, const size_t& size) {
+			const auto start = std::chrono::steady_clock::now();
+			if(_compressor) {
+				_compressor->write(data, size);
+			} else {
+				write_to_disk(data, size);
+			}
+			_metrics.WriteTime += std::chrono::steady_clock::now() - start;
+		}
+
+		void write_to_disk(const char* data, const size_t& size) {
+			if(_direct) {
+				_direct->write(data, size);
+			} else {
+				_stream.write(data, size);
+			}
+		}
+
+		void open_file(const FileOptions& opts, const std::string& fileName) {
+			_fullFileDir = fileName;
+			_openTime = std::chrono::steady_clock::now();
+			_blockSize = opts.FramingBlockSize;
+
+			if(opts.DirectIO) {
+				_direct = std::make_unique<directFileWriter>(_fullFileDir,
+					opts.DirectConfig);
+
+				if(_direct->IsOpen()) {
+					_open = true;
+				} else {
+					spdlog::warn("Falling back to buffered writes for {0}",
+						_fullFileDir);
+					_direct.reset();
+				}
+			}
+
+			if(!_open) {
+				_stream.open(_fullFileDir,
+					std::ofstream::app | std::ofstream::binary);
+
+				if(_stream.is_open()) {
+					_open = true;
+				}
+			}
+
+			if(_open && opts.Compress) {
+				// The compressor writes from its own threads but only
+				// one at a time, and never while we flush or close.
+				std::error_code ec;
+				auto size = std::filesystem::file_size(_fullFileDir, ec);
+				_compressor = std::make_unique<chunkCompressor>(
+					[this](const char* data, const size_t& size) {
+						write_to_disk(data, size);
+					}, _fullFileDir, ec ? 0 : size, opts.Compression);
+			}
 		}
 
 	};
@@ -141,14 +414,22 @@ public:
 	template <typename T>
 	void open(DataFile<T>& res, const std::string& fileName) {
 
-		if(res) {
-			res.release();
-		}
-
+		// reset(...) deletes the old file which closes it.
+		res.reset();
 		res = std::make_unique<dataFile<T>>(fileName);
 
 	}
 
+	// Same as above but the file is written as opts says.
+	template <typename T>
+	void open(DataFile<T>& res, const FileOptions& opts,
+		const std::string& fileName) {
+
+		res.reset();
+		res = std::make_unique<dataFile<T>>(opts, fileName);
+
+	}
+
 	// Opens the file with name fileName.
 	// If file is an already opened file, it is closed and opened again.
 	// It will also write to the file whatever f returns with args...
@@ -157,19 +438,26 @@ public:
 	void open(DataFile<T>& res,
 		const std::string& fileName, InitWriteFunc&& f,  Args&&... args) {
 
-		if(res) {
-			res.release();
-		}
-
+		res.reset();
 		res = std::make_unique<dataFile<T>>(fileName,
 			std::forward<InitWriteFunc>(f), std::forward<Args>(args)...);
 	}
 
+	// Same as above but the file is written as opts says.
+	template <typename T, typename InitWriteFunc, typename... Args>
+	void open(DataFile<T>& res, const FileOptions& opts,
+		const std::string& fileName, InitWriteFunc&& f,  Args&&... args) {
+
+		res.reset();
+		res = std::make_unique<dataFile<T>>(opts, fileName,
+			std::forward<InitWriteFunc>(f), std::forward<Args>(args)...);
+	}
+
+	// Closes the file and frees its resources. Anything in the file
+	// queue that was not saved is lost.
 	template <typename T>
 	void close(DataFile<T>& res) {
-		if(res) {
-			res.release();
-		}
+		res.reset();
 	}
 
 	// Saves the contents of DataFile using the format function f
@@ -180,11 +468,11 @@ public:
 	void save(DataFile<T>& file, FormatFunc&& f,  Args&&... args) noexcept {
 
 		if(file->IsOpen()) {
-			// GetData becomes a thread-safe operation
-			// because of the concurrent queue
-			// for the async version this data is locked into the
-			// thread that is saving and is cleared by the end
-			auto data = file->GetData();
+			const auto write_time = file->GetMetrics().WriteTime;
+
+			// The queue is thread-safe, so items can be added while
+			// this is saving. It goes in slices (see consume(...)) so
+			// a large backlog does not need a large buffer.
 			// If FormatFunc takes the single item as an argument
 			// We will call f for every item in TempData
 			if constexpr (
@@ -192,20 +480,30 @@ public:
 				std::is_invocable_v<FormatFunc, const T&, Args...> 	||
 				std::is_invocable_v<FormatFunc, T&, Args...>) {
 
-				for(auto& item : data) {
-					(*file) << f(item, std::forward<Args>(args)...);
-				}
+				file->consume([&](std::vector<T>& data) {
+					for(auto& item : data) {
+						(*file) << f(item, args...);
+						file->end_item();
+					}
+				});
 
-			// If it takes the entire format, then apply it to all.
+			// If it takes the entire format, then apply it to each slice.
 			} else if constexpr (std::is_invocable_v<FormatFunc,
 				std::vector<T>&, Args...>) {
-				(*file) << f(data, std::forward<Args>(args)...);
+				file->consume([&](std::vector<T>& data) {
+					(*file) << f(data, args...);
+					file->end_item(data.size());
+				});
 
 			// if not, just save what f returns
 			} else {
 				(*file) << f(std::forward<Args>(args)...);
 			}
 
+			// Every save ends a block, so a crash loses at most what
+			// is being saved
+			file->flush_block();
+			file->add_save_latency(file->GetMetrics().WriteTime - write_time);
 		}
 
 	}
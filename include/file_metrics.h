@@ -0,0 +1,175 @@
+#pragma once
+
+/*
+
+	What a dataFile has done since it was opened: bytes and items
+	written, how many items were waiting to be saved, the time spent
+	formatting versus writing and how long each save took to write.
+
+	fileMetricsMonitor turns them into rates between calls, ex: every
+	second for the GUI indicators,
+
+		fileMetricsMonitor monitor;
+		auto rates = monitor(file->GetMetrics());
+		// rates.BytesPerSecond, rates.WriteFraction, ...
+
+	and format_file_metrics(...) into a line for the log.
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+// 3rd party includes
+#include <spdlog/fmt/fmt.h>
+
+namespace SBCQueens {
+
+	// Latencies in powers of 2 of us: bucket 0 is < 1 us, bucket i is
+	// [2^(i-1), 2^i) us. Not thread safe.
+	struct LatencyHistogram {
+		static constexpr size_t NumBuckets = 32;
+		std::array<uint64_t, NumBuckets> Counts = {};
+		uint64_t Total = 0;
+		std::chrono::nanoseconds Max = std::chrono::nanoseconds(0);
+
+		void add(const std::chrono::nanoseconds& t) noexcept {
+			const auto us = std::chrono::duration_cast<
+				std::chrono::microseconds>(t).count();
+			size_t bucket = 0;
+			while(bucket < NumBuckets - 1 && (int64_t(1) << bucket) <= us) {
+				bucket++;
+			}
+
+			Counts[bucket]++;
+			Total++;
+			Max = std::max(Max, t);
+		}
+
+		// Latency (ms) under which a fraction q of them are. It is the
+		// upper edge of its bucket, so at most 2x more than the real one.
+		double quantile_ms(const double& q) const noexcept {
+			if(Total == 0) {
+				return 0.0;
+			}
+
+			const auto target = static_cast<uint64_t>(std::ceil(
+				std::clamp(q, 0.0, 1.0)*Total));
+			uint64_t count = 0;
+			for(size_t i = 0; i < NumBuckets; i++) {
+				count += Counts[i];
+				if(count >= std::max<uint64_t>(target, 1)) {
+					return std::min((int64_t(1) << i) / 1000.0, max_ms());
+				}
+			}
+
+			return max_ms();
+		}
+
+		double max_ms() const noexcept {
+			return std::chrono::duration<double, std::milli>(Max).count();
+		}
+	};
+
+	// Counters of a dataFile since it was opened
+	struct DataFileMetrics {
+		// Before compression and without the block frames
+		uint64_t BytesWritten = 0;
+		// Items taken out of the queue to be saved
+		uint64_t ItemsWritten = 0;
+		// Items waiting at the start of the last save, and the most ever
+		uint64_t QueueDepth = 0;
+		uint64_t MaxQueueDepth = 0;
+		// Time spent making what is saved and writing it (to the disk,
+		// or to the compressor if compressed)
+		std::chrono::nanoseconds FormatTime = std::chrono::nanoseconds(0);
+		std::chrono::nanoseconds WriteTime = std::chrono::nanoseconds(0);
+		// Time to write what each save(...) had
+		LatencyHistogram SaveLatency;
+		// Time of each flush() to the disk, only those
+		LatencyHistogram FlushLatency;
+	};
+
+	struct FileMetricsRates {
+		double BytesPerSecond = 0.0;
+		double ItemsPerSecond = 0.0;
+		// Fraction of the time formatting and writing. If they add
+		// up to 1, the thread that saves cannot keep up.
+		double FormatFraction = 0.0;
+		double WriteFraction = 0.0;
+	};
+
+	// Rates of a file between calls
+	class fileMetricsMonitor {
+		DataFileMetrics _last;
+		std::chrono::steady_clock::time_point _lastTime
+			= std::chrono::steady_clock::now();
+
+public:
+		FileMetricsRates operator()(const DataFileMetrics& now) {
+			const auto time = std::chrono::steady_clock::now();
+			const double dt = std::chrono::duration<double>(
+				time - _lastTime).count();
+
+			// A new file (ex: the next segment) starts from 0
+			if(now.BytesWritten < _last.BytesWritten
+				|| now.ItemsWritten < _last.ItemsWritten) {
+				_last = DataFileMetrics();
+			}
+
+			FileMetricsRates rates;
+			if(dt > 0.0) {
+				auto seconds = [](const std::chrono::nanoseconds& t) {
+					return std::chrono::duration<double>(t).count();
+				};
+
+				rates.BytesPerSecond = (now.BytesWritten
+					- _last.BytesWritten) / dt;
+				rates.ItemsPerSecond = (now.ItemsWritten
+					- _last.ItemsWritten) / dt;
+				rates.FormatFraction = seconds(now.FormatTime
+					- _last.FormatTime) / dt;
+				rates.WriteFraction = seconds(now.WriteTime
+					- _last.WriteTime) / dt;
+			}
+
+			_last = now;
+			_lastTime = time;
+			return rates;
+		}
+	};
+
+	// One line for the log with the metrics of file name. sync is the
+	// fsync latency, if any.
+	inline std::string format_file_metrics(const std::string& name,
+		const DataFileMetrics& metrics, const FileMetricsRates& rates,
+		const LatencyHistogram* sync = nullptr) {
+		std::string out = fmt::format("{0}: {1:.2f} MB/s, {2:.0f} items/s, "
+			"queue {3} (max {4}), formatting {5:.1f}% writing {6:.1f}%, "
+			"save p99 {7:.2f} ms (max {8:.2f} ms)", name,
+			rates.BytesPerSecond / 1e6, rates.ItemsPerSecond,
+			metrics.QueueDepth, metrics.MaxQueueDepth,
+			100.0*rates.FormatFraction, 100.0*rates.WriteFraction,
+			metrics.SaveLatency.quantile_ms(0.99),
+			metrics.SaveLatency.max_ms());
+
+		if(metrics.FlushLatency.Total > 0) {
+			out += fmt::format(", flush p99 {0:.2f} ms (max {1:.2f} ms)",
+				metrics.FlushLatency.quantile_ms(0.99),
+				metrics.FlushLatency.max_ms());
+		}
+
+		if(sync && sync->Total > 0) {
+			out += fmt::format(", fsync p99 {0:.2f} ms (max {1:.2f} ms)",
+				sync->quantile_ms(0.99), sync->max_ms());
+		}
+
+		return out;
+	}
+
+} // namespace SBCQueens
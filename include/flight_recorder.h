@@ -0,0 +1,134 @@
+#pragma once
+
+/*
+
+	Flight recorder of the SiPM events.
+
+	In the oscilloscope and statistics modes nothing is saved, so the
+	recorder keeps the last Seconds of events (up to MaxMB of traces) in
+	a ring of events. The events are decoded straight into the ring, so
+	keeping them does not copy anything, and the oldest ones are decoded
+	over once the ring is full.
+
+	The ring is saved to a SBC binary file (RunDir/RunName/
+	flight_YYYYmmddHHMMSS.bin, the same format as the run files) when
+	asked, ex: a GUI button, or when one of the triggers fires:
+
+	- the event rate over one second is above RateThreshold, or
+	- any sample of an event is more than AmplitudeThreshold counts
+	away from the baseline of its trace.
+
+	After a trigger it keeps recording PostTriggerSeconds before saving,
+	and it does not trigger again until HoldOffSeconds later.
+
+		flightRecorder recorder;
+		recorder.configure(config, Port);
+		retrieve_data(Port);
+		recorder.add_all(Port);
+		recorder.update(Port, file_config, dir);
+
+*/
+
+// STD includes
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// my includes
+#include "caen_helper.h"
+
+namespace SBCQueens {
+
+	struct FlightRecorderConfig {
+		bool Enabled = false;
+		// How much is kept, whatever is reached first
+		double Seconds = 10.0;
+		double MaxMB = 256.0;
+
+		// Automatic saves, 0 = disabled
+		// In Hz
+		double RateThreshold = 0.0;
+		// In ADC counts from the baseline, the mean of the first
+		// BaselineSamples of each trace
+		uint16_t AmplitudeThreshold = 0;
+		uint32_t BaselineSamples = 16;
+		// Time recorded after a trigger and before saving
+		double PostTriggerSeconds = 1.0;
+		// Minimum time between automatic saves
+		double HoldOffSeconds = 60.0;
+	};
+
+	class flightRecorder {
+		using clock = std::chrono::steady_clock;
+
+		struct slot {
+			CAENEvent Event;
+			clock::time_point Time;
+		};
+
+		FlightRecorderConfig _config;
+		std::vector<slot> _ring;
+		// Where the next event goes and how many there are
+		size_t _next = 0;
+		size_t _size = 0;
+
+		// Rate over the last second
+		clock::time_point _rateStart;
+		uint64_t _rateEvents = 0;
+
+		// Pending save, if any, and why
+		bool _saveRequested = false;
+		clock::time_point _saveAt;
+		std::string _saveReason;
+		clock::time_point _lastTrigger;
+		bool _triggered = false;
+
+		void trigger(const std::string& reason);
+
+public:
+		flightRecorder() = default;
+
+		// No copying, the ring can be huge
+		flightRecorder(const flightRecorder&) = delete;
+
+		// Sizes the ring for the events of res. Call it after every
+		// setup of the digitizer. Anything recorded is lost.
+		void configure(const FlightRecorderConfig& config, CAEN& res);
+
+		// Frees all the events. Call it before disconnecting.
+		void clear();
+
+		bool IsEnabled() const { return _config.Enabled && !_ring.empty(); }
+
+		// Number of events recorded
+		size_t size() const { return _size; }
+
+		// Decodes event i of the data retrieved into the ring and checks
+		// the amplitude trigger. Returns false if it could not.
+		bool add(CAEN& res, const uint32_t& i);
+
+		// Same for all the events retrieved, and checks the rate trigger.
+		// f, if any, is called with every event added.
+		void add_all(CAEN& res,
+			const std::function<void(CAENEvent&)>& f = nullptr);
+
+		// The last event added, null if none
+		CAENEvent latest() const;
+
+		// Saves the ring at the next update(...), ex: from the GUI
+		void request_save(const std::string& reason = "requested");
+
+		// Saves the ring into dir if asked or triggered and it is time.
+		// Returns the name of the file or empty if nothing was saved.
+		std::string update(CAEN& res, const SBCFileConfig& config,
+			const std::string& dir);
+
+		// Saves the events of the last Seconds into fileName.
+		// Returns the number of events saved.
+		uint64_t save(CAEN& res, const SBCFileConfig& config,
+			const std::string& fileName);
+	};
+
+} // namespace SBCQueens
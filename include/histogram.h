@@ -0,0 +1,262 @@
+#pragma once
+
+/*
+
+	Histograms that many threads can fill at the same time, ex: from the
+	kernels of analysis_executor.h.
+
+	Every thread fills its own shard, so filling is the bin search and
+	an add to memory nobody else writes: the counters are atomics but
+	only loaded and stored (relaxed), which are plain moves in x86 and
+	ARM, never a locked add. merge() adds the shards (from any thread,
+	while they are being filled) into a snapshot that the GUI or the
+	files read without stopping anyone:
+
+		concurrentHistogram amplitudes("Amplitude", {HistogramBinning::Linear,
+			200, 0.0, 1000.0});
+		amplitudes.fill(x); 	// any thread
+		// or, in a loop, without looking for the shard every time
+		auto& shard = amplitudes.local();
+		for(...) { shard.fill(x); }
+
+		amplitudes.merge(); 	// ex: every second
+		auto snapshot = amplitudes.GetSnapshot(); 	// any thread
+
+	The bins are Linear or Log (same width in log(x)) between Min and
+	Max, plus an underflow and an overflow. The log ones use a log2 table
+	and then the exact edges, so they are the same as with std::log.
+
+	Snapshots are saved with histograms_save(...) to a "SBCH" file, one
+	record per histogram:
+
+	uint32 				size of the payload
+	uint32 				crc32c of the payload
+	char[size] 			payload
+
+	and the payload is its name (uint16 size and chars), binning (uint8),
+	NumBins (uint32), Min, Max (double), Entries (uint64), Sum, Sum2
+	(double) and then the NumBins + 2 counts as LEB128 varints, so the
+	empty bins are 1 byte.
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace SBCQueens {
+
+	// "SBCH" in little endian. First 4 bytes of a histogram file.
+	constexpr uint32_t HistogramFileMagic = 0x48434253;
+
+	enum class HistogramBinning : uint8_t { Linear = 0, Log = 1 };
+
+	const std::unordered_map<std::string, HistogramBinning>
+		HistogramBinning_map = {
+		{"Linear", HistogramBinning::Linear},
+		{"Log", HistogramBinning::Log}
+	};
+
+	struct HistogramAxis {
+		HistogramBinning Binning = HistogramBinning::Linear;
+		uint32_t NumBins = 100;
+		// Min > 0 for Log
+		double Min = 0.0;
+		double Max = 100.0;
+	};
+
+	namespace histogram_internal {
+
+		// log2 of the middle of each 1/1024 of [1, 2)
+		inline std::array<double, 1024> make_log2_table() {
+			std::array<double, 1024> table;
+			for(size_t k = 0; k < table.size(); k++) {
+				table[k] = std::log2(1.0 + (k + 0.5) / table.size());
+			}
+			return table;
+		}
+
+		inline const std::array<double, 1024> Log2Table = make_log2_table();
+
+	} // namespace histogram_internal
+
+	// log2(x) to 1e-3, for x > 0 and normal, from the exponent and the
+	// first 10 bits of the mantissa
+	inline double fast_log2(const double& x) noexcept {
+		uint64_t bits;
+		std::memcpy(&bits, &x, sizeof(bits));
+		const auto exponent = static_cast<int64_t>((bits >> 52) & 0x7FF) - 1023;
+		return exponent + histogram_internal::Log2Table[(bits >> 42) & 0x3FF];
+	}
+
+	// Which bin a value goes to
+	class histogramBins {
+		HistogramAxis _axis;
+		// Min in the units of the binning (x or log2(x)) and bins per unit
+		double _start = 0.0;
+		double _scale = 1.0;
+		// NumBins + 1, only for Log
+		std::vector<double> _edges;
+
+public:
+		histogramBins() = default;
+		explicit histogramBins(const HistogramAxis& axis);
+
+		const HistogramAxis& GetAxis() const { return _axis; }
+
+		// Bins, underflow and overflow
+		size_t size() const { return _axis.NumBins + 2; }
+
+		// Lower edge of bin i (1 to NumBins), or upper of the bin before
+		double edge(const size_t& i) const noexcept;
+
+		// 0 is the underflow (and NaN), NumBins + 1 the overflow
+		size_t operator()(const double& x) const noexcept {
+			if(!(x >= _axis.Min)) {
+				return 0;
+			}
+
+			if(x >= _axis.Max) {
+				return _axis.NumBins + 1;
+			}
+
+			if(_axis.Binning == HistogramBinning::Linear) {
+				const auto i = static_cast<size_t>((x - _start)*_scale);
+				return (i < _axis.NumBins ? i : _axis.NumBins - 1) + 1;
+			}
+
+			auto i = static_cast<size_t>((fast_log2(x) - _start)*_scale);
+			i = i < _axis.NumBins ? i : _axis.NumBins - 1;
+			// The approximation is off by less than a bin unless there are
+			// more than ~1000 per factor of 2
+			while(i > 0 && x < _edges[i]) {
+				i--;
+			}
+			while(i + 1 < _axis.NumBins && x >= _edges[i + 1]) {
+				i++;
+			}
+			return i + 1;
+		}
+	};
+
+	// The counts of one thread. Only that thread fills it.
+	class alignas(64) histogramShard {
+		const histogramBins& _bins;
+		std::unique_ptr<std::atomic<uint64_t>[]> _counts;
+		std::atomic<double> _sum{0.0};
+		std::atomic<double> _sum2{0.0};
+
+		template<typename N>
+		static void add(std::atomic<N>& to, const N& x) noexcept {
+			to.store(to.load(std::memory_order_relaxed) + x,
+				std::memory_order_relaxed);
+		}
+
+public:
+		explicit histogramShard(const histogramBins& bins);
+
+		void fill(const double& x) noexcept {
+			add<uint64_t>(_counts[_bins(x)], 1);
+			add(_sum, x);
+			add(_sum2, x*x);
+		}
+
+		// Adds its counts to counts (size() of them), sum and sum2. Can be
+		// called while it is being filled.
+		void read(std::vector<uint64_t>& counts, double& sum,
+			double& sum2) const noexcept;
+	};
+
+	struct histogramSnapshot {
+		std::string Name;
+		HistogramAxis Axis;
+		// NumBins + 2: the underflow, the bins and the overflow
+		std::vector<uint64_t> Counts;
+		// All of them, with the underflow and overflow
+		uint64_t Entries = 0;
+		double Sum = 0.0;
+		double Sum2 = 0.0;
+
+		double GetMean() const {
+			return Entries > 0 ? Sum / Entries : 0.0;
+		}
+
+		double GetRMS() const {
+			const double mean = GetMean();
+			return Entries > 0 ?
+				std::sqrt(std::max(Sum2 / Entries - mean*mean, 0.0)) : 0.0;
+		}
+	};
+
+	// Left edges of the bins and then the right edge of the last one,
+	// each with its counts, ex: for ImPlot::PlotStairs. Without the
+	// underflow and overflow.
+	void histogram_stairs(const histogramSnapshot& hist,
+		std::vector<double>& x, std::vector<double>& y);
+
+	class concurrentHistogram {
+		const std::string _name;
+		const histogramBins _bins;
+		// To find it in the shards of each thread, never reused
+		const uint64_t _id;
+
+		mutable std::mutex _mutex;
+		std::unordered_map<std::thread::id, std::unique_ptr<histogramShard>>
+			_shards;
+		// What the shards had at the last reset()
+		std::vector<uint64_t> _resetCounts;
+		double _resetSum = 0.0;
+		double _resetSum2 = 0.0;
+		// Replaced, never changed, so the readers always see a whole one
+		std::shared_ptr<const histogramSnapshot> _snapshot;
+
+		histogramShard& make_local();
+		// What the shards have now minus what they had at the last reset
+		histogramSnapshot read() const;
+
+public:
+		concurrentHistogram(const std::string& name, const HistogramAxis& axis);
+
+		// No copying or moving, the threads have pointers to its shards
+		concurrentHistogram(const concurrentHistogram&) = delete;
+		concurrentHistogram& operator=(const concurrentHistogram&) = delete;
+
+		// The shard of this thread, made the first time
+		histogramShard& local();
+
+		void fill(const double& x) { local().fill(x); }
+
+		// Adds the shards into a new snapshot
+		void merge();
+
+		// Forgets what was filled until now, from any thread. The fills
+		// at the same time may or may not count.
+		void reset();
+
+		const std::string& GetName() const { return _name; }
+		const HistogramAxis& GetAxis() const { return _bins.GetAxis(); }
+
+		// Of the last merge()
+		std::shared_ptr<const histogramSnapshot> GetSnapshot() const;
+	};
+
+	// Saves the histograms to fileName, replacing it
+	bool histograms_save(const std::string& fileName,
+		const std::vector<histogramSnapshot>& hists) noexcept;
+
+	// Loads the histograms of fileName. Stops at the first record that is
+	// cut or corrupted and returns false.
+	bool histograms_load(const std::string& fileName,
+		std::vector<histogramSnapshot>& hists) noexcept;
+
+} // namespace SBCQueens
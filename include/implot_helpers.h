@@ -61,6 +61,13 @@ namespace SBCQueens {
 		bool ClearOnNewData;
 	};
 
+	// How a plot is drawn. For Stairs, y[i] is held from x[i] to x[i+1],
+	// ex: a histogram with the left edges of its bins. Bars are as wide
+	// as the distance between the first two x.
+	enum class PlotStyle {
+		Line, Stairs, Bars
+	};
+
 	enum class NumericFormat {
 		Default, Scientific, HexFloat, Fixed
 	};
@@ -178,13 +185,15 @@ public:
 
 		bool Cleared = false;
 		bool ClearOnNewData = false;
+		PlotStyle Style = PlotStyle::Line;
 
 public:
 		using type = T;
 		using data_type = double;
 
-		explicit Plot(const T& id, bool clearOnNewData = false)
-			: Indicator<T>(id), ClearOnNewData(clearOnNewData) {
+		explicit Plot(const T& id, bool clearOnNewData = false,
+			const PlotStyle& style = PlotStyle::Line)
+			: Indicator<T>(id), ClearOnNewData(clearOnNewData), Style(style) {
 		}
 
 		// No moving
@@ -242,9 +251,18 @@ public:
 			Cleared = false;
 		}
 
-		// Wraps ImPlot::PlotLine
+		// Wraps ImPlot::PlotLine, PlotStairs or PlotBars
 		void operator()(const std::string& label) {
-			ImPlot::PlotLine(label.c_str(), &_x.front(), &_y.front(), _x.size());
+			if(Style == PlotStyle::Stairs && !_x.empty()) {
+				ImPlot::PlotStairs(label.c_str(), _x.data(), _y.data(),
+					_x.size());
+			} else if(Style == PlotStyle::Bars && !_x.empty()) {
+				const double width = _x.size() > 1 ? _x[1] - _x[0] : 1.0;
+				ImPlot::PlotBars(label.c_str(), _x.data(), _y.data(),
+					_x.size(), width);
+			} else {
+				ImPlot::PlotLine(label.c_str(), &_x.front(), &_y.front(), _x.size());
+			}
 		}
 
 		void Draw(const std::string& label) {
@@ -350,10 +368,11 @@ public:
 		// Adds plot with ID, and draws it at the placed location if exists
 		// It returns a smart pointer to the indicator (not plot)
 		auto& plot(const T& id, const std::string& label,
-			bool clearOnNewData = false) {
+			bool clearOnNewData = false,
+			const PlotStyle& style = PlotStyle::Line) {
 
 			_indicators.try_emplace(id,
-				std::make_unique<Plot<T>>(id, clearOnNewData));
+				std::make_unique<Plot<T>>(id, clearOnNewData, style));
 
 			auto& ind = _indicators.at(id);
 
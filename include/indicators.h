@@ -23,6 +23,15 @@ namespace SBCQueens {
 		SiPM_Plot_TWO,
 		SiPM_Plot_THREE,
 
+		SiPM_Template_ZERO,
+		SiPM_Template_ONE,
+		SiPM_Template_TWO,
+		SiPM_Template_THREE,
+
+		AMPLITUDE_HISTOGRAM,
+		FILTERED_AMPLITUDE_HISTOGRAM,
+		TRIGGER_TIME_HISTOGRAM,
+
 		// For indicators:
 		// Teeensy Indicators
 		LATEST_RTD1_TEMP,
@@ -39,7 +48,21 @@ namespace SBCQueens {
 		CAENBUFFEREVENTS,
 		FREQUENCY,
 		DARK_NOISE_RATE,
-		GAIN
+		GAIN,
+		CROSSTALK,
+		AFTERPULSE,
+		BASELINE_ALERTS,
+		NOISE_RMS,
+
+		// SiPM file indicators
+		FILE_WRITE_RATE,
+		FILE_EVENT_RATE,
+		FILE_QUEUE_DEPTH,
+		FILE_MAX_QUEUE_DEPTH,
+		FILE_FORMAT_TIME,
+		FILE_WRITE_TIME,
+		FILE_SAVE_LATENCY,
+		FILE_SYNC_LATENCY
 	};
 
 
@@ -0,0 +1,184 @@
+#pragma once
+
+/*
+
+	Optimal (matched) filter of the SiPM traces, for pulses that are too
+	small for the threshold of the pulse finder.
+
+	For every channel it learns, from the first traces it sees:
+
+	- the noise power spectrum J, from NoiseTraces traces without any
+	pulse,
+	- the pulse template s, the mean of TemplateTraces traces with a
+	single pulse of an amplitude in [TemplateMinAmplitude,
+	TemplateMaxAmplitude] aligned on its peak (ex: the 1 PE pulses),
+	normalized to a peak of 1. Or the one given by SetTemplate(...),
+	ex: the one of pulse_template.h.
+
+	Then the amplitude of the template that fits best, with every shift
+	t of it at once, is:
+
+		A(t) = IFFT(conj(S) V / J) / norm, norm = sum(|S|^2 / J) / n
+
+	and the pulse is the largest A(t). Its time is the peak of the
+	template, with the fraction of a sample from a parabola through the
+	3 points at the top. Its expected error (from the noise alone) is
+	1 / sqrt(n norm), GetResolution(). The DC bin is left out, so the
+	baseline does not change A.
+
+	The traces are zero padded to the next power of two of the record
+	length (see real_fft.h) and the FFT plans are shared. The filters
+	do not change once made, so any number of threads can use them at
+	the same time, each with its own workspace:
+
+		optimalFilterBuilder builder;
+		builder.configure(config, record_length, pulse_config);
+		builder.add(ch, data, size, pulses, num_pulses); 	// one thread
+		auto filters = builder.GetFilters(); 	// any thread
+		if(auto filter = filters->at(ch)) {
+			auto pulse = (*filter)(data, size, baseline, ch, workspace);
+		}
+
+*/
+
+// STD includes
+#include <array>
+#include <complex>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// my includes
+#include "pulse_finder.h"
+#include "real_fft.h"
+
+namespace SBCQueens {
+
+	struct OptimalFilterConfig {
+		bool Enabled = false;
+		// Traces of each channel learned before its filter is made
+		uint32_t NoiseTraces = 1000;
+		uint32_t TemplateTraces = 1000;
+		// Only pulses with amplitudes in this range go to the template,
+		// ex: the 1 PE ones
+		float TemplateMinAmplitude = 0.0f;
+		float TemplateMaxAmplitude = 65535.0f;
+		// Samples of the template before its peak
+		uint32_t TemplatePeak = 32;
+	};
+
+	struct FilteredPulse {
+		// Of the peak, in samples from the start of the trace
+		float Time = 0.0f;
+		// Height of the template that fits best, in ADC counts. Same
+		// sign as the template, so positive for both polarities
+		float Amplitude = 0.0f;
+		uint8_t Channel = 0;
+		// False if there was no filter for the channel
+		bool Valid = false;
+	};
+
+	// What a filter needs to filter one trace, one per thread
+	struct OptimalFilterWorkspace {
+		std::vector<float> Trace;
+		std::vector<std::complex<float>> Spectrum;
+	};
+
+	class optimalFilter {
+		std::shared_ptr<const realFFT> _fft;
+		// conj(S)/J/norm
+		std::vector<std::complex<float>> _filter;
+		std::vector<float> _template;
+		uint32_t _peak = 0;
+		double _resolution = 0.0;
+
+public:
+		// noise has the n/2 + 1 bins of the power spectrum and templ the n
+		// samples of the template with its peak at peak
+		optimalFilter(std::shared_ptr<const realFFT> fft,
+			const std::vector<double>& noise, const std::vector<float>& templ,
+			const uint32_t& peak);
+
+		// The best pulse of the size samples of data
+		FilteredPulse operator()(const uint16_t* data, const uint32_t& size,
+			const float& baseline, const uint8_t& channel,
+			OptimalFilterWorkspace& workspace) const noexcept;
+
+		const std::vector<float>& GetTemplate() const { return _template; }
+
+		// Expected error of the amplitude, in ADC counts
+		double GetResolution() const { return _resolution; }
+	};
+
+	// Filter of every channel number, or nullptr
+	using OptimalFilters = std::array<std::shared_ptr<const optimalFilter>, 256>;
+
+	class optimalFilterBuilder {
+		struct channelData {
+			std::vector<double> Noise;
+			uint32_t NumNoise = 0;
+			std::vector<double> Template;
+			std::vector<uint32_t> TemplateCounts;
+			uint32_t NumTemplate = 0;
+			// Given by SetTemplate(...)
+			std::vector<float> External;
+			bool Done = false;
+		};
+
+		OptimalFilterConfig _config;
+		PulseFinderConfig _pulseConfig;
+		std::shared_ptr<const realFFT> _fft;
+		std::array<std::unique_ptr<channelData>, 256> _channels;
+		OptimalFilterWorkspace _workspace;
+		// Replaced, never changed, so the readers always see a whole one
+		std::shared_ptr<const OptimalFilters> _filters;
+		mutable std::mutex _filtersMutex;
+
+		void make_filter(const uint8_t& ch, channelData& data);
+		void set_filter(const uint8_t& ch,
+			std::shared_ptr<const optimalFilter> filter);
+		channelData& get_channel(const uint8_t& ch);
+
+public:
+		optimalFilterBuilder();
+
+		// Anything learned is lost. The baseline is the same as the one of
+		// the pulse finder.
+		void configure(const OptimalFilterConfig& config,
+			const uint32_t& recordLength, const PulseFinderConfig& pulseConfig);
+
+		// Starts learning again
+		void reset();
+
+		bool IsEnabled() const { return _config.Enabled; }
+
+		// Samples of the templates, the traces are padded to it
+		size_t GetSize() const { return _fft ? _fft->size() : 0; }
+
+		// Uses templ (GetSize() samples with a peak of 1 at TemplatePeak)
+		// for ch instead of learning one, ex: from pulse_template.h. Only
+		// before its filter is made.
+		void SetTemplate(const uint8_t& ch, const std::vector<float>& templ);
+
+		// If ch has a template or a filter already
+		bool HasTemplate(const uint8_t& ch) const;
+
+		// Learns from a trace of channel ch. pulses are all the pulses
+		// found in its event. Returns true if it made the filter of ch.
+		bool add(const uint8_t& ch, const uint16_t* data, const uint32_t& size,
+			const float& baseline, const SiPMPulse* pulses,
+			const size_t& numPulses);
+
+		// Same, with the baseline of the pulse finder
+		bool add(const uint8_t& ch, const uint16_t* data, const uint32_t& size,
+			const SiPMPulse* pulses, const size_t& numPulses) {
+			return add(ch, data, size, data ? pulse_baseline(data, size,
+				_pulseConfig) : 0.0f, pulses, numPulses);
+		}
+
+		// Can be called from any thread
+		std::shared_ptr<const OptimalFilters> GetFilters() const;
+	};
+
+} // namespace SBCQueens
@@ -0,0 +1,159 @@
+#pragma once
+
+/*
+
+	Photoelectron (PE) spectrum of the SiPM pulses and their gain.
+
+	The integral of every pulse found (see pulse_finder.h) goes into a
+	histogram of its channel. The SiPMs fire one cell per photoelectron,
+	so the histogram has a peak for 1 PE, 2 PE, ... at equal distances:
+	the gain. Every FitSeconds the histograms are copied and fitted in
+	another thread:
+
+	- the peaks are the local maxima of the smoothed histogram that
+	are higher than MinPeakHeight of the highest one and are separated
+	by a valley,
+	- each one is fitted to a gaussian (parabola to the log of the
+	counts weighted by the counts),
+	- and their means to a line, mean = Pedestal + Gain*n, where the
+	first peak is n = 1 PE.
+
+	Resolution is the sigma of the 1 PE peak over the gain. Gain and
+	Pedestal are in the units of the integral, counts*samples.
+
+		peSpectrum spectrum;
+		spectrum.configure(config);
+		spectrum.add(pulses); 		// O(1) per pulse
+		if(spectrum.update()) { 	// new fits
+			spectrum.GetGain();
+		}
+
+*/
+
+// STD includes
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+// my includes
+#include "pulse_finder.h"
+
+namespace SBCQueens {
+
+	struct PESpectrumConfig {
+		bool Enabled = false;
+		// Integrals in [0, MaxCharge) counts*samples in NumBins bins
+		double MaxCharge = 2000.0;
+		uint32_t NumBins = 500;
+		// Time between fits
+		double FitSeconds = 10.0;
+		// Pulses a channel needs to be fitted
+		uint64_t MinEntries = 1000;
+		// Peaks used for the gain, from 1 PE
+		uint32_t MaxPeaks = 5;
+		// Smallest peak, as a fraction of the highest one
+		double MinPeakHeight = 0.01;
+	};
+
+	struct PESpectrumPeak {
+		double Mean = 0.0;
+		double Sigma = 0.0;
+		// Counts in the fitted bins
+		double Counts = 0.0;
+	};
+
+	struct PESpectrumFit {
+		uint8_t Channel = 0;
+		uint64_t Entries = 0;
+		std::vector<PESpectrumPeak> Peaks;
+
+		double Gain = 0.0;
+		double GainError = 0.0;
+		double Pedestal = 0.0;
+		double Resolution = 0.0;
+
+		// It needs at least two peaks
+		bool IsValid() const { return Peaks.size() >= 2; }
+	};
+
+	// Fits the histogram counts of bins of binWidth that start at 0
+	PESpectrumFit fit_pe_spectrum(const std::vector<uint64_t>& counts,
+		const double& binWidth, const PESpectrumConfig& config) noexcept;
+
+	class peSpectrum {
+		using clock = std::chrono::steady_clock;
+
+		PESpectrumConfig _config;
+		double _binWidth = 1.0;
+		// Index is the channel number
+		std::vector<std::vector<uint64_t>> _histograms;
+		std::vector<uint64_t> _entries;
+
+		std::future<std::vector<PESpectrumFit>> _fitting;
+		clock::time_point _lastFit;
+		std::vector<PESpectrumFit> _fits;
+
+		// Copies the histograms and fits them in another thread
+		void start_fit();
+
+public:
+		peSpectrum() = default;
+
+		// No copying, it could be fitting
+		peSpectrum(const peSpectrum&) = delete;
+
+		// Anything added is lost
+		void configure(const PESpectrumConfig& config);
+
+		// Empties the histograms and forgets the fits
+		void clear();
+
+		bool IsEnabled() const { return _config.Enabled; }
+
+		void add(const SiPMPulse& pulse) noexcept {
+			if(!_config.Enabled || pulse.Integral < 0.0f) {
+				return;
+			}
+
+			const auto bin = static_cast<uint64_t>(pulse.Integral / _binWidth);
+			if(bin >= _config.NumBins) {
+				return;
+			}
+
+			// Only the first pulse of each channel allocates
+			if(pulse.Channel >= _histograms.size()) {
+				_histograms.resize(pulse.Channel + 1);
+				_entries.resize(pulse.Channel + 1, 0);
+			}
+
+			auto& hist = _histograms[pulse.Channel];
+			if(hist.empty()) {
+				hist.resize(_config.NumBins, 0);
+			}
+
+			hist[bin]++;
+			_entries[pulse.Channel]++;
+		}
+
+		void add(const std::vector<SiPMPulse>& pulses) noexcept {
+			for(const auto& pulse : pulses) {
+				add(pulse);
+			}
+		}
+
+		// Picks up the fits if they are done and starts new ones if it
+		// is time. Returns true if there are new fits.
+		bool update();
+
+		// Waits for the fits running and fits everything added until now
+		void finish();
+
+		// Of every channel with enough pulses, by channel number
+		const std::vector<PESpectrumFit>& GetFits() const { return _fits; }
+
+		// Mean of the gains of the good fits, 0 if none
+		double GetGain() const;
+	};
+
+} // namespace SBCQueens
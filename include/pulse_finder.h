@@ -0,0 +1,255 @@
+#pragma once
+
+/*
+
+	Pulse finder of the SiPM traces.
+
+	For every trace it calculates the baseline (mean of the first
+	BaselineSamples, the pre-trigger region, unless it is given) and
+	looks for the samples more than Threshold counts away from it in the
+	direction of the pulses. Each group of them is a pulse:
+
+		Start 		first sample over threshold
+		Width 		samples until it goes back under threshold
+					(minus Hysteresis, so noise does not split it)
+		PeakTime 	sample furthest from the baseline
+		Amplitude 	counts between the peak and the baseline
+		Integral 	sum of the samples minus the baseline from PreSamples
+					before Start to PostSamples after the end, in
+					counts*samples
+
+	Amplitude and Integral are positive for both polarities.
+
+	Most of a trace is just the baseline, so the search for the next
+	sample over threshold is vectorized: 16 samples at a time with AVX2
+	if the compiler has it enabled (-mavx2, see USE_AVX2 in
+	CMakeLists.txt), 8 with SSE2 (always in x86-64) or one by one
+	otherwise. The pulses themselves are short and done one by one.
+	All the paths find the same pulses.
+
+	It does not keep any state, so it can be called from any number of
+	threads at the same time.
+
+		std::vector<SiPMPulse> pulses;
+		float baseline = find_pulses(data, size, config, ch, pulses);
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SBC_PULSE_FINDER_SSE2
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace SBCQueens {
+
+	enum class PulsePolarity { Positive, Negative };
+
+	struct PulseFinderConfig {
+		// Direction of the pulses from the baseline
+		PulsePolarity Polarity = PulsePolarity::Positive;
+		// Counts away from the baseline for a pulse to start
+		uint16_t Threshold = 20;
+		// A pulse ends when it is Threshold - Hysteresis away or closer
+		uint16_t Hysteresis = 5;
+		// Samples at the start used to calculate the baseline
+		uint32_t BaselineSamples = 16;
+		// Samples integrated before and after the pulse
+		uint32_t PreSamples = 2;
+		uint32_t PostSamples = 8;
+		// Pulses kept per trace, the rest are ignored. 0 = all
+		uint32_t MaxPulses = 64;
+	};
+
+	// 20 bytes per pulse
+	struct SiPMPulse {
+		uint32_t Start = 0;
+		uint32_t PeakTime = 0;
+		uint16_t Width = 0;
+		uint8_t Channel = 0;
+		// Set if the pulse is still going at the end of the trace
+		bool Truncated = false;
+		float Amplitude = 0.0f;
+		float Integral = 0.0f;
+	};
+
+	// Sum of the samples in [start, end)
+	inline uint64_t pulse_sum(const uint16_t* in, size_t i,
+		const size_t& end) noexcept {
+		uint64_t sum = 0;
+#ifdef SBC_PULSE_FINDER_SSE2
+		// 32 bits lanes are enough for 65536 samples each
+		const __m128i zero = _mm_setzero_si128();
+		while(i + 8 <= end) {
+			__m128i acc = _mm_setzero_si128();
+			const size_t block_end = std::min(end, i + 8*65536);
+			for(; i + 8 <= block_end; i += 8) {
+				const __m128i x = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(in + i));
+				acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(x, zero));
+				acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(x, zero));
+			}
+
+			alignas(16) uint32_t lanes[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+			sum += uint64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+		}
+#endif
+		for(const uint16_t* x = in + i; x < in + end; x++) {
+			sum += *x;
+		}
+
+		return sum;
+	}
+
+	// First sample from i that is over level (Positive) or under level
+	// (Negative), or n if there is none.
+	inline size_t pulse_next_over(const uint16_t* in, size_t i,
+		const size_t& n, const uint16_t& level,
+		const PulsePolarity& polarity) noexcept {
+		const bool positive = polarity == PulsePolarity::Positive;
+#ifdef SBC_PULSE_FINDER_SSE2
+		// There are only signed comparisons, so everything is moved by
+		// 0x8000 to keep the order of the unsigned values
+		const auto biased = static_cast<short>(level ^ 0x8000);
+#ifdef __AVX2__
+		const __m256i bias8 = _mm256_set1_epi16(static_cast<short>(0x8000));
+		const __m256i l8 = _mm256_set1_epi16(biased);
+		for(; i + 16 <= n; i += 16) {
+			const __m256i x = _mm256_xor_si256(bias8, _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(in + i)));
+			const __m256i over = positive ? _mm256_cmpgt_epi16(x, l8)
+				: _mm256_cmpgt_epi16(l8, x);
+			const auto mask = static_cast<uint32_t>(
+				_mm256_movemask_epi8(over));
+			if(mask != 0) {
+				return i + __builtin_ctz(mask) / 2;
+			}
+		}
+#endif
+		const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+		const __m128i l = _mm_set1_epi16(biased);
+		for(; i + 8 <= n; i += 8) {
+			const __m128i x = _mm_xor_si128(bias, _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(in + i)));
+			const __m128i over = positive ? _mm_cmpgt_epi16(x, l)
+				: _mm_cmplt_epi16(x, l);
+			const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(over));
+			if(mask != 0) {
+				return i + __builtin_ctz(mask) / 2;
+			}
+		}
+#endif
+		for(; i < n; i++) {
+			if(positive ? in[i] > level : in[i] < level) {
+				return i;
+			}
+		}
+
+		return n;
+	}
+
+	// Mean of the first BaselineSamples of the trace
+	inline float pulse_baseline(const uint16_t* in, const size_t& n,
+		const PulseFinderConfig& config) noexcept {
+		const size_t num_baseline = std::min<size_t>(config.BaselineSamples, n);
+		if(num_baseline == 0) {
+			return 0.0f;
+		}
+
+		return static_cast<float>(pulse_sum(in, 0, num_baseline))
+			/ num_baseline;
+	}
+
+	// Adds the pulses of the n samples of in to out, with the baseline
+	// given, ex: from baseline_tracker.h. channel is only copied to the
+	// pulses.
+	inline void find_pulses(const uint16_t* in, const size_t& n,
+		const PulseFinderConfig& config, const uint8_t& channel,
+		const float& baseline, std::vector<SiPMPulse>& out) noexcept {
+		if(n == 0) {
+			return;
+		}
+
+		// Over threshold is x > floor(baseline + threshold) for
+		// positive pulses and x < ceil(baseline - threshold) for negative
+		const bool positive = config.Polarity == PulsePolarity::Positive;
+		const int32_t sign = positive ? 1 : -1;
+		const int32_t level = positive ?
+			static_cast<int32_t>(std::floor(baseline + config.Threshold))
+			: static_cast<int32_t>(std::ceil(baseline - config.Threshold));
+		if(positive ? level >= 0xFFFF : level <= 0) {
+			return;
+		}
+		const int32_t end_level = level - sign*config.Hysteresis;
+
+		uint32_t num_pulses = 0;
+		// Where the integral of the previous pulse ended, so they do
+		// not count the same samples twice
+		size_t last_end = 0;
+		size_t i = pulse_next_over(in, 0, n, static_cast<uint16_t>(level),
+			config.Polarity);
+		while(i < n) {
+			if(config.MaxPulses > 0 && num_pulses >= config.MaxPulses) {
+				break;
+			}
+
+			SiPMPulse pulse;
+			pulse.Channel = channel;
+			pulse.Start = static_cast<uint32_t>(i);
+
+			int32_t peak = sign*static_cast<int32_t>(in[i]);
+			pulse.PeakTime = pulse.Start;
+			for(; i < n && sign*(static_cast<int32_t>(in[i]) - end_level) > 0;
+				i++) {
+				const int32_t x = sign*static_cast<int32_t>(in[i]);
+				if(x > peak) {
+					peak = x;
+					pulse.PeakTime = static_cast<uint32_t>(i);
+				}
+			}
+
+			pulse.Width = static_cast<uint16_t>(std::min<size_t>(
+				i - pulse.Start, 0xFFFF));
+			pulse.Truncated = i == n;
+			pulse.Amplitude = static_cast<float>(peak) - sign*baseline;
+
+			const size_t int_start = std::max<size_t>(last_end,
+				pulse.Start > config.PreSamples ?
+				pulse.Start - config.PreSamples : 0);
+			const size_t int_end = std::min(n, i + config.PostSamples);
+			const double sum = static_cast<double>(
+				pulse_sum(in, int_start, int_end));
+			pulse.Integral = static_cast<float>(sign*(sum
+				- static_cast<double>(baseline)*(int_end - int_start)));
+			last_end = int_end;
+
+			out.push_back(pulse);
+			num_pulses++;
+
+			i = pulse_next_over(in, i, n, static_cast<uint16_t>(level),
+				config.Polarity);
+		}
+	}
+
+	// Adds the pulses of the n samples of in to out and returns the
+	// baseline. channel is only copied to the pulses.
+	inline float find_pulses(const uint16_t* in, const size_t& n,
+		const PulseFinderConfig& config, const uint8_t& channel,
+		std::vector<SiPMPulse>& out) noexcept {
+		const float baseline = pulse_baseline(in, n, config);
+		find_pulses(in, n, config, channel, baseline, out);
+		return baseline;
+	}
+
+} // namespace SBCQueens
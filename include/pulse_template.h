@@ -0,0 +1,138 @@
+#pragma once
+
+/*
+
+	Average pulse shape (template) of every channel, built while taking
+	data from the traces with a single pulse of an amplitude in
+	[MinAmplitude, MaxAmplitude] (ex: the 1 PE ones).
+
+	Each pulse is placed in time by its peak (a parabola through the
+	largest sample and its neighbours) or by where it crossed the
+	threshold (a line between the samples at each side), to a fraction
+	of a sample. That fraction picks one of Oversampling phases, and the
+	Samples + 1 samples around it, PreSamples before, are added to the
+	32 bit sums of that phase, 16 (AVX2) or 8 (SSE2) samples at a time.
+	The noise moves the peak of a round pulse more than its rising edge,
+	so Threshold gives a sharper template unless the pulses are fast.
+	Then the phases together make the template with Oversampling points
+	per sample:
+
+		template[g] at g/Oversampling - PreSamples samples from the pulse
+
+	Adding a pulse is O(Samples) and does not allocate, everything is
+	allocated in configure(...). The sums can take 65536 pulses per
+	phase, after that the phase is full and the new pulses are ignored.
+
+		pulseTemplates templates;
+		templates.configure(config, pulse_config, channels);
+		templates.add(ch, data, size, pulses, num_pulses);
+		auto shape = templates.GetTemplate(ch);
+		// ex: for optimal_filter.h, n samples with its time at sample 32
+		auto filter_template = templates.GetSampledTemplate(ch, n, 32);
+
+	It is not thread safe, add(...) and the Get functions have to be
+	called from the same thread or with a lock.
+
+*/
+
+// STD includes
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// my includes
+#include "pulse_finder.h"
+
+namespace SBCQueens {
+
+	enum class TemplateAlignment { Peak, Threshold };
+
+	const std::unordered_map<std::string, TemplateAlignment>
+		TemplateAlignment_map = {
+		{"Peak", TemplateAlignment::Peak},
+		{"Threshold", TemplateAlignment::Threshold}
+	};
+
+	struct PulseTemplateConfig {
+		bool Enabled = false;
+		TemplateAlignment Alignment = TemplateAlignment::Peak;
+		// Only traces with one pulse in this range of amplitudes
+		float MinAmplitude = 0.0f;
+		float MaxAmplitude = 65535.0f;
+		// Samples of the template and how many before the pulse time
+		uint32_t Samples = 256;
+		uint32_t PreSamples = 32;
+		// Points per sample
+		uint32_t Oversampling = 4;
+	};
+
+	// Adds size samples of in to sums
+	void template_accumulate(uint32_t* sums, const uint16_t* in,
+		const size_t& size) noexcept;
+
+	class pulseTemplates {
+		struct channelSums {
+			// Oversampling rows of Samples + 1
+			std::vector<uint32_t> Sums;
+			std::vector<uint32_t> Counts;
+			// Of the baselines, per phase
+			std::vector<double> Baselines;
+			uint64_t Total = 0;
+		};
+
+		PulseTemplateConfig _config;
+		PulseFinderConfig _pulseConfig;
+		std::vector<uint8_t> _channels;
+		// Index of each channel number in _channels, -1 if not there
+		std::vector<int> _channelIndex;
+		std::vector<channelSums> _sums;
+
+		// Time of the pulse in samples from the start of the trace
+		double pulse_time(const uint16_t* data, const uint32_t& size,
+			const float& baseline, const SiPMPulse& pulse) const noexcept;
+
+public:
+		pulseTemplates() = default;
+
+		// Anything added is lost. channels are the channel numbers that
+		// will be added, ex: enabled_channels(...)
+		void configure(const PulseTemplateConfig& config,
+			const PulseFinderConfig& pulseConfig,
+			const std::vector<uint8_t>& channels);
+
+		// Starts over, keeps the memory
+		void reset() noexcept;
+
+		bool IsEnabled() const { return _config.Enabled; }
+		const PulseTemplateConfig& GetConfig() const { return _config; }
+		const std::vector<uint8_t>& GetChannels() const { return _channels; }
+
+		// Adds the trace of channel ch if it has a single pulse that
+		// passes the selection. pulses are all the pulses of its event.
+		// Returns true if it was added.
+		bool add(const uint8_t& ch, const uint16_t* data, const uint32_t& size,
+			const float& baseline, const SiPMPulse* pulses,
+			const size_t& numPulses) noexcept;
+
+		// Same, with the baseline of the pulse finder
+		bool add(const uint8_t& ch, const uint16_t* data, const uint32_t& size,
+			const SiPMPulse* pulses, const size_t& numPulses) noexcept {
+			return add(ch, data, size, data ? pulse_baseline(data, size,
+				_pulseConfig) : 0.0f, pulses, numPulses);
+		}
+
+		// Pulses added to the template of ch
+		uint64_t GetCount(const uint8_t& ch) const noexcept;
+
+		// Samples*Oversampling points, minus the baseline, in ADC counts.
+		// The phases without pulses are 0.
+		std::vector<float> GetTemplate(const uint8_t& ch) const;
+
+		// size samples (not oversampled) with the pulse time at sample
+		// at, 0 outside of the template. Normalized to a peak of 1 (or -1)
+		std::vector<float> GetSampledTemplate(const uint8_t& ch,
+			const size_t& size, const uint32_t& at) const;
+	};
+
+} // namespace SBCQueens
@@ -0,0 +1,194 @@
+#pragma once
+
+/*
+
+	FFT of real data of a power of two size n, without any libraries. It
+	does a complex FFT of n/2 points (the even samples as the real part
+	and the odd ones as the imaginary) and splits it into the n/2 + 1
+	bins of the real one, so it is about twice as fast as a complex FFT.
+
+		auto fft = real_fft_plan(real_fft_size(record_length));
+		fft->forward(in, spectrum); 	// n/2 + 1 bins
+		fft->inverse(spectrum, out); 	// out == in
+
+	forward is not normalized and inverse is divided by n. The plans are
+	made once per size and cached, and they do not change after, so any
+	number of threads can use the same one at the same time.
+
+*/
+
+// STD includes
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace SBCQueens {
+
+	// Smallest power of two >= n, at least 4
+	inline size_t real_fft_size(const size_t& n) noexcept {
+		size_t size = 4;
+		while(size < n) {
+			size <<= 1;
+		}
+		return size;
+	}
+
+	class realFFT {
+		using complex = std::complex<float>;
+
+		size_t _n;
+		size_t _m;
+		std::vector<uint32_t> _bitReverse;
+		// e^(-2 pi i k/m) for k < m/2
+		std::vector<complex> _twiddles;
+		// e^(-2 pi i k/n) for k <= m/2, to split the halves
+		std::vector<complex> _split;
+
+		// std::complex * checks for nans and infs, which is slow
+		static complex mul(const complex& a, const complex& b) noexcept {
+			return {a.real()*b.real() - a.imag()*b.imag(),
+				a.real()*b.imag() + a.imag()*b.real()};
+		}
+
+		static complex conj_mul(const complex& a, const complex& b) noexcept {
+			return {a.real()*b.real() + a.imag()*b.imag(),
+				a.imag()*b.real() - a.real()*b.imag()};
+		}
+
+		// In place, forward, m points
+		void complex_fft(complex* z) const noexcept {
+			for(size_t i = 0; i < _m; i++) {
+				const size_t j = _bitReverse[i];
+				if(i < j) {
+					std::swap(z[i], z[j]);
+				}
+			}
+
+			for(size_t len = 2; len <= _m; len <<= 1) {
+				const size_t half = len / 2;
+				const size_t step = _m / len;
+				for(size_t s = 0; s < _m; s += len) {
+					for(size_t k = 0; k < half; k++) {
+						const complex a = z[s + k];
+						const complex b = mul(z[s + k + half],
+							_twiddles[k*step]);
+						z[s + k] = a + b;
+						z[s + k + half] = a - b;
+					}
+				}
+			}
+		}
+
+public:
+		// n has to be a power of two and at least 4
+		explicit realFFT(const size_t& n) : _n(n), _m(n / 2) {
+			_bitReverse.resize(_m);
+			size_t bits = 0;
+			while((size_t(1) << bits) < _m) {
+				bits++;
+			}
+
+			for(size_t i = 0; i < _m; i++) {
+				size_t r = 0;
+				for(size_t b = 0; b < bits; b++) {
+					r |= ((i >> b) & 1) << (bits - 1 - b);
+				}
+				_bitReverse[i] = static_cast<uint32_t>(r);
+			}
+
+			// In double so large sizes are still accurate
+			const double pi = std::acos(-1.0);
+			_twiddles.resize(_m / 2);
+			for(size_t k = 0; k < _m / 2; k++) {
+				const double a = -2.0*pi*k / _m;
+				_twiddles[k] = complex(static_cast<float>(std::cos(a)),
+					static_cast<float>(std::sin(a)));
+			}
+
+			_split.resize(_m / 2 + 1);
+			for(size_t k = 0; k <= _m / 2; k++) {
+				const double a = -2.0*pi*k / _n;
+				_split[k] = complex(static_cast<float>(std::cos(a)),
+					static_cast<float>(std::sin(a)));
+			}
+		}
+
+		size_t size() const noexcept { return _n; }
+		size_t bins() const noexcept { return _m + 1; }
+
+		// n samples of in to the n/2 + 1 bins of out
+		void forward(const float* in, complex* out) const noexcept {
+			for(size_t j = 0; j < _m; j++) {
+				out[j] = complex(in[2*j], in[2*j + 1]);
+			}
+
+			complex_fft(out);
+
+			// Z = FFT(even) + i FFT(odd), so with b = conj(Z[m - k]):
+			// X[k] = (Z[k] + b)/2 - i e^(-2 pi i k/n) (Z[k] - b)/2
+			const complex z0 = out[0];
+			out[0] = complex(z0.real() + z0.imag(), 0.0f);
+			out[_m] = complex(z0.real() - z0.imag(), 0.0f);
+			for(size_t k = 1; k <= _m / 2; k++) {
+				const complex a = out[k];
+				const complex b = std::conj(out[_m - k]);
+				const complex even = 0.5f*(a + b);
+				const complex odd = 0.5f*(a - b);
+				// -i*odd
+				const complex odd_i(odd.imag(), -odd.real());
+				out[k] = even + mul(_split[k], odd_i);
+				if(k != _m - k) {
+					// Same for m - k, its twiddle is -conj(_split[k])
+					out[_m - k] = std::conj(even)
+						- mul(std::conj(_split[k]), std::conj(odd_i));
+				}
+			}
+		}
+
+		// The n/2 + 1 bins of in to the n samples of out
+		void inverse(const complex* in, float* out) const noexcept {
+			// out is used for the n/2 complex points on the way
+			auto z = reinterpret_cast<complex*>(out);
+
+			// FFT(even) = (X[k] + conj(X[m - k]))/2 and
+			// FFT(odd) = (X[k] - conj(X[m - k]))/2 e^(2 pi i k/n)
+			for(size_t k = 0; k < _m; k++) {
+				const complex a = in[k];
+				const complex b = std::conj(in[_m - k]);
+				const complex twiddle = k <= _m / 2 ? _split[k]
+					: -std::conj(_split[_m - k]);
+				const complex even = 0.5f*(a + b);
+				const complex odd = conj_mul(0.5f*(a - b), twiddle);
+				// Inverse with the forward one: conj(FFT(conj(Z)))
+				z[k] = std::conj(even + complex(-odd.imag(), odd.real()));
+			}
+
+			complex_fft(z);
+
+			const float scale = 1.0f / _m;
+			for(size_t j = 0; j < _m; j++) {
+				z[j] = std::conj(z[j])*scale;
+			}
+		}
+	};
+
+	// The plan of size n, made the first time
+	inline std::shared_ptr<const realFFT> real_fft_plan(const size_t& n) {
+		static std::mutex mutex;
+		static std::map<size_t, std::shared_ptr<const realFFT>> plans;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		auto& plan = plans[n];
+		if(!plan) {
+			plan = std::make_shared<const realFFT>(n);
+		}
+		return plan;
+	}
+
+} // namespace SBCQueens
@@ -0,0 +1,209 @@
+#pragma once
+
+/*
+
+	Zero suppression of the digitizer traces (roi16).
+
+	Most triggers have one short pulse in a long record and many channels
+	have nothing at all. Only the regions of interest (ROI) around the
+	samples that are far from the baseline are kept:
+
+		uint16 			baseline (mean of the first samples)
+		uint32 			number of regions, 0 = nothing in this channel
+		then, for every region:
+		uint32 			first sample
+		uint32 			number of samples
+		uint16[n] 		samples
+
+	A sample is in a region if |sample - baseline| > Threshold. Regions
+	are extended by PadBefore and PadAfter samples and merged if they
+	touch. When decoding, everything outside of the regions is the
+	baseline, so it is NOT lossless: the noise outside is lost.
+
+	If the regions would take more space than the raw trace, the whole
+	trace is saved as a single region, so it is never bigger than
+	roi_max_size(n).
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SBC_ROI_CODEC_SSE2
+#endif
+
+namespace SBCQueens {
+
+	struct ROIConfig {
+		// Counts away from the baseline for a sample to be kept
+		uint16_t Threshold = 20;
+		// Samples kept before and after the ones above threshold
+		uint32_t PadBefore = 16;
+		uint32_t PadAfter = 32;
+		// Samples at the start used to calculate the baseline
+		uint32_t BaselineSamples = 64;
+	};
+
+	constexpr size_t ROIHeaderSize = sizeof(uint16_t) + sizeof(uint32_t);
+	constexpr size_t ROIRegionHeaderSize = 2*sizeof(uint32_t);
+
+	// Largest number of bytes roi_encode(...) can return for a trace
+	// of n samples
+	inline size_t roi_max_size(const size_t& n) noexcept {
+		return ROIHeaderSize + ROIRegionHeaderSize + n*sizeof(uint16_t);
+	}
+
+	// First sample from i that is more than threshold away from baseline,
+	// or n if there is none.
+	inline size_t roi_next_active(const uint16_t* in, size_t i,
+		const size_t& n, const uint16_t& baseline,
+		const uint16_t& threshold) noexcept {
+#ifdef SBC_ROI_CODEC_SSE2
+		// |x - b| with saturation then (|x - b| - threshold) != 0
+		const __m128i b = _mm_set1_epi16(static_cast<short>(baseline));
+		const __m128i t = _mm_set1_epi16(static_cast<short>(threshold));
+		const __m128i zero = _mm_setzero_si128();
+		for(; i + 8 <= n; i += 8) {
+			const __m128i x = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(in + i));
+			const __m128i diff = _mm_or_si128(_mm_subs_epu16(x, b),
+				_mm_subs_epu16(b, x));
+			const __m128i over = _mm_cmpeq_epi16(_mm_subs_epu16(diff, t),
+				zero);
+			if(_mm_movemask_epi8(over) != 0xFFFF) {
+				break;
+			}
+		}
+#endif
+		for(; i < n; i++) {
+			const uint16_t diff = in[i] > baseline ?
+				in[i] - baseline : baseline - in[i];
+			if(diff > threshold) {
+				return i;
+			}
+		}
+
+		return n;
+	}
+
+	// Encodes n samples of in into out, which has to have at least
+	// roi_max_size(n) bytes. Returns the number of bytes written.
+	inline size_t roi_encode(const uint16_t* in, const size_t& n,
+		const ROIConfig& config, char* out) noexcept {
+		const size_t num_baseline = std::min<size_t>(config.BaselineSamples, n);
+		uint64_t sum = 0;
+		for(size_t i = 0; i < num_baseline; i++) {
+			sum += in[i];
+		}
+
+		const auto baseline = static_cast<uint16_t>(num_baseline > 0 ?
+			(sum + num_baseline/2) / num_baseline : 0);
+		std::memcpy(out, &baseline, sizeof(uint16_t));
+
+		const size_t max_size = roi_max_size(n);
+		size_t pos = ROIHeaderSize;
+		uint32_t num_regions = 0;
+		bool too_big = false;
+
+		size_t i = roi_next_active(in, 0, n, baseline, config.Threshold);
+		while(i < n) {
+			const size_t start = i > config.PadBefore ? i - config.PadBefore : 0;
+			size_t end = std::min(n, i + config.PadAfter + 1);
+
+			// Anything active before end + PadBefore would overlap this
+			// region once padded, so it is the same region
+			i = roi_next_active(in, i + 1, n, baseline, config.Threshold);
+			while(i < n && i < end + config.PadBefore) {
+				end = std::min(n, i + config.PadAfter + 1);
+				i = roi_next_active(in, i + 1, n, baseline, config.Threshold);
+			}
+
+			const size_t length = end - start;
+			if(pos + ROIRegionHeaderSize + length*sizeof(uint16_t)
+				> max_size) {
+				too_big = true;
+				break;
+			}
+
+			const auto region = std::array<uint32_t, 2>{
+				static_cast<uint32_t>(start), static_cast<uint32_t>(length)};
+			std::memcpy(out + pos, region.data(), ROIRegionHeaderSize);
+			std::memcpy(out + pos + ROIRegionHeaderSize, in + start,
+				length*sizeof(uint16_t));
+			pos += ROIRegionHeaderSize + length*sizeof(uint16_t);
+			num_regions++;
+		}
+
+		// Not worth it, the whole trace then
+		if(too_big) {
+			num_regions = 1;
+			const auto region = std::array<uint32_t, 2>{
+				0, static_cast<uint32_t>(n)};
+			std::memcpy(out + ROIHeaderSize, region.data(),
+				ROIRegionHeaderSize);
+			std::memcpy(out + ROIHeaderSize + ROIRegionHeaderSize, in,
+				n*sizeof(uint16_t));
+			pos = max_size;
+		}
+
+		std::memcpy(out + sizeof(uint16_t), &num_regions, sizeof(uint32_t));
+		return pos;
+	}
+
+	// Decodes in into n samples of out. The samples outside of the
+	// regions are set to the baseline. Returns the number of bytes of in
+	// that were used, or 0 if in is not valid.
+	inline size_t roi_decode(const char* in, const size_t& in_size,
+		uint16_t* out, const size_t& n) noexcept {
+		if(in_size < ROIHeaderSize) {
+			return 0;
+		}
+
+		uint16_t baseline;
+		uint32_t num_regions;
+		std::memcpy(&baseline, in, sizeof(uint16_t));
+		std::memcpy(&num_regions, in + sizeof(uint16_t), sizeof(uint32_t));
+		std::fill_n(out, n, baseline);
+
+		size_t pos = ROIHeaderSize;
+		for(uint32_t r = 0; r < num_regions; r++) {
+			if(pos + ROIRegionHeaderSize > in_size) {
+				return 0;
+			}
+
+			uint32_t region[2];
+			std::memcpy(region, in + pos, ROIRegionHeaderSize);
+			pos += ROIRegionHeaderSize;
+
+			const uint64_t start = region[0];
+			const uint64_t length = region[1];
+			if(start + length > n
+				|| pos + length*sizeof(uint16_t) > in_size) {
+				return 0;
+			}
+
+			std::memcpy(out + start, in + pos, length*sizeof(uint16_t));
+			pos += length*sizeof(uint16_t);
+		}
+
+		return pos;
+	}
+
+	// Number of regions of an encoded channel, 0 = no activity
+	inline uint32_t roi_num_regions(const char* in,
+		const size_t& in_size) noexcept {
+		uint32_t num_regions = 0;
+		if(in_size >= ROIHeaderSize) {
+			std::memcpy(&num_regions, in + sizeof(uint16_t), sizeof(uint32_t));
+		}
+
+		return num_regions;
+	}
+
+} // namespace SBCQueens
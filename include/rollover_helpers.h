@@ -0,0 +1,322 @@
+#pragma once
+
+/*
+
+	Splits a long run file into segments.
+
+	Whenever one of the policies is met, the DataFile is swapped with the
+	next segment, which was already opened (and had its header written)
+	in the background. The old segment is closed and fsync'd in the
+	background, too, so the thread that saves never waits for the disk.
+
+	Every closed segment is appended to a manifest file, a small csv
+	with one line per segment.
+
+*/
+
+// STD includes
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// 3rd party includes
+#include <spdlog/spdlog.h>
+
+// my includes
+#include "file_helpers.h"
+
+namespace SBCQueens {
+
+	// When to move to the next file. 0 disables that policy.
+	struct RolloverPolicy {
+		uint64_t MaxBytes = 0;
+		uint64_t MaxEvents = 0;
+		std::chrono::seconds MaxDuration = std::chrono::seconds(0);
+
+		bool IsEnabled() const {
+			return MaxBytes > 0 || MaxEvents > 0 || MaxDuration.count() > 0;
+		}
+	};
+
+	// What is known of each segment once it is closed.
+	struct RolloverSegment {
+		uint32_t Number = 0;
+		std::string FileName;
+		uint64_t Events = 0;
+		uint64_t Bytes = 0;
+		// Unix time in seconds
+		int64_t StartTime = 0;
+		int64_t EndTime = 0;
+	};
+
+	template<typename T>
+	class fileRollover {
+		// Called right before a segment is closed, in the thread that
+		// saves. Anything written to the file here ends up in it.
+		using CloseHook = std::function<void(DataFile<T>&)>;
+		// Called in the background once a segment is closed
+		using ClosedHook = std::function<void(const RolloverSegment&)>;
+
+		RolloverPolicy _policy;
+		FileOptions _options;
+
+		// Segment n is named _baseName + "_n" + _extension
+		// except the first one which is _baseName + _extension
+		std::string _baseName;
+		std::string _extension;
+		std::string _header;
+
+		uint32_t _segmentNumber;
+		int64_t _segmentStart;
+
+		// The next segment and if it was opened by this rollover, not
+		// found already there (ex: from an earlier run with the same name)
+		struct preparedSegment {
+			DataFile<T> File;
+			bool Created = false;
+		};
+
+		std::future<preparedSegment> _nextFile;
+		std::vector<std::future<void>> _closingFiles;
+
+		std::mutex _manifestMutex;
+		std::vector<RolloverSegment> _segments;
+		// How long each closed segment took to get to the disk
+		LatencyHistogram _syncLatency;
+
+		CloseHook _onClose;
+		ClosedHook _onClosed;
+
+		static int64_t now() {
+			return std::chrono::duration_cast<std::chrono::seconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+		}
+
+		std::string segment_name(const uint32_t& n) const {
+			if(n == 0) {
+				return _baseName + _extension;
+			}
+
+			std::ostringstream out;
+			out << _baseName << "_" << std::setw(3) << std::setfill('0')
+				<< n << _extension;
+			return out.str();
+		}
+
+		DataFile<T> open_segment(const uint32_t& n) const {
+			auto file = std::make_unique<dataFile<T>>(_options,
+				segment_name(n),
+				[](const std::string& h) { return h; }, _header);
+
+			if(!file->IsOpen()) {
+				spdlog::error("Could not open file segment {0}",
+					file->GetFileName());
+			}
+
+			return file;
+		}
+
+		void prepare_next() {
+			_nextFile = std::async(std::launch::async,
+				[this, n = _segmentNumber + 1]() {
+				preparedSegment next;
+				std::error_code ec;
+				next.Created = !std::filesystem::exists(segment_name(n), ec)
+					&& !ec;
+				next.File = open_segment(n);
+				return next;
+			});
+		}
+
+		// Moves file out, and closes it in the background.
+		void close_in_background(DataFile<T>& file) {
+			if(_onClose) {
+				_onClose(file);
+			}
+
+			RolloverSegment seg;
+			seg.Number = _segmentNumber;
+			seg.FileName = file->GetFileName();
+			seg.Events = file->GetItemsRetrieved();
+			seg.Bytes = file->GetBytesWritten();
+			seg.StartTime = _segmentStart;
+			seg.EndTime = now();
+
+			_closingFiles.push_back(std::async(std::launch::async,
+				[this, seg, old = std::move(file)]() mutable {
+					old.reset();
+					if(_onClosed) {
+						_onClosed(seg);
+					}
+
+					const auto start = std::chrono::steady_clock::now();
+					if(!sync_file(seg.FileName)) {
+						spdlog::warn("Could not sync {0} to disk.",
+							seg.FileName);
+					}
+
+					{
+						std::lock_guard<std::mutex> lock(_manifestMutex);
+						_syncLatency.add(std::chrono::steady_clock::now()
+							- start);
+					}
+
+					add_to_manifest(seg);
+				}
+			));
+		}
+
+		void add_to_manifest(const RolloverSegment& seg) {
+			std::lock_guard<std::mutex> lock(_manifestMutex);
+			_segments.push_back(seg);
+
+			if(!_policy.IsEnabled()) {
+				return;
+			}
+
+			std::string manifest_name = _baseName + ".manifest";
+			bool is_new = !std::filesystem::exists(manifest_name);
+
+			std::ofstream manifest(manifest_name, std::ofstream::app);
+			if(is_new) {
+				manifest << "segment,file,events,bytes,start_time,end_time\n";
+			}
+
+			manifest << seg.Number << ","
+				<< std::filesystem::path(seg.FileName).filename().string()
+				<< "," << seg.Events << "," << seg.Bytes << ","
+				<< seg.StartTime << "," << seg.EndTime << "\n";
+		}
+
+public:
+		// baseName: file name (with directories) without extension
+		// extension: extension of all the segments, ex: ".bin"
+		// header: written at the start of every segment
+		fileRollover(const RolloverPolicy& policy, const FileOptions& opts,
+			const std::string& baseName, const std::string& extension,
+			const std::string& header) :
+			_policy(policy), _options(opts), _baseName(baseName),
+			_extension(extension), _header(header), _segmentNumber(0),
+			_segmentStart(now()) { }
+
+		// No copying nor moving, the background tasks point to this
+		fileRollover(fileRollover&&) = delete;
+		fileRollover(const fileRollover&) = delete;
+
+		~fileRollover() {
+			for(auto& f : _closingFiles) {
+				f.wait();
+			}
+		}
+
+		// f is called with each segment right before it is closed
+		void SetOnClose(CloseHook f) {
+			_onClose = f;
+		}
+
+		// f is called with each segment after it is closed
+		void SetOnClosed(ClosedHook f) {
+			_onClosed = f;
+		}
+
+		// Opens the first segment into file and starts opening the
+		// next one if there are any policies.
+		void start(DataFile<T>& file) {
+			file = open_segment(0);
+			_segmentStart = now();
+
+			if(_policy.IsEnabled()) {
+				prepare_next();
+			}
+		}
+
+		// Checks the policies and, if any is met, swaps file for the next
+		// segment. Returns true if the file changed.
+		// Only call it right after a save(...) so the queue of file is
+		// empty, anything left in it is lost.
+		bool operator()(DataFile<T>& file) {
+			if(!_policy.IsEnabled() || !file) {
+				return false;
+			}
+
+			bool rollover =
+				(_policy.MaxBytes > 0
+					&& file->GetBytesWritten() >= _policy.MaxBytes)
+				|| (_policy.MaxEvents > 0
+					&& file->GetItemsRetrieved() >= _policy.MaxEvents)
+				|| (_policy.MaxDuration.count() > 0
+					&& file->GetTimeOpen() >= _policy.MaxDuration);
+
+			if(!rollover) {
+				return false;
+			}
+
+			// If the disk is so slow that the next file is not ready,
+			// we keep writing to the current one instead of waiting.
+			if(_nextFile.wait_for(std::chrono::seconds(0))
+				!= std::future_status::ready) {
+				return false;
+			}
+
+			close_in_background(file);
+			file = std::move(_nextFile.get().File);
+
+			_segmentNumber++;
+			_segmentStart = now();
+			spdlog::info("Moving to file segment {0}", file->GetFileName());
+
+			prepare_next();
+			return true;
+		}
+
+		// Closes file, deletes the segment that was prepared but never
+		// used (only if it did not exist before) and waits for every file
+		// to be on disk.
+		void finish(DataFile<T>& file) {
+			if(file) {
+				close_in_background(file);
+			}
+
+			if(_nextFile.valid()) {
+				auto unused = _nextFile.get();
+				auto unused_name = unused.File->GetFileName();
+				unused.File.reset();
+				if(unused.Created) {
+					std::error_code ec;
+					std::filesystem::remove(unused_name, ec);
+				}
+			}
+
+			for(auto& f : _closingFiles) {
+				f.wait();
+			}
+			_closingFiles.clear();
+		}
+
+		// All the segments closed so far
+		std::vector<RolloverSegment> GetSegments() {
+			std::lock_guard<std::mutex> lock(_manifestMutex);
+			return _segments;
+		}
+
+		// fsync latency of the segments closed so far
+		LatencyHistogram GetSyncLatency() {
+			std::lock_guard<std::mutex> lock(_manifestMutex);
+			return _syncLatency;
+		}
+
+	};
+
+	template<typename T>
+	using FileRollover = std::unique_ptr<fileRollover<T>>;
+
+} // namespace SBCQueens
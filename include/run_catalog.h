@@ -0,0 +1,401 @@
+#pragma once
+
+/*
+
+	Catalog of the runs saved in a run directory (RunDir/RunName).
+
+	Every run adds a record to RunDir/RunName/catalog.sbcr when it
+	starts (its parameters) and another when it stops (its events, file
+	segments and results, ex: the gain), so nothing has to open the run
+	files to know what is in them:
+
+		RunCatalogEntry run;
+		run.StartTime = ...;
+		run.SiPMParameters = "VUV4 4OV";
+		catalog_add_start(catalog_name(run_dir), run);
+		// ... the run ...
+		catalog_add_stop(catalog_name(run_dir), run);
+
+	The file is a "SBCR" magic followed by the records:
+
+	uint32 				size of the payload
+	uint32 				crc32c of the payload
+	char[size] 			payload, its first byte is the record type
+
+	so a record is only added at the end, and one cut by a crash is
+	ignored when it is read. A run without a stop record was never
+	stopped properly.
+
+	runCatalog reads the catalogs (a few hundred bytes per run) and keeps
+	the runs sorted by start time to query them:
+
+		runCatalog catalog;
+		catalog.open(catalog_name(run_dir));
+		RunCatalogQuery query;
+		query.SiPM = "VUV4";
+		query.Parameters.push_back({"PeltierTempSetpoint", -101, -99});
+		for(const auto* run : catalog.query(query)) { ... }
+
+	It only depends on byte_io.h and crc32c.h, so it can be used by the
+	tools.
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+// my includes
+#include "byte_io.h"
+#include "crc32c.h"
+
+namespace SBCQueens {
+
+	// "SBCR" in little endian. First 4 bytes of a catalog.
+	constexpr uint32_t RunCatalogMagic = 0x52434253;
+
+	enum class RunCatalogRecord : uint8_t {
+		Start = 1,
+		Stop = 2
+	};
+
+	// Anything that describes a run with a number, ex: a setpoint
+	struct RunCatalogParameter {
+		std::string Name;
+		double Value = 0.0;
+	};
+
+	struct RunCatalogSegment {
+		// Without directories, they are next to the catalog
+		std::string FileName;
+		uint64_t Events = 0;
+		uint64_t Bytes = 0;
+	};
+
+	struct RunCatalogEntry {
+		// Unix time in ms. The start time is also what identifies the run.
+		uint64_t StartTime = 0;
+		// 0 if the run was never stopped
+		uint64_t EndTime = 0;
+
+		// Hash of the digitizer configuration, see caen_config_hash
+		uint64_t ConfigHash = 0;
+		std::string SiPMParameters;
+		// Name of the files without the segment number or extension
+		std::string FilePrefix;
+		std::vector<RunCatalogParameter> Parameters;
+
+		uint64_t Events = 0;
+		std::vector<RunCatalogSegment> Segments;
+		// Measured during the run, ex: the gain. Saved when it stops.
+		std::vector<RunCatalogParameter> Results;
+
+		bool IsStopped() const { return EndTime > 0; }
+
+		// Parameter or result, nullptr if the run does not have it
+		const double* GetParameter(const std::string& name) const {
+			for(const auto* pars : {&Parameters, &Results}) {
+				for(const auto& par : *pars) {
+					if(par.Name == name) {
+						return &par.Value;
+					}
+				}
+			}
+			return nullptr;
+		}
+	};
+
+	// Catalog of the run directory dir
+	inline std::string catalog_name(const std::string& dir) noexcept {
+		return (std::filesystem::path(dir) / "catalog.sbcr").string();
+	}
+
+	namespace run_catalog_internal {
+
+		// Appends a record with payload to the catalog fileName
+		inline bool append_record(const std::string& fileName,
+			const std::string& payload) noexcept {
+			std::error_code ec;
+			const bool is_new = !std::filesystem::exists(fileName, ec)
+				|| std::filesystem::file_size(fileName, ec) == 0;
+
+			std::ofstream file(fileName,
+				std::ofstream::binary | std::ofstream::app);
+			if(!file.is_open()) {
+				return false;
+			}
+
+			std::string out;
+			if(is_new) {
+				append_num(out, RunCatalogMagic);
+			}
+			append_num(out, static_cast<uint32_t>(payload.size()));
+			append_num(out, crc32c(payload.data(), payload.size()));
+			out += payload;
+
+			// At once, so another program reading it never sees half
+			file.write(out.data(), out.size());
+			file.flush();
+			return static_cast<bool>(file);
+		}
+
+	} // namespace run_catalog_internal
+
+	// Adds the start of run to the catalog fileName. It only uses the
+	// parameters, the file prefix and the start time.
+	inline bool catalog_add_start(const std::string& fileName,
+		const RunCatalogEntry& run) noexcept {
+		using namespace run_catalog_internal;
+		std::string payload;
+		append_num(payload, RunCatalogRecord::Start);
+		append_num(payload, run.StartTime);
+		append_num(payload, run.ConfigHash);
+		append_str(payload, run.SiPMParameters);
+		append_str(payload, run.FilePrefix);
+
+		append_num(payload, static_cast<uint16_t>(run.Parameters.size()));
+		for(const auto& par : run.Parameters) {
+			append_str(payload, par.Name);
+			append_num(payload, par.Value);
+		}
+
+		return append_record(fileName, payload);
+	}
+
+	// Adds the end of run (end time, events, segments and results) to
+	// the catalog fileName.
+	inline bool catalog_add_stop(const std::string& fileName,
+		const RunCatalogEntry& run) noexcept {
+		using namespace run_catalog_internal;
+		std::string payload;
+		append_num(payload, RunCatalogRecord::Stop);
+		append_num(payload, run.StartTime);
+		append_num(payload, run.EndTime);
+		append_num(payload, run.Events);
+
+		append_num(payload, static_cast<uint32_t>(run.Segments.size()));
+		for(const auto& seg : run.Segments) {
+			append_str(payload, seg.FileName);
+			append_num(payload, seg.Events);
+			append_num(payload, seg.Bytes);
+		}
+
+		append_num(payload, static_cast<uint16_t>(run.Results.size()));
+		for(const auto& par : run.Results) {
+			append_str(payload, par.Name);
+			append_num(payload, par.Value);
+		}
+
+		return append_record(fileName, payload);
+	}
+
+	// What to look for. Everything has to match.
+	struct RunCatalogQuery {
+		// Runs that started in [From, To], unix ms
+		uint64_t From = 0;
+		uint64_t To = std::numeric_limits<uint64_t>::max();
+
+		// Text that has to be in the SiPM parameters, empty = any
+		std::string SiPM;
+
+		struct Range {
+			std::string Name;
+			double Min = -std::numeric_limits<double>::infinity();
+			double Max = std::numeric_limits<double>::infinity();
+		};
+		// Parameters that have to be in [Min, Max]
+		std::vector<Range> Parameters;
+
+		// 0 = any
+		uint64_t ConfigHash = 0;
+		bool OnlyStopped = false;
+	};
+
+	class runCatalog {
+		// Sorted by start time
+		std::vector<RunCatalogEntry> _runs;
+		std::string _error;
+
+		RunCatalogEntry& find_or_add(const uint64_t& startTime) {
+			auto it = std::lower_bound(_runs.begin(), _runs.end(), startTime,
+				[](const RunCatalogEntry& run, const uint64_t& t) {
+					return run.StartTime < t;
+				});
+
+			if(it == _runs.end() || it->StartTime != startTime) {
+				it = _runs.insert(it, RunCatalogEntry());
+				it->StartTime = startTime;
+			}
+
+			return *it;
+		}
+
+		bool read_record(const char* ptr, const uint32_t& size,
+			const std::string& dir) {
+			payloadReader in{ptr, ptr + size};
+			const auto type = static_cast<RunCatalogRecord>(in.num<uint8_t>());
+			const auto start_time = in.num<uint64_t>();
+			// From a newer version, skipped
+			if(type != RunCatalogRecord::Start
+				&& type != RunCatalogRecord::Stop) {
+				return in.Ok;
+			}
+
+			auto& run = find_or_add(start_time);
+			if(type == RunCatalogRecord::Start) {
+				run.ConfigHash = in.num<uint64_t>();
+				run.SiPMParameters = in.str();
+				run.FilePrefix = (std::filesystem::path(dir)
+					/ in.str()).string();
+
+				run.Parameters.resize(in.num<uint16_t>());
+				for(auto& par : run.Parameters) {
+					par.Name = in.str();
+					par.Value = in.num<double>();
+				}
+			} else {
+				run.EndTime = in.num<uint64_t>();
+				run.Events = in.num<uint64_t>();
+
+				const auto num_segments = in.num<uint32_t>();
+				// Each one is at least 18 bytes
+				if(num_segments > size / 18) {
+					return false;
+				}
+
+				run.Segments.resize(num_segments);
+				for(auto& seg : run.Segments) {
+					seg.FileName = (std::filesystem::path(dir)
+						/ in.str()).string();
+					seg.Events = in.num<uint64_t>();
+					seg.Bytes = in.num<uint64_t>();
+				}
+
+				// Older catalogs do not have them
+				if(in.Ptr < in.End) {
+					run.Results.resize(in.num<uint16_t>());
+					for(auto& par : run.Results) {
+						par.Name = in.str();
+						par.Value = in.num<double>();
+					}
+				}
+			}
+
+			return in.Ok;
+		}
+
+public:
+		runCatalog() = default;
+
+		// Reads the catalog fileName and adds its runs to the ones
+		// already read. The file names of the runs get the directory of
+		// the catalog. Returns false if it could not read it at all.
+		bool open(const std::string& fileName) {
+			_error.clear();
+			std::ifstream file(fileName,
+				std::ifstream::binary | std::ifstream::ate);
+			if(!file.is_open()) {
+				_error = "Could not open " + fileName;
+				return false;
+			}
+
+			std::string data(static_cast<size_t>(file.tellg()), '\0');
+			file.seekg(0);
+			file.read(data.data(), data.size());
+
+			uint32_t magic = 0;
+			if(data.size() >= sizeof(uint32_t)) {
+				std::memcpy(&magic, data.data(), sizeof(uint32_t));
+			}
+
+			if(!file || magic != RunCatalogMagic) {
+				_error = fileName + " is not a run catalog";
+				return false;
+			}
+
+			const std::string dir
+				= std::filesystem::path(fileName).parent_path().string();
+			size_t pos = sizeof(uint32_t);
+			const size_t frame_size = 2*sizeof(uint32_t);
+			while(pos < data.size()) {
+				uint32_t size = 0, crc = 0;
+				if(data.size() - pos >= frame_size) {
+					std::memcpy(&size, &data[pos], sizeof(uint32_t));
+					std::memcpy(&crc, &data[pos + sizeof(uint32_t)],
+						sizeof(uint32_t));
+				}
+
+				const char* payload = data.data()
+					+ std::min(pos + frame_size, data.size());
+				// A cut or corrupted record is the end, ex: a crash
+				// while it was being written
+				if(data.size() - pos < frame_size
+					|| data.size() - pos - frame_size < size
+					|| crc32c(payload, size) != crc
+					|| !read_record(payload, size, dir)) {
+					_error = fileName + " has a bad record at byte "
+						+ std::to_string(pos);
+					break;
+				}
+
+				pos += frame_size + size;
+			}
+
+			return true;
+		}
+
+		// Why the last open(...) failed or stopped early
+		const std::string& GetError() const { return _error; }
+
+		const std::vector<RunCatalogEntry>& GetRuns() const { return _runs; }
+
+		// Runs that match, by start time
+		std::vector<const RunCatalogEntry*> query(
+			const RunCatalogQuery& q) const {
+			auto by_time = [](const RunCatalogEntry& run, const uint64_t& t) {
+				return run.StartTime < t;
+			};
+
+			auto first = std::lower_bound(_runs.begin(), _runs.end(), q.From,
+				by_time);
+			auto last = q.To == std::numeric_limits<uint64_t>::max()
+				? _runs.end()
+				: std::lower_bound(first, _runs.end(), q.To + 1, by_time);
+
+			std::vector<const RunCatalogEntry*> out;
+			for(auto it = first; it != last; it++) {
+				if(q.OnlyStopped && !it->IsStopped()) {
+					continue;
+				}
+
+				if(q.ConfigHash != 0 && it->ConfigHash != q.ConfigHash) {
+					continue;
+				}
+
+				if(!q.SiPM.empty()
+					&& it->SiPMParameters.find(q.SiPM) == std::string::npos) {
+					continue;
+				}
+
+				const bool in_range = std::all_of(q.Parameters.begin(),
+					q.Parameters.end(), [&](const RunCatalogQuery::Range& r) {
+						const double* val = it->GetParameter(r.Name);
+						return val && *val >= r.Min && *val <= r.Max;
+					});
+
+				if(in_range) {
+					out.push_back(&(*it));
+				}
+			}
+
+			return out;
+		}
+	};
+
+} // namespace SBCQueens
@@ -0,0 +1,442 @@
+#pragma once
+
+/*
+
+	Columnar (struct of arrays) layout of the SBC files.
+
+	Instead of one line per event with everything in it, events are
+	buffered into chunks and every column of a chunk is saved together.
+	The traces have one column per channel, so reading a single channel
+	of a whole run only reads that channel. sipm_trace_i is the channel
+	en_chs[i].
+
+	uint32 				"SBCC"
+	uint16 				header length
+	char[] 				header, same as the row format: name;type;dims;
+	uint16 				k, the first k columns of the header are
+						run constants and are saved once, right after
+	char[] 				one line of the k constant columns
+	chunks 				each column of the chunk, one after the other
+	directory 			per chunk: uint64 first event, uint64 events,
+						uint64 first time stamp, uint64 last time stamp
+						then uint64 offset and uint64 size per column
+	uint64 				number of chunks
+	uint32 				number of columns per chunk
+	uint32 				"SBCD"
+
+	Fixed size columns are saved as events*elements values. bitpack16 and
+	roi16 columns are the encoded traces one after the other.
+	The time_stamp column is the unwrapped (uint64) trigger time tag so
+	the directory can be searched by time.
+
+	The directory is only written when the file is closed.
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// my includes
+#include "sbc_reader.h"
+#include "trace_codec.h"
+
+namespace SBCQueens {
+
+	// "SBCC" and "SBCD" in little endian
+	constexpr uint32_t SBCColumnarMagic = 0x43434253;
+	constexpr uint32_t SBCChunkDirectoryMagic = 0x44434253;
+
+	// Size in bytes of the end of the directory (without entries)
+	constexpr size_t SBCChunkDirectoryTrailerSize = sizeof(uint64_t)
+		+ 2*sizeof(uint32_t);
+
+	struct SBCChunkEntry {
+		uint64_t FirstEvent = 0;
+		uint64_t NumEvents = 0;
+		// Unwrapped trigger time tags of the first and last events
+		uint64_t FirstTime = 0;
+		uint64_t LastTime = 0;
+		// Where each column of the chunk is in the file and its size
+		std::vector<uint64_t> Offsets;
+		std::vector<uint64_t> Sizes;
+	};
+
+	// Saves the directory of chunks to be written at the end of the file
+	inline std::string sbc_chunk_directory(
+		const std::vector<SBCChunkEntry>& chunks,
+		const uint32_t& numColumns) noexcept {
+
+		std::string out;
+		out.reserve(chunks.size()*(4 + 2*numColumns)*sizeof(uint64_t)
+			+ SBCChunkDirectoryTrailerSize);
+
+		auto append = [&](auto num) {
+			out.append(reinterpret_cast<const char*>(&num), sizeof(num));
+		};
+
+		for(const auto& chunk : chunks) {
+			append(chunk.FirstEvent);
+			append(chunk.NumEvents);
+			append(chunk.FirstTime);
+			append(chunk.LastTime);
+			for(uint32_t i = 0; i < numColumns; i++) {
+				append(i < chunk.Offsets.size() ? chunk.Offsets[i] : 0ull);
+				append(i < chunk.Sizes.size() ? chunk.Sizes[i] : 0ull);
+			}
+		}
+
+		append(static_cast<uint64_t>(chunks.size()));
+		append(numColumns);
+		append(SBCChunkDirectoryMagic);
+
+		return out;
+	}
+
+	// Reads columns of a columnar SBC file, one chunk at a time.
+	// Only the chunks and columns asked for are read.
+	//
+	// 	sbcColumnarReader reader("run.sbcc");
+	// 	std::vector<uint16_t> traces;
+	// 	reader.read_column("sipm_trace_3", 0, reader.NumChunks(), traces);
+	//
+	// traces is then [event][sample] of the 4th channel in en_chs.
+	class sbcColumnarReader {
+		std::string _fileName;
+		std::string _error;
+		std::ifstream _file;
+
+		std::string _header;
+		// The constants offsets are in _constantData
+		std::vector<SBCColumnInfo> _constants;
+		std::string _constantData;
+		std::vector<SBCColumnInfo> _columns;
+		std::vector<SBCChunkEntry> _chunks;
+		uint64_t _numEvents = 0;
+
+		bool fail(const std::string& error) {
+			_error = error;
+			close();
+			return false;
+		}
+
+		template<typename N>
+		bool read_num(N& val) {
+			_file.read(reinterpret_cast<char*>(&val), sizeof(N));
+			return static_cast<bool>(_file);
+		}
+
+		bool parse_header() {
+			uint32_t magic = 0;
+			uint16_t header_length = 0, num_constants = 0;
+			if(!read_num(magic) || magic != SBCColumnarMagic) {
+				return fail(_fileName + " is not a columnar SBC file");
+			}
+
+			_header.resize(read_num(header_length) ? header_length : 0);
+			_file.read(_header.data(), _header.size());
+			if(!read_num(num_constants)) {
+				return fail(_fileName + " header is truncated");
+			}
+
+			auto columns = sbc_parse_columns(_header);
+			if(columns.empty()) {
+				return fail(_fileName + " header is not valid");
+			}
+
+			if(num_constants > columns.size()) {
+				return fail(_fileName + " has more constants than columns");
+			}
+
+			size_t offset = 0;
+			for(size_t i = 0; i < columns.size(); i++) {
+				auto& info = columns[i];
+				if(info.TypeSize == 0 && !sbc_is_encoded_type(info.Type)) {
+					return fail(_fileName + " has an unknown type: "
+						+ info.Type);
+				}
+
+				if(i < num_constants) {
+					info.Offset = offset;
+					offset += info.TypeSize*info.NumElements;
+					_constants.push_back(info);
+				} else {
+					_columns.push_back(info);
+				}
+			}
+
+			_constantData.resize(offset);
+			_file.read(_constantData.data(), _constantData.size());
+			if(!_file) {
+				return fail(_fileName + " constants are truncated");
+			}
+
+			return true;
+		}
+
+		bool parse_directory() {
+			_file.seekg(0, std::ifstream::end);
+			const uint64_t file_size = _file.tellg();
+			if(file_size < SBCChunkDirectoryTrailerSize) {
+				return fail(_fileName + " has no chunk directory");
+			}
+
+			uint64_t num_chunks = 0;
+			uint32_t num_columns = 0, magic = 0;
+			_file.seekg(file_size - SBCChunkDirectoryTrailerSize);
+			read_num(num_chunks);
+			read_num(num_columns);
+			read_num(magic);
+			if(!_file || magic != SBCChunkDirectoryMagic) {
+				return fail(_fileName + " has no chunk directory, "
+					"it was not closed properly");
+			}
+
+			// A file without events never knew how many channels it had
+			if(num_chunks > 0 && num_columns != _columns.size()) {
+				return fail(_fileName + " directory does not match "
+					"its header");
+			}
+
+			const uint64_t entry_size = (4 + 2*num_columns)*sizeof(uint64_t);
+			if(num_chunks > (file_size - SBCChunkDirectoryTrailerSize)
+				/ entry_size) {
+				return fail(_fileName + " directory is corrupted");
+			}
+
+			_file.seekg(file_size - SBCChunkDirectoryTrailerSize
+				- num_chunks*entry_size);
+			_chunks.resize(num_chunks);
+			for(auto& chunk : _chunks) {
+				read_num(chunk.FirstEvent);
+				read_num(chunk.NumEvents);
+				read_num(chunk.FirstTime);
+				read_num(chunk.LastTime);
+				chunk.Offsets.resize(num_columns);
+				chunk.Sizes.resize(num_columns);
+				for(uint32_t i = 0; i < num_columns; i++) {
+					read_num(chunk.Offsets[i]);
+					read_num(chunk.Sizes[i]);
+				}
+
+				_numEvents += chunk.NumEvents;
+			}
+
+			if(!_file) {
+				return fail(_fileName + " directory is truncated");
+			}
+
+			return true;
+		}
+
+		size_t column_number(const std::string& name) const {
+			for(size_t i = 0; i < _columns.size(); i++) {
+				if(_columns[i].Name == name) {
+					return i;
+				}
+			}
+			return _columns.size();
+		}
+
+		template<typename V>
+		static bool can_read_as(const SBCColumnInfo& info) {
+			return sbc_type_matches<V>(info.Type)
+				|| (sbc_is_encoded_type(info.Type)
+					&& std::is_same_v<V, uint16_t>);
+		}
+
+public:
+		sbcColumnarReader() = default;
+
+		explicit sbcColumnarReader(const std::string& fileName) {
+			open(fileName);
+		}
+
+		bool open(const std::string& fileName) {
+			close();
+			_fileName = fileName;
+			_error.clear();
+
+			_file.open(fileName, std::ifstream::binary);
+			if(!_file.is_open()) {
+				return fail("Could not open " + fileName);
+			}
+
+			return parse_header() && parse_directory();
+		}
+
+		void close() {
+			if(_file.is_open()) {
+				_file.close();
+			}
+			_file.clear();
+			_constants.clear();
+			_constantData.clear();
+			_columns.clear();
+			_chunks.clear();
+			_numEvents = 0;
+		}
+
+		bool IsOpen() const { return _file.is_open(); }
+
+		// Why open(...) failed
+		const std::string& GetError() const { return _error; }
+
+		const std::string& GetHeader() const { return _header; }
+
+		// Columns saved once per file
+		const std::vector<SBCColumnInfo>& GetConstants() const {
+			return _constants;
+		}
+
+		// Columns saved in every chunk
+		const std::vector<SBCColumnInfo>& GetColumns() const {
+			return _columns;
+		}
+
+		const SBCColumnInfo* FindColumn(const std::string& name) const {
+			auto i = column_number(name);
+			return i < _columns.size() ? &_columns[i] : nullptr;
+		}
+
+		const std::vector<SBCChunkEntry>& GetChunks() const {
+			return _chunks;
+		}
+
+		size_t NumChunks() const { return _chunks.size(); }
+
+		uint64_t NumEvents() const { return _numEvents; }
+
+		// Values of a run constant. Empty if it does not exist or V is
+		// not its type.
+		template<typename V>
+		std::vector<V> constant(const std::string& name) const {
+			for(const auto& info : _constants) {
+				if(info.Name == name && sbc_type_matches<V>(info.Type)) {
+					std::vector<V> out(info.NumElements);
+					std::memcpy(out.data(), _constantData.data() + info.Offset,
+						out.size()*sizeof(V));
+					return out;
+				}
+			}
+			return {};
+		}
+
+		// Appends column name of chunks [first, last) to out as
+		// [event][elements...]. Encoded columns are decoded and read
+		// as uint16_t.
+		template<typename V>
+		bool read_column(const std::string& name, const size_t& first,
+			const size_t& last, std::vector<V>& out) {
+
+			const auto col = column_number(name);
+			if(col == _columns.size() || !can_read_as<V>(_columns[col])) {
+				return false;
+			}
+
+			const auto& info = _columns[col];
+			std::string buffer;
+			for(size_t c = first; c < std::min(last, _chunks.size()); c++) {
+				const auto& chunk = _chunks[c];
+				buffer.resize(chunk.Sizes[col]);
+				_file.clear();
+				_file.seekg(chunk.Offsets[col]);
+				_file.read(buffer.data(), buffer.size());
+				if(!_file) {
+					return false;
+				}
+
+				const size_t n = chunk.NumEvents*info.NumElements;
+				const size_t start = out.size();
+				out.resize(start + n);
+
+				if(!sbc_is_encoded_type(info.Type)) {
+					if(buffer.size() != n*sizeof(V)) {
+						return false;
+					}
+
+					std::memcpy(out.data() + start, buffer.data(), buffer.size());
+					continue;
+				}
+
+				const size_t num_samples = info.Dims.back();
+				const size_t num_traces = info.NumElements / num_samples;
+				const char* ptr = buffer.data();
+				size_t left = buffer.size();
+				for(size_t t = 0; t < chunk.NumEvents*num_traces; t++) {
+					auto used = sbc_decode_trace(info.Type, ptr, left,
+						reinterpret_cast<uint16_t*>(out.data())
+						+ start + t*num_samples, num_samples);
+					if(used == 0) {
+						return false;
+					}
+
+					ptr += used;
+					left -= used;
+				}
+			}
+
+			return true;
+		}
+
+		// Chunks [first, last) that have events between the unwrapped
+		// time stamps t0 and t1 (both included)
+		std::pair<size_t, size_t> FindChunks(const uint64_t& t0,
+			const uint64_t& t1) const {
+			size_t first = _chunks.size(), last = 0;
+			for(size_t c = 0; c < _chunks.size(); c++) {
+				if(_chunks[c].LastTime >= t0 && _chunks[c].FirstTime <= t1) {
+					first = std::min(first, c);
+					last = c + 1;
+				}
+			}
+
+			return first < last ? std::make_pair(first, last)
+				: std::make_pair(size_t(0), size_t(0));
+		}
+
+		// Appends column name of every event with a time stamp between
+		// t0 and t1 (both included) to out. If times is not null, their
+		// time stamps are appended to it.
+		template<typename V>
+		bool read_time_range(const std::string& name, const uint64_t& t0,
+			const uint64_t& t1, std::vector<V>& out,
+			std::vector<uint64_t>* times = nullptr) {
+
+			auto info = FindColumn(name);
+			if(!info) {
+				return false;
+			}
+
+			auto [first, last] = FindChunks(t0, t1);
+			std::vector<uint64_t> time_stamps;
+			std::vector<V> values;
+			if(!read_column("time_stamp", first, last, time_stamps)
+				|| !read_column(name, first, last, values)) {
+				return false;
+			}
+
+			const size_t n = info->NumElements;
+			for(size_t i = 0; i < time_stamps.size(); i++) {
+				if(time_stamps[i] < t0 || time_stamps[i] > t1) {
+					continue;
+				}
+
+				out.insert(out.end(), values.begin() + i*n,
+					values.begin() + (i + 1)*n);
+				if(times) {
+					times->push_back(time_stamps[i]);
+				}
+			}
+
+			return true;
+		}
+	};
+
+} // namespace SBCQueens
@@ -0,0 +1,940 @@
+#pragma once
+
+/*
+
+	Memory mapped reader of the SBC binary files.
+
+	The file is mapped, not read, so opening it only parses the header
+	and the OS brings in the pages as they are used. Columns are accessed
+	through views that point directly into the file, ex:
+
+		sbcReader reader("run.bin");
+		auto time_stamp = reader.column<uint32_t>("time_stamp");
+		auto traces = reader.column<uint16_t>("sipm_traces");
+
+		uint32_t t = time_stamp[i];
+		uint16_t s = traces[i][ch][sample];
+
+	The dimensions of each column are in the same order as ReadBinary.py,
+	the slowest first. For sipm_traces that is [channel][sample].
+
+	Files with compressed (bitpack16) or zero suppressed (roi16) traces
+	have lines of different lengths, and the traces must be decoded with
+	decode_traces(...). The index at the end of the file says where every
+	IndexInterval-th line starts, so the lines in between are only found
+	the first time one of them is used. Without an index, the whole file
+	is read once when opened.
+	Files saved in blocks (see block_framing.h) only have their block
+	headers read when opened, the lines of each block are found the same
+	way. The CRCs of the blocks are only checked by sbc_recover.
+
+	It only depends on trace_codec.h, roi_codec.h and block_framing.h, so
+	they can be copied and used for analysis anywhere.
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// my includes
+#include "block_framing.h"
+#include "roi_codec.h"
+#include "trace_codec.h"
+
+namespace SBCQueens {
+
+	// Size in bytes of every type the header can have. 0 = not a fixed
+	// size type.
+	inline size_t sbc_type_size(const std::string& type) noexcept {
+		static const std::unordered_map<std::string, size_t> sizes = {
+			{"char", 1}, {"int8", 1}, {"int16", 2}, {"int32", 4},
+			{"int64", 8}, {"uint8", 1}, {"uint16", 2}, {"uint32", 4},
+			{"uint64", 8}, {"single", 4}, {"float32", 4}, {"double", 8},
+			{"float64", 8}, {"float128", 16}
+		};
+
+		auto it = sizes.find(type);
+		return it == sizes.end() ? 0 : it->second;
+	}
+
+	// Checks that V can hold an element of a column of type
+	template<typename V>
+	bool sbc_type_matches(const std::string& type) noexcept {
+		if constexpr (std::is_same_v<V, char>) {
+			return type == "char";
+		} else if constexpr (std::is_floating_point_v<V>) {
+			return sbc_type_size(type) == sizeof(V) && (type == "single"
+				|| type == "double" || type == "float32"
+				|| type == "float64" || type == "float128");
+		} else if constexpr (std::is_signed_v<V>) {
+			return sbc_type_size(type) == sizeof(V) && type[0] == 'i';
+		} else {
+			return sbc_type_size(type) == sizeof(V) && type[0] == 'u';
+		}
+	}
+
+	// Types of the traces saved with a codec, whose size is only known
+	// after decoding them. They decode to uint16.
+	inline bool sbc_is_encoded_type(const std::string& type) noexcept {
+		return type == "bitpack16" || type == "roi16";
+	}
+
+	// Decodes one trace of n samples with the codec of type. Returns the
+	// number of bytes used, 0 if in is not valid.
+	inline size_t sbc_decode_trace(const std::string& type, const char* in,
+		const size_t& in_size, uint16_t* out, const size_t& n) noexcept {
+		if(type == "bitpack16") {
+			return bitpack16_decode(in, in_size, out, n);
+		} else if(type == "roi16") {
+			return roi_decode(in, in_size, out, n);
+		}
+
+		return 0;
+	}
+
+	struct SBCColumnInfo {
+		std::string Name;
+		std::string Type;
+		// Slowest first, as in ReadBinary.py
+		std::vector<size_t> Dims;
+		// Size of one element, 0 if it is not a fixed size type
+		size_t TypeSize = 0;
+		// Total number of elements in one line
+		size_t NumElements = 1;
+		// Where the column starts in each line
+		size_t Offset = 0;
+	};
+
+	// Columns of a header string: name;type;dim1,dim2...;
+	// Everything but the offsets is filled. Empty if a dimension is not
+	// a number, ex: the header is damaged.
+	inline std::vector<SBCColumnInfo> sbc_parse_columns(
+		const std::string& header) noexcept {
+		std::vector<std::string> parts;
+		size_t start = 0;
+		for(size_t i = 0; i < header.size(); i++) {
+			if(header[i] == ';') {
+				parts.push_back(header.substr(start, i - start));
+				start = i + 1;
+			}
+		}
+
+		std::vector<SBCColumnInfo> columns;
+		for(size_t i = 0; i + 2 < parts.size(); i += 3) {
+			if(parts[i].empty()) {
+				continue;
+			}
+
+			SBCColumnInfo info;
+			info.Name = parts[i];
+			info.Type = parts[i + 1];
+			info.TypeSize = sbc_type_size(info.Type);
+
+			// The header has the fastest dimension first
+			std::string dims = parts[i + 2].empty() ? "1" : parts[i + 2];
+			size_t dstart = 0;
+			for(size_t j = 0; j <= dims.size(); j++) {
+				if(j == dims.size() || dims[j] == ',') {
+					size_t dim = 0;
+					const char* first = dims.data() + dstart;
+					const char* last = dims.data() + j;
+					auto res = std::from_chars(first, last, dim);
+					if(res.ec != std::errc() || res.ptr != last) {
+						return {};
+					}
+
+					info.Dims.push_back(dim);
+					dstart = j + 1;
+				}
+			}
+			std::reverse(info.Dims.begin(), info.Dims.end());
+
+			for(auto d : info.Dims) {
+				info.NumElements *= d;
+			}
+
+			columns.push_back(info);
+		}
+
+		return columns;
+	}
+
+	// View of a N-dimensional array of V inside the file.
+	// Indexing it gives a view of one less dimension, and a view of
+	// a single element can be used as V directly.
+	template<typename V>
+	class sbcArrayView {
+		static constexpr size_t MaxDims = 4;
+
+		const char* _data = nullptr;
+		size_t _numDims = 0;
+		std::array<size_t, MaxDims> _dims = {};
+		std::array<size_t, MaxDims> _strides = {};
+
+public:
+		sbcArrayView() = default;
+
+		sbcArrayView(const char* data, const std::vector<size_t>& dims)
+			: _data(data), _numDims(std::min(dims.size(), MaxDims)) {
+			size_t stride = sizeof(V);
+			for(size_t i = _numDims; i-- > 0;) {
+				_dims[i] = dims[i];
+				_strides[i] = stride;
+				stride *= dims[i];
+			}
+		}
+
+		bool IsValid() const { return _data != nullptr; }
+
+		// Size of the first (slowest) dimension
+		size_t size() const { return _numDims > 0 ? _dims[0] : 1; }
+
+		// Total number of elements
+		size_t NumElements() const {
+			size_t n = 1;
+			for(size_t i = 0; i < _numDims; i++) {
+				n *= _dims[i];
+			}
+			return n;
+		}
+
+		// Raw pointer to the first byte, it might not be aligned to V
+		const char* data() const { return _data; }
+
+		sbcArrayView operator[](const size_t& i) const {
+			sbcArrayView sub;
+			sub._data = _data + i*_strides[0];
+			sub._numDims = _numDims > 0 ? _numDims - 1 : 0;
+			for(size_t d = 1; d < _numDims; d++) {
+				sub._dims[d - 1] = _dims[d];
+				sub._strides[d - 1] = _strides[d];
+			}
+			return sub;
+		}
+
+		// Element i of the flattened array
+		V get(const size_t& i) const {
+			// memcpy because the lines are not aligned. It compiles to
+			// a normal load anyways.
+			V val;
+			std::memcpy(&val, _data + i*sizeof(V), sizeof(V));
+			return val;
+		}
+
+		operator V() const {
+			return get(0);
+		}
+
+		// Copies all the elements into out
+		void copy_to(V* out) const {
+			std::memcpy(out, _data, NumElements()*sizeof(V));
+		}
+
+		std::vector<V> to_vector() const {
+			std::vector<V> out(NumElements());
+			copy_to(out.data());
+			return out;
+		}
+	};
+
+	class sbcReader;
+
+	// All the values of a column, line by line.
+	template<typename V>
+	class sbcColumn {
+		const sbcReader* _reader = nullptr;
+		const SBCColumnInfo* _info = nullptr;
+
+public:
+		sbcColumn() = default;
+		sbcColumn(const sbcReader* reader, const SBCColumnInfo* info)
+			: _reader(reader), _info(info) { }
+
+		bool IsValid() const { return _reader != nullptr; }
+
+		const SBCColumnInfo& Info() const { return *_info; }
+
+		// Number of lines
+		size_t size() const;
+
+		// The column in line i
+		sbcArrayView<V> operator[](const size_t& i) const;
+
+		class iterator {
+			const sbcColumn* _column;
+			size_t _line;
+
+public:
+			iterator(const sbcColumn* column, const size_t& line)
+				: _column(column), _line(line) { }
+
+			sbcArrayView<V> operator*() const { return (*_column)[_line]; }
+
+			iterator& operator++();
+
+			bool operator!=(const iterator& other) const {
+				return _line != other._line;
+			}
+
+			size_t Line() const { return _line; }
+		};
+
+		// Iterates over the lines [first, last)
+		struct range {
+			iterator First, Last;
+			iterator begin() const { return First; }
+			iterator end() const { return Last; }
+		};
+
+		iterator begin() const { return lines(0, size()).First; }
+		iterator end() const { return iterator(this, size()); }
+
+		range lines(const size_t& first, const size_t& last) const;
+	};
+
+	// Entry of the index at the end of the file. See SBCFileIndex
+	// in caen_helper.h
+	struct SBCReaderIndexEntry {
+		uint64_t Event = 0;
+		uint64_t Offset = 0;
+		uint64_t TimeStamp = 0;
+	};
+
+	class sbcReader {
+		std::string _fileName;
+		std::string _error;
+
+		const char* _map = nullptr;
+		uint64_t _fileSize = 0;
+#ifdef _WIN32
+		HANDLE _file = INVALID_HANDLE_VALUE;
+		HANDLE _mapping = nullptr;
+#else
+		int _fd = -1;
+#endif
+
+		std::string _header;
+		std::vector<SBCColumnInfo> _columns;
+
+		// Byte where the lines start and end (without the footer)
+		uint64_t _dataStart = 0;
+		uint64_t _dataEnd = 0;
+		// 0 if the lines are not all the same size
+		size_t _lineSize = 0;
+		uint64_t _numLines = 0;
+		// Number of lines as written in the file, 0 if unknown
+		int32_t _storedNumLines = 0;
+
+		// NumLines lines in the bytes [Begin, End) of the file
+		struct lineRange {
+			uint64_t NumLines = 0;
+			uint64_t Begin = 0;
+			uint64_t End = 0;
+		};
+
+		// Lines of a block, or between two index entries. If the lines
+		// are not all the same size, where each one starts is only
+		// found the first time one of them is used.
+		struct lineSegment : lineRange {
+			uint64_t FirstLine = 0;
+			mutable std::vector<uint64_t> Lines;
+			mutable std::once_flag Found;
+		};
+
+		// Only for files with lines of different sizes or in blocks
+		std::unique_ptr<lineSegment[]> _segments;
+		size_t _numSegments = 0;
+		bool _isFramed = false;
+
+		std::vector<SBCReaderIndexEntry> _index;
+		uint32_t _indexInterval = 0;
+		// Number of lines, as written in the index
+		uint64_t _indexLines = 0;
+
+		// Sequential mode: how many lines to ask the OS to read ahead
+		size_t _prefetchLines = 0;
+
+		bool fail(const std::string& error) {
+			_error = error;
+			close();
+			return false;
+		}
+
+		bool map_file() {
+#ifdef _WIN32
+			_file = CreateFileA(_fileName.c_str(), GENERIC_READ,
+				FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL, nullptr);
+			if(_file == INVALID_HANDLE_VALUE) {
+				return fail("Could not open " + _fileName);
+			}
+
+			LARGE_INTEGER size;
+			if(!GetFileSizeEx(_file, &size)) {
+				return fail("Could not get the size of " + _fileName);
+			}
+			_fileSize = static_cast<uint64_t>(size.QuadPart);
+			if(_fileSize == 0) {
+				return fail(_fileName + " is empty");
+			}
+
+			_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY,
+				0, 0, nullptr);
+			if(!_mapping) {
+				return fail("Could not map " + _fileName);
+			}
+
+			_map = static_cast<const char*>(
+				MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+			_fd = ::open(_fileName.c_str(), O_RDONLY);
+			if(_fd < 0) {
+				return fail("Could not open " + _fileName);
+			}
+
+			struct stat st;
+			if(fstat(_fd, &st) < 0) {
+				return fail("Could not get the size of " + _fileName);
+			}
+			_fileSize = static_cast<uint64_t>(st.st_size);
+			if(_fileSize == 0) {
+				return fail(_fileName + " is empty");
+			}
+
+			void* ptr = mmap(nullptr, _fileSize, PROT_READ, MAP_SHARED, _fd, 0);
+			_map = ptr == MAP_FAILED ? nullptr : static_cast<const char*>(ptr);
+#endif
+			if(!_map) {
+				return fail("Could not map " + _fileName);
+			}
+
+			return true;
+		}
+
+		template<typename N>
+		N read_num(const uint64_t& offset) const {
+			N val;
+			std::memcpy(&val, _map + offset, sizeof(N));
+			return val;
+		}
+
+		bool parse_header() {
+			if(_fileSize < sizeof(uint32_t) + sizeof(uint16_t)) {
+				return fail(_fileName + " is too small to be a SBC file");
+			}
+
+			if(read_num<uint32_t>(0) != 0x01020304) {
+				return fail(_fileName + " is not a SBC file or it has a "
+					"different endianness");
+			}
+
+			const uint16_t header_length = read_num<uint16_t>(4);
+			_dataStart = 6 + header_length + sizeof(int32_t);
+			if(_dataStart > _fileSize) {
+				return fail(_fileName + " header is truncated");
+			}
+
+			_header = std::string(_map + 6, header_length);
+			_storedNumLines = read_num<int32_t>(6 + header_length);
+
+			const auto columns = sbc_parse_columns(_header);
+			if(columns.empty()) {
+				return fail(_fileName + " header is not valid");
+			}
+
+			size_t offset = 0;
+			bool is_fixed = true;
+			for(auto info : columns) {
+				info.Offset = offset;
+				if(!is_fixed) {
+					return fail(_fileName + " has columns after a "
+						"variable size column, not supported.");
+				}
+
+				if(sbc_is_encoded_type(info.Type)) {
+					// uint32 size then the bytes. The rest is not fixed
+					is_fixed = false;
+				} else if(info.TypeSize == 0) {
+					return fail(_fileName + " has an unknown type: "
+						+ info.Type);
+				} else {
+					offset += info.TypeSize*info.NumElements;
+				}
+
+				_columns.push_back(info);
+			}
+
+			_lineSize = is_fixed ? offset : 0;
+			return true;
+		}
+
+		// Looks for the index footer and removes it from the data
+		void parse_index() {
+			_dataEnd = _fileSize;
+
+			const uint64_t trailer_size = 2*sizeof(uint64_t)
+				+ 2*sizeof(uint32_t);
+			const uint64_t entry_size = 3*sizeof(uint64_t);
+			if(_fileSize < _dataStart + trailer_size) {
+				return;
+			}
+
+			const uint64_t trailer = _fileSize - trailer_size;
+			if(read_num<uint32_t>(_fileSize - sizeof(uint32_t)) != 0x49434253) {
+				return;
+			}
+
+			const auto num_entries = read_num<uint64_t>(trailer);
+			if(num_entries > (trailer - _dataStart) / entry_size) {
+				return;
+			}
+
+			_indexLines = read_num<uint64_t>(trailer + sizeof(uint64_t));
+			_indexInterval = read_num<uint32_t>(trailer + 2*sizeof(uint64_t));
+
+			const uint64_t first = trailer - num_entries*entry_size;
+			_index.resize(num_entries);
+			for(uint64_t i = 0; i < num_entries; i++) {
+				_index[i].Event = read_num<uint64_t>(first + i*entry_size);
+				_index[i].Offset = read_num<uint64_t>(first + i*entry_size + 8);
+				_index[i].TimeStamp
+					= read_num<uint64_t>(first + i*entry_size + 16);
+			}
+
+			_dataEnd = first;
+		}
+
+		// Smallest line there can be: the fixed part and, if the rest is
+		// not fixed, the uint32 with its size
+		uint64_t min_line_size() const {
+			return _lineSize > 0 ? _lineSize
+				: _columns.back().Offset + sizeof(uint32_t);
+		}
+
+		// Where each line of different size of a piece of the file that
+		// is not framed starts, up to max lines. Returns where the last
+		// complete line ends.
+		uint64_t find_lines_in(const uint64_t& begin, const uint64_t& end,
+			std::vector<uint64_t>& out, const uint64_t& max) const {
+			// The fixed part, then a uint32 with the size of the rest
+			const uint64_t fixed = _columns.back().Offset;
+			uint64_t pos = begin;
+			while(out.size() < max && pos + fixed + sizeof(uint32_t) <= end) {
+				const auto rest = read_num<uint32_t>(pos + fixed);
+				const uint64_t next = pos + fixed + sizeof(uint32_t) + rest;
+				if(next > end) {
+					break;
+				}
+
+				out.push_back(pos);
+				pos = next;
+			}
+
+			return pos;
+		}
+
+		// Finds the lines of segment, if they were not found already
+		void find_segment_lines(const lineSegment& segment) const {
+			std::call_once(segment.Found, [&]() {
+				segment.Lines.reserve(segment.NumLines);
+				find_lines_in(segment.Begin, segment.End, segment.Lines,
+					segment.NumLines);
+
+				// Only if the file is damaged. Its size was checked, so
+				// the first line can be read even if it is garbage.
+				segment.Lines.resize(segment.NumLines, segment.Begin);
+			});
+		}
+
+		const lineSegment& segment_of(const uint64_t& line) const {
+			const auto* first = _segments.get();
+			const auto* last = first + _numSegments;
+			auto it = std::upper_bound(first, last, line,
+				[](const uint64_t& l, const lineSegment& segment) {
+					return l < segment.FirstLine;
+				});
+			return *std::prev(it);
+		}
+
+		void make_segments(const std::vector<lineRange>& ranges) {
+			_numSegments = ranges.size();
+			_segments = std::make_unique<lineSegment[]>(_numSegments);
+			_numLines = 0;
+			for(size_t i = 0; i < _numSegments; i++) {
+				static_cast<lineRange&>(_segments[i]) = ranges[i];
+				_segments[i].FirstLine = _numLines;
+				_numLines += ranges[i].NumLines;
+			}
+		}
+
+		// The segments between the index entries, if the index looks right
+		bool segments_from_index() {
+			if(_index.empty() || _indexInterval == 0
+				|| _index.front().Event != 0
+				|| _index.front().Offset != _dataStart) {
+				return false;
+			}
+
+			std::vector<lineRange> segments(_index.size());
+			for(size_t i = 0; i < _index.size(); i++) {
+				const bool is_last = i + 1 == _index.size();
+				auto& segment = segments[i];
+				segment.Begin = _index[i].Offset;
+				segment.End = is_last ? _dataEnd : _index[i + 1].Offset;
+				const uint64_t next_line = is_last ? _indexLines
+					: _index[i + 1].Event;
+				if(next_line <= _index[i].Event || segment.End < segment.Begin
+					|| segment.End > _dataEnd) {
+					return false;
+				}
+
+				segment.NumLines = next_line - _index[i].Event;
+				if(segment.NumLines > (segment.End - segment.Begin)
+					/ min_line_size()) {
+					return false;
+				}
+			}
+
+			make_segments(segments);
+			return true;
+		}
+
+		void find_lines() {
+			_isFramed = _dataStart + sizeof(uint32_t) <= _dataEnd
+				&& read_num<uint32_t>(_dataStart) == SBCBlockMagic;
+
+			// Only the block headers. The number of lines of a block
+			// cannot be more than what fits in it.
+			if(_isFramed) {
+				std::vector<lineRange> blocks;
+				uint64_t pos = _dataStart;
+				BlockFrameHeader header;
+				while(read_block_frame_header(_map + pos, _dataEnd - pos,
+					header)) {
+					const uint64_t begin = pos + BlockFrameHeaderSize;
+					pos = begin + header.Size;
+					if(header.Items == 0) {
+						continue;
+					}
+
+					blocks.emplace_back();
+					blocks.back().Begin = begin;
+					blocks.back().End = pos;
+					blocks.back().NumLines = std::min<uint64_t>(header.Items,
+						header.Size / min_line_size());
+				}
+
+				make_segments(blocks);
+				return;
+			}
+
+			if(_lineSize > 0) {
+				const uint64_t available = (_dataEnd - _dataStart) / _lineSize;
+				_numLines = _storedNumLines > 0 ?
+					std::min<uint64_t>(_storedNumLines, available) : available;
+				return;
+			}
+
+			if(segments_from_index()) {
+				return;
+			}
+
+			// No index, every line now
+			std::vector<uint64_t> lines;
+			find_lines_in(_dataStart, _dataEnd, lines,
+				std::numeric_limits<uint64_t>::max());
+			std::vector<lineRange> all(1);
+			all[0].Begin = _dataStart;
+			all[0].End = _dataEnd;
+			all[0].NumLines = lines.size();
+			make_segments(all);
+			_segments[0].Lines = std::move(lines);
+			std::call_once(_segments[0].Found, []() { });
+		}
+
+public:
+		sbcReader() = default;
+
+		explicit sbcReader(const std::string& fileName) {
+			open(fileName);
+		}
+
+		// No copying, views point to this
+		sbcReader(sbcReader&&) = delete;
+		sbcReader(const sbcReader&) = delete;
+
+		~sbcReader() {
+			close();
+		}
+
+		bool open(const std::string& fileName) {
+			close();
+			_fileName = fileName;
+			_error.clear();
+
+			if(!map_file() || !parse_header()) {
+				return false;
+			}
+
+			parse_index();
+			find_lines();
+			return true;
+		}
+
+		void close() {
+#ifdef _WIN32
+			if(_map) {
+				UnmapViewOfFile(_map);
+			}
+			if(_mapping) {
+				CloseHandle(_mapping);
+			}
+			if(_file != INVALID_HANDLE_VALUE) {
+				CloseHandle(_file);
+			}
+			_mapping = nullptr;
+			_file = INVALID_HANDLE_VALUE;
+#else
+			if(_map) {
+				munmap(const_cast<char*>(_map), _fileSize);
+			}
+			if(_fd >= 0) {
+				::close(_fd);
+			}
+			_fd = -1;
+#endif
+			_map = nullptr;
+			_fileSize = 0;
+			_columns.clear();
+			_segments.reset();
+			_numSegments = 0;
+			_isFramed = false;
+			_index.clear();
+			_indexInterval = 0;
+			_indexLines = 0;
+			_numLines = 0;
+		}
+
+		bool IsOpen() const { return _map != nullptr; }
+
+		// Why open(...) failed
+		const std::string& GetError() const { return _error; }
+
+		const std::string& GetHeader() const { return _header; }
+
+		const std::vector<SBCColumnInfo>& GetColumns() const {
+			return _columns;
+		}
+
+		uint64_t NumLines() const { return _numLines; }
+
+		// True if the file has fewer lines than what its header says,
+		// or the number of lines was never written (file not closed)
+		bool IsTruncated() const {
+			if(_storedNumLines <= 0) {
+				return true;
+			}
+
+			return static_cast<uint64_t>(_storedNumLines) > _numLines;
+		}
+
+		// True if the file is saved in blocks
+		bool IsFramed() const { return _isFramed; }
+
+		// Byte where line i starts. Any thread.
+		uint64_t LineOffset(const uint64_t& i) const {
+			if(!_segments) {
+				return _dataStart + i*_lineSize;
+			}
+
+			const auto& segment = segment_of(i);
+			const uint64_t k = i - segment.FirstLine;
+			if(_lineSize > 0) {
+				return segment.Begin + k*_lineSize;
+			}
+
+			find_segment_lines(segment);
+			return segment.Lines[k];
+		}
+
+		const char* LinePtr(const uint64_t& i) const {
+			return _map + LineOffset(i);
+		}
+
+		const SBCColumnInfo* FindColumn(const std::string& name) const {
+			for(const auto& info : _columns) {
+				if(info.Name == name) {
+					return &info;
+				}
+			}
+			return nullptr;
+		}
+
+		// Typed view of column name. Invalid if it does not exist or
+		// V is not its type.
+		template<typename V>
+		sbcColumn<V> column(const std::string& name) const {
+			auto info = FindColumn(name);
+			if(!info || !sbc_type_matches<V>(info->Type)) {
+				return sbcColumn<V>();
+			}
+
+			return sbcColumn<V>(this, info);
+		}
+
+		// Decodes the sipm_traces of line i into out as [channel][sample]
+		// It works with uint16, bitpack16 and roi16 files.
+		bool decode_traces(const uint64_t& i, std::vector<uint16_t>& out,
+			const std::string& name = "sipm_traces") const {
+			auto info = FindColumn(name);
+			if(!info || i >= _numLines) {
+				return false;
+			}
+
+			out.resize(info->NumElements);
+			const char* ptr = LinePtr(i) + info->Offset;
+			if(info->Type == "uint16") {
+				std::memcpy(out.data(), ptr, out.size()*sizeof(uint16_t));
+				return true;
+			}
+
+			if(!sbc_is_encoded_type(info->Type)) {
+				return false;
+			}
+
+			auto size = read_num<uint32_t>(ptr - _map);
+			ptr += sizeof(uint32_t);
+
+			const size_t num_samples = info->Dims.back();
+			const size_t num_channels = info->NumElements / num_samples;
+			for(size_t ch = 0; ch < num_channels; ch++) {
+				auto used = sbc_decode_trace(info->Type, ptr, size,
+					out.data() + ch*num_samples, num_samples);
+				if(used == 0) {
+					return false;
+				}
+
+				ptr += used;
+				size -= used;
+			}
+
+			return true;
+		}
+
+		// Index at the end of the file, empty if there is none
+		const std::vector<SBCReaderIndexEntry>& GetIndex() const {
+			return _index;
+		}
+
+		// Every how many events there is an index entry, 0 = no index
+		uint32_t GetIndexInterval() const { return _indexInterval; }
+
+		// First line of the index block that contains time_stamp
+		// (unwrapped trigger time tag). 0 if there is no index.
+		uint64_t FindLineByTime(const uint64_t& time_stamp) const {
+			auto it = std::upper_bound(_index.begin(), _index.end(),
+				time_stamp, [](const uint64_t& t, const auto& entry) {
+					return t < entry.TimeStamp;
+				});
+
+			return it == _index.begin() ? 0 : std::prev(it)->Event;
+		}
+
+		// Tells the OS the file will be read in order and, while
+		// iterating a column, to read ahead numLines lines.
+		// 0 goes back to normal.
+		void SetSequential(const size_t& numLines) {
+			_prefetchLines = numLines;
+#ifndef _WIN32
+			if(_map) {
+				madvise(const_cast<char*>(_map), _fileSize,
+					numLines > 0 ? MADV_SEQUENTIAL : MADV_NORMAL);
+			}
+#endif
+		}
+
+		size_t GetPrefetchLines() const { return _prefetchLines; }
+
+		// Asks the OS to start reading lines [first, first + n)
+		void prefetch(const uint64_t& first, const uint64_t& n) const {
+			if(!_map || first >= _numLines) {
+				return;
+			}
+
+			const uint64_t last = std::min(first + n, _numLines);
+			const uint64_t begin = LineOffset(first);
+			const uint64_t end = last < _numLines ? LineOffset(last) : _dataEnd;
+#ifdef _WIN32
+			WIN32_MEMORY_RANGE_ENTRY range;
+			range.VirtualAddress = const_cast<char*>(_map + begin);
+			range.NumberOfBytes = end - begin;
+			PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+			// madvise needs a page aligned address
+			const uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+			const uint64_t aligned = begin - begin % page;
+			madvise(const_cast<char*>(_map + aligned), end - aligned,
+				MADV_WILLNEED);
+#endif
+		}
+	};
+
+	template<typename V>
+	size_t sbcColumn<V>::size() const {
+		return _reader ? _reader->NumLines() : 0;
+	}
+
+	template<typename V>
+	sbcArrayView<V> sbcColumn<V>::operator[](const size_t& i) const {
+		return sbcArrayView<V>(_reader->LinePtr(i) + _info->Offset,
+			_info->Dims);
+	}
+
+	template<typename V>
+	typename sbcColumn<V>::range sbcColumn<V>::lines(const size_t& first,
+		const size_t& last) const {
+		const size_t n = _reader ? _reader->GetPrefetchLines() : 0;
+		if(n > 0) {
+			_reader->prefetch(first, 2*n);
+		}
+
+		return range{iterator(this, first), iterator(this, std::min(last, size()))};
+	}
+
+	template<typename V>
+	typename sbcColumn<V>::iterator& sbcColumn<V>::iterator::operator++() {
+		_line++;
+
+		// In sequential mode, every block of lines asks for the next one
+		const size_t n = _column->_reader->GetPrefetchLines();
+		if(n > 0 && _line % n == 0) {
+			_column->_reader->prefetch(_line + n, n);
+		}
+
+		return *this;
+	}
+
+} // namespace SBCQueens
@@ -0,0 +1,271 @@
+#pragma once
+
+/*
+
+	Binary slow control files.
+
+	The slow control values (Peltiers, RTDs, pressures and BMEs) are
+	saved in the same SBC binary format as the SiPM files. The header is
+	the schema of the file, one double per column with the time first:
+
+		time;double;1;RTD_1;double;1;RTD_2;double;1;
+
+	so every line is a fixed size record that ReadBinary.py, sbcReader
+	and sbc_convert (-f csv to get the old text files) can read. The
+	values are saved as they are, nothing is rounded.
+
+	When the file is closed, a time index is written at the end with an
+	entry every IndexInterval lines (same footer as the SiPM files, see
+	SBCFileIndex in caen_helper.h) using the time in ms as time stamp.
+	It is only a shortcut: the times always grow, so the reader can
+	binary search them without it.
+
+		slowControlReader reader("RTDs.bin");
+		std::vector<double> temps, times;
+		reader.read_time_range("RTD_1", t0, t1, temps, &times);
+
+	It only depends on sbc_reader.h, so it can be used by the tools.
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+// my includes
+#include "sbc_reader.h"
+
+namespace SBCQueens {
+
+	// One column of the file, Get takes its value out of a T
+	template<typename T>
+	struct SlowControlColumn {
+		std::string Name;
+		double (*Get)(const T&);
+	};
+
+	// Columns of a T file. The first one has to be the time.
+	template<typename T>
+	using SlowControlSchema = std::vector<SlowControlColumn<T>>;
+
+	// Lines saved so far and the time index. One per file.
+	struct SlowControlIndex {
+		// An entry every Interval lines, 0 = no index
+		uint32_t Interval = 0;
+		uint64_t NumLines = 0;
+		// Byte where the first line starts, set by sc_init_file
+		uint64_t DataStart = 0;
+		std::vector<SBCReaderIndexEntry> Entries;
+
+		void reset() noexcept {
+			NumLines = 0;
+			DataStart = 0;
+			Entries.clear();
+		}
+	};
+
+	// Header of a file with schema. Meant to be written once.
+	template<typename T>
+	std::string sc_init_file(const SlowControlSchema<T>& schema,
+		SlowControlIndex& index) noexcept {
+		std::string header;
+		for(const auto& col : schema) {
+			header += col.Name + ";double;1;";
+		}
+
+		const uint32_t endianness = 0x01020304;
+		const auto header_length = static_cast<uint16_t>(header.size());
+		// 0 means that it will be calculated by the number of lines
+		const int32_t num_lines = 0;
+
+		std::string out;
+		out.append(reinterpret_cast<const char*>(&endianness),
+			sizeof(uint32_t));
+		out.append(reinterpret_cast<const char*>(&header_length),
+			sizeof(uint16_t));
+		out += header;
+		out.append(reinterpret_cast<const char*>(&num_lines), sizeof(int32_t));
+
+		index.reset();
+		index.DataStart = out.size();
+		return out;
+	}
+
+	// Lines of all the items in data, to be used with save(...)
+	template<typename T>
+	std::string sc_save_func(std::vector<T>& data,
+		const SlowControlSchema<T>& schema, SlowControlIndex& index) noexcept {
+		const size_t line_size = schema.size()*sizeof(double);
+		std::string out(data.size()*line_size, '\0');
+
+		char* ptr = out.data();
+		for(const auto& item : data) {
+			if(index.Interval > 0 && index.NumLines % index.Interval == 0) {
+				index.Entries.push_back(SBCReaderIndexEntry{index.NumLines,
+					index.DataStart + index.NumLines*line_size,
+					static_cast<uint64_t>(schema[0].Get(item))});
+			}
+
+			for(const auto& col : schema) {
+				const double val = col.Get(item);
+				std::memcpy(ptr, &val, sizeof(double));
+				ptr += sizeof(double);
+			}
+
+			index.NumLines++;
+		}
+
+		return out;
+	}
+
+	// Returns the footer with the index to be written after the last line.
+	// Empty if the index interval is 0.
+	inline std::string sc_index_footer(const SlowControlIndex& index) noexcept {
+		if(index.Interval == 0) {
+			return "";
+		}
+
+		std::string footer;
+		auto append = [&](auto num) {
+			footer.append(reinterpret_cast<const char*>(&num), sizeof(num));
+		};
+
+		for(const auto& entry : index.Entries) {
+			append(entry.Event);
+			append(entry.Offset);
+			append(entry.TimeStamp);
+		}
+
+		append(static_cast<uint64_t>(index.Entries.size()));
+		append(index.NumLines);
+		append(index.Interval);
+		// "SBCI"
+		append(static_cast<uint32_t>(0x49434253));
+
+		return footer;
+	}
+
+	// Writes the real number of lines in the header of a closed file.
+	// Returns false if it could not, ex: if the file is compressed.
+	inline bool sc_finalize_file(const std::string& fileName,
+		const SlowControlIndex& index) noexcept {
+		if(index.NumLines > static_cast<uint64_t>(INT32_MAX)) {
+			return false;
+		}
+
+		std::fstream file(fileName,
+			std::fstream::in | std::fstream::out | std::fstream::binary);
+		uint32_t endianness = 0;
+		file.read(reinterpret_cast<char*>(&endianness), sizeof(uint32_t));
+		if(!file || endianness != 0x01020304) {
+			return false;
+		}
+
+		const auto num_lines = static_cast<int32_t>(index.NumLines);
+		file.seekp(index.DataStart - sizeof(int32_t));
+		file.write(reinterpret_cast<const char*>(&num_lines), sizeof(int32_t));
+		return static_cast<bool>(file);
+	}
+
+	// Reads a slow control file by time
+	class slowControlReader {
+		sbcReader _reader;
+		sbcColumn<double> _time;
+
+public:
+		slowControlReader() = default;
+
+		explicit slowControlReader(const std::string& fileName) {
+			open(fileName);
+		}
+
+		bool open(const std::string& fileName) {
+			if(!_reader.open(fileName)) {
+				return false;
+			}
+
+			_time = _reader.column<double>("time");
+			return _time.IsValid();
+		}
+
+		bool IsOpen() const { return _reader.IsOpen() && _time.IsValid(); }
+
+		const std::string& GetError() const { return _reader.GetError(); }
+
+		const std::vector<SBCColumnInfo>& GetColumns() const {
+			return _reader.GetColumns();
+		}
+
+		uint64_t NumLines() const { return _reader.NumLines(); }
+
+		// The underlying reader, for anything else
+		const sbcReader& Reader() const { return _reader; }
+
+		// Lines [first, last) with t0 <= time <= t1
+		std::pair<uint64_t, uint64_t> FindLines(const double& t0,
+			const double& t1) const {
+			if(!IsOpen()) {
+				return {0, 0};
+			}
+
+			auto lower = [&](const double& t, uint64_t lo, uint64_t hi,
+				const bool& inclusive) {
+				while(lo < hi) {
+					const uint64_t mid = lo + (hi - lo)/2;
+					const double val = _time[mid];
+					if(val < t || (inclusive && val == t)) {
+						lo = mid + 1;
+					} else {
+						hi = mid;
+					}
+				}
+				return lo;
+			};
+
+			// The index narrows the search to the lines after the last
+			// entry before t0. Its times are rounded down to the ms.
+			uint64_t lo = 0;
+			const auto& index = _reader.GetIndex();
+			auto it = std::upper_bound(index.begin(), index.end(), t0,
+				[](const double& t, const SBCReaderIndexEntry& entry) {
+					return t < static_cast<double>(entry.TimeStamp) + 1.0;
+				});
+			if(it != index.begin()) {
+				lo = std::prev(it)->Event;
+			}
+
+			const uint64_t first = lower(t0, std::min(lo, NumLines()),
+				NumLines(), false);
+			return {first, lower(t1, first, NumLines(), true)};
+		}
+
+		// Appends column name between t0 and t1 (inclusive) to out,
+		// and their times to times if it is not null.
+		bool read_time_range(const std::string& name, const double& t0,
+			const double& t1, std::vector<double>& out,
+			std::vector<double>* times = nullptr) const {
+			auto column = _reader.column<double>(name);
+			if(!column.IsValid() || !IsOpen()) {
+				return false;
+			}
+
+			auto [first, last] = FindLines(t0, t1);
+			out.reserve(out.size() + (last - first));
+			for(uint64_t i = first; i < last; i++) {
+				out.push_back(column[i]);
+				if(times) {
+					times->push_back(_time[i]);
+				}
+			}
+
+			return true;
+		}
+	};
+
+} // namespace SBCQueens
@@ -0,0 +1,87 @@
+#pragma once
+
+/*
+
+	Comma separated text lines of any T with a schema, see
+	SlowControlSchema in slow_control_file.h.
+
+	All the lines of a save(...) are formatted with std::to_chars (fmt
+	for the numbers that do not fit) into a buffer that is kept between
+	saves, so after the first save it does not allocate, and then written
+	to the file at once:
+
+		csvFormatter<RTDs> rtds_text(RTDsSchema, 6);
+		save(rtds_file, rtds_text);
+
+	The values are written with Precision digits after the decimal point,
+	6 is the same as std::to_string.
+
+*/
+
+// STD includes
+#include <charconv>
+#include <iterator>
+#include <system_error>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 3rd party includes
+#include <spdlog/fmt/fmt.h>
+
+// my includes
+#include "slow_control_file.h"
+
+namespace SBCQueens {
+
+	template<typename T>
+	class csvFormatter {
+		SlowControlSchema<T> _schema;
+		fmt::memory_buffer _buffer;
+
+public:
+		// Digits after the decimal point
+		int Precision = 6;
+
+		explicit csvFormatter(const SlowControlSchema<T>& schema,
+			const int& precision = 6)
+			: _schema(schema), Precision(precision) { }
+
+		// Names of the columns as a line, ex: for a header
+		std::string header() const {
+			std::string out;
+			for(size_t i = 0; i < _schema.size(); i++) {
+				out += (i == 0 ? "" : ",") + _schema[i].Name;
+			}
+			return out + "\n";
+		}
+
+		// Lines of all the items in data. The view is valid until the
+		// next call.
+		std::string_view operator()(std::vector<T>& data) {
+			_buffer.clear();
+			auto out = std::back_inserter(_buffer);
+			for(const auto& item : data) {
+				for(size_t i = 0; i < _schema.size(); i++) {
+					if(i > 0) {
+						_buffer.push_back(',');
+					}
+					// to_chars is the fastest, but huge numbers do not fit
+					const double val = _schema[i].Get(item);
+					char num[64];
+					auto res = std::to_chars(num, num + sizeof(num), val,
+						std::chars_format::fixed, Precision);
+					if(res.ec == std::errc()) {
+						_buffer.append(num, res.ptr);
+					} else {
+						fmt::format_to(out, "{:.{}f}", val, Precision);
+					}
+				}
+				_buffer.push_back('\n');
+			}
+
+			return std::string_view(_buffer.data(), _buffer.size());
+		}
+	};
+
+} // namespace SBCQueens
@@ -0,0 +1,38 @@
+#pragma once
+
+// STD includes
+#include <cstdint>
+
+namespace SBCQueens {
+
+	// The trigger time tag is 31 bits (the 32nd is an overflow flag) so
+	// it rolls over every ~17s in the x730 (8ns per count, see
+	// TimeTagPeriod).
+	// This keeps track of the roll overs and returns a 64 bits time tag.
+	// It cannot see roll overs if two events are more than one
+	// period apart.
+	struct TimeTagUnwrapper {
+		uint64_t operator()(const uint32_t& ttt) noexcept {
+			const uint32_t t = ttt & 0x7FFFFFFF;
+			if(_started && t < _last) {
+				_rollovers++;
+			}
+
+			_last = t;
+			_started = true;
+			return (_rollovers << 31) | t;
+		}
+
+		void reset() noexcept {
+			_started = false;
+			_last = 0;
+			_rollovers = 0;
+		}
+
+private:
+		bool _started = false;
+		uint32_t _last = 0;
+		uint64_t _rollovers = 0;
+	};
+
+} // namespace SBCQueens
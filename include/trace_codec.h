@@ -0,0 +1,286 @@
+#pragma once
+
+/*
+
+	Lossless codec for the digitizer traces (bitpack16).
+
+	The digitizers are 12 or 14 bits and consecutive samples are only a
+	few counts apart, so storing every sample as a raw uint16 wastes most
+	of the bits. Each trace is encoded as:
+
+		uint16 			baseline (mean of the first samples)
+		then, for every block of 32 samples:
+		uint8 			w, bits needed by the largest value in the block
+		uint32[w] 		bit planes. Bit j of plane b is bit b of value j
+
+	The values are the zig-zag encoded differences between consecutive
+	samples (the first one against the baseline). All the arithmetic is
+	modulo 2^16, so any uint16 trace can be recovered exactly.
+
+	The last block is padded with repetitions of the last sample, so the
+	padding costs no bits. The decoder needs to know the number of
+	samples, which is in the file header anyways.
+
+	SSE2 is used when available (always in x86-64) and AVX2 for the
+	encoder if the compiler has it enabled (-mavx2, see USE_AVX2 in
+	CMakeLists.txt). Otherwise, everything falls back to plain C++.
+	All the paths produce the exact same bytes.
+
+*/
+
+// STD includes
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SBC_TRACE_CODEC_SSE2
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace SBCQueens {
+
+	// Samples per block, each block has its own bit width
+	constexpr size_t BitPack16BlockSize = 32;
+
+	// Samples used to calculate the baseline
+	constexpr size_t BitPack16BaselineSamples = 16;
+
+	// Largest number of bytes bitpack16_encode(...) can return for a trace
+	// of n samples
+	inline size_t bitpack16_max_size(const size_t& n) noexcept {
+		const size_t blocks = (n + BitPack16BlockSize - 1) / BitPack16BlockSize;
+		return sizeof(uint16_t) + blocks*(1 + 16*sizeof(uint32_t));
+	}
+
+	// Calculates the zig-zag deltas of a block and returns the OR of all of
+	// them. block[0] is the previous sample and block[1...32] the samples.
+	inline uint16_t bitpack16_deltas(const uint16_t* block,
+		uint16_t* zz) noexcept {
+#ifdef SBC_TRACE_CODEC_SSE2
+		__m128i all = _mm_setzero_si128();
+		for(size_t i = 0; i < BitPack16BlockSize; i += 8) {
+			__m128i cur = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(block + i + 1));
+			__m128i prev = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(block + i));
+
+			__m128i d = _mm_sub_epi16(cur, prev);
+			__m128i z = _mm_xor_si128(_mm_slli_epi16(d, 1),
+				_mm_srai_epi16(d, 15));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(zz + i), z);
+			all = _mm_or_si128(all, z);
+		}
+
+		all = _mm_or_si128(all, _mm_srli_si128(all, 8));
+		all = _mm_or_si128(all, _mm_srli_si128(all, 4));
+		all = _mm_or_si128(all, _mm_srli_si128(all, 2));
+		return static_cast<uint16_t>(_mm_cvtsi128_si32(all));
+#else
+		uint16_t all = 0;
+		for(size_t i = 0; i < BitPack16BlockSize; i++) {
+			auto d = static_cast<int16_t>(
+				static_cast<uint16_t>(block[i + 1] - block[i]));
+			zz[i] = static_cast<uint16_t>((d << 1) ^ (d >> 15));
+			all |= zz[i];
+		}
+		return all;
+#endif
+	}
+
+	// Writes the w bit planes of the 32 values in zz into out
+	inline void bitpack16_pack(const uint16_t* zz, const uint8_t& w,
+		char* out) noexcept {
+#if defined(__AVX2__)
+		__m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(zz));
+		__m256i hi = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i*>(zz + 16));
+
+		for(uint8_t b = 0; b < w; b++) {
+			// Moves bit b to the sign bit, so packs keeps it and movemask
+			// can pick it up.
+			__m128i shift = _mm_cvtsi32_si128(15 - b);
+			__m256i p = _mm256_packs_epi16(_mm256_sll_epi16(lo, shift),
+				_mm256_sll_epi16(hi, shift));
+			// packs works within 128 bit lanes, this puts them back in order
+			p = _mm256_permute4x64_epi64(p, 0xD8);
+
+			uint32_t word = static_cast<uint32_t>(_mm256_movemask_epi8(p));
+			std::memcpy(out + b*sizeof(uint32_t), &word, sizeof(uint32_t));
+		}
+#elif defined(SBC_TRACE_CODEC_SSE2)
+		__m128i v[4];
+		for(size_t i = 0; i < 4; i++) {
+			v[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(zz + 8*i));
+		}
+
+		for(uint8_t b = 0; b < w; b++) {
+			__m128i shift = _mm_cvtsi32_si128(15 - b);
+			__m128i p01 = _mm_packs_epi16(_mm_sll_epi16(v[0], shift),
+				_mm_sll_epi16(v[1], shift));
+			__m128i p23 = _mm_packs_epi16(_mm_sll_epi16(v[2], shift),
+				_mm_sll_epi16(v[3], shift));
+
+			uint32_t word = static_cast<uint32_t>(_mm_movemask_epi8(p01))
+				| (static_cast<uint32_t>(_mm_movemask_epi8(p23)) << 16);
+			std::memcpy(out + b*sizeof(uint32_t), &word, sizeof(uint32_t));
+		}
+#else
+		for(uint8_t b = 0; b < w; b++) {
+			uint32_t word = 0;
+			for(size_t j = 0; j < BitPack16BlockSize; j++) {
+				word |= static_cast<uint32_t>((zz[j] >> b) & 1) << j;
+			}
+			std::memcpy(out + b*sizeof(uint32_t), &word, sizeof(uint32_t));
+		}
+#endif
+	}
+
+	// Reads the w bit planes in in and turns them back into samples.
+	// prev is the sample before the block and it is updated to the last
+	// sample of the block. out must have space for 32 samples.
+	inline void bitpack16_unpack(const char* in, const uint8_t& w,
+		uint16_t& prev, uint16_t* out) noexcept {
+#ifdef SBC_TRACE_CODEC_SSE2
+		const __m128i lane_bits = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+		__m128i z[4] = {_mm_setzero_si128(), _mm_setzero_si128(),
+			_mm_setzero_si128(), _mm_setzero_si128()};
+
+		for(uint8_t b = 0; b < w; b++) {
+			uint32_t word;
+			std::memcpy(&word, in + b*sizeof(uint32_t), sizeof(uint32_t));
+			const __m128i bit = _mm_set1_epi16(static_cast<int16_t>(1 << b));
+
+			for(size_t i = 0; i < 4; i++) {
+				// Each lane j of the 8 gets bit j of this byte of the word
+				__m128i byte = _mm_set1_epi16(
+					static_cast<int16_t>((word >> 8*i) & 0xFF));
+				__m128i set = _mm_cmpeq_epi16(_mm_and_si128(byte, lane_bits),
+					lane_bits);
+				z[i] = _mm_or_si128(z[i], _mm_and_si128(set, bit));
+			}
+		}
+
+		const __m128i one = _mm_set1_epi16(1);
+		for(size_t i = 0; i < 4; i++) {
+			// zig-zag decode
+			__m128i d = _mm_xor_si128(_mm_srli_epi16(z[i], 1),
+				_mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(z[i], one)));
+
+			// prefix sum of the 8 deltas
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+			d = _mm_add_epi16(d, _mm_set1_epi16(static_cast<int16_t>(prev)));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8*i), d);
+			prev = static_cast<uint16_t>(_mm_extract_epi16(d, 7));
+		}
+#else
+		uint16_t zz[BitPack16BlockSize] = {0};
+		for(uint8_t b = 0; b < w; b++) {
+			uint32_t word;
+			std::memcpy(&word, in + b*sizeof(uint32_t), sizeof(uint32_t));
+			for(size_t j = 0; j < BitPack16BlockSize; j++) {
+				zz[j] |= static_cast<uint16_t>(((word >> j) & 1) << b);
+			}
+		}
+
+		for(size_t j = 0; j < BitPack16BlockSize; j++) {
+			auto d = static_cast<uint16_t>((zz[j] >> 1) ^ -(zz[j] & 1));
+			prev = static_cast<uint16_t>(prev + d);
+			out[j] = prev;
+		}
+#endif
+	}
+
+	// Encodes the n samples of in into out. out must have at least
+	// bitpack16_max_size(n) bytes.
+	// Returns the number of bytes written.
+	inline size_t bitpack16_encode(const uint16_t* in, const size_t& n,
+		char* out) noexcept {
+
+		const size_t nb = std::min(n, BitPack16BaselineSamples);
+		uint32_t sum = 0;
+		for(size_t i = 0; i < nb; i++) {
+			sum += in[i];
+		}
+		const uint16_t baseline = nb > 0 ? static_cast<uint16_t>(sum / nb) : 0;
+
+		std::memcpy(out, &baseline, sizeof(uint16_t));
+		size_t pos = sizeof(uint16_t);
+
+		// One extra at the start for the previous sample
+		uint16_t block[BitPack16BlockSize + 1];
+		uint16_t zz[BitPack16BlockSize];
+
+		block[0] = baseline;
+		for(size_t start = 0; start < n; start += BitPack16BlockSize) {
+			const size_t m = std::min(BitPack16BlockSize, n - start);
+
+			std::memcpy(block + 1, in + start, m*sizeof(uint16_t));
+			std::fill(block + 1 + m, block + 1 + BitPack16BlockSize, block[m]);
+
+			uint16_t all = bitpack16_deltas(block, zz);
+
+			uint8_t w = 0;
+			while(w < 16 && (all >> w)) {
+				w++;
+			}
+
+			out[pos++] = static_cast<char>(w);
+			bitpack16_pack(zz, w, out + pos);
+			pos += w*sizeof(uint32_t);
+
+			block[0] = block[m];
+		}
+
+		return pos;
+	}
+
+	// Decodes n samples from in, which has in_size bytes, into out.
+	// Returns the number of bytes used, or 0 if in is not a valid
+	// bitpack16 trace of n samples.
+	inline size_t bitpack16_decode(const char* in, const size_t& in_size,
+		uint16_t* out, const size_t& n) noexcept {
+
+		if(in_size < sizeof(uint16_t)) {
+			return 0;
+		}
+
+		uint16_t prev;
+		std::memcpy(&prev, in, sizeof(uint16_t));
+		size_t pos = sizeof(uint16_t);
+
+		uint16_t block[BitPack16BlockSize];
+		for(size_t start = 0; start < n; start += BitPack16BlockSize) {
+			if(pos >= in_size) {
+				return 0;
+			}
+
+			const auto w = static_cast<uint8_t>(in[pos++]);
+			if(w > 16 || pos + w*sizeof(uint32_t) > in_size) {
+				return 0;
+			}
+
+			const size_t m = std::min(BitPack16BlockSize, n - start);
+			if(m == BitPack16BlockSize) {
+				bitpack16_unpack(in + pos, w, prev, out + start);
+			} else {
+				bitpack16_unpack(in + pos, w, prev, block);
+				std::memcpy(out + start, block, m*sizeof(uint16_t));
+			}
+
+			pos += w*sizeof(uint32_t);
+		}
+
+		return pos;
+	}
+
+} // namespace SBCQueens
@@ -70,10 +70,13 @@ int main(int argc, char *argv[])
 
 	spdlog::info("Starting threads");
 
-	tc_thread.detach();
-	caen_thread.detach();
 	gui_wrapper();
 
+	// Closing the GUI tells the threads to close, wait for them so
+	// the files are finished
+	tc_thread.join();
+	caen_thread.join();
+
 	spdlog::info("Closing software");
 
 	return 0;
@@ -0,0 +1,241 @@
+#include "baseline_tracker.h"
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace SBCQueens {
+
+	// Estimates every EstimatePeriod histograms worth of samples
+	constexpr uint64_t EstimatePeriod = 16;
+
+	baselineTracker::baselineTracker() {
+		_channelIndex.fill(-1);
+		for(auto& baseline : _baselines) {
+			baseline.store(std::numeric_limits<float>::quiet_NaN(),
+				std::memory_order_relaxed);
+		}
+	}
+
+	void baselineTracker::configure(const BaselineTrackerConfig& config,
+		const std::vector<uint8_t>& channels, const uint32_t& numSamples,
+		const uint32_t& adcBits) {
+		_config = config;
+		_config.HistogramCodes = std::clamp<uint32_t>(_config.HistogramCodes,
+			16, 65536);
+		// The counts have to fit in 32 bits
+		_config.HalfLifeSamples = std::clamp<uint64_t>(
+			_config.HalfLifeSamples, _config.HistogramCodes, 1ull << 30);
+		_numSamples = numSamples;
+		_fullScale = static_cast<float>((1u << std::min(adcBits, 16u)) - 1);
+
+		_channelIndex.fill(-1);
+		_channels.assign(channels.size(), channelData());
+		for(size_t k = 0; k < channels.size(); k++) {
+			_channelIndex[channels[k]] = static_cast<int>(k);
+			_channels[k].State.Channel = channels[k];
+		}
+
+		reset();
+	}
+
+	void baselineTracker::reset() {
+		for(auto& channel : _channels) {
+			channel.Counts.assign(_config.HistogramCodes, 0);
+			channel.Offset = 0;
+			channel.HasOffset = false;
+			channel.ToHalve = _config.HalfLifeSamples;
+			channel.ToUpdate = EstimatePeriod*_config.HistogramCodes;
+
+			const auto ch = channel.State.Channel;
+			channel.State = BaselineState();
+			channel.State.Channel = ch;
+		}
+
+		for(auto& baseline : _baselines) {
+			baseline.store(std::numeric_limits<float>::quiet_NaN(),
+				std::memory_order_relaxed);
+		}
+	}
+
+	void baselineTracker::add(const uint8_t& ch, const uint16_t* data,
+		const uint32_t& size) noexcept {
+		const int k = _channelIndex[ch];
+		const uint32_t n = std::min(size, _numSamples);
+		if(!_config.Enabled || k < 0 || n == 0) {
+			return;
+		}
+
+		auto& channel = _channels[k];
+		if(!channel.HasOffset) {
+			recenter(channel, data[0]);
+		}
+
+		const int32_t last = static_cast<int32_t>(_config.HistogramCodes) - 1;
+		uint32_t i = 0;
+		while(i < n) {
+			// Up to the next halving or estimate
+			const auto todo = static_cast<uint32_t>(std::min<uint64_t>(
+				{n - i, channel.ToHalve, channel.ToUpdate}));
+			uint32_t* counts = channel.Counts.data();
+			for(uint32_t j = i; j < i + todo; j++) {
+				const int32_t bin = static_cast<int32_t>(data[j])
+					- channel.Offset;
+				counts[std::clamp(bin, 0, last)]++;
+			}
+
+			i += todo;
+			channel.State.Samples += todo;
+			channel.ToHalve -= todo;
+			channel.ToUpdate -= todo;
+			if(channel.ToHalve == 0) {
+				for(auto& count : channel.Counts) {
+					count >>= 1;
+				}
+				channel.ToHalve = _config.HalfLifeSamples;
+			}
+
+			if(channel.ToUpdate == 0) {
+				update(channel);
+				channel.ToUpdate = EstimatePeriod*_config.HistogramCodes;
+			}
+		}
+	}
+
+	void baselineTracker::update(channelData& channel) noexcept {
+		const auto& counts = channel.Counts;
+		const size_t num_codes = counts.size();
+		uint64_t total = 0;
+		for(const auto& count : counts) {
+			total += count;
+		}
+
+		if(total == 0) {
+			return;
+		}
+
+		// Not the first and last, they have everything outside
+		size_t peak = 1;
+		for(size_t j = 2; j + 1 < num_codes; j++) {
+			if(counts[j] > counts[peak]) {
+				peak = j;
+			}
+		}
+
+		// Of a parabola through the logs of the peak and its neighbours,
+		// exact for a gaussian
+		double delta = 0.0;
+		if(counts[peak - 1] > 0 && counts[peak + 1] > 0) {
+			const double left = std::log(static_cast<double>(counts[peak - 1]));
+			const double center = std::log(static_cast<double>(counts[peak]));
+			const double right = std::log(static_cast<double>(counts[peak + 1]));
+			const double curvature = left - 2.0*center + right;
+			if(curvature < 0.0) {
+				delta = 0.5*(left - right) / curvature;
+			}
+		}
+
+		// Each code is [code - 0.5, code + 0.5) with its counts spread
+		// evenly
+		const std::array<double, 3> fractions = {0.15866, 0.5, 0.84134};
+		std::array<double, 3> quantiles = {0.0, 0.0, 0.0};
+		size_t q = 0;
+		uint64_t below = 0;
+		for(size_t j = 0; j < num_codes && q < fractions.size(); j++) {
+			while(q < fractions.size()
+				&& below + counts[j] >= fractions[q]*total) {
+				quantiles[q] = channel.Offset + static_cast<double>(j) - 0.5
+					+ (fractions[q]*total - below) / std::max(counts[j], 1u);
+				q++;
+			}
+			below += counts[j];
+		}
+
+		auto& state = channel.State;
+		state.Mode = static_cast<float>(static_cast<double>(channel.Offset)
+			+ peak + delta);
+		state.Median = static_cast<float>(quantiles[1]);
+		state.NoiseRMS = static_cast<float>(0.5*(quantiles[2] - quantiles[0]));
+		state.Baseline = _config.Estimator == BaselineEstimator::Mode ?
+			state.Mode : state.Median;
+		state.IsReady = state.Samples >= _config.MinSamples;
+		state.InWindow = !state.IsReady
+			|| (state.Baseline >= _config.MinBaseline
+				&& state.Baseline <= _config.MaxBaseline
+				&& state.Baseline >= _config.SaturationMargin
+				&& state.Baseline <= _fullScale - _config.SaturationMargin
+				&& (_config.MaxNoiseRMS <= 0.0f
+					|| state.NoiseRMS <= _config.MaxNoiseRMS));
+
+		_baselines[state.Channel].store(state.IsReady ? state.Baseline
+			: std::numeric_limits<float>::quiet_NaN(),
+			std::memory_order_relaxed);
+
+		// Half of the samples are outside, it jumped further than the
+		// histogram. It starts again from the next sample.
+		if(quantiles[1] < channel.Offset + 0.5
+			|| quantiles[1] > channel.Offset + num_codes - 1.5) {
+			std::fill(channel.Counts.begin(), channel.Counts.end(), 0);
+			channel.HasOffset = false;
+			return;
+		}
+
+		// Too close to an edge, the tails would not fit. The median, the
+		// mode does not look at the edges so it would not follow a jump.
+		const double middle = channel.Offset + 0.5*num_codes;
+		if(std::abs(state.Median - middle) > 0.25*num_codes) {
+			recenter(channel, static_cast<int32_t>(std::lround(
+				state.Median)));
+		}
+	}
+
+	void baselineTracker::recenter(channelData& channel,
+		const int32_t& code) noexcept {
+		const int32_t num_codes = static_cast<int32_t>(channel.Counts.size());
+		const int32_t offset = code - num_codes / 2;
+		if(!channel.HasOffset) {
+			channel.Offset = offset;
+			channel.HasOffset = true;
+			return;
+		}
+
+		// What falls outside goes to the first or last code, as if it
+		// was added now. In place, it is called while taking data.
+		auto& counts = channel.Counts;
+		const int32_t shift = channel.Offset - offset;
+		if(shift >= num_codes || shift <= -num_codes) {
+			const auto total = std::accumulate(counts.begin(), counts.end(),
+				0u);
+			std::fill(counts.begin(), counts.end(), 0);
+			counts[shift > 0 ? num_codes - 1 : 0] = total;
+		} else if(shift > 0) {
+			const auto last = std::accumulate(
+				counts.end() - shift - 1, counts.end(), 0u);
+			std::copy_backward(counts.begin(), counts.end() - shift - 1,
+				counts.end() - 1);
+			std::fill(counts.begin(), counts.begin() + shift, 0);
+			counts.back() = last;
+		} else if(shift < 0) {
+			const auto first = std::accumulate(counts.begin(),
+				counts.begin() - shift + 1, 0u);
+			std::copy(counts.begin() - shift + 1, counts.end(),
+				counts.begin() + 1);
+			std::fill(counts.end() + shift, counts.end(), 0);
+			counts.front() = first;
+		}
+
+		channel.Offset = offset;
+	}
+
+	std::vector<BaselineState> baselineTracker::GetStates() const {
+		std::vector<BaselineState> states;
+		states.reserve(_channels.size());
+		for(const auto& channel : _channels) {
+			states.push_back(channel.State);
+		}
+		return states;
+	}
+
+} // namespace SBCQueens
@@ -1,6 +1,10 @@
 #include "caen_helper.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -13,6 +17,9 @@
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/fmt.h>
 
+#include "roi_codec.h"
+#include "trace_codec.h"
+
 namespace SBCQueens {
 
 	std::string translate_caen_code(const CAENComm_ErrorCode& err) noexcept {
@@ -76,6 +83,9 @@ namespace SBCQueens {
 		// errCode |= CAEN_DGTZ_ClearData(handle);
 		errCode |= CAEN_DGTZ_CloseDigitizer(handle);
 
+		// reset, not release, or the resource is never deleted
+		res.reset();
+
 		if(errCode < 0) {
 			return CAENError {
 				.ErrorMessage = "Error while disconnecting CAEN resource. "
@@ -85,7 +95,6 @@ namespace SBCQueens {
 			};
 		}
 
-		res.release();
 		return CAENError();
 	}
 
@@ -765,7 +774,226 @@ namespace SBCQueens {
 		return real_max_buffs;
 	}
 
-	std::string sbc_init_file(CAEN& res) noexcept {
+	namespace {
+
+	// Values of the run constants, as saved at the start of each line:
+	// sample_rate, en_chs, trg_mask, thresholds, dc_offsets,
+	// dc_corrections and dc_range
+	std::string sbc_run_constants(CAEN& res) noexcept {
+		const uint8_t ch_per_group = res->GetNumberOfChannelsPerGroup();
+		const uint8_t num_groups = res->GetNumberOfGroups();
+		const bool has_groups = num_groups > 0;
+
+		uint64_t offset = 0;
+		auto append_cstr = [](auto num, uint64_t& offset, char* str) {
+			char* ptr = reinterpret_cast<char*>(&num);
+			for(size_t i = 0; i < sizeof(num) / sizeof(char); i++) {
+				str[offset + i] = ptr[i];
+			}
+			offset += sizeof(num) / sizeof(char);
+		};
+
+		// This will switch between Zhiheng code and mine if it has groups
+		auto wrap_if_group = [=, grp_conf = res->GroupConfigs]
+			(uint64_t& offset, char* str, auto f) {
+			for(auto gr_pair : grp_conf) {
+				if(has_groups){
+					for(int ch = 0; ch < ch_per_group; ch++) {
+						if (gr_pair.second.AcquisitionMask & (1 << ch)){
+							f(gr_pair.second, offset, str, ch);
+						}
+					}
+				} else {
+					f(gr_pair.second, offset, str, 0);
+				}
+			}
+		};
+
+
+		// 8 + 4 bytes and 10 per channel
+		std::vector<char> out_str(12 + 10*res->GroupConfigs.size()
+			*std::max<uint8_t>(ch_per_group, 1));
+
+		// sample_rate
+		append_cstr(res->GetSampleRate(), offset, &out_str[0]);
+
+		// en_chs
+		// for(auto gr_pair : res->GroupConfigs) {
+		// 	for(int ch = 0; ch < ch_per_group; ch++) {
+		// 		if (gr_pair.second.AcquisitionMask & (1<<ch)){
+		// 			uint8_t channel = gr_pair.second.Number * ch_per_group + ch;
+		// 			append_cstr(channel, offset, &out_str[0]);
+		// 		}
+		// 	}
+		// }
+
+		wrap_if_group(offset, &out_str[0],
+			[=](auto group, uint64_t& offset, char* str, uint8_t ch) {
+				uint8_t channel = group.Number * ch_per_group + ch;
+				append_cstr(channel, offset, str);
+			}
+		);
+
+		// trg_mask
+		uint32_t trg_mask = 0;
+		for(auto gr_pair : res->GroupConfigs) {
+			uint32_t pos = has_groups ? gr_pair.second.Number * ch_per_group
+			: gr_pair.second.Number;
+			trg_mask |= (gr_pair.second.TriggerMask << pos);
+		}
+
+		append_cstr(trg_mask, offset, &out_str[0]);
+
+		// thresholds
+		// for(auto gr_pair : res->GroupConfigs) {
+		// 	if(has_groups){
+		// 		for(int ch = 0; ch < ch_per_group; ch++) {
+		// 			if (gr_pair.second.AcquisitionMask & (1 << ch)){
+		// 				append_cstr(gr_pair.second.TriggerThreshold, offset, &out_str[0]);
+		// 			}
+		// 		}
+		// 	} else {
+		// 		append_cstr(gr_pair.second.TriggerThreshold, offset, &out_str[0]);
+		// 	}
+		// }
+
+		wrap_if_group(offset, &out_str[0],
+			[=](auto group, uint64_t& offset, char* str, uint8_t ch) {
+				append_cstr(group.TriggerThreshold, offset, str);
+			}
+		);
+
+		// dc_offsets
+		// for(auto gr_pair : res->GroupConfigs) {
+		// 	for(int ch = 0; ch < ch_per_group; ch++) {
+		// 		if (gr_pair.second.AcquisitionMask & (1<<ch)){
+		// 			append_cstr(gr_pair.second.DCOffset, offset, &out_str[0]);
+		// 		}
+		// 	}
+		// }
+		wrap_if_group(offset, &out_str[0],
+			[=](auto group, uint64_t& offset, char* str, uint8_t ch) {
+				append_cstr(group.DCOffset, offset, str);
+			}
+		);
+
+		// dc_corrections
+		// for(auto gr_pair : res->GroupConfigs) {
+		// 	for(int ch = 0; ch < ch_per_group; ch++) {
+		// 		if (gr_pair.second.AcquisitionMask & (1<<ch)){
+		// 			append_cstr(gr_pair.second.DCCorrections[ch], offset, &out_str[0]);
+		// 		}
+		// 	}
+		// }
+		wrap_if_group(offset, &out_str[0],
+			[=](auto group, uint64_t& offset, char* str, uint8_t ch) {
+				if(group.DCCorrections.size() == 8){
+					append_cstr(group.DCCorrections[ch], offset, str);
+				} else {
+					uint8_t tmp = 0;
+					append_cstr(tmp, offset, str);
+				}
+			}
+		);
+
+		// dc_range
+		// for(auto gr_pair : res->GroupConfigs) {
+		// 	for(int ch = 0; ch < ch_per_group; ch++) {
+		// 		if (gr_pair.second.AcquisitionMask & (1<<ch)){
+		// 			float val = res->GetVoltageRange(gr_pair.second.Number);
+		// 			append_cstr(val, offset, &out_str[0]);
+		// 		}
+		// 	}
+		// }
+
+		wrap_if_group(offset, &out_str[0],
+			[&](auto group, uint64_t& off, char* str, uint8_t ch) {
+				float val = res->GetVoltageRange(group.Number);
+				append_cstr(val, off, str);
+			}
+		);
+
+		return std::string(out_str.data(), offset);
+	}
+
+	// Calls f(data, size) with the trace of every enabled channel of evt
+	template<typename Func>
+	void sbc_for_each_trace(CAENEvent& evt, CAEN& res, Func f) noexcept {
+		sbc_for_each_channel(evt, res,
+			[&](uint8_t, const uint16_t* data, uint32_t size) {
+				f(data, size);
+		});
+	}
+
+	// Type of the sipm_traces in the header
+	std::string sbc_trace_type(const SBCFileConfig& config) noexcept {
+		switch(config.TraceEncoding) {
+			case SBCTraceEncoding::BitPacked:
+				return "bitpack16";
+			case SBCTraceEncoding::ROI:
+				return "roi16";
+			case SBCTraceEncoding::Raw:
+			default:
+				return "uint16";
+		}
+	}
+
+	// Largest size of an encoded trace of size samples
+	size_t sbc_encoded_max_size(const SBCFileConfig& config,
+		const uint32_t& size) noexcept {
+		return config.TraceEncoding == SBCTraceEncoding::ROI ?
+			roi_max_size(size) : bitpack16_max_size(size);
+	}
+
+	// Encodes a trace into out, which has to have at least
+	// sbc_encoded_max_size(...) bytes. Returns the bytes written.
+	size_t sbc_encode_trace(const SBCFileConfig& config, const uint16_t* data,
+		const uint32_t& size, char* out) noexcept {
+		return config.TraceEncoding == SBCTraceEncoding::ROI ?
+			roi_encode(data, size, config.ROI, out) :
+			bitpack16_encode(data, size, out);
+	}
+
+	// Moves the events of chunk into a string to be saved at offset
+	// and adds it to the directory
+	std::string sbc_columnar_flush(SBCColumnarChunk& chunk,
+		const uint64_t& offset) noexcept {
+		if(chunk.EventsInChunk == 0) {
+			return "";
+		}
+
+		SBCChunkEntry entry;
+		entry.FirstEvent = chunk.NumEvents;
+		entry.NumEvents = chunk.EventsInChunk;
+		entry.FirstTime = chunk.FirstTime;
+		entry.LastTime = chunk.LastTime;
+
+		size_t total = 0;
+		for(const auto& column : chunk.Columns) {
+			total += column.size();
+		}
+
+		std::string out;
+		out.reserve(total);
+		for(auto& column : chunk.Columns) {
+			entry.Offsets.push_back(offset + out.size());
+			entry.Sizes.push_back(column.size());
+			out += column;
+			// clear() keeps the memory for the next chunk
+			column.clear();
+		}
+
+		chunk.NumEvents += chunk.EventsInChunk;
+		chunk.EventsInChunk = 0;
+		chunk.Directory.push_back(std::move(entry));
+		return out;
+	}
+
+	} // namespace
+
+	std::string sbc_init_file(CAEN& res, const SBCFileConfig& config) noexcept {
+		res->RunConstants = sbc_run_constants(res);
+
 		// header string = name;type;x,y,z...;
 		auto g_config = res->GlobalConfig;
 		auto group_configs = res->GroupConfigs;
@@ -856,7 +1084,9 @@ namespace SBCQueens {
 
 		// This part is the header for the SiPM pulses
 		// The pulses are saved as raw counts, so uint16 is enough
-		const std::string c_type = "uint16";
+		// unless they are compressed, then the type tells the reader
+		// which codec was used.
+		const std::string c_type = sbc_trace_type(config);
 		// Name of this block
 		const std::string c_sipm_name = "sipm_traces";
 
@@ -902,7 +1132,8 @@ namespace SBCQueens {
 	// }
 
 
-	std::string sbc_save_func(CAENEvent& evt, CAEN& res) noexcept {
+	std::string sbc_save_func(CAENEvent& evt, CAEN& res,
+		const SBCFileConfig& config) noexcept {
 
 		// TODO(Hector): so this code could be improved and half of the reason
 		// it is related to the format itself. A bunch of the details
@@ -927,9 +1158,13 @@ namespace SBCQueens {
 		// data 			uint16 		2*rl*ch_size 	N
 		//
 		// Total length 				20 + ch_size(10 + 2*recordlength)
+		//
+		// If the traces are BitPacked or ROI, data is instead a uint32
+		// with the number of bytes followed by the bitpack16 or roi16
+		// traces, one per channel.
+		// The length of each line is not fixed anymore.
 
 		const auto rl = res->GlobalConfig.RecordLength;
-		const uint8_t ch_per_group = res->GetNumberOfChannelsPerGroup();
 		const uint8_t num_groups = res->GetNumberOfGroups();
 		const bool has_groups = num_groups > 0;
 
@@ -946,25 +1181,8 @@ namespace SBCQueens {
 			offset += sizeof(num) / sizeof(char);
 		};
 
-		// This will switch between Zhiheng code and mine if it has groups
-		auto wrap_if_group = [=, grp_conf = res->GroupConfigs]
-			(uint64_t& offset, char* str, auto f) {
-			for(auto gr_pair : grp_conf) {
-				if(has_groups){
-					for(int ch = 0; ch < ch_per_group; ch++) {
-						if (gr_pair.second.AcquisitionMask & (1 << ch)){
-							f(gr_pair.second, offset, str, ch);
-						}
-					}
-				} else {
-					f(gr_pair.second, offset, str, 0);
-				}
-			}
-		};
-
-
 		uint32_t num_ch = 0;
-		for (auto gr_pair : res->GroupConfigs) {
+		for (const auto& gr_pair : res->GroupConfigs) {
 			if(has_groups) {
 				num_ch += has_groups*n_channels_acq(gr_pair.second.AcquisitionMask);
 			} else {
@@ -973,142 +1191,383 @@ namespace SBCQueens {
 		}
 
 		// No strings for this one as this is more efficient
-		const size_t nline = 20 + (2*rl + 10)*num_ch;
+		const bool is_encoded =
+			config.TraceEncoding != SBCTraceEncoding::Raw;
+		const size_t nline = is_encoded ?
+			24 + (sbc_encoded_max_size(config, rl) + 10)*num_ch :
+			20 + (2*rl + 10)*num_ch;
 		char out_str[nline];
 
-		// sample_rate
-		append_cstr(res->GetSampleRate(), offset, &out_str[0]);
+		// sample_rate, en_chs, trg_mask, thresholds, dc_offsets,
+		// dc_corrections and dc_range. Only if the file was not opened
+		// with sbc_init_file(...)
+		if(res->RunConstants.empty()) {
+			res->RunConstants = sbc_run_constants(res);
+		}
 
-		// en_chs
-		// for(auto gr_pair : res->GroupConfigs) {
-		// 	for(int ch = 0; ch < ch_per_group; ch++) {
-		// 		if (gr_pair.second.AcquisitionMask & (1<<ch)){
-		// 			uint8_t channel = gr_pair.second.Number * ch_per_group + ch;
-		// 			append_cstr(channel, offset, &out_str[0]);
-		// 		}
-		// 	}
-		// }
+		const auto& constants = res->RunConstants;
+		std::memcpy(&out_str[0], constants.data(), constants.size());
+		offset += constants.size();
 
-		wrap_if_group(offset, &out_str[0],
-			[=](auto group, uint64_t& offset, char* str, uint8_t ch) {
-				uint8_t channel = group.Number * ch_per_group + ch;
-				append_cstr(channel, offset, str);
+		// time_stamp
+		append_cstr(evt->Info.TriggerTimeTag, offset, &out_str[0]);
+
+		// tgr_source
+		append_cstr(evt->Info.Pattern, offset, &out_str[0]);
+
+
+		if(is_encoded) {
+			// The number of bytes is only known at the end
+			uint64_t size_offset = offset;
+			offset += sizeof(uint32_t);
+
+			sbc_for_each_trace(evt, res, [&](const uint16_t* data, uint32_t size) {
+				offset += sbc_encode_trace(config, data, std::min(size, rl),
+					&out_str[offset]);
+			});
+
+			uint32_t num_bytes = offset - size_offset - sizeof(uint32_t);
+			std::memcpy(&out_str[size_offset], &num_bytes, sizeof(uint32_t));
+
+			return std::string(out_str, offset);
+		}
+
+		// For CAEN data, each line is an Event which contains a 2-D array
+		// where the x-axis is the record length and the y-axis are the
+		// number of channels that are activated
+		sbc_for_each_trace(evt, res, [&](const uint16_t* data, uint32_t size) {
+			for(uint32_t xp = 0; xp < size; xp++) {
+				append_cstr(data[xp], offset, &out_str[0]);
 			}
-		);
+		});
 
-		// trg_mask
-		uint32_t trg_mask = 0;
-		for(auto gr_pair : res->GroupConfigs) {
-			uint32_t pos = has_groups ? gr_pair.second.Number * ch_per_group
-			: gr_pair.second.Number;
-			trg_mask |= (gr_pair.second.TriggerMask << pos);
+		// However, we do convert to string at the end, I wonder if this
+		// is a big performance impact?
+		return std::string(out_str, nline);
+	}
+
+	void sbc_index_event(SBCFileIndex& index, const CAENEvent& evt,
+		const uint64_t& offset) noexcept {
+
+		// The time stamp is unwrapped even if the event is not in the
+		// index, otherwise roll overs would be lost.
+		const uint64_t time_stamp = index.Unwrapper(evt->Info.TriggerTimeTag);
+
+		if(index.Interval > 0 && index.NumEvents % index.Interval == 0) {
+			index.Entries.push_back(
+				SBCIndexEntry{index.NumEvents, offset, time_stamp});
 		}
 
-		append_cstr(trg_mask, offset, &out_str[0]);
+		index.NumEvents++;
+	}
 
-		// thresholds
-		// for(auto gr_pair : res->GroupConfigs) {
-		// 	if(has_groups){
-		// 		for(int ch = 0; ch < ch_per_group; ch++) {
-		// 			if (gr_pair.second.AcquisitionMask & (1 << ch)){
-		// 				append_cstr(gr_pair.second.TriggerThreshold, offset, &out_str[0]);
-		// 			}
-		// 		}
-		// 	} else {
-		// 		append_cstr(gr_pair.second.TriggerThreshold, offset, &out_str[0]);
-		// 	}
-		// }
+	std::string sbc_index_footer(const SBCFileIndex& index) noexcept {
+		if(index.Interval == 0) {
+			return "";
+		}
 
-		wrap_if_group(offset, &out_str[0],
-			[=](auto group, uint64_t& offset, char* str, uint8_t ch) {
-				append_cstr(group.TriggerThreshold, offset, str);
+		std::string footer;
+		footer.reserve(index.Entries.size()*sizeof(SBCIndexEntry)
+			+ SBCIndexTrailerSize);
+
+		auto append = [&](auto num) {
+			footer.append(reinterpret_cast<const char*>(&num), sizeof(num));
+		};
+
+		for(const auto& entry : index.Entries) {
+			append(entry.Event);
+			append(entry.Offset);
+			append(entry.TimeStamp);
+		}
+
+		append(static_cast<uint64_t>(index.Entries.size()));
+		append(index.NumEvents);
+		append(index.Interval);
+		append(SBCIndexMagic);
+
+		return footer;
+	}
+
+	bool sbc_finalize_file(const std::string& fileName,
+		const uint64_t& numEvents) noexcept {
+
+		if(numEvents > static_cast<uint64_t>(INT32_MAX)) {
+			spdlog::warn("{0} has too many lines for the header, it will be "
+				"left as 0.", fileName);
+			return false;
+		}
+
+		std::fstream file(fileName,
+			std::fstream::in | std::fstream::out | std::fstream::binary);
+		if(!file.is_open()) {
+			return false;
+		}
+
+		uint32_t endianness = 0;
+		uint16_t header_length = 0;
+		file.read(reinterpret_cast<char*>(&endianness), sizeof(uint32_t));
+		file.read(reinterpret_cast<char*>(&header_length), sizeof(uint16_t));
+
+		// If it does not start like a SBC file, it is most likely
+		// compressed and it cannot be changed in place.
+		if(!file || endianness != 0x01020304) {
+			return false;
+		}
+
+		const int32_t num_lines = static_cast<int32_t>(numEvents);
+		file.seekp(sizeof(uint32_t) + sizeof(uint16_t) + header_length);
+		file.write(reinterpret_cast<const char*>(&num_lines), sizeof(int32_t));
+
+		return static_cast<bool>(file);
+	}
+
+	bool sbc_read_index(const std::string& fileName,
+		SBCFileIndex& index) noexcept {
+
+		std::ifstream file(fileName, std::ifstream::binary);
+		if(!file.is_open()) {
+			return false;
+		}
+
+		file.seekg(0, std::ifstream::end);
+		const uint64_t file_size = file.tellg();
+		if(file_size < SBCIndexTrailerSize) {
+			return false;
+		}
+
+		uint64_t num_entries = 0, num_events = 0;
+		uint32_t interval = 0, magic = 0;
+		file.seekg(file_size - SBCIndexTrailerSize);
+		file.read(reinterpret_cast<char*>(&num_entries), sizeof(uint64_t));
+		file.read(reinterpret_cast<char*>(&num_events), sizeof(uint64_t));
+		file.read(reinterpret_cast<char*>(&interval), sizeof(uint32_t));
+		file.read(reinterpret_cast<char*>(&magic), sizeof(uint32_t));
+
+		const uint64_t entry_size = 3*sizeof(uint64_t);
+		if(!file || magic != SBCIndexMagic
+			|| num_entries > (file_size - SBCIndexTrailerSize) / entry_size) {
+			return false;
+		}
+
+		index.reset();
+		index.Interval = interval;
+		index.NumEvents = num_events;
+		index.Entries.resize(num_entries);
+
+		file.seekg(file_size - SBCIndexTrailerSize - num_entries*entry_size);
+		for(auto& entry : index.Entries) {
+			file.read(reinterpret_cast<char*>(&entry.Event), sizeof(uint64_t));
+			file.read(reinterpret_cast<char*>(&entry.Offset), sizeof(uint64_t));
+			file.read(reinterpret_cast<char*>(&entry.TimeStamp),
+				sizeof(uint64_t));
+		}
+
+		return static_cast<bool>(file);
+	}
+
+	std::string sbc_columnar_init_file(CAEN& res,
+		const SBCFileConfig& config) noexcept {
+
+		// Same columns as the rows format up to trg_source
+		const auto rows = sbc_init_file(res, config);
+		uint16_t rows_length = 0;
+		std::memcpy(&rows_length, rows.data() + sizeof(uint32_t),
+			sizeof(uint16_t));
+		const auto rows_header = rows.substr(6, rows_length);
+		const auto columns = sbc_parse_columns(rows_header);
+
+		std::string header = rows_header.substr(0,
+			rows_header.find("time_stamp;"));
+		// Everything before time_stamp is a run constant
+		const auto num_constants = static_cast<uint16_t>(
+			sbc_parse_columns(header).size());
+
+		// time_stamp is unwrapped so it can be searched and the traces
+		// get one column per channel
+		header += "time_stamp;uint64;1;trg_source;uint32;1;";
+
+		// Made by sbc_init_file(...)
+		const auto& constants = res->RunConstants;
+		for(const auto& col : columns) {
+			if(col.Name != "sipm_traces") {
+				continue;
 			}
-		);
 
-		// dc_offsets
-		// for(auto gr_pair : res->GroupConfigs) {
-		// 	for(int ch = 0; ch < ch_per_group; ch++) {
-		// 		if (gr_pair.second.AcquisitionMask & (1<<ch)){
-		// 			append_cstr(gr_pair.second.DCOffset, offset, &out_str[0]);
-		// 		}
-		// 	}
-		// }
-		wrap_if_group(offset, &out_str[0],
-			[=](auto group, uint64_t& offset, char* str, uint8_t ch) {
-				append_cstr(group.DCOffset, offset, str);
+			// sipm_trace_i is the channel en_chs[i]
+			for(size_t i = 0; i < col.Dims.front(); i++) {
+				header += "sipm_trace_" + std::to_string(i) + ";"
+					+ col.Type + ";" + std::to_string(col.Dims.back()) + ";";
 			}
-		);
+		}
 
-		// dc_corrections
-		// for(auto gr_pair : res->GroupConfigs) {
-		// 	for(int ch = 0; ch < ch_per_group; ch++) {
-		// 		if (gr_pair.second.AcquisitionMask & (1<<ch)){
-		// 			append_cstr(gr_pair.second.DCCorrections[ch], offset, &out_str[0]);
-		// 		}
-		// 	}
-		// }
-		wrap_if_group(offset, &out_str[0],
-			[=](auto group, uint64_t& offset, char* str, uint8_t ch) {
-				if(group.DCCorrections.size() == 8){
-					append_cstr(group.DCCorrections[ch], offset, str);
-				} else {
-					uint8_t tmp = 0;
-					append_cstr(tmp, offset, str);
+		std::string out;
+		auto append = [&](auto num) {
+			out.append(reinterpret_cast<const char*>(&num), sizeof(num));
+		};
+
+		append(SBCColumnarMagic);
+		append(static_cast<uint16_t>(header.length()));
+		out += header;
+		append(num_constants);
+		out += constants;
+
+		return out;
+	}
+
+	std::string sbc_columnar_save_func(SBCColumnarChunk& chunk,
+		CAENEvent& evt, CAEN& res, const SBCFileConfig& config,
+		const uint64_t& offset) noexcept {
+
+		const auto rl = res->GlobalConfig.RecordLength;
+		const uint32_t chunk_events = std::max(config.ChunkEvents, 1u);
+		const bool is_encoded =
+			config.TraceEncoding != SBCTraceEncoding::Raw;
+
+		const uint64_t time_stamp = chunk.Unwrapper(evt->Info.TriggerTimeTag);
+		if(chunk.EventsInChunk == 0) {
+			chunk.FirstTime = time_stamp;
+		}
+		chunk.LastTime = time_stamp;
+
+		// time_stamp, trg_source then one column per channel
+		if(chunk.Columns.size() < 2) {
+			chunk.Columns.resize(2);
+		}
+
+		chunk.Columns[0].append(reinterpret_cast<const char*>(&time_stamp),
+			sizeof(uint64_t));
+		chunk.Columns[1].append(
+			reinterpret_cast<const char*>(&evt->Info.Pattern),
+			sizeof(uint32_t));
+
+		size_t col = 2;
+		sbc_for_each_trace(evt, res, [&](const uint16_t* data, uint32_t size) {
+			if(chunk.Columns.size() <= col) {
+				chunk.Columns.emplace_back();
+			}
+
+			auto& out = chunk.Columns[col++];
+			size = std::min(size, rl);
+			if(is_encoded) {
+				const size_t start = out.size();
+				out.resize(start + sbc_encoded_max_size(config, size));
+				out.resize(start + sbc_encode_trace(config, data, size,
+					&out[start]));
+			} else {
+				if(out.empty()) {
+					out.reserve(chunk_events*rl*sizeof(uint16_t));
 				}
+
+				// Every trace must be rl long or the chunk cannot be read
+				out.append(reinterpret_cast<const char*>(data),
+					size*sizeof(uint16_t));
+				out.append((rl - size)*sizeof(uint16_t), '\0');
 			}
-		);
+		});
 
-		// dc_range
-		// for(auto gr_pair : res->GroupConfigs) {
-		// 	for(int ch = 0; ch < ch_per_group; ch++) {
-		// 		if (gr_pair.second.AcquisitionMask & (1<<ch)){
-		// 			float val = res->GetVoltageRange(gr_pair.second.Number);
-		// 			append_cstr(val, offset, &out_str[0]);
-		// 		}
-		// 	}
-		// }
+		chunk.EventsInChunk++;
+		if(chunk.EventsInChunk < chunk_events) {
+			return "";
+		}
 
-		wrap_if_group(offset, &out_str[0],
-			[&](auto group, uint64_t& off, char* str, uint8_t ch) {
-				float val = res->GetVoltageRange(group.Number);
-				append_cstr(val, off, str);
+		return sbc_columnar_flush(chunk, offset);
+	}
+
+	std::string sbc_columnar_footer(SBCColumnarChunk& chunk,
+		const uint64_t& offset) noexcept {
+		auto out = sbc_columnar_flush(chunk, offset);
+		out += sbc_chunk_directory(chunk.Directory,
+			static_cast<uint32_t>(chunk.Columns.size()));
+		return out;
+	}
+
+	uint16_t event_max_amplitude(CAENEvent& evt, CAEN& res,
+		const uint32_t& baselineSamples) noexcept {
+		uint16_t amplitude = 0;
+		if(!evt || !evt->Data) {
+			return amplitude;
+		}
+
+		sbc_for_each_trace(evt, res, [&](const uint16_t* data, uint32_t size) {
+			const uint32_t num_baseline = std::min(baselineSamples, size);
+			if(num_baseline == 0) {
+				return;
 			}
-		);
 
-		// time_stamp
-		append_cstr(evt->Info.TriggerTimeTag, offset, &out_str[0]);
+			uint64_t sum = 0;
+			for(uint32_t i = 0; i < num_baseline; i++) {
+				sum += data[i];
+			}
+			const auto baseline = static_cast<int32_t>(sum / num_baseline);
 
-		// tgr_source
-		append_cstr(evt->Info.Pattern, offset, &out_str[0]);
+			int32_t max_diff = 0;
+			for(uint32_t i = 0; i < size; i++) {
+				max_diff = std::max(max_diff,
+					std::abs(static_cast<int32_t>(data[i]) - baseline));
+			}
+			amplitude = std::max(amplitude, static_cast<uint16_t>(max_diff));
+		});
+
+		return amplitude;
+	}
 
+	std::vector<uint8_t> enabled_channels(CAEN& res) noexcept {
+		std::vector<uint8_t> out;
+		if(!res) {
+			return out;
+		}
 
-		// For CAEN data, each line is an Event which contains a 2-D array
-		// where the x-axis is the record length and the y-axis are the
-		// number of channels that are activated
-		auto& evtdata = evt->Data;
-		for(auto gr_pair : res->GroupConfigs){
-			auto gr = gr_pair.second.Number;
-
-			if(has_groups){
-				for(int ch = 0; ch < ch_per_group; ch++) {
-					if (gr_pair.second.AcquisitionMask & (1<<ch)){
-						for(uint32_t xp = 0; xp < evtdata->ChSize[gr*ch_per_group+ch]; xp++) {
-							append_cstr(evtdata->DataChannel[ch][xp], offset, &out_str[0]);
-						}
-					}
-				}
-			} else {
-				if(evtdata->ChSize[gr] > 0) {
-					for(uint32_t xp = 0; xp < evtdata->ChSize[gr]; xp++) {
-						append_cstr(evtdata->DataChannel[gr][xp], offset, &out_str[0]);
-					}
+		const uint8_t ch_per_group = res->GetNumberOfChannelsPerGroup();
+		const bool has_groups = res->GetNumberOfGroups() > 0;
+		for(const auto& gr_pair : res->GroupConfigs) {
+			const auto gr = gr_pair.second.Number;
+			if(!has_groups) {
+				out.push_back(gr);
+				continue;
+			}
+
+			for(int ch = 0; ch < ch_per_group; ch++) {
+				if(gr_pair.second.AcquisitionMask & (1<<ch)) {
+					out.push_back(static_cast<uint8_t>(gr*ch_per_group + ch));
 				}
 			}
 		}
 
-		// However, we do convert to string at the end, I wonder if this
-		// is a big performance impact?
-		return std::string(out_str, nline);
+		return out;
+	}
+
+	uint64_t caen_config_hash(CAEN& res) noexcept {
+		// FNV-1a, it only has to tell configurations apart
+		uint64_t hash = 0xcbf29ce484222325;
+		auto add = [&](const char* data, const size_t& size) {
+			for(size_t i = 0; i < size; i++) {
+				hash ^= static_cast<uint8_t>(data[i]);
+				hash *= 0x100000001b3;
+			}
+		};
+		auto add_num = [&](auto num) {
+			add(reinterpret_cast<const char*>(&num), sizeof(num));
+		};
+
+		// Sample rate, channels, thresholds, offsets and ranges
+		const auto constants = sbc_run_constants(res);
+		add(constants.data(), constants.size());
+
+		const auto& g_config = res->GlobalConfig;
+		add_num(static_cast<int>(res->Model));
+		add_num(g_config.RecordLength);
+		add_num(g_config.PostTriggerPorcentage);
+		add_num(g_config.EXTasGate);
+		add_num(static_cast<int>(g_config.EXTTriggerMode));
+		add_num(static_cast<int>(g_config.SWTriggerMode));
+		add_num(static_cast<int>(g_config.CHTriggerMode));
+		add_num(static_cast<int>(g_config.AcqMode));
+		add_num(static_cast<int>(g_config.IOLevel));
+		add_num(g_config.TriggerOverlappingEn);
+		add_num(g_config.MemoryFullModeSelection);
+		add_num(static_cast<int>(g_config.TriggerPolarity));
+
+		return hash;
 	}
 
 } // namespace SBCQueens
@@ -0,0 +1,312 @@
+#include "chunk_compressor.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+#include <zstd.h>
+
+namespace SBCQueens {
+
+	chunkCompressor::chunkCompressor(SinkFunc sink, const std::string& name,
+		const uint64_t& startOffset, const CompressionConfig& config) :
+		_name(name), _config(config), _sink(sink), _open(false),
+		_error(false), _bytesIn(0), _nextNumber(0), _inFlight(0),
+		_stop(false), _compressionSeconds(0.0), _nextOut(0),
+		_outOffset(startOffset) {
+
+		if(_config.ChunkSize == 0) {
+			_config.ChunkSize = CompressionConfig().ChunkSize;
+		}
+
+		unsigned int num_threads = _config.NumThreads;
+		if(num_threads == 0) {
+			num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		_config.NumThreads = num_threads;
+
+		_current.reserve(_config.ChunkSize);
+
+		for(unsigned int i = 0; i < num_threads; i++) {
+			_workers.emplace_back(&chunkCompressor::worker_loop, this);
+		}
+
+		_open = true;
+	}
+
+	chunkCompressor::~chunkCompressor() {
+		close();
+	}
+
+	void chunkCompressor::worker_loop() {
+		// Each thread keeps its own context, creating one per chunk
+		// is surprisingly expensive
+		ZSTD_CCtx* ctx = ZSTD_createCCtx();
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(true) {
+			_cv.wait(lock, [&]() { return _stop || !_jobs.empty(); });
+
+			if(_jobs.empty()) {
+				// _stop is true and there is nothing left
+				break;
+			}
+
+			job j = std::move(_jobs.front());
+			_jobs.pop_front();
+			lock.unlock();
+
+			auto start = std::chrono::steady_clock::now();
+			std::string out(ZSTD_compressBound(j.Data.size()), '\0');
+			size_t r = ctx ? ZSTD_compressCCtx(ctx, out.data(), out.size(),
+				j.Data.data(), j.Data.size(), _config.Level) : 0;
+
+			bool failed = !ctx || ZSTD_isError(r);
+			if(failed) {
+				spdlog::error("Could not compress chunk {0} of {1}: {2}",
+					j.Number, _name,
+					ctx ? ZSTD_getErrorName(r) : "no zstd context");
+				out.clear();
+			} else {
+				out.resize(r);
+			}
+
+			std::chrono::duration<double> elapsed
+				= std::chrono::steady_clock::now() - start;
+
+			if(failed) {
+				_error = true;
+			}
+
+			lock.lock();
+			_compressionSeconds += elapsed.count();
+			_done.emplace(j.Number, std::make_pair(std::move(j), std::move(out)));
+			lock.unlock();
+
+			write_ready();
+
+			lock.lock();
+		}
+
+		ZSTD_freeCCtx(ctx);
+	}
+
+	// Writes all the chunks that are done and next in line.
+	void chunkCompressor::write_ready() {
+		std::lock_guard<std::mutex> out_lock(_outMutex);
+
+		while(true) {
+			std::pair<job, std::string> item;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				auto it = _done.find(_nextOut);
+				if(it == _done.end()) {
+					return;
+				}
+
+				item = std::move(it->second);
+				_done.erase(it);
+			}
+
+			// A failed chunk is lost, but the rest of the file is fine
+			const auto& frame = item.second;
+			if(!frame.empty()) {
+				_sink(frame.data(), frame.size());
+
+				CompressedChunk chunk;
+				chunk.Offset = _outOffset;
+				chunk.CompressedSize = frame.size();
+				chunk.UncompressedOffset = item.first.UncompressedOffset;
+				chunk.UncompressedSize = item.first.Data.size();
+				_index.push_back(chunk);
+
+				_outOffset += frame.size();
+			}
+
+			_nextOut++;
+
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_inFlight--;
+			}
+			_cv.notify_all();
+		}
+	}
+
+	void chunkCompressor::submit_current() {
+		if(_current.empty()) {
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		// Backpressure: if the workers cannot keep up, we wait here
+		_cv.wait(lock, [&]() { return _inFlight < 2*_workers.size(); });
+
+		job j;
+		j.Number = _nextNumber++;
+		j.UncompressedOffset = _bytesIn - _current.size();
+		j.Data = std::move(_current);
+
+		_jobs.push_back(std::move(j));
+		_inFlight++;
+		lock.unlock();
+		_cv.notify_all();
+
+		_current = std::string();
+		_current.reserve(_config.ChunkSize);
+	}
+
+	void chunkCompressor::write(const char* data, const size_t& size) {
+		if(!_open) {
+			return;
+		}
+
+		size_t copied = 0;
+		while(copied < size) {
+			size_t n = std::min(size - copied,
+				_config.ChunkSize - _current.size());
+			_current.append(data + copied, n);
+
+			copied += n;
+			_bytesIn += n;
+
+			if(_current.size() == _config.ChunkSize) {
+				submit_current();
+			}
+		}
+	}
+
+	void chunkCompressor::flush() {
+		if(!_open) {
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		_cv.wait(lock, [&]() { return _inFlight == 0; });
+	}
+
+	void chunkCompressor::close() {
+		if(!_open) {
+			return;
+		}
+
+		submit_current();
+		flush();
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_cv.notify_all();
+
+		for(auto& worker : _workers) {
+			worker.join();
+		}
+		_workers.clear();
+
+		// The index, as a skippable frame so zstd ignores it
+		auto append = [](std::string& str, auto num) {
+			str.append(reinterpret_cast<const char*>(&num), sizeof(num));
+		};
+
+		std::string index;
+		uint32_t frame_size = static_cast<uint32_t>(
+			_index.size()*4*sizeof(uint64_t) + 2*sizeof(uint32_t));
+		append(index, ZSTDSkippableMagic);
+		append(index, frame_size);
+		for(const auto& chunk : _index) {
+			append(index, chunk.Offset);
+			append(index, chunk.CompressedSize);
+			append(index, chunk.UncompressedOffset);
+			append(index, chunk.UncompressedSize);
+		}
+		append(index, static_cast<uint32_t>(_index.size()));
+		append(index, SBCZIndexMagic);
+
+		_sink(index.data(), index.size());
+
+		_open = false;
+
+		auto report = GetReport();
+		spdlog::info("{0}: {1:.2f} MB compressed to {2:.2f} MB "
+			"(ratio {3:.2f}) in {4} chunks. {5:.1f} MB/s per thread, "
+			"{6} threads.", _name, report.BytesIn / 1e6,
+			report.BytesOut / 1e6, report.Ratio(), report.NumChunks,
+			report.ThreadThroughput(), report.NumThreads);
+	}
+
+	CompressionReport chunkCompressor::GetReport() {
+		CompressionReport report;
+
+		{
+			std::lock_guard<std::mutex> out_lock(_outMutex);
+			report.NumChunks = _index.size();
+			for(const auto& chunk : _index) {
+				report.BytesOut += chunk.CompressedSize;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		report.BytesIn = _bytesIn;
+		report.NumThreads = _config.NumThreads;
+		report.CompressionSeconds = _compressionSeconds;
+
+		return report;
+	}
+
+	std::vector<CompressedChunk> read_chunk_index(
+		const std::string& fileName) noexcept {
+
+		std::vector<CompressedChunk> index;
+		std::ifstream file(fileName, std::ifstream::binary);
+		if(!file.is_open()) {
+			return index;
+		}
+
+		file.seekg(0, std::ifstream::end);
+		const uint64_t file_size = file.tellg();
+		if(file_size < 4*sizeof(uint32_t)) {
+			return index;
+		}
+
+		uint32_t num_chunks = 0, magic = 0;
+		file.seekg(file_size - 2*sizeof(uint32_t));
+		file.read(reinterpret_cast<char*>(&num_chunks), sizeof(uint32_t));
+		file.read(reinterpret_cast<char*>(&magic), sizeof(uint32_t));
+		if(magic != SBCZIndexMagic) {
+			return index;
+		}
+
+		const uint64_t frame_size = num_chunks*4*sizeof(uint64_t)
+			+ 2*sizeof(uint32_t);
+		if(frame_size + 2*sizeof(uint32_t) > file_size) {
+			return index;
+		}
+
+		uint32_t frame_magic = 0, stored_size = 0;
+		file.seekg(file_size - frame_size - 2*sizeof(uint32_t));
+		file.read(reinterpret_cast<char*>(&frame_magic), sizeof(uint32_t));
+		file.read(reinterpret_cast<char*>(&stored_size), sizeof(uint32_t));
+		if(frame_magic != ZSTDSkippableMagic || stored_size != frame_size) {
+			return index;
+		}
+
+		index.resize(num_chunks);
+		for(auto& chunk : index) {
+			file.read(reinterpret_cast<char*>(&chunk.Offset), sizeof(uint64_t));
+			file.read(reinterpret_cast<char*>(&chunk.CompressedSize),
+				sizeof(uint64_t));
+			file.read(reinterpret_cast<char*>(&chunk.UncompressedOffset),
+				sizeof(uint64_t));
+			file.read(reinterpret_cast<char*>(&chunk.UncompressedSize),
+				sizeof(uint64_t));
+		}
+
+		if(!file) {
+			index.clear();
+		}
+
+		return index;
+	}
+
+} // namespace SBCQueens
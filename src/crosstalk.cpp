@@ -0,0 +1,507 @@
+#include "crosstalk.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <tuple>
+#include <utility>
+
+namespace SBCQueens {
+
+	namespace {
+
+		// Expected counts of each bin for dark rate r, probability a and
+		// time constant tau
+		struct delayModel {
+			const std::vector<uint64_t>& Counts;
+			const std::vector<double>& Exposure;
+			double MinDelay;
+			double BinWidth;
+
+			// Of the afterpulses in bin k
+			double shape(const size_t& k, const double& tau) const {
+				const double t = MinDelay + k*BinWidth;
+				return std::exp(-t / tau) - std::exp(-(t + BinWidth) / tau);
+			}
+
+			// d shape / d tau
+			double shape_tau(const size_t& k, const double& tau) const {
+				const double t = MinDelay + k*BinWidth;
+				return (t*std::exp(-t / tau) - (t + BinWidth)
+					*std::exp(-(t + BinWidth) / tau)) / (tau*tau);
+			}
+
+			double log_likelihood(const double& r, const double& a,
+				const double& tau) const {
+				double out = 0.0;
+				for(size_t k = 0; k < Counts.size(); k++) {
+					const double mu = Exposure[k]*(r*BinWidth
+						+ a*shape(k, tau));
+					if(mu > 0.0) {
+						out += Counts[k]*std::log(mu) - mu;
+					}
+				}
+				return out;
+			}
+
+			// r and a that fit best for tau, by EM. False if tau cannot
+			// be seen in these delays.
+			bool fit(const double& tau, double& r, double& a) const {
+				double dark_exposure = 0.0, ap_exposure = 0.0, total = 0.0;
+				for(size_t k = 0; k < Counts.size(); k++) {
+					dark_exposure += Exposure[k]*BinWidth;
+					ap_exposure += Exposure[k]*shape(k, tau);
+					total += Counts[k];
+				}
+
+				if(dark_exposure <= 0.0 || ap_exposure <= 1e-12*dark_exposure
+					|| total <= 0.0) {
+					return false;
+				}
+
+				r = 0.5*total / dark_exposure;
+				a = 0.5*total / ap_exposure;
+				for(int i = 0; i < 1000; i++) {
+					double sum_r = 0.0, sum_a = 0.0;
+					for(size_t k = 0; k < Counts.size(); k++) {
+						if(Counts[k] == 0) {
+							continue;
+						}
+
+						const double s = shape(k, tau);
+						const double rate = r*BinWidth + a*s;
+						sum_r += Counts[k]*BinWidth / rate;
+						sum_a += Counts[k]*s / rate;
+					}
+
+					const double new_r = r*sum_r / dark_exposure;
+					const double new_a = a*sum_a / ap_exposure;
+					const bool done = std::abs(new_r - r) <= 1e-10*r
+						&& std::abs(new_a - a) <= 1e-10*std::max(a, 1e-12);
+					r = new_r;
+					a = new_a;
+					if(done) {
+						break;
+					}
+				}
+				return true;
+			}
+		};
+
+		// Inverse of the symmetric m, false if it is singular
+		bool invert3(const double m[3][3], double out[3][3]) {
+			const double det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+				- m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+				+ m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+			if(!(std::abs(det) > 0.0) || !std::isfinite(det)) {
+				return false;
+			}
+
+			for(int i = 0; i < 3; i++) {
+				for(int j = 0; j < 3; j++) {
+					// Cofactor of (j, i)
+					const int r0 = (j + 1) % 3, r1 = (j + 2) % 3;
+					const int c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+					out[i][j] = (m[r0][c0]*m[r1][c1] - m[r0][c1]*m[r1][c0])
+						/ det;
+				}
+			}
+			return true;
+		}
+
+		TriggerAfterpulse fit_triggers(const uint64_t& numShort,
+			const uint64_t& numLong, const double& longTime,
+			const double& window) {
+			TriggerAfterpulse out;
+			out.Intervals = numShort + numLong;
+			if(numLong == 0 || longTime <= 0.0) {
+				return out;
+			}
+
+			// Exponential, so the ones after the window alone give the rate
+			out.Rate = numLong / longTime;
+			const double f0 = 1.0 - std::exp(-out.Rate*window);
+			const double f = static_cast<double>(numShort) / out.Intervals;
+			out.Probability = (f - f0) / (1.0 - f0);
+
+			const double f_var = f*(1.0 - f) / out.Intervals;
+			const double rate_error = out.Rate / std::sqrt(numLong);
+			const double dq_df0 = (f - 1.0) / ((1.0 - f0)*(1.0 - f0));
+			const double df0_drate = window*(1.0 - f0);
+			const double q_rate = dq_df0*df0_drate*rate_error;
+			out.Error = std::sqrt(f_var / ((1.0 - f0)*(1.0 - f0))
+				+ q_rate*q_rate);
+			return out;
+		}
+
+	} // namespace
+
+	AfterpulseFit fit_afterpulses(const std::vector<uint64_t>& counts,
+		const std::vector<double>& exposure, const double& minDelay,
+		const double& binWidth) noexcept {
+		AfterpulseFit out;
+		const delayModel model{counts, exposure, minDelay, binWidth};
+		const double range = binWidth*counts.size();
+		if(counts.empty() || range <= 0.0) {
+			return out;
+		}
+
+		// Grid of tau in log, from a fraction of a bin to twice the range
+		const size_t num_taus = 64;
+		const double log_min = std::log(0.25*binWidth);
+		const double log_step = (std::log(2.0*(minDelay + range)) - log_min)
+			/ (num_taus - 1);
+		std::vector<double> likelihood(num_taus,
+			-std::numeric_limits<double>::infinity());
+		size_t best = 0;
+		for(size_t i = 0; i < num_taus; i++) {
+			double r, a;
+			const double tau = std::exp(log_min + i*log_step);
+			if(model.fit(tau, r, a)) {
+				likelihood[i] = model.log_likelihood(r, a, tau);
+				if(likelihood[i] > likelihood[best]) {
+					best = i;
+				}
+			}
+		}
+
+		if(!std::isfinite(likelihood[best])) {
+			return out;
+		}
+
+		// Parabola through the best and its neighbours
+		double log_tau = log_min + best*log_step;
+		if(best > 0 && best + 1 < num_taus
+			&& std::isfinite(likelihood[best - 1])
+			&& std::isfinite(likelihood[best + 1])) {
+			const double y0 = likelihood[best - 1];
+			const double y1 = likelihood[best];
+			const double y2 = likelihood[best + 1];
+			const double curvature = y0 - 2.0*y1 + y2;
+			if(curvature < 0.0) {
+				log_tau += std::clamp(0.5*(y0 - y2) / curvature, -0.5, 0.5)
+					*log_step;
+			}
+		}
+
+		double r, a;
+		const double tau = std::exp(log_tau);
+		if(!model.fit(tau, r, a)) {
+			return out;
+		}
+
+		out.Probability = a;
+		out.Tau = tau;
+		out.DarkRate = r;
+
+		// Fisher matrix of (r, a, tau)
+		double fisher[3][3] = {};
+		for(size_t k = 0; k < counts.size(); k++) {
+			const double s = model.shape(k, tau);
+			const double mu = exposure[k]*(r*binWidth + a*s);
+			if(mu <= 0.0) {
+				continue;
+			}
+
+			const double d[3] = {exposure[k]*binWidth, exposure[k]*s,
+				exposure[k]*a*model.shape_tau(k, tau)};
+			for(int i = 0; i < 3; i++) {
+				for(int j = 0; j < 3; j++) {
+					fisher[i][j] += d[i]*d[j] / mu;
+				}
+			}
+		}
+
+		double covariance[3][3];
+		if(invert3(fisher, covariance) && covariance[1][1] >= 0.0
+			&& covariance[2][2] >= 0.0) {
+			out.ProbabilityError = std::sqrt(covariance[1][1]);
+			out.TauError = std::sqrt(covariance[2][2]);
+		} else if(fisher[0][0]*fisher[1][1] - fisher[0][1]*fisher[1][0] > 0.0) {
+			// Without afterpulses tau is anything, only r and a
+			out.ProbabilityError = std::sqrt(fisher[0][0] / (fisher[0][0]
+				*fisher[1][1] - fisher[0][1]*fisher[1][0]));
+		}
+
+		return out;
+	}
+
+	void crosstalkEstimator::configure(const CrosstalkConfig& config,
+		const DarkCountTrace& trace, const uint32_t& recordLength) {
+		reset();
+		_config = config;
+		_config.NumBins = std::max<uint32_t>(_config.NumBins, 1);
+		_config.DelayBins = std::max<uint32_t>(_config.DelayBins, 1);
+		_config.MaxDelay = std::max(_config.MaxDelay, _config.MinDelay + 1);
+		_trace = trace;
+		_recordLength = recordLength;
+		_chargeBinWidth = _config.MaxCharge > 0.0 ?
+			_config.MaxCharge / _config.NumBins : 1.0;
+		_delayBinWidth = static_cast<double>(_config.MaxDelay
+			- _config.MinDelay) / _config.DelayBins;
+
+		_channelIndex.assign(256, -1);
+		_channels.assign(_trace.Channels.size(), channelData());
+		for(size_t k = 0; k < _channels.size(); k++) {
+			_channelIndex[_trace.Channels[k]] = static_cast<int>(k);
+			auto& channel = _channels[k];
+			channel.Charges.assign(_config.NumBins + 1, 0);
+			channel.Delays.assign(_config.DelayBins, 0);
+			channel.ExposureEnds.assign(_config.DelayBins + 1, 0);
+			channel.Gain = _config.Gain;
+			channel.Pedestal = _config.Pedestal;
+		}
+	}
+
+	void crosstalkEstimator::reset() {
+		if(_fitting.valid()) {
+			_fitting.wait();
+			_fitting = decltype(_fitting)();
+		}
+
+		// Keeps the memory
+		for(auto& channel : _channels) {
+			std::fill(channel.Charges.begin(), channel.Charges.end(), 0);
+			std::fill(channel.Delays.begin(), channel.Delays.end(), 0);
+			std::fill(channel.ExposureEnds.begin(),
+				channel.ExposureEnds.end(), 0);
+			channel.Primaries = 0;
+		}
+
+		_unwrapper.reset();
+		_hasLastTrigger = false;
+		_triggers = triggerSums();
+		_results.clear();
+		_triggerResult = TriggerAfterpulse();
+		_lastFit = clock::now();
+	}
+
+	void crosstalkEstimator::set_gains(
+		const std::vector<PESpectrumFit>& fits) noexcept {
+		if(_config.Gain > 0.0) {
+			return;
+		}
+
+		for(const auto& fit : fits) {
+			const int k = _channelIndex.empty() ? -1
+				: _channelIndex[fit.Channel];
+			if(k >= 0 && fit.IsValid()) {
+				_channels[k].Gain = fit.Gain;
+				_channels[k].Pedestal = fit.Pedestal;
+			}
+		}
+	}
+
+	void crosstalkEstimator::add_trigger(const uint32_t& ttt) noexcept {
+		const uint64_t time = _unwrapper(ttt);
+		if(_hasLastTrigger) {
+			const double dead_time = _recordLength*_trace.SamplePeriod;
+			const double dt = (time - _lastTrigger)*_trace.TimeTagPeriod
+				- dead_time;
+			if(dt >= 0.0 && dt < _config.TriggerWindow) {
+				_triggers.Short++;
+			} else if(dt >= _config.TriggerWindow) {
+				_triggers.Long++;
+				_triggers.LongTime += dt - _config.TriggerWindow;
+			}
+		}
+
+		_lastTrigger = time;
+		_hasLastTrigger = true;
+	}
+
+	void crosstalkEstimator::add(const uint32_t& ttt,
+		const SiPMPulse* pulses, const size_t& numPulses) noexcept {
+		if(!_config.Enabled || _channels.empty()) {
+			return;
+		}
+
+		add_trigger(ttt);
+		for(size_t i = 0; i < numPulses; i++) {
+			const auto& pulse = pulses[i];
+			const int k = _channelIndex[pulse.Channel];
+			if(k < 0) {
+				continue;
+			}
+
+			auto& channel = _channels[k];
+			if(pulse.Start >= _trace.WindowStart
+				&& pulse.Start < _trace.WindowEnd) {
+				const auto bin = pulse.Integral < 0.0f ? 0
+					: static_cast<uint64_t>(pulse.Integral / _chargeBinWidth);
+				channel.Charges[std::min<uint64_t>(bin, _config.NumBins)]++;
+			}
+
+			// Primaries are 1 PE, and not right after another pulse
+			if(channel.Gain <= 0.0 || pulse.Truncated
+				|| pulse.Start >= _recordLength) {
+				continue;
+			}
+
+			const double pe = (pulse.Integral - channel.Pedestal)
+				/ channel.Gain;
+			const bool after_another = i > 0
+				&& pulses[i - 1].Channel == pulse.Channel
+				&& pulse.Start - pulses[i - 1].Start < _config.MinDelay;
+			if(pe < 0.5 || pe >= 1.5 || after_another) {
+				continue;
+			}
+
+			// The bins that fit whole in the rest of the trace
+			const uint32_t rest = _recordLength - pulse.Start;
+			const uint32_t seen = rest > _config.MinDelay ?
+				static_cast<uint32_t>(std::min<double>(_config.DelayBins,
+					std::floor((rest - _config.MinDelay) / _delayBinWidth)))
+				: 0;
+			channel.ExposureEnds[seen]++;
+			channel.Primaries++;
+
+			for(size_t j = i + 1; j < numPulses
+				&& pulses[j].Channel == pulse.Channel; j++) {
+				const uint32_t delay = pulses[j].Start - pulse.Start;
+				if(delay < _config.MinDelay) {
+					continue;
+				}
+
+				if(delay >= _config.MaxDelay) {
+					break;
+				}
+
+				const auto bin = static_cast<uint32_t>(
+					(delay - _config.MinDelay) / _delayBinWidth);
+				if(bin < seen) {
+					channel.Delays[bin]++;
+				}
+			}
+		}
+	}
+
+	void crosstalkEstimator::start_fit() {
+		_fitting = std::async(std::launch::async,
+			[channels = _channels, triggers = _triggers, config = _config,
+				trace = _trace, chargeBinWidth = _chargeBinWidth,
+				delayBinWidth = _delayBinWidth]() {
+			std::vector<CrosstalkResult> results(channels.size());
+			for(size_t k = 0; k < channels.size(); k++) {
+				const auto& channel = channels[k];
+				auto& result = results[k];
+				result.Channel = trace.Channels[k];
+				result.Primaries = channel.Primaries;
+				if(channel.Gain <= 0.0) {
+					continue;
+				}
+
+				// By the center of the bins, the overflow is 2 PE or more
+				uint64_t one = 0, more = channel.Charges.back();
+				for(size_t b = 0; b + 1 < channel.Charges.size(); b++) {
+					const double pe = ((b + 0.5)*chargeBinWidth
+						- channel.Pedestal) / channel.Gain;
+					if(pe >= 1.5) {
+						more += channel.Charges[b];
+					} else if(pe >= 0.5) {
+						one += channel.Charges[b];
+					}
+				}
+
+				result.DarkPulses = one + more;
+				if(result.DarkPulses > 0) {
+					const double p = static_cast<double>(more)
+						/ result.DarkPulses;
+					result.Crosstalk = p;
+					// So none is not 0 +- 0
+					result.CrosstalkError = std::sqrt(std::max(p*(1.0 - p),
+						1.0 / result.DarkPulses) / result.DarkPulses);
+				}
+
+				if(channel.Primaries < config.MinPrimaries) {
+					continue;
+				}
+
+				std::vector<double> exposure(config.DelayBins, 0.0);
+				double seen = 0.0;
+				for(size_t b = config.DelayBins; b-- > 0;) {
+					seen += channel.ExposureEnds[b + 1];
+					exposure[b] = seen;
+				}
+
+				const auto fit = fit_afterpulses(channel.Delays, exposure,
+					config.MinDelay, delayBinWidth);
+				if(fit.IsValid()) {
+					result.Afterpulse = fit.Probability;
+					result.AfterpulseError = fit.ProbabilityError;
+					result.AfterpulseTau = fit.Tau*trace.SamplePeriod;
+					result.AfterpulseTauError = fit.TauError
+						*trace.SamplePeriod;
+				}
+			}
+
+			return std::make_pair(std::move(results), fit_triggers(
+				triggers.Short, triggers.Long, triggers.LongTime,
+				config.TriggerWindow));
+		});
+		_lastFit = clock::now();
+	}
+
+	bool crosstalkEstimator::update() {
+		if(!_config.Enabled) {
+			return false;
+		}
+
+		bool new_fits = false;
+		if(_fitting.valid() && _fitting.wait_for(std::chrono::seconds(0))
+			== std::future_status::ready) {
+			std::tie(_results, _triggerResult) = _fitting.get();
+			new_fits = true;
+		}
+
+		const auto fit_interval = std::chrono::duration<double>(
+			_config.FitSeconds);
+		if(!_fitting.valid() && clock::now() - _lastFit >= fit_interval) {
+			start_fit();
+		}
+
+		return new_fits;
+	}
+
+	void crosstalkEstimator::finish() {
+		if(!_config.Enabled) {
+			return;
+		}
+
+		// Those are already old
+		if(_fitting.valid()) {
+			_fitting.wait();
+			_fitting = decltype(_fitting)();
+		}
+
+		start_fit();
+		std::tie(_results, _triggerResult) = _fitting.get();
+	}
+
+	double crosstalkEstimator::GetCrosstalk() const {
+		double sum = 0.0;
+		int num = 0;
+		for(const auto& result : _results) {
+			if(result.HasCrosstalk()) {
+				sum += result.Crosstalk;
+				num++;
+			}
+		}
+
+		return num > 0 ? sum / num : 0.0;
+	}
+
+	double crosstalkEstimator::GetAfterpulse() const {
+		double sum = 0.0;
+		int num = 0;
+		for(const auto& result : _results) {
+			if(result.HasAfterpulse()) {
+				sum += result.Afterpulse;
+				num++;
+			}
+		}
+
+		return num > 0 ? sum / num : 0.0;
+	}
+
+} // namespace SBCQueens
@@ -0,0 +1,322 @@
+#include "direct_file_helpers.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace SBCQueens {
+
+#ifdef __linux__
+
+	directFileWriter::directFileWriter(const std::string& fileName,
+		const DirectIOConfig& config) :
+		_fileName(fileName), _config(config), _fd(-1), _open(false),
+		_error(false), _wasEmpty(true), _logicalSize(0), _bufferOffset(0),
+		_allocatedSize(0), _stop(false), _busy(false) {
+
+		// Buffer sizes that are not multiple of the block size
+		// would make every pwrite fail with EINVAL
+		if(_config.BufferSize < _config.BlockSize) {
+			_config.BufferSize = _config.BlockSize;
+		}
+		_config.BufferSize -= _config.BufferSize % _config.BlockSize;
+		_config.NumBuffers = std::max<size_t>(_config.NumBuffers, 2);
+
+		_fd = ::open(_fileName.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0644);
+		if(_fd < 0) {
+			spdlog::error("Could not open {0} with O_DIRECT: {1}",
+				_fileName, std::strerror(errno));
+			return;
+		}
+
+		struct stat st;
+		if(fstat(_fd, &st) < 0) {
+			spdlog::error("Could not stat {0}: {1}",
+				_fileName, std::strerror(errno));
+			::close(_fd);
+			_fd = -1;
+			return;
+		}
+
+		for(size_t i = 0; i < _config.NumBuffers; i++) {
+			void* ptr = nullptr;
+			if(posix_memalign(&ptr, _config.BlockSize, _config.BufferSize)) {
+				spdlog::error("Could not allocate aligned buffers for {0}",
+					_fileName);
+				for(char* b : _pool) {
+					std::free(b);
+				}
+				_pool.clear();
+				::close(_fd);
+				_fd = -1;
+				return;
+			}
+
+			_pool.push_back(static_cast<char*>(ptr));
+		}
+
+		// First buffer is the current one, the rest are free
+		_current.Data = _pool[0];
+		for(size_t i = 1; i < _pool.size(); i++) {
+			_free.push_back(buffer{_pool[i], 0, 0});
+		}
+
+		_logicalSize = static_cast<uint64_t>(st.st_size);
+		_allocatedSize = _logicalSize;
+		_wasEmpty = _logicalSize == 0;
+
+		// If the file already has data, we start from the last aligned
+		// block and bring its contents back into the first buffer so
+		// it can be rewritten together with the new data.
+		_bufferOffset = _logicalSize - (_logicalSize % _config.BlockSize);
+		_current.Offset = _bufferOffset;
+		_current.Size = _logicalSize - _bufferOffset;
+		if(_current.Size > 0) {
+			auto r = pread(_fd, _current.Data, _config.BlockSize,
+				static_cast<off_t>(_bufferOffset));
+			if(r < static_cast<ssize_t>(_current.Size)) {
+				spdlog::error("Could not read the tail of {0}: {1}",
+					_fileName, std::strerror(errno));
+				_error = true;
+			}
+		}
+
+		_open = true;
+		_writerThread = std::thread(&directFileWriter::writer_loop, this);
+	}
+
+	directFileWriter::~directFileWriter() {
+		close();
+
+		for(char* b : _pool) {
+			std::free(b);
+		}
+	}
+
+	void directFileWriter::preallocate(const uint64_t& upTo) {
+		if(_config.PreallocationSize == 0 || upTo <= _allocatedSize) {
+			return;
+		}
+
+		// Grow in whole extents so this happens rarely
+		uint64_t extents = (upTo - _allocatedSize
+			+ _config.PreallocationSize - 1) / _config.PreallocationSize;
+		uint64_t length = extents*_config.PreallocationSize;
+
+		// FALLOC_FL_KEEP_SIZE so readers (and a crash) never see
+		// the preallocated zeros as data
+		if(fallocate(_fd, FALLOC_FL_KEEP_SIZE,
+			static_cast<off_t>(_allocatedSize),
+			static_cast<off_t>(length)) < 0) {
+			spdlog::warn("fallocate failed for {0} ({1}). "
+				"Disabling preallocation.", _fileName, std::strerror(errno));
+			_config.PreallocationSize = 0;
+			return;
+		}
+
+		_allocatedSize += length;
+	}
+
+	bool directFileWriter::write_buffer(const buffer& buf, const size_t& size) {
+		preallocate(buf.Offset + size);
+
+		size_t written = 0;
+		while(written < size) {
+			auto r = pwrite(_fd, buf.Data + written, size - written,
+				static_cast<off_t>(buf.Offset + written));
+
+			if(r < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+
+				spdlog::error("O_DIRECT write to {0} failed: {1}",
+					_fileName, std::strerror(errno));
+				return false;
+			}
+
+			written += static_cast<size_t>(r);
+		}
+
+		return true;
+	}
+
+	void directFileWriter::writer_loop() {
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(true) {
+			_cv.wait(lock, [&]() { return _stop || !_full.empty(); });
+
+			if(_full.empty()) {
+				// _stop is true and there is nothing left
+				return;
+			}
+
+			buffer buf = _full.front();
+			_full.pop_front();
+			_busy = true;
+
+			lock.unlock();
+			bool ok = _error || write_buffer(buf, buf.Size);
+			lock.lock();
+
+			if(!ok) {
+				_error = true;
+			}
+			_busy = false;
+			buf.Size = 0;
+			_free.push_back(buf);
+			_cv.notify_all();
+		}
+	}
+
+	void directFileWriter::submit_current() {
+		std::unique_lock<std::mutex> lock(_mutex);
+		_full.push_back(_current);
+		_cv.notify_all();
+
+		// Backpressure: if the disk cannot keep up, we wait here
+		_cv.wait(lock, [&]() { return !_free.empty(); });
+
+		_bufferOffset += _current.Size;
+		_current = _free.front();
+		_free.pop_front();
+		_current.Size = 0;
+		_current.Offset = _bufferOffset;
+	}
+
+	void directFileWriter::write(const char* data, const size_t& size) {
+		if(!_open) {
+			return;
+		}
+
+		size_t copied = 0;
+		while(copied < size) {
+			size_t n = std::min(size - copied,
+				_config.BufferSize - _current.Size);
+			std::memcpy(_current.Data + _current.Size, data + copied, n);
+
+			_current.Size += n;
+			copied += n;
+
+			if(_current.Size == _config.BufferSize) {
+				submit_current();
+			}
+		}
+
+		_logicalSize += size;
+	}
+
+	void directFileWriter::flush() {
+		if(!_open) {
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		_cv.wait(lock, [&]() { return _full.empty() && !_busy; });
+	}
+
+	void directFileWriter::close() {
+		if(!_open) {
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_cv.notify_all();
+		_writerThread.join();
+
+		// The tail: pad it with zeros up to the next block, write it
+		// with O_DIRECT as any other buffer and then cut the file to
+		// the actual size. This also gives back the preallocated
+		// extents that were not used.
+		if(_current.Size > 0 && !_error) {
+			size_t padded = ((_current.Size + _config.BlockSize - 1)
+				/ _config.BlockSize) * _config.BlockSize;
+			std::memset(_current.Data + _current.Size, 0,
+				padded - _current.Size);
+
+			if(!write_buffer(_current, padded)) {
+				_error = true;
+			}
+		}
+
+		if(ftruncate(_fd, static_cast<off_t>(_logicalSize)) < 0) {
+			spdlog::error("Could not truncate {0} to its final size: {1}",
+				_fileName, std::strerror(errno));
+		}
+
+		::close(_fd);
+		_fd = -1;
+		_open = false;
+	}
+
+#else
+
+	directFileWriter::directFileWriter(const std::string& fileName,
+		const DirectIOConfig& config) :
+		_fileName(fileName), _config(config), _fd(-1), _open(false),
+		_error(false), _wasEmpty(true), _logicalSize(0), _bufferOffset(0),
+		_allocatedSize(0), _stop(false), _busy(false) {
+		spdlog::warn("O_DIRECT writes are only supported in Linux.");
+	}
+
+	directFileWriter::~directFileWriter() { }
+
+	void directFileWriter::preallocate(const uint64_t&) { }
+
+	bool directFileWriter::write_buffer(const buffer&, const size_t&) {
+		return false;
+	}
+
+	void directFileWriter::writer_loop() { }
+
+	void directFileWriter::submit_current() { }
+
+	void directFileWriter::write(const char*, const size_t&) { }
+
+	void directFileWriter::flush() { }
+
+	void directFileWriter::close() { }
+
+#endif
+
+	bool sync_file(const std::string& fileName) noexcept {
+#ifdef __linux__
+		int fd = ::open(fileName.c_str(), O_RDONLY);
+		if(fd < 0) {
+			return false;
+		}
+
+		bool ok = fsync(fd) == 0;
+		::close(fd);
+		return ok;
+#elif defined(_WIN32)
+		// _commit needs a handle with write access
+		int fd = _open(fileName.c_str(), _O_WRONLY | _O_BINARY);
+		if(fd < 0) {
+			return false;
+		}
+
+		bool ok = _commit(fd) == 0;
+		_close(fd);
+		return ok;
+#else
+		return false;
+#endif
+	}
+
+} // namespace SBCQueens
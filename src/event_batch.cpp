@@ -0,0 +1,98 @@
+#include "event_batch.h"
+
+#include <cmath>
+
+namespace SBCQueens {
+
+	uint32_t event_pulses(CAENEvent& evt, CAEN& res,
+		const PulseFinderConfig& config,
+		std::vector<SiPMPulse>& out) noexcept {
+		if(!evt || !evt->Data) {
+			return 0;
+		}
+
+		auto ch_config = config;
+		ch_config.Polarity = pulse_polarity(res);
+
+		const size_t num_before = out.size();
+		sbc_for_each_channel(evt, res,
+			[&](uint8_t ch, const uint16_t* data, uint32_t size) {
+				find_pulses(data, size, ch_config, ch, out);
+		});
+
+		return static_cast<uint32_t>(out.size() - num_before);
+	}
+
+	PulsePolarity pulse_polarity(CAEN& res) noexcept {
+		if(!res) {
+			return PulsePolarity::Positive;
+		}
+
+		return res->GlobalConfig.TriggerPolarity
+			== CAEN_DGTZ_TriggerPolarity_t::CAEN_DGTZ_TriggerOnFallingEdge ?
+			PulsePolarity::Negative : PulsePolarity::Positive;
+	}
+
+	void batch_add_event(EventBatch& batch, CAENEvent& evt,
+		CAEN& res) noexcept {
+		if(!evt || !evt->Data) {
+			return;
+		}
+
+		EventBatch::Event event;
+		event.TriggerTimeTag = evt->Info.TriggerTimeTag;
+		event.FirstTrace = static_cast<uint32_t>(batch.Traces.size());
+		sbc_for_each_channel(evt, res,
+			[&](uint8_t ch, const uint16_t* data, uint32_t size) {
+				EventBatch::Trace trace;
+				trace.Channel = ch;
+				trace.Size = size;
+				trace.Offset = batch.Samples.size();
+				batch.Samples.insert(batch.Samples.end(), data, data + size);
+				batch.Traces.push_back(trace);
+		});
+
+		event.NumTraces = static_cast<uint32_t>(batch.Traces.size())
+			- event.FirstTrace;
+		batch.Events.push_back(event);
+	}
+
+	void batch_pulses(EventBatch& batch, const PulseFinderConfig& config,
+		const baselineTracker& baselines) noexcept {
+		batch.Pulses.clear();
+		for(auto& event : batch.Events) {
+			event.FirstPulse = static_cast<uint32_t>(batch.Pulses.size());
+			for(uint32_t i = 0; i < event.NumTraces; i++) {
+				auto& trace = batch.Traces[event.FirstTrace + i];
+				const auto data = batch.data(trace);
+				trace.Baseline = baselines.GetBaseline(trace.Channel);
+				if(std::isnan(trace.Baseline)) {
+					trace.Baseline = pulse_baseline(data, trace.Size, config);
+				}
+
+				find_pulses(data, trace.Size, config, trace.Channel,
+					trace.Baseline, batch.Pulses);
+			}
+			event.NumPulses = static_cast<uint32_t>(batch.Pulses.size())
+				- event.FirstPulse;
+		}
+	}
+
+	void batch_filter(EventBatch& batch, const OptimalFilters& filters,
+		OptimalFilterWorkspace& workspace) noexcept {
+		batch.Filtered.resize(batch.Traces.size());
+		for(size_t i = 0; i < batch.Traces.size(); i++) {
+			const auto& trace = batch.Traces[i];
+			const auto& filter = filters[trace.Channel];
+			if(!filter) {
+				batch.Filtered[i] = FilteredPulse();
+				batch.Filtered[i].Channel = trace.Channel;
+				continue;
+			}
+
+			batch.Filtered[i] = (*filter)(batch.data(trace), trace.Size,
+				trace.Baseline, trace.Channel, workspace);
+		}
+	}
+
+} // namespace SBCQueens
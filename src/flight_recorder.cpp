@@ -0,0 +1,217 @@
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <bitset>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/fmt.h>
+
+namespace SBCQueens {
+
+	void flightRecorder::clear() {
+		// The events are freed with the digitizer handle, so this has
+		// to happen before disconnecting
+		_ring.clear();
+		_next = 0;
+		_size = 0;
+		_saveRequested = false;
+		_triggered = false;
+		_rateEvents = 0;
+		_rateStart = clock::now();
+	}
+
+	void flightRecorder::configure(const FlightRecorderConfig& config,
+		CAEN& res) {
+		clear();
+		_config = config;
+		if(!_config.Enabled || !res) {
+			return;
+		}
+
+		// Bytes of the traces of one event
+		const uint8_t ch_per_group = res->GetNumberOfChannelsPerGroup();
+		const bool has_groups = res->GetNumberOfGroups() > 0;
+		uint64_t num_channels = 0;
+		for(const auto& gr_pair : res->GroupConfigs) {
+			num_channels += has_groups ? std::bitset<8>(
+				gr_pair.second.AcquisitionMask
+				& ((1u << ch_per_group) - 1)).count() : 1;
+		}
+
+		const uint64_t event_size = std::max<uint64_t>(num_channels
+			*res->GlobalConfig.RecordLength*sizeof(uint16_t), 1);
+		const auto num_slots = static_cast<size_t>(
+			std::max(_config.MaxMB, 0.0)*1e6 / event_size);
+		if(num_slots == 0) {
+			spdlog::warn("The flight recorder cannot hold a single event "
+				"in {0} MB, it will be disabled.", _config.MaxMB);
+			return;
+		}
+
+		// The events themselves are allocated the first time they are used
+		_ring.resize(num_slots);
+		spdlog::info("Flight recorder keeps the last {0} s or {1} events.",
+			_config.Seconds, num_slots);
+	}
+
+	void flightRecorder::trigger(const std::string& reason) {
+		const auto now = clock::now();
+		const auto hold_off = std::chrono::duration<double>(
+			_config.HoldOffSeconds);
+		if(_saveRequested || (_triggered && now - _lastTrigger < hold_off)) {
+			return;
+		}
+
+		_triggered = true;
+		_lastTrigger = now;
+		_saveRequested = true;
+		_saveAt = now + std::chrono::duration_cast<clock::duration>(
+			std::chrono::duration<double>(_config.PostTriggerSeconds));
+		_saveReason = reason;
+		spdlog::info("Flight recorder triggered by {0}", reason);
+	}
+
+	bool flightRecorder::add(CAEN& res, const uint32_t& i) {
+		if(!IsEnabled() || !res || res->LatestError.ErrorCode < 0) {
+			return false;
+		}
+
+		auto& s = _ring[_next];
+		extract_event(res, i, s.Event);
+		if(!s.Event) {
+			return false;
+		}
+
+		s.Time = clock::now();
+		_next = (_next + 1) % _ring.size();
+		_size = std::min(_size + 1, _ring.size());
+		_rateEvents++;
+
+		if(_config.AmplitudeThreshold > 0
+			&& event_max_amplitude(s.Event, res, _config.BaselineSamples)
+				> _config.AmplitudeThreshold) {
+			trigger(fmt::format("an event over {0} counts",
+				_config.AmplitudeThreshold));
+		}
+
+		return true;
+	}
+
+	void flightRecorder::add_all(CAEN& res,
+		const std::function<void(CAENEvent&)>& f) {
+		if(!IsEnabled() || !res) {
+			return;
+		}
+
+		for(uint32_t i = 0; i < res->Data.NumEvents; i++) {
+			if(add(res, i) && f) {
+				f(_ring[(_next + _ring.size() - 1) % _ring.size()].Event);
+			}
+		}
+
+		const auto now = clock::now();
+		const double dt = std::chrono::duration<double>(now - _rateStart).count();
+		if(dt < 1.0) {
+			return;
+		}
+
+		const double rate = _rateEvents / dt;
+		_rateEvents = 0;
+		_rateStart = now;
+		if(_config.RateThreshold > 0.0 && rate > _config.RateThreshold) {
+			trigger(fmt::format("a rate of {0:.1f} Hz", rate));
+		}
+	}
+
+	CAENEvent flightRecorder::latest() const {
+		if(_size == 0) {
+			return nullptr;
+		}
+
+		return _ring[(_next + _ring.size() - 1) % _ring.size()].Event;
+	}
+
+	void flightRecorder::request_save(const std::string& reason) {
+		_saveRequested = true;
+		_saveAt = clock::now();
+		_saveReason = reason;
+	}
+
+	std::string flightRecorder::update(CAEN& res,
+		const SBCFileConfig& config, const std::string& dir) {
+		if(!IsEnabled() || !_saveRequested || clock::now() < _saveAt) {
+			return "";
+		}
+		_saveRequested = false;
+
+		std::time_t now_t = std::time(nullptr);
+		char time[32];
+		std::strftime(time, sizeof(time), "%Y%m%d%H%M%S",
+			std::localtime(&now_t));
+
+		std::error_code ec;
+		std::filesystem::create_directories(dir, ec);
+		const auto base = (std::filesystem::path(dir)
+			/ (std::string("flight_") + time)).string();
+		std::string file_name = base + ".bin";
+		for(int i = 1; std::filesystem::exists(file_name); i++) {
+			file_name = base + "_" + std::to_string(i) + ".bin";
+		}
+
+		const auto num_events = save(res, config, file_name);
+		if(num_events == 0) {
+			return "";
+		}
+
+		spdlog::info("Flight recorder saved {0} events into {1} ({2})",
+			num_events, file_name, _saveReason);
+		return file_name;
+	}
+
+	uint64_t flightRecorder::save(CAEN& res, const SBCFileConfig& config,
+		const std::string& fileName) {
+		if(!IsEnabled() || !res) {
+			return 0;
+		}
+
+		std::ofstream out(fileName, std::ofstream::binary);
+		if(!out.is_open()) {
+			spdlog::error("Could not open {0} to save the flight recorder",
+				fileName);
+			return 0;
+		}
+
+		// Always one line per event, whatever the run files use
+		auto file_config = config;
+		file_config.Layout = SBCFileLayout::Rows;
+		const auto header = sbc_init_file(res, file_config);
+		out.write(header.data(), header.size());
+
+		// From the oldest to the newest
+		const auto oldest = clock::now() - std::chrono::duration_cast<
+			clock::duration>(std::chrono::duration<double>(_config.Seconds));
+		uint64_t num_events = 0;
+		for(size_t k = 0; k < _size; k++) {
+			auto& s = _ring[(_next + _ring.size() - _size + k) % _ring.size()];
+			if(!s.Event || s.Time < oldest) {
+				continue;
+			}
+
+			const auto line = sbc_save_func(s.Event, res, file_config);
+			out.write(line.data(), line.size());
+			num_events++;
+		}
+
+		out.close();
+		if(!sbc_finalize_file(fileName, num_events)) {
+			spdlog::warn("Could not write the number of lines of {0}",
+				fileName);
+		}
+
+		return num_events;
+	}
+
+} // namespace SBCQueens
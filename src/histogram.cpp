@@ -0,0 +1,309 @@
+#include "histogram.h"
+
+#include <fstream>
+#include <iterator>
+
+// my includes
+#include "byte_io.h"
+#include "crc32c.h"
+
+namespace SBCQueens {
+
+	namespace {
+
+		// For the shards of each thread
+		std::atomic<uint64_t> next_histogram_id{1};
+
+		struct localShard {
+			uint64_t ID;
+			histogramShard* Shard;
+		};
+
+		// Of every histogram this thread filled. The ones of histograms
+		// that do not exist anymore are never found, their ids are not
+		// reused.
+		thread_local std::vector<localShard> local_shards;
+
+		void append_varint(std::string& out, uint64_t x) {
+			while(x >= 0x80) {
+				out.push_back(static_cast<char>((x & 0x7F) | 0x80));
+				x >>= 7;
+			}
+			out.push_back(static_cast<char>(x));
+		}
+
+		bool read_varint(payloadReader& in,
+			uint64_t& x) noexcept {
+			x = 0;
+			for(unsigned shift = 0; shift < 64; shift += 7) {
+				if(in.Ptr >= in.End) {
+					return false;
+				}
+
+				const auto byte = static_cast<uint8_t>(*in.Ptr++);
+				x |= static_cast<uint64_t>(byte & 0x7F) << shift;
+				if(!(byte & 0x80)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool read_histogram(const char* ptr, const uint32_t& size,
+			histogramSnapshot& hist) {
+			payloadReader in{ptr, ptr + size};
+			hist.Name = in.str();
+			hist.Axis.Binning = static_cast<HistogramBinning>(
+				in.num<uint8_t>());
+			hist.Axis.NumBins = in.num<uint32_t>();
+			hist.Axis.Min = in.num<double>();
+			hist.Axis.Max = in.num<double>();
+			hist.Entries = in.num<uint64_t>();
+			hist.Sum = in.num<double>();
+			hist.Sum2 = in.num<double>();
+			// At least 1 byte per count
+			if(!in.Ok || hist.Axis.NumBins + 2ull
+				> static_cast<uint64_t>(in.End - in.Ptr)) {
+				return false;
+			}
+
+			hist.Counts.resize(hist.Axis.NumBins + 2);
+			for(auto& count : hist.Counts) {
+				if(!read_varint(in, count)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+	} // namespace
+
+	histogramBins::histogramBins(const HistogramAxis& axis) : _axis(axis) {
+		_axis.NumBins = std::max<uint32_t>(_axis.NumBins, 1);
+		if(_axis.Binning == HistogramBinning::Log) {
+			_axis.Min = _axis.Min > 0.0 ? _axis.Min : 1e-9;
+		}
+		if(!(_axis.Max > _axis.Min)) {
+			_axis.Max = _axis.Binning == HistogramBinning::Log ?
+				10.0*_axis.Min : _axis.Min + 1.0;
+		}
+
+		if(_axis.Binning == HistogramBinning::Linear) {
+			_start = _axis.Min;
+			_scale = _axis.NumBins / (_axis.Max - _axis.Min);
+			return;
+		}
+
+		_start = std::log2(_axis.Min);
+		_scale = _axis.NumBins / (std::log2(_axis.Max) - _start);
+		_edges.resize(_axis.NumBins + 1);
+		for(size_t i = 0; i < _edges.size(); i++) {
+			_edges[i] = edge(i + 1);
+		}
+	}
+
+	double histogramBins::edge(const size_t& i) const noexcept {
+		const double f = static_cast<double>(i - 1) / _axis.NumBins;
+		if(_axis.Binning == HistogramBinning::Linear) {
+			return _axis.Min + f*(_axis.Max - _axis.Min);
+		}
+
+		return _axis.Min*std::pow(_axis.Max / _axis.Min, f);
+	}
+
+	histogramShard::histogramShard(const histogramBins& bins) : _bins(bins),
+		_counts(std::make_unique<std::atomic<uint64_t>[]>(bins.size())) {
+		for(size_t i = 0; i < _bins.size(); i++) {
+			_counts[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void histogramShard::read(std::vector<uint64_t>& counts, double& sum,
+		double& sum2) const noexcept {
+		for(size_t i = 0; i < _bins.size(); i++) {
+			counts[i] += _counts[i].load(std::memory_order_relaxed);
+		}
+		sum += _sum.load(std::memory_order_relaxed);
+		sum2 += _sum2.load(std::memory_order_relaxed);
+	}
+
+	void histogram_stairs(const histogramSnapshot& hist,
+		std::vector<double>& x, std::vector<double>& y) {
+		const histogramBins bins(hist.Axis);
+		const size_t num_bins = bins.GetAxis().NumBins;
+		x.resize(num_bins + 1);
+		y.resize(num_bins + 1);
+		for(size_t i = 0; i <= num_bins; i++) {
+			// The last one is held until the right edge
+			const size_t bin = std::min(i + 1, num_bins);
+			x[i] = bins.edge(i + 1);
+			y[i] = bin < hist.Counts.size() ?
+				static_cast<double>(hist.Counts[bin]) : 0.0;
+		}
+	}
+
+	concurrentHistogram::concurrentHistogram(const std::string& name,
+		const HistogramAxis& axis) : _name(name), _bins(axis),
+		_id(next_histogram_id++), _resetCounts(_bins.size(), 0) {
+		merge();
+	}
+
+	histogramShard& concurrentHistogram::local() {
+		for(const auto& shard : local_shards) {
+			if(shard.ID == _id) {
+				return *shard.Shard;
+			}
+		}
+
+		return make_local();
+	}
+
+	histogramShard& concurrentHistogram::make_local() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto& shard = _shards[std::this_thread::get_id()];
+		if(!shard) {
+			shard = std::make_unique<histogramShard>(_bins);
+		}
+
+		local_shards.push_back({_id, shard.get()});
+		return *shard;
+	}
+
+	histogramSnapshot concurrentHistogram::read() const {
+		histogramSnapshot out;
+		out.Name = _name;
+		out.Axis = _bins.GetAxis();
+		out.Counts.assign(_bins.size(), 0);
+		for(const auto& shard : _shards) {
+			shard.second->read(out.Counts, out.Sum, out.Sum2);
+		}
+
+		for(size_t i = 0; i < out.Counts.size(); i++) {
+			// A fill can be seen in the counts of one bin and not in the
+			// reset ones of another, never less than 0
+			out.Counts[i] -= std::min(out.Counts[i], _resetCounts[i]);
+			out.Entries += out.Counts[i];
+		}
+		out.Sum -= _resetSum;
+		out.Sum2 -= _resetSum2;
+		return out;
+	}
+
+	void concurrentHistogram::merge() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_snapshot = std::make_shared<const histogramSnapshot>(read());
+	}
+
+	void concurrentHistogram::reset() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::fill(_resetCounts.begin(), _resetCounts.end(), 0);
+		_resetSum = 0.0;
+		_resetSum2 = 0.0;
+		for(const auto& shard : _shards) {
+			shard.second->read(_resetCounts, _resetSum, _resetSum2);
+		}
+
+		auto empty = std::make_shared<histogramSnapshot>();
+		empty->Name = _name;
+		empty->Axis = _bins.GetAxis();
+		empty->Counts.assign(_bins.size(), 0);
+		_snapshot = std::move(empty);
+	}
+
+	std::shared_ptr<const histogramSnapshot>
+	concurrentHistogram::GetSnapshot() const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _snapshot;
+	}
+
+	bool histograms_save(const std::string& fileName,
+		const std::vector<histogramSnapshot>& hists) noexcept {
+		try {
+			std::string out;
+			append_num(out, HistogramFileMagic);
+			for(const auto& hist : hists) {
+				std::string payload;
+				append_str(payload, hist.Name);
+				append_num(payload, static_cast<uint8_t>(hist.Axis.Binning));
+				append_num(payload, hist.Axis.NumBins);
+				append_num(payload, hist.Axis.Min);
+				append_num(payload, hist.Axis.Max);
+				append_num(payload, hist.Entries);
+				append_num(payload, hist.Sum);
+				append_num(payload, hist.Sum2);
+				for(size_t i = 0; i < hist.Axis.NumBins + 2ull; i++) {
+					append_varint(payload, i < hist.Counts.size() ?
+						hist.Counts[i] : 0);
+				}
+
+				append_num(out, static_cast<uint32_t>(payload.size()));
+				append_num(out, crc32c(payload.data(), payload.size()));
+				out += payload;
+			}
+
+			std::ofstream file(fileName,
+				std::ofstream::binary | std::ofstream::trunc);
+			if(!file.is_open()) {
+				return false;
+			}
+
+			file.write(out.data(), out.size());
+			file.flush();
+			return static_cast<bool>(file);
+		} catch(...) {
+			return false;
+		}
+	}
+
+	bool histograms_load(const std::string& fileName,
+		std::vector<histogramSnapshot>& hists) noexcept {
+		hists.clear();
+		try {
+			std::ifstream file(fileName, std::ifstream::binary);
+			if(!file.is_open()) {
+				return false;
+			}
+
+			const std::string data((std::istreambuf_iterator<char>(file)),
+				std::istreambuf_iterator<char>());
+			uint32_t magic = 0;
+			if(data.size() < sizeof(magic)) {
+				return false;
+			}
+
+			std::memcpy(&magic, data.data(), sizeof(magic));
+			if(magic != HistogramFileMagic) {
+				return false;
+			}
+
+			size_t pos = sizeof(magic);
+			while(pos < data.size()) {
+				uint32_t size = 0, crc = 0;
+				if(data.size() - pos < 8) {
+					return false;
+				}
+
+				std::memcpy(&size, data.data() + pos, 4);
+				std::memcpy(&crc, data.data() + pos + 4, 4);
+				pos += 8;
+				if(data.size() - pos < size
+					|| crc32c(data.data() + pos, size) != crc) {
+					return false;
+				}
+
+				histogramSnapshot hist;
+				if(!read_histogram(data.data() + pos, size, hist)) {
+					return false;
+				}
+
+				hists.push_back(std::move(hist));
+				pos += size;
+			}
+
+			return true;
+		} catch(...) {
+			return false;
+		}
+	}
+
+} // namespace SBCQueens
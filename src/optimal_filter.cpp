@@ -0,0 +1,325 @@
+#include "optimal_filter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace SBCQueens {
+
+	namespace {
+
+		std::complex<float> mul(const std::complex<float>& a,
+			const std::complex<float>& b) noexcept {
+			return {a.real()*b.real() - a.imag()*b.imag(),
+				a.real()*b.imag() + a.imag()*b.real()};
+		}
+
+		// The trace minus its baseline, zero padded to the size of the FFT
+		void fill_trace(const uint16_t* data, const uint32_t& size,
+			const float& baseline, std::vector<float>& out) noexcept {
+			const size_t len = std::min<size_t>(size, out.size());
+			for(size_t i = 0; i < len; i++) {
+				out[i] = static_cast<float>(data[i]) - baseline;
+			}
+			std::fill(out.begin() + len, out.end(), 0.0f);
+		}
+
+	} // namespace
+
+	optimalFilter::optimalFilter(std::shared_ptr<const realFFT> fft,
+		const std::vector<double>& noise, const std::vector<float>& templ,
+		const uint32_t& peak) : _fft(std::move(fft)), _template(templ),
+		_peak(peak) {
+		const size_t n = _fft->size();
+		const size_t bins = _fft->bins();
+		_template.resize(n, 0.0f);
+		_peak = std::min<uint32_t>(_peak, static_cast<uint32_t>(n - 1));
+
+		std::vector<std::complex<float>> s(bins);
+		_fft->forward(_template.data(), s.data());
+
+		// Bins 1 to n/2 - 1 are there twice in the full spectrum. The DC
+		// one is left out.
+		double norm = 0.0;
+		for(size_t k = 1; k < bins; k++) {
+			if(k < noise.size() && noise[k] > 0.0) {
+				const double weight = k + 1 == bins ? 1.0 : 2.0;
+				norm += weight*std::norm(s[k]) / noise[k];
+			}
+		}
+		norm /= n;
+
+		_filter.assign(bins, std::complex<float>(0.0f, 0.0f));
+		if(norm <= 0.0 || !std::isfinite(norm)) {
+			return;
+		}
+
+		for(size_t k = 1; k < bins; k++) {
+			if(k < noise.size() && noise[k] > 0.0) {
+				_filter[k] = std::conj(s[k])
+					*static_cast<float>(1.0 / (noise[k]*norm));
+			}
+		}
+
+		_resolution = 1.0 / std::sqrt(n*norm);
+	}
+
+	FilteredPulse optimalFilter::operator()(const uint16_t* data,
+		const uint32_t& size, const float& baseline, const uint8_t& channel,
+		OptimalFilterWorkspace& workspace) const noexcept {
+		FilteredPulse out;
+		out.Channel = channel;
+		const size_t n = _fft->size();
+		const size_t len = std::min<size_t>(size, n);
+		if(!data || len == 0) {
+			return out;
+		}
+
+		// Only allocates the first time
+		auto& trace = workspace.Trace;
+		auto& spectrum = workspace.Spectrum;
+		trace.resize(n);
+		spectrum.resize(_fft->bins());
+
+		fill_trace(data, size, baseline, trace);
+		_fft->forward(trace.data(), spectrum.data());
+		for(size_t k = 0; k < spectrum.size(); k++) {
+			spectrum[k] = mul(spectrum[k], _filter[k]);
+		}
+		_fft->inverse(spectrum.data(), trace.data());
+
+		// trace[t] is the amplitude of the template shifted by t, so with
+		// its peak at t + _peak. Only the peaks inside the trace count.
+		const size_t mask = n - 1;
+		size_t best = 0;
+		float best_amplitude = trace[(n - _peak) & mask];
+		for(size_t p = 1; p < len; p++) {
+			const float a = trace[(p + n - _peak) & mask];
+			if(a > best_amplitude) {
+				best_amplitude = a;
+				best = p;
+			}
+		}
+
+		const size_t t = (best + n - _peak) & mask;
+		const float y0 = trace[(t + n - 1) & mask];
+		const float y1 = trace[t];
+		const float y2 = trace[(t + 1) & mask];
+		const float curvature = y0 - 2.0f*y1 + y2;
+		float delta = 0.0f;
+		if(curvature < 0.0f) {
+			delta = std::clamp(0.5f*(y0 - y2) / curvature, -0.5f, 0.5f);
+		}
+
+		out.Time = static_cast<float>(best) + delta;
+		out.Amplitude = y1 - 0.25f*(y0 - y2)*delta;
+		out.Valid = true;
+		return out;
+	}
+
+	optimalFilterBuilder::optimalFilterBuilder()
+		: _filters(std::make_shared<const OptimalFilters>()) { }
+
+	void optimalFilterBuilder::configure(const OptimalFilterConfig& config,
+		const uint32_t& recordLength, const PulseFinderConfig& pulseConfig) {
+		_config = config;
+		_config.NoiseTraces = std::max<uint32_t>(_config.NoiseTraces, 1);
+		_config.TemplateTraces = std::max<uint32_t>(_config.TemplateTraces, 1);
+		_pulseConfig = pulseConfig;
+		_fft = real_fft_plan(real_fft_size(recordLength));
+		_config.TemplatePeak = std::min<uint32_t>(_config.TemplatePeak,
+			static_cast<uint32_t>(_fft->size() - 1));
+		reset();
+	}
+
+	void optimalFilterBuilder::reset() {
+		for(auto& channel : _channels) {
+			channel.reset();
+		}
+
+		std::lock_guard<std::mutex> lock(_filtersMutex);
+		_filters = std::make_shared<const OptimalFilters>();
+	}
+
+	bool optimalFilterBuilder::add(const uint8_t& ch, const uint16_t* data,
+		const uint32_t& size, const float& baseline, const SiPMPulse* pulses,
+		const size_t& numPulses) {
+		if(!_config.Enabled || !_fft || !data || size == 0) {
+			return false;
+		}
+
+		const size_t n = _fft->size();
+		auto& channel = get_channel(ch);
+		if(channel.Done) {
+			return false;
+		}
+
+		const SiPMPulse* pulse = nullptr;
+		size_t num_ch_pulses = 0;
+		for(size_t i = 0; i < numPulses; i++) {
+			if(pulses[i].Channel == ch) {
+				pulse = pulses + i;
+				num_ch_pulses++;
+			}
+		}
+
+		if(num_ch_pulses == 0 && channel.NumNoise < _config.NoiseTraces) {
+			_workspace.Trace.resize(n);
+			_workspace.Spectrum.resize(_fft->bins());
+			fill_trace(data, size, baseline, _workspace.Trace);
+			_fft->forward(_workspace.Trace.data(),
+				_workspace.Spectrum.data());
+			for(size_t k = 0; k < channel.Noise.size(); k++) {
+				channel.Noise[k] += std::norm(_workspace.Spectrum[k]);
+			}
+			channel.NumNoise++;
+		} else if(num_ch_pulses == 1 && channel.External.empty()
+			&& channel.NumTemplate < _config.TemplateTraces
+			&& !pulse->Truncated
+			&& pulse->Amplitude >= _config.TemplateMinAmplitude
+			&& pulse->Amplitude <= _config.TemplateMaxAmplitude) {
+			// Its peak goes to TemplatePeak
+			const int64_t offset = static_cast<int64_t>(pulse->PeakTime)
+				- _config.TemplatePeak;
+			const int64_t len = std::min<int64_t>(size, n);
+			for(size_t j = 0; j < n; j++) {
+				const int64_t src = offset + static_cast<int64_t>(j);
+				if(src >= 0 && src < len) {
+					channel.Template[j] += data[src] - baseline;
+					channel.TemplateCounts[j]++;
+				}
+			}
+			channel.NumTemplate++;
+		}
+
+		if(channel.NumNoise < _config.NoiseTraces
+			|| (channel.External.empty()
+				&& channel.NumTemplate < _config.TemplateTraces)) {
+			return false;
+		}
+
+		make_filter(ch, channel);
+		return true;
+	}
+
+	void optimalFilterBuilder::make_filter(const uint8_t& ch,
+		channelData& channel) {
+		const size_t n = _fft->size();
+		std::vector<double> noise(channel.Noise.size());
+		for(size_t k = 0; k < noise.size(); k++) {
+			noise[k] = channel.Noise[k] / channel.NumNoise;
+		}
+
+		if(!channel.External.empty()) {
+			auto filter = std::make_shared<const optimalFilter>(_fft, noise,
+				channel.External, _config.TemplatePeak);
+			set_filter(ch, std::move(filter));
+			channel = channelData();
+			channel.Done = true;
+			return;
+		}
+
+		std::vector<float> templ(n, 0.0f);
+		for(size_t j = 0; j < n; j++) {
+			if(channel.TemplateCounts[j] > 0) {
+				templ[j] = static_cast<float>(channel.Template[j]
+					/ channel.TemplateCounts[j]);
+			}
+		}
+
+		// Peak of 1 (or -1), so the amplitudes are in ADC counts. The
+		// pulses were aligned on their largest sample, which the noise
+		// makes larger than it should, so the peak is a parabola through
+		// the 2 samples at each side.
+		const size_t p = _config.TemplatePeak;
+		float peak = std::abs(templ[p]);
+		if(p >= 2 && p + 2 < n) {
+			double sum = 0.0, sum_x = 0.0, sum_x2 = 0.0;
+			for(int x : {-2, -1, 1, 2}) {
+				const double y = std::abs(templ[p + x]);
+				sum += y;
+				sum_x += x*y;
+				sum_x2 += x*x*y;
+			}
+
+			const double a = (34.0*sum - 10.0*sum_x2) / 36.0;
+			const double b = sum_x / 10.0;
+			const double c = (4.0*sum_x2 - 10.0*sum) / 36.0;
+			const double fit = c < 0.0 ? a - b*b / (4.0*c) : a;
+			if(fit > 0.0) {
+				peak = static_cast<float>(fit);
+			}
+		}
+
+		if(peak <= 0.0f) {
+			for(const auto& x : templ) {
+				peak = std::max(peak, std::abs(x));
+			}
+		}
+
+		if(peak > 0.0f) {
+			for(auto& x : templ) {
+				x /= peak;
+			}
+		}
+
+		auto filter = std::make_shared<const optimalFilter>(_fft, noise, templ,
+			_config.TemplatePeak);
+		set_filter(ch, std::move(filter));
+
+		// Not needed anymore
+		channel = channelData();
+		channel.Done = true;
+	}
+
+	void optimalFilterBuilder::set_filter(const uint8_t& ch,
+		std::shared_ptr<const optimalFilter> filter) {
+		std::lock_guard<std::mutex> lock(_filtersMutex);
+		auto filters = std::make_shared<OptimalFilters>(*_filters);
+		(*filters)[ch] = std::move(filter);
+		_filters = std::move(filters);
+	}
+
+	optimalFilterBuilder::channelData& optimalFilterBuilder::get_channel(
+		const uint8_t& ch) {
+		auto& slot = _channels[ch];
+		if(!slot) {
+			const size_t n = _fft->size();
+			slot = std::make_unique<channelData>();
+			slot->Noise.assign(_fft->bins(), 0.0);
+			slot->Template.assign(n, 0.0);
+			slot->TemplateCounts.assign(n, 0);
+		}
+
+		return *slot;
+	}
+
+	void optimalFilterBuilder::SetTemplate(const uint8_t& ch,
+		const std::vector<float>& templ) {
+		if(!_fft) {
+			return;
+		}
+
+		auto& channel = get_channel(ch);
+		if(channel.Done) {
+			return;
+		}
+
+		channel.External = templ;
+		channel.External.resize(_fft->size(), 0.0f);
+		// Its own is not needed anymore
+		channel.Template = std::vector<double>();
+		channel.TemplateCounts = std::vector<uint32_t>();
+	}
+
+	bool optimalFilterBuilder::HasTemplate(const uint8_t& ch) const {
+		const auto& channel = _channels[ch];
+		return channel && (channel->Done || !channel->External.empty());
+	}
+
+	std::shared_ptr<const OptimalFilters>
+	optimalFilterBuilder::GetFilters() const {
+		std::lock_guard<std::mutex> lock(_filtersMutex);
+		return _filters;
+	}
+
+} // namespace SBCQueens
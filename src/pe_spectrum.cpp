@@ -0,0 +1,316 @@
+#include "pe_spectrum.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace SBCQueens {
+
+	namespace {
+
+		// Two peaks are the same one if the lowest point between them is
+		// above this fraction of the smallest
+		constexpr double PeakValleyFraction = 0.85;
+
+		// Gaussian fit of counts in [first, last]: a parabola to log(y)
+		// weighted by y^2, so the tails with few counts do not matter
+		// much. Returns false if it is not a peak.
+		bool fit_peak(const std::vector<uint64_t>& counts, const size_t& center,
+			const size_t& first, const size_t& last, const double& binWidth,
+			PESpectrumPeak& peak) {
+			// x in bins from the center, keeps the sums small
+			double s[5] = {0, 0, 0, 0, 0};
+			double t[3] = {0, 0, 0};
+			peak.Counts = 0.0;
+			for(size_t i = first; i <= last; i++) {
+				const double y = static_cast<double>(counts[i]);
+				peak.Counts += y;
+				if(y <= 0.0) {
+					continue;
+				}
+
+				const double x = static_cast<double>(i) - center;
+				const double w = y*y;
+				const double ly = std::log(y);
+				double xn = w;
+				for(int k = 0; k < 5; k++) {
+					s[k] += xn;
+					if(k < 3) {
+						t[k] += xn*ly;
+					}
+					xn *= x;
+				}
+			}
+
+			// Normal equations of ln(y) = a + b*x + c*x^2
+			const double m[3][3] = {{s[0], s[1], s[2]}, {s[1], s[2], s[3]},
+				{s[2], s[3], s[4]}};
+			auto det3 = [](const double a[3][3]) {
+				return a[0][0]*(a[1][1]*a[2][2] - a[1][2]*a[2][1])
+					- a[0][1]*(a[1][0]*a[2][2] - a[1][2]*a[2][0])
+					+ a[0][2]*(a[1][0]*a[2][1] - a[1][1]*a[2][0]);
+			};
+
+			const double det = det3(m);
+			if(det == 0.0 || !std::isfinite(det)) {
+				return false;
+			}
+
+			double coef[3];
+			for(int k = 0; k < 3; k++) {
+				double mk[3][3];
+				for(int r = 0; r < 3; r++) {
+					for(int c = 0; c < 3; c++) {
+						mk[r][c] = c == k ? t[r] : m[r][c];
+					}
+				}
+				coef[k] = det3(mk) / det;
+			}
+
+			const double b = coef[1];
+			const double c = coef[2];
+			if(c >= 0.0) {
+				return false;
+			}
+
+			const double mean = -b / (2.0*c);
+			if(mean < static_cast<double>(first) - center
+				|| mean > static_cast<double>(last) - center) {
+				return false;
+			}
+
+			// Bin i covers [i, i + 1)*binWidth
+			peak.Mean = (center + 0.5 + mean)*binWidth;
+			peak.Sigma = std::sqrt(-1.0 / (2.0*c))*binWidth;
+			return true;
+		}
+
+		std::vector<PESpectrumFit> fit_all(
+			const std::vector<std::vector<uint64_t>>& histograms,
+			const std::vector<uint64_t>& entries, const double& binWidth,
+			const PESpectrumConfig& config) {
+			std::vector<PESpectrumFit> fits;
+			for(size_t ch = 0; ch < histograms.size(); ch++) {
+				if(entries[ch] < std::max<uint64_t>(config.MinEntries, 1)) {
+					continue;
+				}
+
+				auto fit = fit_pe_spectrum(histograms[ch], binWidth, config);
+				fit.Channel = static_cast<uint8_t>(ch);
+				fit.Entries = entries[ch];
+				fits.push_back(std::move(fit));
+			}
+
+			return fits;
+		}
+
+	} // namespace
+
+	PESpectrumFit fit_pe_spectrum(const std::vector<uint64_t>& counts,
+		const double& binWidth, const PESpectrumConfig& config) noexcept {
+		PESpectrumFit fit;
+		const size_t n = counts.size();
+		if(n < 5 || config.MaxPeaks < 2) {
+			return fit;
+		}
+
+		// Smoothed with a triangle of 5 bins
+		std::vector<double> smooth(n, 0.0);
+		double max_smooth = 0.0;
+		for(size_t i = 0; i < n; i++) {
+			double sum = 0.0, weight = 0.0;
+			for(int k = -2; k <= 2; k++) {
+				const auto j = static_cast<int64_t>(i) + k;
+				if(j >= 0 && j < static_cast<int64_t>(n)) {
+					sum += (3 - std::abs(k))*static_cast<double>(counts[j]);
+					weight += 3 - std::abs(k);
+				}
+			}
+			smooth[i] = sum / weight;
+			max_smooth = std::max(max_smooth, smooth[i]);
+		}
+
+		std::vector<size_t> peaks;
+		for(size_t i = 1; i + 1 < n; i++) {
+			if(smooth[i] > smooth[i - 1] && smooth[i] >= smooth[i + 1]
+				&& smooth[i] >= config.MinPeakHeight*max_smooth
+				&& smooth[i] > 0.0) {
+				peaks.push_back(i);
+			}
+		}
+
+		// Bumps of the same peak are merged into the highest one
+		for(bool merged = true; merged;) {
+			merged = false;
+			for(size_t k = 0; k + 1 < peaks.size(); k++) {
+				const size_t a = peaks[k];
+				const size_t b = peaks[k + 1];
+				const double valley = *std::min_element(
+					smooth.begin() + a, smooth.begin() + b + 1);
+				if(valley > PeakValleyFraction*std::min(smooth[a], smooth[b])) {
+					peaks.erase(peaks.begin() + k
+						+ (smooth[a] >= smooth[b] ? 1 : 0));
+					merged = true;
+					break;
+				}
+			}
+		}
+
+		if(peaks.size() > config.MaxPeaks) {
+			peaks.resize(config.MaxPeaks);
+		}
+
+		// Each peak is fitted up to half way to its neighbours
+		for(size_t k = 0; k < peaks.size(); k++) {
+			const size_t left = k > 0 ? peaks[k] - peaks[k - 1]
+				: (peaks.size() > 1 ? peaks[1] - peaks[0] : 4);
+			const size_t right = k + 1 < peaks.size() ? peaks[k + 1] - peaks[k]
+				: left;
+			const size_t half_left = std::max<size_t>(left / 2, 2);
+			const size_t half_right = std::max<size_t>(right / 2, 2);
+			const size_t first = peaks[k] > half_left ? peaks[k] - half_left : 0;
+			const size_t last = std::min(n - 1, peaks[k] + half_right);
+
+			PESpectrumPeak peak;
+			if(!fit_peak(counts, peaks[k], first, last, binWidth, peak)) {
+				// The peaks after a bad one would get the wrong number of PE
+				break;
+			}
+			fit.Peaks.push_back(peak);
+		}
+
+		if(fit.Peaks.size() < 2) {
+			fit.Peaks.clear();
+			return fit;
+		}
+
+		// mean = Pedestal + Gain*n weighted by the error of each mean
+		double s = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+		for(size_t k = 0; k < fit.Peaks.size(); k++) {
+			const auto& peak = fit.Peaks[k];
+			const double err = std::max(peak.Sigma, binWidth / std::sqrt(12.0))
+				/ std::sqrt(std::max(peak.Counts, 1.0));
+			const double w = 1.0 / (err*err);
+			const double x = static_cast<double>(k + 1);
+			s += w;
+			sx += w*x;
+			sy += w*peak.Mean;
+			sxx += w*x*x;
+			sxy += w*x*peak.Mean;
+		}
+
+		const double det = s*sxx - sx*sx;
+		fit.Gain = (s*sxy - sx*sy) / det;
+		fit.Pedestal = (sxx*sy - sx*sxy) / det;
+		fit.GainError = std::sqrt(s / det);
+
+		// If the peaks are further from the line than their errors,
+		// the error is scaled up
+		if(fit.Peaks.size() > 2) {
+			double chi2 = 0.0;
+			for(size_t k = 0; k < fit.Peaks.size(); k++) {
+				const auto& peak = fit.Peaks[k];
+				const double err = std::max(peak.Sigma,
+					binWidth / std::sqrt(12.0))
+					/ std::sqrt(std::max(peak.Counts, 1.0));
+				const double r = (peak.Mean - fit.Pedestal - fit.Gain*(k + 1))
+					/ err;
+				chi2 += r*r;
+			}
+
+			fit.GainError *= std::sqrt(std::max(1.0,
+				chi2 / (fit.Peaks.size() - 2)));
+		}
+
+		if(!(fit.Gain > 0.0) || !std::isfinite(fit.Gain)) {
+			fit = PESpectrumFit();
+			return fit;
+		}
+
+		fit.Resolution = fit.Peaks[0].Sigma / fit.Gain;
+		return fit;
+	}
+
+	void peSpectrum::configure(const PESpectrumConfig& config) {
+		clear();
+		_histograms.clear();
+		_entries.clear();
+		_config = config;
+		_config.NumBins = std::max<uint32_t>(_config.NumBins, 1);
+		_binWidth = _config.MaxCharge > 0.0 ?
+			_config.MaxCharge / _config.NumBins : 1.0;
+	}
+
+	void peSpectrum::clear() {
+		if(_fitting.valid()) {
+			_fitting.wait();
+			_fitting = std::future<std::vector<PESpectrumFit>>();
+		}
+
+		// Keeps the memory, only the first run allocates
+		for(auto& hist : _histograms) {
+			std::fill(hist.begin(), hist.end(), 0);
+		}
+		std::fill(_entries.begin(), _entries.end(), 0);
+		_fits.clear();
+		_lastFit = clock::now();
+	}
+
+	void peSpectrum::start_fit() {
+		_fitting = std::async(std::launch::async,
+			[histograms = _histograms, entries = _entries,
+				binWidth = _binWidth, config = _config]() {
+				return fit_all(histograms, entries, binWidth, config);
+		});
+		_lastFit = clock::now();
+	}
+
+	bool peSpectrum::update() {
+		if(!_config.Enabled) {
+			return false;
+		}
+
+		bool new_fits = false;
+		if(_fitting.valid() && _fitting.wait_for(std::chrono::seconds(0))
+			== std::future_status::ready) {
+			_fits = _fitting.get();
+			new_fits = true;
+		}
+
+		const auto fit_interval = std::chrono::duration<double>(
+			_config.FitSeconds);
+		if(!_fitting.valid() && clock::now() - _lastFit >= fit_interval) {
+			start_fit();
+		}
+
+		return new_fits;
+	}
+
+	void peSpectrum::finish() {
+		if(!_config.Enabled) {
+			return;
+		}
+
+		// Those are already old
+		if(_fitting.valid()) {
+			_fitting.wait();
+			_fitting = std::future<std::vector<PESpectrumFit>>();
+		}
+
+		_fits = fit_all(_histograms, _entries, _binWidth, _config);
+		_lastFit = clock::now();
+	}
+
+	double peSpectrum::GetGain() const {
+		double sum = 0.0;
+		int num = 0;
+		for(const auto& fit : _fits) {
+			if(fit.IsValid()) {
+				sum += fit.Gain;
+				num++;
+			}
+		}
+
+		return num > 0 ? sum / num : 0.0;
+	}
+
+} // namespace SBCQueens
@@ -0,0 +1,257 @@
+#include "pulse_template.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace SBCQueens {
+
+	namespace {
+
+		// So the uint32 sums of uint16 samples do not overflow
+		constexpr uint32_t MaxPulsesPerPhase = 65536;
+
+	} // namespace
+
+	void template_accumulate(uint32_t* sums, const uint16_t* in,
+		const size_t& size) noexcept {
+		size_t i = 0;
+#if defined(__AVX2__)
+		for(; i + 16 <= size; i += 16) {
+			const __m256i x = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(in + i));
+			const __m256i lo = _mm256_cvtepu16_epi32(
+				_mm256_castsi256_si128(x));
+			const __m256i hi = _mm256_cvtepu16_epi32(
+				_mm256_extracti128_si256(x, 1));
+			auto s = reinterpret_cast<__m256i*>(sums + i);
+			_mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s), lo));
+			_mm256_storeu_si256(s + 1,
+				_mm256_add_epi32(_mm256_loadu_si256(s + 1), hi));
+		}
+#elif defined(SBC_PULSE_FINDER_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+		for(; i + 8 <= size; i += 8) {
+			const __m128i x = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(in + i));
+			auto s = reinterpret_cast<__m128i*>(sums + i);
+			_mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s),
+				_mm_unpacklo_epi16(x, zero)));
+			_mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1),
+				_mm_unpackhi_epi16(x, zero)));
+		}
+#endif
+		for(; i < size; i++) {
+			sums[i] += in[i];
+		}
+	}
+
+	void pulseTemplates::configure(const PulseTemplateConfig& config,
+		const PulseFinderConfig& pulseConfig,
+		const std::vector<uint8_t>& channels) {
+		_config = config;
+		_config.Samples = std::max<uint32_t>(_config.Samples, 1);
+		_config.Oversampling = std::max<uint32_t>(_config.Oversampling, 1);
+		_pulseConfig = pulseConfig;
+		_channels = channels;
+
+		_channelIndex.assign(256, -1);
+		_sums.resize(_channels.size());
+		for(size_t k = 0; k < _channels.size(); k++) {
+			_channelIndex[_channels[k]] = static_cast<int>(k);
+			_sums[k].Sums.assign(
+				size_t(_config.Oversampling)*(_config.Samples + 1), 0);
+			_sums[k].Counts.assign(_config.Oversampling, 0);
+			_sums[k].Baselines.assign(_config.Oversampling, 0.0);
+		}
+
+		reset();
+	}
+
+	void pulseTemplates::reset() noexcept {
+		for(auto& sums : _sums) {
+			std::fill(sums.Sums.begin(), sums.Sums.end(), 0);
+			std::fill(sums.Counts.begin(), sums.Counts.end(), 0);
+			std::fill(sums.Baselines.begin(), sums.Baselines.end(), 0.0);
+			sums.Total = 0;
+		}
+	}
+
+	double pulseTemplates::pulse_time(const uint16_t* data,
+		const uint32_t& size, const float& baseline,
+		const SiPMPulse& pulse) const noexcept {
+		const double sign = _pulseConfig.Polarity == PulsePolarity::Positive ?
+			1.0 : -1.0;
+		auto y = [&](const size_t& i) {
+			return sign*(static_cast<double>(data[i]) - baseline);
+		};
+
+		if(_config.Alignment == TemplateAlignment::Threshold) {
+			// Between the sample before Start and Start
+			const size_t s = pulse.Start;
+			if(s == 0 || s >= size) {
+				return s;
+			}
+
+			const double a = y(s - 1);
+			const double b = y(s);
+			const double frac = b > a ?
+				std::clamp((_pulseConfig.Threshold - a) / (b - a), 0.0, 1.0)
+				: 1.0;
+			return s - 1 + frac;
+		}
+
+		const size_t p = pulse.PeakTime;
+		if(p == 0 || p + 1 >= size) {
+			return p;
+		}
+
+		const double y0 = y(p - 1);
+		const double y1 = y(p);
+		const double y2 = y(p + 1);
+		const double curvature = y0 - 2.0*y1 + y2;
+		if(curvature >= 0.0) {
+			return p;
+		}
+
+		return p + std::clamp(0.5*(y0 - y2) / curvature, -0.5, 0.5);
+	}
+
+	bool pulseTemplates::add(const uint8_t& ch, const uint16_t* data,
+		const uint32_t& size, const float& baseline, const SiPMPulse* pulses,
+		const size_t& numPulses) noexcept {
+		if(!_config.Enabled || !data) {
+			return false;
+		}
+
+		const int k = _channelIndex.empty() ? -1 : _channelIndex[ch];
+		if(k < 0) {
+			return false;
+		}
+
+		const SiPMPulse* pulse = nullptr;
+		for(size_t i = 0; i < numPulses; i++) {
+			if(pulses[i].Channel != ch) {
+				continue;
+			}
+
+			// Only alone
+			if(pulse) {
+				return false;
+			}
+			pulse = pulses + i;
+		}
+
+		if(!pulse || pulse->Truncated
+			|| pulse->Amplitude < _config.MinAmplitude
+			|| pulse->Amplitude > _config.MaxAmplitude) {
+			return false;
+		}
+
+		const double time = pulse_time(data, size, baseline, *pulse);
+		const uint32_t os = _config.Oversampling;
+		auto start = static_cast<int64_t>(std::floor(time));
+		auto phase = static_cast<uint32_t>(std::lround(
+			(time - start)*os));
+		if(phase == os) {
+			start++;
+			phase = 0;
+		}
+
+		const int64_t first = start - _config.PreSamples;
+		const size_t row = _config.Samples + 1;
+		if(first < 0 || first + static_cast<int64_t>(row) > size) {
+			return false;
+		}
+
+		auto& sums = _sums[k];
+		if(sums.Counts[phase] >= MaxPulsesPerPhase) {
+			return false;
+		}
+
+		template_accumulate(sums.Sums.data() + phase*row, data + first, row);
+		sums.Counts[phase]++;
+		sums.Baselines[phase] += baseline;
+		sums.Total++;
+		return true;
+	}
+
+	uint64_t pulseTemplates::GetCount(const uint8_t& ch) const noexcept {
+		const int k = _channelIndex.empty() ? -1 : _channelIndex[ch];
+		return k < 0 ? 0 : _sums[k].Total;
+	}
+
+	std::vector<float> pulseTemplates::GetTemplate(const uint8_t& ch) const {
+		const int k = _channelIndex.empty() ? -1 : _channelIndex[ch];
+		const uint32_t os = _config.Oversampling;
+		std::vector<float> out(size_t(_config.Samples)*os, 0.0f);
+		if(k < 0) {
+			return out;
+		}
+
+		// Sample j of phase p is at j - PreSamples - p/os
+		const auto& sums = _sums[k];
+		const size_t row = _config.Samples + 1;
+		for(size_t g = 0; g < out.size(); g++) {
+			const size_t p = (os - g % os) % os;
+			const size_t j = (g + p) / os;
+			if(sums.Counts[p] == 0) {
+				continue;
+			}
+
+			out[g] = static_cast<float>(
+				(static_cast<double>(sums.Sums[p*row + j])
+				- sums.Baselines[p]) / sums.Counts[p]);
+		}
+
+		return out;
+	}
+
+	std::vector<float> pulseTemplates::GetSampledTemplate(const uint8_t& ch,
+		const size_t& size, const uint32_t& at) const {
+		const auto shape = GetTemplate(ch);
+		const int64_t os = _config.Oversampling;
+		std::vector<float> out(size, 0.0f);
+
+		// The mean of the points within half a sample (the ones at the
+		// edges count half), so all the phases are used
+		const int64_t half = os / 2;
+		float peak = 0.0f;
+		for(size_t i = 0; i < size; i++) {
+			const int64_t g = (static_cast<int64_t>(i) - at
+				+ _config.PreSamples)*os;
+			double sum = 0.0, weight = 0.0;
+			for(int64_t d = -half; d <= half; d++) {
+				if(g + d < 0 || g + d >= static_cast<int64_t>(shape.size())) {
+					continue;
+				}
+
+				const double w = os % 2 == 0 && std::abs(d) == half ?
+					0.5 : 1.0;
+				sum += w*shape[g + d];
+				weight += w;
+			}
+
+			if(weight > 0.0) {
+				out[i] = static_cast<float>(sum / weight);
+				peak = std::max(peak, std::abs(out[i]));
+			}
+		}
+
+		if(peak > 0.0f) {
+			for(auto& x : out) {
+				x /= peak;
+			}
+		}
+
+		return out;
+	}
+
+} // namespace SBCQueens
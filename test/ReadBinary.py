@@ -67,6 +67,13 @@ def ReadBlock(file_name, max_file_size = 2000):
                     [header_components[variable + 1],
                      header_components[variable + 2]]
 
+        # Compressed traces make every line a different length
+        for key in meta_data:
+            if meta_data[key][0] in ('bitpack16', 'roi16'):
+                raise ValueError("File {} has {} compressed ({}). "
+                                 "Use sbc_convert or the C++ readers".
+                                 format(file_name, key, meta_data[key][0]))
+
         # Get the number of data lines in the block
         num_lines = np.fromfile(read_in, dtype=np.int32, count=1)[0]
 
@@ -86,18 +93,32 @@ def ReadBlock(file_name, max_file_size = 2000):
                 bytes_per_line += (possible_data_types[meta_data[key][0]] *
                                    temp_size / 8)
 
-        if True or num_lines <= 0:
-            start_of_data = read_in.tell()
-            read_in.seek(0, 2)
-            end_of_data = read_in.tell()
-            read_in.seek(start_of_data, 0)
-            blocksize = end_of_data - start_of_data
+        start_of_data = read_in.tell()
+        read_in.seek(0, 2)
+        end_of_data = read_in.tell() - IndexFooterSize(read_in)
+        read_in.seek(start_of_data, 0)
+        blocksize = end_of_data - start_of_data
+
+        # Files saved in blocks have their lines cut in pieces
+        framed_data = ReadFrames(read_in, end_of_data)
+        if framed_data is not None:
+            blocksize = len(framed_data)
+
+        if num_lines > 0:
+            # The writer saved the real number of lines when it closed
+            # the file, so anything missing means the file is truncated
+            if (num_lines * int(bytes_per_line)) > blocksize:
+                print("Warning: file " + file_name +
+                      " is truncated, will pad the missing lines with 0s")
+            else:
+                blocksize = num_lines * int(bytes_per_line)
+        else:
             num_lines = int(blocksize / bytes_per_line)
 
-        if (num_lines * int(bytes_per_line)) < blocksize:
-            print("Warning: file " + file_name +
-                  " not closed properly, will pad last line with 0s")
-            num_lines = num_lines + 1
+            if (num_lines * int(bytes_per_line)) < blocksize:
+                print("Warning: file " + file_name +
+                      " not closed properly, will pad last line with 0s")
+                num_lines = num_lines + 1
 
         for variable in range(0, len(header_components), 3):
             if header_components[variable]:
@@ -105,8 +126,14 @@ def ReadBlock(file_name, max_file_size = 2000):
 
         uint8_buffer = np.zeros(num_lines * int(bytes_per_line),
                                 dtype=np.uint8)
-        uint8_buffer[:blocksize] = np.fromfile(read_in,
-                                               dtype=np.uint8, count=-1)
+        if framed_data is not None:
+            uint8_buffer[:blocksize] = np.frombuffer(framed_data,
+                                                     dtype=np.uint8,
+                                                     count=blocksize)
+        else:
+            uint8_buffer[:blocksize] = np.fromfile(read_in,
+                                                   dtype=np.uint8,
+                                                   count=blocksize)
         # uint8_buffer = np.fromfile(read_in, dtype=np.uint8,
         #                            count=num_lines * int(bytes_per_line))
         uint8_buffer = np.reshape(uint8_buffer,
@@ -148,6 +175,62 @@ def ReadBlock(file_name, max_file_size = 2000):
     return variables_dict
 
 
+def IndexFooterSize(read_in):
+    '''
+    Returns the size in bytes of the index footer at the end of the file,
+    or 0 if there is none. Leaves the file at the end.
+    The footer ends with: uint64 entries, uint64 events,
+    uint32 interval and uint32 "SBCI".
+    '''
+    trailer_size = 24
+    entry_size = 24
+
+    read_in.seek(0, 2)
+    end = read_in.tell()
+    if end < trailer_size:
+        return 0
+
+    read_in.seek(end - trailer_size, 0)
+    num_entries = np.fromfile(read_in, dtype=np.uint64, count=1)[0]
+    read_in.seek(end - 4, 0)
+    magic = read_in.read(4)
+    read_in.seek(0, 2)
+
+    if magic != b'SBCI':
+        return 0
+
+    return trailer_size + int(num_entries) * entry_size
+
+
+def ReadFrames(read_in, end_of_data):
+    '''
+    If the data starts with a block (see block_framing.h), returns the
+    payload of all the complete blocks together, otherwise None.
+    Each block starts with: uint32 "SBCB", uint32 size, uint32 number of
+    lines and uint32 CRC32C. The CRCs are not checked here, use
+    sbc_recover for that. Leaves the file at the start of the data.
+    '''
+    start_of_data = read_in.tell()
+    if read_in.read(4) != b'SBCB':
+        read_in.seek(start_of_data, 0)
+        return None
+
+    payloads = []
+    position = start_of_data
+    while position + 16 <= end_of_data:
+        read_in.seek(position, 0)
+        frame = np.fromfile(read_in, dtype=np.uint32, count=4)
+        if len(frame) < 4 or frame[0] != 0x42434253 or \
+                position + 16 + int(frame[1]) > end_of_data:
+            break
+
+        payloads.append(read_in.read(int(frame[1])))
+        position += 16 + int(frame[1])
+
+    read_in.seek(start_of_data, 0)
+    return b''.join(payloads)
+
+
 def Cast(variable_name, data):
     '''
     This function takes in the type to be cast to,
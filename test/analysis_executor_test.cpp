@@ -0,0 +1,174 @@
+// g++ analysis_executor_test.cpp -O3 -march=native -I../include -lspdlog -lfmt -pthread -o analysis_executor_test.exe
+#include "analysis_executor.h"
+#include "pulse_finder.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Like EventBatch in event_batch.h, without the CAEN libraries
+struct TestBatch {
+	uint64_t Number = 0;
+	std::vector<uint16_t> Samples;
+	std::vector<SBCQueens::SiPMPulse> Pulses;
+
+	void clear() noexcept {
+		Samples.clear();
+		Pulses.clear();
+	}
+};
+
+const size_t TraceSize = 2048;
+const size_t TracesPerBatch = 256;
+
+int main(int argc, char const *argv[])
+{
+	// Some traces with pulses, copied into every batch
+	std::mt19937 gen(1234);
+	std::normal_distribution<double> noise(0.0, 3.0);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	std::vector<uint16_t> traces(TraceSize*TracesPerBatch);
+	for(size_t t = 0; t < TracesPerBatch; t++) {
+		for(size_t i = 0; i < TraceSize; i++) {
+			traces[t*TraceSize + i] = static_cast<uint16_t>(1000 + noise(gen));
+		}
+
+		for(size_t i = 64; i + 64 < TraceSize; i++) {
+			if(uniform(gen) < 0.005) {
+				for(size_t j = i; j < i + 40; j++) {
+					traces[t*TraceSize + j] += static_cast<uint16_t>(
+						200*std::exp(-double(j - i) / 10.0));
+				}
+				i += 40;
+			}
+		}
+	}
+
+	SBCQueens::PulseFinderConfig config;
+	auto find = [&](TestBatch& batch) {
+		for(size_t t = 0; t < TracesPerBatch; t++) {
+			SBCQueens::find_pulses(batch.Samples.data() + t*TraceSize,
+				TraceSize, config, 0, batch.Pulses);
+		}
+	};
+
+	// What one thread gets
+	TestBatch reference;
+	reference.Samples = traces;
+	find(reference);
+	const size_t pulses_per_batch = reference.Pulses.size();
+
+	bool ok = pulses_per_batch > 0;
+	const uint64_t num_batches = 400;
+	double single_rate = 0.0;
+	// At least 4 so the stealing is tested with few cores too
+	const unsigned int max_threads = std::max(
+		std::thread::hardware_concurrency(), 4u);
+	for(unsigned int num_threads = 1; num_threads <= max_threads;
+		num_threads *= 2) {
+		SBCQueens::analysisExecutor<TestBatch> executor;
+		uint64_t expected = 0;
+		uint64_t total_pulses = 0;
+		bool in_order = true;
+		executor.add_kernel(find);
+		executor.add_ordered_kernel([&](TestBatch& batch) {
+			in_order &= batch.Number == expected++;
+			total_pulses += batch.Pulses.size();
+		});
+
+		SBCQueens::AnalysisConfig a_config;
+		a_config.NumThreads = num_threads;
+		// Nothing dropped, this is about the speed
+		a_config.MaxBatches = num_batches;
+		executor.start(a_config);
+
+		auto start = std::chrono::steady_clock::now();
+		for(uint64_t i = 0; i < num_batches; i++) {
+			auto batch = executor.get_batch();
+			batch->Number = i;
+			batch->Samples.assign(traces.begin(), traces.end());
+			ok &= executor.submit(std::move(batch));
+		}
+		executor.wait();
+		auto end = std::chrono::steady_clock::now();
+
+		const double rate = num_batches*TracesPerBatch
+			/ std::chrono::duration<double>(end - start).count();
+		if(num_threads == 1) {
+			single_rate = rate;
+		}
+
+		std::cout << num_threads << " threads: " << rate / 1e3
+			<< " k traces/s (x" << rate / single_rate << ")\n";
+
+		ok &= in_order && executor.GetProcessed() == num_batches
+			&& executor.GetDropped() == 0
+			&& total_pulses == num_batches*pulses_per_batch;
+		executor.stop();
+	}
+
+	// A full pool drops instead of waiting
+	{
+		SBCQueens::analysisExecutor<TestBatch> executor;
+		uint64_t reduced = 0;
+		executor.add_kernel([](TestBatch&) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		});
+		executor.add_ordered_kernel([&](TestBatch&) { reduced++; });
+
+		SBCQueens::AnalysisConfig a_config;
+		a_config.NumThreads = 2;
+		a_config.MaxBatches = 4;
+		executor.start(a_config);
+
+		auto start = std::chrono::steady_clock::now();
+		uint64_t accepted = 0;
+		for(int i = 0; i < 100; i++) {
+			accepted += executor.submit(executor.get_batch());
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		// stop() finishes what was accepted
+		executor.stop();
+		std::cout << "Full pool: " << accepted << " accepted, "
+			<< executor.GetDropped() << " dropped in "
+			<< std::chrono::duration<double, std::milli>(end - start).count()
+			<< " ms\n";
+		ok &= accepted == 4 && executor.GetDropped() == 96 && reduced == 4
+			&& end - start < std::chrono::milliseconds(20);
+	}
+
+	// A slow ordered kernel does not stop the others
+	{
+		SBCQueens::analysisExecutor<TestBatch> executor;
+		std::atomic<uint64_t> analyzed{0};
+		uint64_t analyzed_first = 0;
+		executor.add_kernel([&](TestBatch&) { analyzed++; });
+		executor.add_ordered_kernel([&](TestBatch& batch) {
+			if(batch.Number == 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(200));
+				analyzed_first = analyzed;
+			}
+		});
+
+		SBCQueens::AnalysisConfig a_config;
+		a_config.NumThreads = 4;
+		a_config.MaxBatches = 40;
+		executor.start(a_config);
+		for(uint64_t i = 0; i < 40; i++) {
+			auto batch = executor.get_batch();
+			batch->Number = i;
+			executor.submit(std::move(batch));
+		}
+		executor.wait();
+
+		std::cout << "Slow ordered kernel: " << analyzed_first
+			<< " batches analyzed while the first was in it\n";
+		ok &= analyzed_first == 40 && executor.GetProcessed() == 40;
+	}
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
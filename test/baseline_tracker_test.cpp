@@ -0,0 +1,114 @@
+// g++ baseline_tracker_test.cpp ../src/baseline_tracker.cpp -O3 -I../include -o baseline_tracker_test.exe
+#include "baseline_tracker.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace SBCQueens;
+
+const uint32_t PreTrigger = 1000;
+const double NoiseRMS = 3.0;
+
+std::mt19937 gen(7);
+
+// Noise around baseline and, in some traces, a pulse
+void make_trace(std::vector<uint16_t>& trace, const double& baseline) {
+	std::normal_distribution<double> noise(baseline, NoiseRMS);
+	for(auto& x : trace) {
+		x = static_cast<uint16_t>(std::lround(noise(gen)));
+	}
+
+	std::bernoulli_distribution has_pulse(0.5);
+	std::uniform_int_distribution<uint32_t> start(0, PreTrigger - 1);
+	if(has_pulse(gen)) {
+		const uint32_t t0 = start(gen);
+		for(uint32_t i = t0; i < std::min<uint32_t>(t0 + 40, trace.size());
+			i++) {
+			trace[i] += static_cast<uint16_t>(200.0*std::exp(-(i - t0) / 8.0));
+		}
+	}
+}
+
+int main(int argc, char const *argv[])
+{
+	bool ok = true;
+
+	BaselineTrackerConfig config;
+	config.Enabled = true;
+	config.HalfLifeSamples = 1 << 18;
+	config.MinBaseline = 500.0f;
+	config.MaxBaseline = 15000.0f;
+	config.MaxNoiseRMS = 5.0f;
+
+	baselineTracker tracker;
+	tracker.configure(config, {2, 5}, PreTrigger, 14);
+	ok &= std::isnan(tracker.GetBaseline(2));
+
+	// A slow drift, 1 count every 1000 traces
+	std::vector<uint16_t> trace(2*PreTrigger);
+	double baseline = 8000.3;
+	double max_error = 0.0;
+	std::chrono::duration<double> add_time(0);
+	const int num_traces = 20000;
+	for(int i = 0; i < num_traces; i++) {
+		baseline += 0.001;
+		make_trace(trace, baseline);
+
+		auto start = std::chrono::steady_clock::now();
+		tracker.add(2, trace.data(), trace.size());
+		add_time += std::chrono::steady_clock::now() - start;
+
+		// After it had time to forget where it started
+		if(i > 1000) {
+			max_error = std::max(max_error,
+				std::abs(tracker.GetBaseline(2) - baseline));
+		}
+	}
+
+	auto state = tracker.GetStates().at(0);
+	std::cout << "Drift: baseline " << state.Baseline << " (" << baseline
+		<< "), median " << state.Median << ", noise " << state.NoiseRMS
+		<< " (" << NoiseRMS << "), largest error " << max_error << ", "
+		<< 1e9*add_time.count() / (num_traces*PreTrigger)
+		<< " ns per sample\n";
+	// It lags the drift by ~half life
+	const double lag = 0.001*config.HalfLifeSamples / PreTrigger;
+	ok &= state.IsReady && state.InWindow && max_error < lag + 1.0
+		&& std::abs(state.NoiseRMS - NoiseRMS) < 0.3
+		&& std::isnan(tracker.GetBaseline(5));
+
+	// A jump further than the histogram, ex: a new DC offset
+	baseline = 8600.0;
+	int traces_to_follow = -1;
+	for(int i = 0; i < 5000 && traces_to_follow < 0; i++) {
+		make_trace(trace, baseline);
+		tracker.add(2, trace.data(), trace.size());
+		if(std::abs(tracker.GetBaseline(2) - baseline) < 0.5) {
+			traces_to_follow = i;
+		}
+	}
+	std::cout << "Jump of " << baseline - 8020.3 << " counts followed after "
+		<< traces_to_follow << " traces\n";
+	ok &= traces_to_follow >= 0;
+
+	// Close to saturation
+	baseline = 16330.0;
+	for(int i = 0; i < 5000; i++) {
+		make_trace(trace, baseline);
+		tracker.add(2, trace.data(), trace.size());
+	}
+	state = tracker.GetStates().at(0);
+	std::cout << "Near saturation: baseline " << state.Baseline
+		<< ", in window " << state.InWindow << "\n";
+	ok &= !state.InWindow && std::abs(state.Baseline - baseline) < 1.0;
+
+	tracker.reset();
+	ok &= std::isnan(tracker.GetBaseline(2))
+		&& tracker.GetStates().at(0).Samples == 0;
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
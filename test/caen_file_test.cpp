@@ -1,15 +1,66 @@
-// g++ caen_file_test.cpp ../src/caen_helper.cpp -Og -I"X:/Program Files/CAEN/Comm/include" -I"X:/Program Files/CAEN/VME/include" -I"X:/Program Files/CAEN/Digitizers/Library/include" -I../include -I../deps/concurrentqueue -L"X:/Program Files/CAEN/Comm/lib" -L"X:/Program Files/CAEN/VME/lib" -L"X:/Program Files/CAEN/Digitizers/Library/lib" -lCAENDigitizer -o out.exe -static-libstdc++ -g
-// g++ caen_file_test.cpp ../src/caen_helper.cpp -Og -I"C:/Program Files/CAEN/Comm/include" -I"C:/Program Files/CAEN/VME/include" -I"C:/Program Files/CAEN/Digitizers/Library/include" -I../include -I../deps/concurrentqueue -L"X:/Program Files/CAEN/Comm/lib" -L"C:/Program Files/CAEN/VME/lib" -L"C:/Program Files/CAEN/Digitizers/Library/lib" -lCAENDigitizer -o out.exe -static-libstdc++ -g
+// g++ caen_file_test.cpp ../src/caen_helper.cpp ../src/direct_file_helpers.cpp ../src/chunk_compressor.cpp ../src/optimal_filter.cpp -Og -I"X:/Program Files/CAEN/Comm/include" -I"X:/Program Files/CAEN/VME/include" -I"X:/Program Files/CAEN/Digitizers/Library/include" -I../include -I../deps/concurrentqueue -L"X:/Program Files/CAEN/Comm/lib" -L"X:/Program Files/CAEN/VME/lib" -L"X:/Program Files/CAEN/Digitizers/Library/lib" -lCAENDigitizer -o out.exe -static-libstdc++ -g
+// g++ caen_file_test.cpp ../src/caen_helper.cpp ../src/direct_file_helpers.cpp ../src/chunk_compressor.cpp ../src/optimal_filter.cpp -Og -I"C:/Program Files/CAEN/Comm/include" -I"C:/Program Files/CAEN/VME/include" -I"C:/Program Files/CAEN/Digitizers/Library/include" -I../include -I../deps/concurrentqueue -L"X:/Program Files/CAEN/Comm/lib" -L"C:/Program Files/CAEN/VME/lib" -L"C:/Program Files/CAEN/Digitizers/Library/lib" -lCAENDigitizer -o out.exe -static-libstdc++ -g
+// ./out.exe [BitPacked | ROI] [Columnar] [Framed]
 #include "caen_helper.h"
 #include "file_helpers.h"
 
 #include <cstdint>
+#include <filesystem>
 #include <iostream>
 #include <memory>
 #include <random>
+#include <string>
+#include <vector>
 
 int main(int argc, char const *argv[])
 {
+	// Grouped digitizers: the traces of group 1 are channels 8 to 15
+	{
+		SBCQueens::CAEN grouped = std::make_unique<SBCQueens::caen>(
+			SBCQueens::CAENDigitizerModel::DT5740D,
+			CAEN_DGTZ_ConnectionType::CAEN_DGTZ_USB,
+			0, 0, 0, 0, SBCQueens::CAENError()
+		);
+
+		grouped->GroupConfigs[0] = SBCQueens::CAENGroupConfig {
+			.Number = 1,
+			.AcquisitionMask = 0b101,
+		};
+
+		SBCQueens::CAENEvent grouped_evt
+			= std::make_shared<SBCQueens::caenEvent>(grouped->Handle);
+		grouped_evt->Data = new CAEN_DGTZ_UINT16_EVENT_t();
+		std::vector<uint16_t> traces(4*100);
+		for(int ch = 0; ch < 4; ch++) {
+			// Group 0 has something too, it should not be read
+			grouped_evt->Data->ChSize[ch] = 100;
+			grouped_evt->Data->DataChannel[ch] = traces.data() + ch*100;
+		}
+		grouped_evt->Data->ChSize[8] = 100;
+		grouped_evt->Data->DataChannel[8] = traces.data() + 200;
+		grouped_evt->Data->ChSize[10] = 100;
+		grouped_evt->Data->DataChannel[10] = traces.data() + 300;
+
+		std::vector<uint8_t> chs;
+		bool ok = true;
+		SBCQueens::sbc_for_each_channel(grouped_evt, grouped,
+			[&](uint8_t ch, const uint16_t* data, uint32_t size) {
+				chs.push_back(ch);
+				ok &= data == grouped_evt->Data->DataChannel[ch]
+					&& size == 100;
+		});
+
+		ok &= chs == std::vector<uint8_t>{8, 10};
+		// They belong to traces, not to the event that frees them
+		for(int ch = 0; ch < 64; ch++) {
+			grouped_evt->Data->DataChannel[ch] = nullptr;
+		}
+		if(!ok) {
+			std::cout << "Grouped channels FAILED" << std::endl;
+			return 1;
+		}
+	}
+
 	// This should never done in an actual production code
 	// as no actual digitizer will be associated with this
 	SBCQueens::CAEN res = std::make_unique<SBCQueens::caen>(
@@ -41,9 +92,36 @@ int main(int argc, char const *argv[])
 
 	};
 
+	// Options: BitPacked or ROI, Columnar and/or Framed
+	SBCQueens::SBCFileConfig file_config;
+	SBCQueens::FileOptions file_options;
+	for(int i = 1; i < argc; i++) {
+		if(std::string(argv[i]) == "BitPacked") {
+			file_config.TraceEncoding = SBCQueens::SBCTraceEncoding::BitPacked;
+		} else if(std::string(argv[i]) == "ROI") {
+			file_config.TraceEncoding = SBCQueens::SBCTraceEncoding::ROI;
+		} else if(std::string(argv[i]) == "Columnar") {
+			file_config.Layout = SBCQueens::SBCFileLayout::Columnar;
+			file_config.ChunkEvents = 10;
+		} else if(std::string(argv[i]) == "Framed") {
+			file_options.Framing = true;
+		}
+	}
+
+	const bool is_columnar
+		= file_config.Layout == SBCQueens::SBCFileLayout::Columnar;
+
 	SBCQueens::DataFile<SBCQueens::CAENEvent> testFile;
 
-	open(testFile, "test.bin", SBCQueens::sbc_init_file, res);
+	if(is_columnar) {
+		// Files are appended to, and this one is read back
+		std::filesystem::remove("test.sbcc");
+		open(testFile, "test.sbcc", SBCQueens::sbc_columnar_init_file,
+			res, file_config);
+	} else {
+		open(testFile, file_options, "test.bin", SBCQueens::sbc_init_file,
+			res, file_config);
+	}
 
 	SBCQueens::CAENEvent evt = std::make_shared<SBCQueens::caenEvent>(
 		res->Handle
@@ -72,9 +150,68 @@ int main(int argc, char const *argv[])
 		}
 	}
 
-	testFile->Add(evt);
+	if(!is_columnar) {
+		// One block per event if it is framed
+		const int num_events = file_options.Framing ? 25 : 1;
+		for(int n = 0; n < num_events; n++) {
+			testFile->Add(evt);
 
-	save(testFile, SBCQueens::sbc_save_func, res);
+			save(testFile, SBCQueens::sbc_save_func, res, file_config);
+		}
+
+		return 0;
+	}
+
+	// 25 events, so the last chunk is not full. The time tag rolls
+	// over halfway.
+	SBCQueens::SBCColumnarChunk chunk;
+	for(uint32_t n = 0; n < 25; n++) {
+		evt->Info.TriggerTimeTag = (0x7FFFFF00u + 0x10u*n) & 0x7FFFFFFF;
+		evt->Data->DataChannel[5][0] = n;
+		testFile->Add(evt);
+
+		save(testFile, [&](SBCQueens::CAENEvent& e) {
+			return SBCQueens::sbc_columnar_save_func(chunk, e, res,
+				file_config, testFile->GetBytesWritten());
+		});
+	}
+
+	(*testFile) << SBCQueens::sbc_columnar_footer(chunk,
+		testFile->GetBytesWritten());
+	testFile.reset();
+
+	SBCQueens::sbcColumnarReader reader("test.sbcc");
+	if(!reader.IsOpen()) {
+		std::cout << reader.GetError() << std::endl;
+		return 1;
+	}
+
+	std::vector<uint16_t> ch3, ch5;
+	std::vector<uint64_t> times;
+	bool ok = reader.NumEvents() == 25 && reader.NumChunks() == 3
+		&& reader.constant<uint16_t>("thresholds").size() == 2
+		&& reader.read_column("sipm_trace_0", 0, 3, ch3)
+		&& reader.read_column("sipm_trace_1", 0, 3, ch5)
+		&& reader.read_column("time_stamp", 0, 3, times)
+		&& ch3.size() == 25*1200 && ch5.size() == 25*1200;
+
+	for(uint32_t n = 0; ok && n < 25; n++) {
+		ok = ch5[n*1200] == n
+			&& ch3[n*1200 + 7] == evt->Data->DataChannel[3][7]
+			&& times[n] == 0x7FFFFF00ull + 0x10ull*n;
+	}
 
-	return 0;
+	// Events 12 to 17 are in chunk 1
+	std::vector<uint16_t> in_range;
+	times.clear();
+	ok = ok && reader.read_time_range("sipm_trace_1",
+			0x7FFFFF00ull + 0x10ull*12, 0x7FFFFF00ull + 0x10ull*17,
+			in_range, &times)
+		&& times.size() == 6 && in_range[0] == 12
+		&& reader.FindChunks(0x7FFFFF00ull + 0x10ull*12,
+			0x7FFFFF00ull + 0x10ull*17).first == 1;
+
+	std::cout << (ok ? "Columnar file OK" : "Columnar file FAILED")
+		<< std::endl;
+	return ok ? 0 : 1;
 }
\ No newline at end of file
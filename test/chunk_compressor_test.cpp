@@ -0,0 +1,98 @@
+// g++ chunk_compressor_test.cpp ../src/chunk_compressor.cpp -O3 -I../include -I../deps/spdlog/include -I../deps/zstd/lib -lzstd -pthread -o chunk_compressor_test.exe
+#include "chunk_compressor.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <zstd.h>
+
+int main(int argc, char const *argv[])
+{
+	bool ok = true;
+
+	// Something that compresses, but not to nothing
+	std::mt19937 gen(42);
+	std::normal_distribution<double> noise(1000.0, 5.0);
+	std::string data;
+	while(data.size() < 100000) {
+		const auto x = static_cast<uint16_t>(noise(gen));
+		data.append(reinterpret_cast<const char*>(&x), sizeof(x));
+	}
+
+	// A header before the compressed data, as the offsets are from the
+	// start of the file
+	const std::string header = "not compressed";
+	const std::string file_name = "chunk_compressor_test.zst";
+	{
+		std::ofstream file(file_name, std::ofstream::binary);
+		file << header;
+
+		SBCQueens::CompressionConfig config;
+		config.ChunkSize = 16000;
+		config.NumThreads = 4;
+		SBCQueens::chunkCompressor compressor(
+			[&](const char* out, const size_t& size) {
+				file.write(out, size);
+			}, "test", header.size(), config);
+
+		// Writes that do not line up with the chunks
+		for(size_t i = 0; i < data.size(); i += 777) {
+			compressor.write(data.data() + i,
+				std::min<size_t>(777, data.size() - i));
+			if(i % (10*777) == 0) {
+				compressor.flush();
+			}
+		}
+		compressor.close();
+
+		auto report = compressor.GetReport();
+		std::cout << report.NumChunks << " chunks, ratio " << report.Ratio()
+			<< std::endl;
+		ok &= !compressor.HasError() && report.BytesIn == data.size()
+			&& report.NumChunks == 7;
+	}
+
+	std::ifstream file(file_name, std::ifstream::binary);
+	const std::string contents((std::istreambuf_iterator<char>(file)),
+		std::istreambuf_iterator<char>());
+	const auto index = SBCQueens::read_chunk_index(file_name);
+	ok &= index.size() == 7 && contents.substr(0, header.size()) == header;
+
+	// Every chunk is a frame by itself, one after the other
+	uint64_t offset = header.size();
+	uint64_t uncompressed_offset = 0;
+	for(const auto& chunk : index) {
+		ok &= chunk.Offset == offset
+			&& chunk.UncompressedOffset == uncompressed_offset
+			&& chunk.Offset + chunk.CompressedSize <= contents.size();
+		if(!ok) {
+			break;
+		}
+
+		std::string out(chunk.UncompressedSize, '\0');
+		const size_t r = ZSTD_decompress(out.data(), out.size(),
+			contents.data() + chunk.Offset, chunk.CompressedSize);
+		ok &= !ZSTD_isError(r) && r == chunk.UncompressedSize
+			&& out == data.substr(chunk.UncompressedOffset,
+				chunk.UncompressedSize);
+
+		offset += chunk.CompressedSize;
+		uncompressed_offset += chunk.UncompressedSize;
+	}
+	ok &= uncompressed_offset == data.size();
+
+	// Not a compressed file
+	ok &= SBCQueens::read_chunk_index("chunk_compressor_test.cpp").empty();
+
+	file.close();
+	std::filesystem::remove(file_name);
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+// g++ crc32c_test.cpp -O3 -I../include -o crc32c_test.exe
+// Checks the CRC32C against known values and that the hardware and
+// software versions give the same answer.
+#include "crc32c.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+int main(int argc, char const *argv[])
+{
+	bool ok = true;
+
+	// From the iSCSI spec (RFC 3720) and the usual check value
+	const std::string check = "123456789";
+	ok &= SBCQueens::crc32c(check.data(), check.size()) == 0xE3069283;
+
+	const std::vector<char> zeros(32, 0);
+	ok &= SBCQueens::crc32c(zeros.data(), zeros.size()) == 0x8A9136AA;
+
+	std::mt19937 gen(1234);
+	std::uniform_int_distribution<int> distribution(0, 255);
+	std::vector<char> data(64 << 20);
+	for(auto& c : data) {
+		c = static_cast<char>(distribution(gen));
+	}
+
+	// In pieces of odd sizes, and both versions
+	for(size_t size : {0, 1, 7, 8, 9, 63, 1000, 4099}) {
+		const auto whole = SBCQueens::crc32c(data.data(), size);
+		const auto first = SBCQueens::crc32c(data.data(), size / 3);
+		const auto pieces = SBCQueens::crc32c(data.data() + size / 3,
+			size - size / 3, first);
+		const auto software = ~SBCQueens::crc32c_internal::software(
+			~0u, data.data(), size);
+
+		ok &= whole == pieces && whole == software;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	auto crc = SBCQueens::crc32c(data.data(), data.size());
+	std::chrono::duration<double> elapsed
+		= std::chrono::steady_clock::now() - start;
+
+	std::cout << "CRC32C (" << (SBCQueens::crc32c_is_hardware() ?
+		"hardware" : "software") << ") " << data.size() / 1e9 / elapsed.count()
+		<< " GB/s, crc " << std::hex << crc << std::endl;
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+// g++ crosstalk_test.cpp ../src/crosstalk.cpp -O2 -pthread -I../include -o crosstalk_test.exe
+#include "crosstalk.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace SBCQueens;
+
+// What the simulated SiPM does
+const double Crosstalk = 0.2;
+const double Afterpulse = 0.1;
+// In samples
+const double AfterpulseTau = 80.0;
+const double DarkRate = 2e-4;
+const double Gain = 100.0;
+
+// And its digitizer
+const uint32_t RecordLength = 2000;
+const double SamplePeriod = 4e-9;
+const double TimeTagPeriod = 8e-9;
+
+// Triggers at random at 1 kHz after the dead time, and TriggerAfterpulse
+// of them 2 us after the one before
+const double TriggerRate = 1e3;
+const double TriggerAfterpulseProb = 0.05;
+
+std::mt19937 gen(2024);
+
+// 1 PE and, with crosstalk, each fired cell can fire another one
+int num_pe() {
+	std::bernoulli_distribution more(Crosstalk);
+	int n = 1;
+	while(more(gen)) {
+		n++;
+	}
+	return n;
+}
+
+// A pulse at time t and its afterpulses, and theirs
+void add_pulse(const double& t, std::vector<SiPMPulse>& pulses) {
+	if(t >= RecordLength) {
+		return;
+	}
+
+	std::normal_distribution<double> noise(0.0, 10.0);
+	SiPMPulse pulse;
+	pulse.Channel = 1;
+	pulse.Start = static_cast<uint32_t>(t);
+	pulse.Integral = static_cast<float>(Gain*num_pe() + noise(gen));
+	pulses.push_back(pulse);
+
+	std::bernoulli_distribution afterpulse(Afterpulse);
+	std::exponential_distribution<double> delay(1.0 / AfterpulseTau);
+	if(afterpulse(gen)) {
+		add_pulse(t + delay(gen), pulses);
+	}
+}
+
+int main(int argc, char const *argv[])
+{
+	CrosstalkConfig config;
+	config.Enabled = true;
+	config.MaxCharge = 1000.0;
+	config.NumBins = 200;
+	config.MinDelay = 10;
+	config.MaxDelay = 1000;
+	config.DelayBins = 99;
+	config.TriggerWindow = 1e-5;
+	config.MinPrimaries = 100;
+
+	DarkCountTrace trace;
+	trace.Channels = {1};
+	trace.WindowStart = 64;
+	trace.WindowEnd = 1000;
+	trace.SamplePeriod = SamplePeriod;
+	trace.TimeTagPeriod = TimeTagPeriod;
+
+	crosstalkEstimator estimator;
+	estimator.configure(config, trace, RecordLength);
+
+	// The gain from the PE spectrum
+	PESpectrumFit fit;
+	fit.Channel = 1;
+	fit.Gain = Gain;
+	fit.Pedestal = 0.0;
+	fit.Peaks.resize(2);
+	estimator.set_gains({fit});
+
+	const int num_events = 200000;
+	std::exponential_distribution<double> dark(DarkRate);
+	std::exponential_distribution<double> random_trigger(TriggerRate);
+	std::exponential_distribution<double> correlated_trigger(1.0 / 2e-6);
+	std::bernoulli_distribution is_correlated(TriggerAfterpulseProb);
+	const double dead_time = RecordLength*SamplePeriod;
+	double time = 0.0;
+	std::vector<SiPMPulse> pulses;
+	std::chrono::duration<double> add_time(0);
+	for(int i = 0; i < num_events; i++) {
+		pulses.clear();
+		for(double t = dark(gen); t < RecordLength; t += dark(gen)) {
+			add_pulse(t, pulses);
+		}
+		std::sort(pulses.begin(), pulses.end(),
+			[](const SiPMPulse& a, const SiPMPulse& b) {
+				return a.Start < b.Start;
+		});
+
+		time += dead_time + (is_correlated(gen) ?
+			correlated_trigger(gen) : random_trigger(gen));
+		const auto ttt = static_cast<uint32_t>(
+			static_cast<uint64_t>(time / TimeTagPeriod) & 0x7FFFFFFF);
+
+		auto start = std::chrono::steady_clock::now();
+		estimator.add(ttt, pulses.data(), pulses.size());
+		add_time += std::chrono::steady_clock::now() - start;
+	}
+
+	estimator.finish();
+	bool ok = estimator.GetResults().size() == 1;
+	const auto result = estimator.GetResults().at(0);
+	const auto trigger = estimator.GetTriggerAfterpulse();
+
+	std::cout << "Crosstalk " << result.Crosstalk << " +- "
+		<< result.CrosstalkError << " (" << Crosstalk << ") from "
+		<< result.DarkPulses << " dark pulses\n";
+	std::cout << "Afterpulses " << result.Afterpulse << " +- "
+		<< result.AfterpulseError << " (" << Afterpulse / (1.0 - Afterpulse)
+		<< "), tau "
+		<< result.AfterpulseTau*1e9 << " +- " << result.AfterpulseTauError*1e9
+		<< " ns (" << AfterpulseTau*SamplePeriod*1e9 << ") from "
+		<< result.Primaries << " primaries\n";
+	std::cout << "Trigger afterpulses " << trigger.Probability << " +- "
+		<< trigger.Error << " (" << TriggerAfterpulseProb << "), rate "
+		<< trigger.Rate << " Hz from " << trigger.Intervals << " triggers\n";
+	std::cout << 1e9*add_time.count() / num_events << " ns per event\n";
+
+	// With the afterpulses of the afterpulses, P/(1 - P) of them and
+	// a little later
+	const double all_afterpulses = Afterpulse / (1.0 - Afterpulse);
+	ok &= std::abs(result.Crosstalk - Crosstalk) < 4.0*result.CrosstalkError
+		&& std::abs(result.Afterpulse - all_afterpulses)
+			< 4.0*result.AfterpulseError
+		&& std::abs(result.AfterpulseTau - AfterpulseTau*SamplePeriod)
+			< 4.0*result.AfterpulseTauError + 0.1*AfterpulseTau*SamplePeriod
+		&& std::abs(trigger.Probability - TriggerAfterpulseProb)
+			< 4.0*trigger.Error
+		&& std::abs(trigger.Rate - TriggerRate) < 0.02*TriggerRate;
+
+	// Without afterpulses, the fit has to say so
+	std::vector<uint64_t> counts(50);
+	std::vector<double> exposure(50, 10000.0);
+	std::poisson_distribution<int> flat(20.0);
+	for(auto& count : counts) {
+		count = flat(gen);
+	}
+	const auto none = fit_afterpulses(counts, exposure, 10.0, 10.0);
+	std::cout << "Without afterpulses " << none.Probability << " +- "
+		<< none.ProbabilityError << ", dark rate " << none.DarkRate
+		<< " per sample (" << 20.0 / 10000.0 / 10.0 << ")\n";
+	ok &= none.Probability < 4.0*none.ProbabilityError + 1e-3
+		&& std::abs(none.DarkRate - 2e-4) < 0.1*2e-4;
+
+	estimator.reset();
+	estimator.finish();
+	ok &= estimator.GetResults().at(0).DarkPulses == 0
+		&& estimator.GetResults().at(0).Primaries == 0;
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
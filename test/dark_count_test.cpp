@@ -0,0 +1,93 @@
+// g++ dark_count_test.cpp -O3 -I../include -o dark_count_test.exe
+#include "dark_count.h"
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+int main(int argc, char const *argv[])
+{
+	std::mt19937 gen(1234);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+	// DT5740D like: 16 ns per sample and count, 1000 samples before the
+	// trigger, 200 Hz of triggers for 100 s (3 roll overs)
+	SBCQueens::DarkCountTrace trace;
+	trace.Channels = {0, 5};
+	trace.WindowStart = 16;
+	trace.WindowEnd = 990;
+	trace.SamplePeriod = 16e-9;
+	trace.TimeTagPeriod = 16e-9;
+
+	SBCQueens::DarkCountConfig config;
+	config.WindowSeconds = 10.0;
+	config.BinSeconds = 1.0;
+
+	SBCQueens::darkCountEstimator dcr;
+	dcr.configure(config, trace);
+
+	const double trigger_rate = 200.0;
+	const uint64_t num_events = 20000;
+	const uint32_t width = 6;
+	// Channel 5 doubles its rate half way
+	const double dcr_0 = 200e3;
+
+	std::vector<SBCQueens::SiPMPulse> pulses;
+	uint64_t time = 1000;
+	for(uint64_t i = 0; i < num_events; i++) {
+		pulses.clear();
+		for(uint8_t ch : trace.Channels) {
+			const double rate = ch == 5 && i >= num_events / 2 ?
+				2*dcr_0 : dcr_0;
+			const double p = rate*trace.SamplePeriod;
+			// Nothing can start while a pulse is over threshold
+			for(uint32_t s = 0; s < 1100; s++) {
+				if(uniform(gen) < p) {
+					SBCQueens::SiPMPulse pulse;
+					pulse.Channel = ch;
+					pulse.Start = s;
+					pulse.Width = width;
+					pulses.push_back(pulse);
+					s += width - 1;
+				}
+			}
+		}
+
+		dcr.add(static_cast<uint32_t>(time & 0x7FFFFFFF), pulses);
+		time += static_cast<uint64_t>(1.0 / trigger_rate / trace.TimeTagPeriod);
+	}
+
+	bool ok = true;
+	auto check = [&](const SBCQueens::DarkCountRate& rate,
+		const double& expected, const char* name) {
+		std::cout << name << ": " << rate.Rate << " +- " << rate.Error
+			<< " Hz (" << rate.Counts << " pulses in " << rate.LiveTime
+			<< " s), expected " << expected << "\n";
+		ok &= std::abs(rate.Rate - expected) < 4*rate.Error;
+	};
+
+	check(dcr.GetRate(0), dcr_0, "Channel 0");
+	check(dcr.GetRate(1), 1.5*dcr_0, "Channel 5");
+	check(dcr.GetWindowRate(0), dcr_0, "Channel 0 (last 10 s)");
+	check(dcr.GetWindowRate(1), 2*dcr_0, "Channel 5 (last 10 s)");
+	check(dcr.GetWindowRate(), 1.5*dcr_0, "Both (last 10 s)");
+
+	std::cout << "Trigger rate " << dcr.GetTriggerRate() << " Hz in "
+		<< dcr.GetElapsedTime() << " s\n";
+	ok &= std::abs(dcr.GetTriggerRate() - trigger_rate) < 0.01
+		&& std::abs(dcr.GetElapsedTime() - (num_events - 1) / trigger_rate) < 0.01;
+
+	// The live time is the region without the pulses
+	const double live_0 = dcr.GetRate(0).LiveTime;
+	ok &= live_0 < num_events*(trace.WindowEnd - trace.WindowStart)
+		*trace.SamplePeriod && live_0 > 0.9*num_events*(trace.WindowEnd
+		- trace.WindowStart)*trace.SamplePeriod;
+
+	dcr.reset();
+	ok &= dcr.GetRate(0).Counts == 0 && dcr.GetWindowRate().LiveTime == 0.0
+		&& dcr.GetTriggerRate() == 0.0;
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
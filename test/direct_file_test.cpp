@@ -0,0 +1,107 @@
+// g++ direct_file_test.cpp ../src/direct_file_helpers.cpp -O3 -I../include -I../deps/spdlog/include -pthread -o direct_file_test.exe
+#include "direct_file_helpers.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace SBCQueens;
+
+std::string read_file(const std::string& fileName) {
+	std::ifstream file(fileName, std::ifstream::binary);
+	return std::string(std::istreambuf_iterator<char>(file),
+		std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char const *argv[])
+{
+	bool ok = true;
+	const std::string direct_name = "direct_file_test.bin";
+	const std::string buffered_name = "direct_file_test_ref.bin";
+	std::filesystem::remove(direct_name);
+	std::filesystem::remove(buffered_name);
+
+	// Small buffers and extents so a few KB go through all of it:
+	// full buffers, waiting for a free one, fallocate and the tail
+	DirectIOConfig config;
+	config.BufferSize = 2*config.BlockSize;
+	config.NumBuffers = 2;
+	config.PreallocationSize = 16*config.BlockSize;
+
+	std::mt19937 gen(42);
+	std::uniform_int_distribution<int> byte(0, 255);
+	auto random_data = [&](const size_t& size) {
+		std::string data(size, '\0');
+		for(auto& c : data) {
+			c = static_cast<char>(byte(gen));
+		}
+		return data;
+	};
+
+	// Sizes of the writes of every open. They end in the middle of a
+	// block (the next open has to read it back), exactly on a block
+	// (nothing to read back) or write nothing at all.
+	const std::vector<std::vector<size_t>> opens = {
+		{1, 7, 4095, 4097, 9999, 13},
+		{3, 8191, 1},
+		{},
+		// Up to 32768 bytes, 8 blocks
+		{6361},
+		{12288},
+		{4096*5 + 1, 333, 70001},
+		{17}
+	};
+
+	uint64_t expected_size = 0;
+	for(size_t i = 0; i < opens.size(); i++) {
+		{
+			directFileWriter direct(direct_name, config);
+			if(!direct.IsOpen()) {
+				std::cout << "Could not open " << direct_name
+					<< " with O_DIRECT" << std::endl;
+				return 1;
+			}
+
+			std::ofstream buffered(buffered_name,
+				std::ofstream::binary | std::ofstream::app);
+
+			ok &= direct.WasEmpty() == (expected_size == 0)
+				&& direct.Size() == expected_size;
+
+			for(const auto& size : opens[i]) {
+				const auto data = random_data(size);
+				direct.write(data.data(), data.size());
+				buffered.write(data.data(), data.size());
+				expected_size += size;
+			}
+
+			// Only the full buffers, the tail waits for close()
+			direct.flush();
+			ok &= direct.Size() == expected_size && !direct.HasError();
+
+			// The second time, close() has nothing to do
+			direct.close();
+			direct.close();
+			ok &= !direct.IsOpen() && !direct.HasError();
+		}
+
+		// Same bytes and no padding nor preallocated zeros at the end
+		const bool good = std::filesystem::file_size(direct_name)
+			== expected_size
+			&& read_file(direct_name) == read_file(buffered_name);
+		std::cout << "Open " << i << ": " << expected_size << " bytes"
+			<< (good ? "" : " FAILED") << "\n";
+		ok &= good;
+	}
+
+	std::filesystem::remove(direct_name);
+	std::filesystem::remove(buffered_name);
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+// g++ file_metrics_test.cpp ../src/chunk_compressor.cpp ../src/direct_file_helpers.cpp -O3 -I../include -I../deps/concurrentqueue -I../deps/spdlog/include -I../deps/zstd/lib -lzstd -pthread -o file_metrics_test.exe
+#include "file_helpers.h"
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TestSt {
+	float x;
+	float y;
+};
+
+int main(int argc, char const *argv[])
+{
+	bool ok = true;
+
+	// 1 us, 10 us, 100 us, 1 ms and 10 ms a hundred times each
+	SBCQueens::LatencyHistogram hist;
+	for(int i = 0; i < 100; i++) {
+		for(int64_t t = 1; t <= 10000; t *= 10) {
+			hist.add(std::chrono::microseconds(t));
+		}
+	}
+
+	// 0.1 ms is in [64, 128) us and 10 ms is the max
+	ok &= hist.Total == 500 && hist.quantile_ms(0.5) == 0.128
+		&& hist.quantile_ms(0.99) == 10.0 && hist.max_ms() == 10.0;
+
+	const std::string file_name = "file_metrics_test.bin";
+	std::filesystem::remove(file_name);
+
+	SBCQueens::fileMetricsMonitor monitor;
+	{
+		SBCQueens::DataFile<TestSt> file;
+		SBCQueens::open(file, file_name);
+
+		const int num_saves = 10;
+		const int num_items = 1000;
+		for(int i = 0; i < num_saves; i++) {
+			for(int j = 0; j < num_items; j++) {
+				file->Add(TestSt{1, 1});
+			}
+
+			// Takes 2 ms to format
+			SBCQueens::save(file, [](std::vector<TestSt>& data) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+				return std::string(data.size()*sizeof(TestSt), 'a');
+			});
+		}
+
+		const auto& metrics = file->GetMetrics();
+		const auto rates = monitor(metrics);
+		std::cout << SBCQueens::format_file_metrics(file_name, metrics, rates)
+			<< "\n";
+
+		ok &= metrics.BytesWritten == num_saves*num_items*sizeof(TestSt)
+			&& metrics.ItemsWritten == num_saves*num_items
+			&& metrics.QueueDepth == num_items
+			&& metrics.MaxQueueDepth == num_items
+			&& metrics.SaveLatency.Total == num_saves
+			&& metrics.FlushLatency.Total == 0
+			&& metrics.FormatTime >= std::chrono::milliseconds(2*num_saves)
+			&& rates.FormatFraction > 0.5 && rates.BytesPerSecond > 0.0;
+	}
+
+	std::filesystem::remove(file_name);
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
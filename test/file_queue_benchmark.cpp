@@ -0,0 +1,188 @@
+// g++ file_queue_benchmark.cpp ../src/chunk_compressor.cpp ../src/direct_file_helpers.cpp -O3 -I../include -I../deps/concurrentqueue -I../deps/spdlog/include -I../deps/zstd/lib -lzstd -pthread -o file_queue_benchmark.exe
+//
+// Compares the queue of dataFile with how it was before: no consumer
+// token and a new vector every save.
+#include "file_helpers.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+struct TestSt {
+	float x;
+	float y;
+};
+
+// The old dataFile queue
+struct oldQueue {
+	moodycamel::ConcurrentQueue<TestSt> _queue;
+
+	void Add(const TestSt& element) {
+		_queue.enqueue(element);
+	}
+
+	auto GetData() {
+		auto approx_length = _queue.size_approx();
+		auto data = std::vector<TestSt>(approx_length);
+		_queue.try_dequeue_bulk(data.data(), approx_length);
+		return data;
+	}
+};
+
+struct result {
+	double Seconds = 0.0;
+	uint64_t Items = 0;
+	// Items that were never added, ex: default constructed
+	uint64_t Bad = 0;
+};
+
+// One thread adds num_items while another saves every 1 ms
+template<typename AddFunc, typename SaveFunc>
+result run(const uint64_t& num_items, AddFunc&& add, SaveFunc&& save) {
+	std::atomic<bool> done = false;
+	result res;
+
+	auto start = std::chrono::steady_clock::now();
+	std::thread producer([&]() {
+		std::mt19937 gen(1234);
+		std::uniform_real_distribution<float> distribution(1, 100);
+		for(uint64_t i = 0; i < num_items; i++) {
+			add(TestSt{distribution(gen), distribution(gen)});
+		}
+		done = true;
+	});
+
+	while(!done) {
+		save(res);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	producer.join();
+	save(res);
+
+	res.Seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+	return res;
+}
+
+template<typename Vector>
+void count(const Vector& data, result& res) {
+	for(const auto& item : data) {
+		res.Items++;
+		res.Bad += item.x < 1.0f;
+	}
+}
+
+void print(const std::string& name, const result& res) {
+	std::cout << name << ": " << res.Items << " items ("
+		<< res.Bad << " bad) in " << res.Seconds << " s, "
+		<< res.Items / res.Seconds / 1e6 << " M items/s\n";
+}
+
+int main(int argc, char const *argv[])
+{
+	const uint64_t num_items = 20000000;
+	bool ok = true;
+
+	// Streaming load, like the slow control or the digitizer
+	{
+		oldQueue queue;
+		auto res = run(num_items, [&](const TestSt& st) { queue.Add(st); },
+			[&](result& res) { count(queue.GetData(), res); });
+		print("old", res);
+	}
+
+	{
+		SBCQueens::dataFile<TestSt> file;
+		auto res = run(num_items, [&](const TestSt& st) { file.Add(st); },
+			[&](result& res) {
+				file.consume([&](std::vector<TestSt>& data) {
+					count(data, res);
+				});
+			});
+		print("dataFile", res);
+		ok &= res.Items == num_items && res.Bad == 0;
+	}
+
+	// A large backlog saved at once
+	{
+		oldQueue queue;
+		for(uint64_t i = 0; i < num_items; i++) {
+			queue.Add(TestSt{1, 1});
+		}
+
+		result res;
+		auto start = std::chrono::steady_clock::now();
+		count(queue.GetData(), res);
+		res.Seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		print("old backlog", res);
+	}
+
+	{
+		SBCQueens::dataFile<TestSt> file;
+		for(uint64_t i = 0; i < num_items; i++) {
+			file.Add(TestSt{1, 1});
+		}
+
+		result res;
+		size_t max_slice = 0;
+		auto start = std::chrono::steady_clock::now();
+		file.consume([&](std::vector<TestSt>& data) {
+			max_slice = std::max(max_slice, data.size());
+			count(data, res);
+		});
+		res.Seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		print("dataFile backlog", res);
+		ok &= res.Items == num_items
+			&& max_slice == SBCQueens::dataFile<TestSt>::DefaultSliceSize;
+	}
+
+	// Several threads adding to the same file, each one in order
+	{
+		const size_t num_producers = 4;
+		SBCQueens::dataFile<TestSt> file;
+		std::vector<std::thread> producers;
+		auto start = std::chrono::steady_clock::now();
+		for(size_t p = 0; p < num_producers; p++) {
+			producers.emplace_back([&, p]() {
+				for(uint64_t i = 0; i < num_items / num_producers; i++) {
+					file.Add(TestSt{static_cast<float>(p + 1),
+						static_cast<float>(i % 1000000)});
+				}
+			});
+		}
+
+		result res;
+		std::vector<float> last(num_producers, -1.0f);
+		bool in_order = true;
+		auto save = [&]() {
+			file.consume([&](std::vector<TestSt>& data) {
+				for(const auto& item : data) {
+					auto& l = last[static_cast<size_t>(item.x) - 1];
+					in_order &= item.y > l || item.y == 0.0f;
+					l = item.y;
+				}
+				count(data, res);
+			});
+		};
+
+		for(auto& producer : producers) {
+			while(producer.joinable()) {
+				save();
+				producer.join();
+			}
+		}
+		save();
+		res.Seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		print("dataFile 4 producers", res);
+		ok &= res.Items == num_items && res.Bad == 0 && in_order;
+	}
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+// g++ histogram_test.cpp ../src/histogram.cpp -O3 -pthread -I../include -o histogram_test.exe
+#include "histogram.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace SBCQueens;
+
+// The bin the slow way
+size_t slow_bin(const HistogramAxis& axis, const double& x) {
+	if(!(x >= axis.Min)) {
+		return 0;
+	}
+	if(x >= axis.Max) {
+		return axis.NumBins + 1;
+	}
+
+	const histogramBins bins(axis);
+	for(size_t i = axis.NumBins; i >= 1; i--) {
+		if(x >= bins.edge(i)) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+	bool ok = true;
+
+	// Log bins against the edges
+	const HistogramAxis log_axis{HistogramBinning::Log, 1000, 1e-6, 10.0};
+	const histogramBins log_bins(log_axis);
+	std::mt19937 gen(99);
+	std::uniform_real_distribution<double> exponent(-7.0, 1.5);
+	int wrong = 0;
+	for(int i = 0; i < 200000; i++) {
+		const double x = std::pow(10.0, exponent(gen));
+		wrong += log_bins(x) != slow_bin(log_axis, x);
+	}
+	for(size_t i = 1; i <= log_axis.NumBins; i++) {
+		wrong += log_bins(log_bins.edge(i)) != i;
+	}
+	std::cout << "Log bins: " << wrong << " wrong\n";
+	ok &= wrong == 0 && log_bins(std::nan("")) == 0;
+
+	// 4 threads at once while another one merges
+	const HistogramAxis axis{HistogramBinning::Linear, 100, 0.0, 100.0};
+	concurrentHistogram hist("Amplitude", axis);
+	const int num_threads = 4;
+	// 1100 values, all of them the same number of times
+	const uint64_t fills = 2000*1100;
+	std::atomic<bool> done{false};
+	uint64_t max_seen = 0;
+	bool monotonic = true;
+	std::thread merger([&]() {
+		while(!done) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			hist.merge();
+			const auto entries = hist.GetSnapshot()->Entries;
+			monotonic &= entries >= max_seen;
+			max_seen = entries;
+		}
+	});
+
+	std::vector<std::thread> fillers;
+	auto start = std::chrono::steady_clock::now();
+	for(int t = 0; t < num_threads; t++) {
+		fillers.emplace_back([&, t]() {
+			auto& shard = hist.local();
+			for(uint64_t i = 0; i < fills; i++) {
+				// 0 to 109.9, so 10% overflow
+				shard.fill(static_cast<double>((i*7 + t) % 1100) / 10.0);
+			}
+		});
+	}
+	for(auto& filler : fillers) {
+		filler.join();
+	}
+	auto end = std::chrono::steady_clock::now();
+	done = true;
+	merger.join();
+
+	hist.merge();
+	auto snapshot = hist.GetSnapshot();
+	const uint64_t total = num_threads*fills;
+	uint64_t in_bins = 0;
+	bool flat = true;
+	for(size_t i = 1; i <= axis.NumBins; i++) {
+		in_bins += snapshot->Counts[i];
+		flat &= snapshot->Counts[i] == snapshot->Counts[1];
+	}
+	std::cout << "Filled " << total << " from " << num_threads
+		<< " threads: " << snapshot->Entries << " entries, "
+		<< snapshot->Counts.back() << " overflow, mean "
+		<< snapshot->GetMean() << ", " << total
+			/ std::chrono::duration<double>(end - start).count() / 1e6
+		<< " M fills/s\n";
+	ok &= monotonic && snapshot->Entries == total && flat
+		&& in_bins == total / 11*10 && snapshot->Counts[0] == 0
+		&& std::abs(snapshot->GetMean() - 54.95) < 1e-6;
+
+	// Filling from one thread with fill(...), finds its shard every time
+	start = std::chrono::steady_clock::now();
+	concurrentHistogram log_hist("TriggerDt", log_axis);
+	std::vector<double> values(1 << 16);
+	for(auto& x : values) {
+		x = std::pow(10.0, exponent(gen));
+	}
+	for(int r = 0; r < 100; r++) {
+		for(const auto& x : values) {
+			log_hist.fill(x);
+		}
+	}
+	end = std::chrono::steady_clock::now();
+	std::cout << "Log: " << 1e9*std::chrono::duration<double>(end
+		- start).count() / (100*values.size()) << " ns per fill\n";
+
+	// Reset, only what comes after counts
+	hist.reset();
+	ok &= hist.GetSnapshot()->Entries == 0;
+	hist.fill(5.5);
+	hist.fill(-1.0);
+	hist.merge();
+	snapshot = hist.GetSnapshot();
+	ok &= snapshot->Entries == 2 && snapshot->Counts[6] == 1
+		&& snapshot->Counts[0] == 1 && std::abs(snapshot->Sum - 4.5) < 1e-9;
+
+	// Stairs
+	std::vector<double> x, y;
+	histogram_stairs(*snapshot, x, y);
+	ok &= x.size() == 101 && x[0] == 0.0 && x[100] == 100.0 && y[5] == 1.0
+		&& y[99] == y[100];
+
+	// Save and load
+	log_hist.merge();
+	std::vector<histogramSnapshot> saved = {*hist.GetSnapshot(),
+		*log_hist.GetSnapshot()};
+	const char* file_name = "histogram_test.sbch";
+	ok &= histograms_save(file_name, saved);
+	std::vector<histogramSnapshot> loaded;
+	ok &= histograms_load(file_name, loaded) && loaded.size() == 2;
+	for(size_t i = 0; ok && i < loaded.size(); i++) {
+		ok &= loaded[i].Name == saved[i].Name
+			&& loaded[i].Axis.Binning == saved[i].Axis.Binning
+			&& loaded[i].Axis.NumBins == saved[i].Axis.NumBins
+			&& loaded[i].Axis.Min == saved[i].Axis.Min
+			&& loaded[i].Counts == saved[i].Counts
+			&& loaded[i].Entries == saved[i].Entries
+			&& loaded[i].Sum == saved[i].Sum;
+	}
+
+	// Corrupted
+	{
+		std::FILE* file = std::fopen(file_name, "r+b");
+		std::fseek(file, 30, SEEK_SET);
+		std::fputc(0x55, file);
+		std::fclose(file);
+	}
+	ok &= !histograms_load(file_name, loaded) && loaded.empty();
+	std::remove(file_name);
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
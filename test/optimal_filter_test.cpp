@@ -0,0 +1,157 @@
+// g++ optimal_filter_test.cpp ../src/optimal_filter.cpp -O3 -march=native -I../include -o optimal_filter_test.exe
+#include "optimal_filter.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// DT5740D like: 2000 samples (padded to 2048), the trigger at 1000
+const uint32_t RecordLength = 2000;
+const uint32_t Trigger = 1000;
+const double Baseline = 2000.0;
+
+std::mt19937 gen(1234);
+
+// Noise with a low frequency part, so the spectrum is not flat
+void make_noise(std::vector<double>& out) {
+	std::normal_distribution<double> white(0.0, 2.0);
+	std::normal_distribution<double> red(0.0, 0.6);
+	double slow = 0.0;
+	for(auto& x : out) {
+		slow = 0.95*slow + red(gen);
+		x = Baseline + white(gen) + slow;
+	}
+}
+
+// Fast rise, 20 samples tail, peak of amplitude at peak
+void add_pulse(std::vector<double>& trace, const double& start,
+	const double& amplitude) {
+	// Peak of (1 - e^-x/2) e^-x/20 is at x = 2 ln(11)
+	const double x_peak = 2.0*std::log(11.0);
+	const double norm = (1.0 - std::exp(-x_peak / 2.0))
+		*std::exp(-x_peak / 20.0);
+	for(size_t i = 0; i < trace.size(); i++) {
+		const double x = i - start;
+		if(x > 0.0) {
+			trace[i] += amplitude*(1.0 - std::exp(-x / 2.0))
+				*std::exp(-x / 20.0) / norm;
+		}
+	}
+}
+
+std::vector<uint16_t> digitize(const std::vector<double>& trace) {
+	std::vector<uint16_t> out(trace.size());
+	for(size_t i = 0; i < trace.size(); i++) {
+		out[i] = static_cast<uint16_t>(std::lround(trace[i]));
+	}
+	return out;
+}
+
+int main(int argc, char const *argv[])
+{
+	SBCQueens::PulseFinderConfig pulse_config;
+	pulse_config.Threshold = 20;
+	pulse_config.BaselineSamples = 64;
+
+	SBCQueens::OptimalFilterConfig config;
+	config.Enabled = true;
+	config.NoiseTraces = 500;
+	config.TemplateTraces = 500;
+	config.TemplateMinAmplitude = 30.0f;
+	config.TemplateMaxAmplitude = 70.0f;
+
+	SBCQueens::optimalFilterBuilder builder;
+	builder.configure(config, RecordLength, pulse_config);
+
+	// Half without pulses, half with one pulse of 50 counts
+	std::vector<double> trace(RecordLength);
+	std::vector<SBCQueens::SiPMPulse> pulses;
+	const double x_peak = 2.0*std::log(11.0);
+	bool made = false;
+	for(int i = 0; i < 2000 && !made; i++) {
+		make_noise(trace);
+		if(i % 2) {
+			add_pulse(trace, Trigger, 50.0);
+		}
+
+		auto data = digitize(trace);
+		pulses.clear();
+		SBCQueens::find_pulses(data.data(), data.size(), pulse_config, 3,
+			pulses);
+		made = builder.add(3, data.data(), RecordLength, pulses.data(),
+			pulses.size());
+	}
+
+	auto filters = builder.GetFilters();
+	auto filter = (*filters)[3];
+	bool ok = made && filter && !(*filters)[0];
+	if(!filter) {
+		std::cout << "FAILED, no filter" << std::endl;
+		return 1;
+	}
+
+	// Pulses of 15 counts, too close to the noise for the threshold. The
+	// largest A(t) of smaller ones is biased up by the noise.
+	const double amplitude = 15.0;
+	const int num_traces = 2000;
+	std::uniform_real_distribution<double> jitter(0.0, 1.0);
+	SBCQueens::OptimalFilterWorkspace workspace;
+	double sum = 0.0, sum2 = 0.0, time_sum2 = 0.0;
+	int num_found = 0;
+	std::vector<std::vector<uint16_t>> traces;
+	for(int i = 0; i < num_traces; i++) {
+		make_noise(trace);
+		const double start = Trigger + 200.0*jitter(gen);
+		add_pulse(trace, start, amplitude);
+		traces.push_back(digitize(trace));
+
+		const auto& data = traces.back();
+		const float baseline = SBCQueens::pulse_baseline(data.data(),
+			data.size(), pulse_config);
+		const auto pulse = (*filter)(data.data(), RecordLength, baseline, 3,
+			workspace);
+		const double true_peak = start + x_peak;
+		if(pulse.Valid && std::abs(pulse.Time - true_peak) < 5.0) {
+			num_found++;
+			sum += pulse.Amplitude;
+			sum2 += pulse.Amplitude*pulse.Amplitude;
+			time_sum2 += (pulse.Time - true_peak)*(pulse.Time - true_peak);
+		}
+	}
+
+	const double mean = sum / num_found;
+	const double sigma = std::sqrt(sum2 / num_found - mean*mean);
+	std::cout << "Found " << num_found << " of " << num_traces
+		<< " pulses of " << amplitude << " counts: " << mean << " +- "
+		<< sigma << " (expected resolution " << filter->GetResolution()
+		<< "), time rms " << std::sqrt(time_sum2 / num_found)
+		<< " samples\n";
+	ok &= num_found > 0.95*num_traces
+		&& std::abs(mean - amplitude) < 0.05*amplitude
+		&& sigma < 1.5*filter->GetResolution()
+		&& sigma > 0.5*filter->GetResolution();
+
+	// Speed, the same traces again
+	auto start = std::chrono::steady_clock::now();
+	float total = 0.0f;
+	const int repeats = 5;
+	for(int r = 0; r < repeats; r++) {
+		for(const auto& data : traces) {
+			total += (*filter)(data.data(), RecordLength,
+				static_cast<float>(Baseline), 3, workspace).Amplitude;
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "Filtered "
+		<< repeats*num_traces / std::chrono::duration<double>(end
+			- start).count() / 1e3 << " k traces/s per thread (" << total
+		<< ")\n";
+
+	builder.reset();
+	ok &= !(*builder.GetFilters())[3];
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+// g++ pe_spectrum_test.cpp ../src/pe_spectrum.cpp -O3 -I../include -pthread -o pe_spectrum_test.exe
+#include "pe_spectrum.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <thread>
+
+int main(int argc, char const *argv[])
+{
+	std::mt19937 gen(1234);
+	// 1 PE with some crosstalk to 2, 3, ... PE
+	std::geometric_distribution<int> crosstalk(0.7);
+	std::normal_distribution<double> noise(0.0, 1.0);
+
+	const double gain = 300.0;
+	const double pedestal = 20.0;
+	const double sigma_0 = 25.0;
+	const double sigma_1 = 20.0;
+
+	SBCQueens::PESpectrumConfig config;
+	config.Enabled = true;
+	config.MaxCharge = 2000.0;
+	config.NumBins = 500;
+	config.FitSeconds = 0.0;
+
+	SBCQueens::peSpectrum spectrum;
+	spectrum.configure(config);
+
+	// Two channels, the second one with half the gain
+	const uint64_t num_pulses = 1000000;
+	auto start = std::chrono::steady_clock::now();
+	for(uint64_t i = 0; i < num_pulses; i++) {
+		SBCQueens::SiPMPulse pulse;
+		pulse.Channel = 2*(i % 2);
+		const int pe = 1 + crosstalk(gen);
+		const double g = pulse.Channel == 0 ? gain : gain / 2;
+		pulse.Integral = static_cast<float>(pedestal + pe*g
+			+ noise(gen)*std::sqrt(sigma_0*sigma_0 + pe*sigma_1*sigma_1)
+			*(pulse.Channel == 0 ? 1.0 : 0.5));
+		spectrum.add(pulse);
+	}
+	auto mid = std::chrono::steady_clock::now();
+
+	// The first update starts the fit and a later one picks it up
+	bool ok = !spectrum.update();
+	for(int i = 0; i < 100 && !spectrum.update(); i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	const auto& fits = spectrum.GetFits();
+	ok &= fits.size() == 2;
+	for(const auto& fit : fits) {
+		const double g = fit.Channel == 0 ? gain : gain / 2;
+		std::cout << "Channel " << int(fit.Channel) << ": " << fit.Entries
+			<< " pulses, " << fit.Peaks.size() << " peaks, gain " << fit.Gain
+			<< " +- " << fit.GainError << ", pedestal " << fit.Pedestal
+			<< ", resolution " << fit.Resolution << "\n";
+		ok &= fit.IsValid() && fit.Peaks.size() >= 3
+			&& std::abs(fit.Gain - g) < 0.02*g
+			&& std::abs(fit.Gain - g) < 5*fit.GainError + 0.005*g
+			&& std::abs(fit.Pedestal - pedestal) < 0.1*g;
+	}
+	ok &= std::abs(spectrum.GetGain() - 0.75*gain) < 0.02*gain;
+
+	std::cout << "Filled in "
+		<< std::chrono::duration<double, std::nano>(mid - start).count()
+			/ num_pulses
+		<< " ns per pulse (with the random numbers), fitted in "
+		<< std::chrono::duration<double, std::milli>(end - mid).count()
+		<< " ms\n";
+
+	// Nothing to fit
+	spectrum.clear();
+	spectrum.finish();
+	ok &= spectrum.GetFits().empty() && spectrum.GetGain() == 0.0;
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+// g++ pulse_finder_test.cpp -O3 -mavx2 -I../include -o pulse_finder_test.exe
+#include "pulse_finder.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// One sample at a time, the way it is described in pulse_finder.h
+std::vector<SBCQueens::SiPMPulse> reference(const std::vector<uint16_t>& in,
+	const SBCQueens::PulseFinderConfig& config) {
+	std::vector<SBCQueens::SiPMPulse> out;
+	const size_t n = in.size();
+	double sum = 0;
+	for(size_t i = 0; i < config.BaselineSamples; i++) {
+		sum += in[i];
+	}
+	const float baseline = static_cast<float>(sum / config.BaselineSamples);
+	const int sign = config.Polarity == SBCQueens::PulsePolarity::Positive ?
+		1 : -1;
+
+	size_t last_end = 0;
+	for(size_t i = 0; i < n;) {
+		if(sign*(in[i] - baseline) <= config.Threshold
+			&& !(sign > 0 && in[i] > std::floor(baseline + config.Threshold))
+			&& !(sign < 0 && in[i] < std::ceil(baseline - config.Threshold))) {
+			i++;
+			continue;
+		}
+
+		SBCQueens::SiPMPulse pulse;
+		pulse.Start = i;
+		pulse.PeakTime = i;
+		const double end_level = sign > 0 ?
+			std::floor(baseline + config.Threshold) - config.Hysteresis
+			: std::ceil(baseline - config.Threshold) + config.Hysteresis;
+		int peak = sign*in[i];
+		for(; i < n && sign*(in[i] - end_level) > 0; i++) {
+			if(sign*in[i] > peak) {
+				peak = sign*in[i];
+				pulse.PeakTime = i;
+			}
+		}
+
+		pulse.Width = i - pulse.Start;
+		pulse.Truncated = i == n;
+		pulse.Amplitude = peak - sign*baseline;
+		const size_t a = std::max<size_t>(last_end,
+			pulse.Start > config.PreSamples ?
+			pulse.Start - config.PreSamples : 0);
+		const size_t b = std::min(n, i + config.PostSamples);
+		double integral = 0;
+		for(size_t j = a; j < b; j++) {
+			integral += in[j];
+		}
+		pulse.Integral = sign*(integral - double(baseline)*(b - a));
+		last_end = b;
+		out.push_back(pulse);
+	}
+
+	return out;
+}
+
+int main(int argc, char const *argv[])
+{
+	std::mt19937 gen(1234);
+	std::normal_distribution<double> noise(0.0, 3.0);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+	// DT5740D like: 12 bits, 3 channels, a few pulses of ~30 counts
+	// on top of the baseline, ~10 samples of decay
+	const size_t num_traces = 3*10000;
+	const size_t record_length = 2048;
+	SBCQueens::PulseFinderConfig config;
+	config.MaxPulses = 0;
+
+	bool ok = true;
+	for(auto polarity : {SBCQueens::PulsePolarity::Positive,
+		SBCQueens::PulsePolarity::Negative}) {
+		config.Polarity = polarity;
+		const double sign = polarity == SBCQueens::PulsePolarity::Positive ?
+			1.0 : -1.0;
+
+		std::vector<std::vector<uint16_t>> traces(num_traces);
+		size_t num_injected = 0;
+		for(auto& trace : traces) {
+			std::vector<double> x(record_length, 2000.0);
+			for(size_t i = 64; i < record_length; i++) {
+				if(uniform(gen) < 2e-3) {
+					num_injected++;
+					const double amp = 30.0*(1 + (uniform(gen) < 0.2));
+					for(size_t j = i; j < record_length; j++) {
+						x[j] += sign*amp*std::exp(-double(j - i) / 10.0);
+					}
+				}
+			}
+
+			trace.resize(record_length);
+			for(size_t i = 0; i < record_length; i++) {
+				trace[i] = static_cast<uint16_t>(std::lround(x[i] + noise(gen)));
+			}
+		}
+
+		std::vector<SBCQueens::SiPMPulse> pulses;
+		pulses.reserve(num_traces*16);
+		auto start = std::chrono::steady_clock::now();
+		for(size_t t = 0; t < num_traces; t++) {
+			SBCQueens::find_pulses(traces[t].data(), record_length, config,
+				t % 3, pulses);
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		// Same pulses as the one by one version
+		size_t k = 0;
+		for(size_t t = 0; t < num_traces && ok; t++) {
+			for(const auto& ref : reference(traces[t], config)) {
+				const auto& p = pulses[k++];
+				ok &= p.Start == ref.Start && p.PeakTime == ref.PeakTime
+					&& p.Width == ref.Width && p.Channel == t % 3
+					&& p.Truncated == ref.Truncated
+					&& std::abs(p.Amplitude - ref.Amplitude) < 1e-3
+					&& std::abs(p.Integral - ref.Integral) < 1e-2;
+			}
+		}
+		ok &= k == pulses.size();
+
+		// Most of the injected pulses are found, and not much noise
+		ok &= pulses.size() > 0.8*num_injected
+			&& pulses.size() < 1.2*num_injected;
+
+		const double seconds = std::chrono::duration<double>(end - start).count();
+		std::cout << (sign > 0 ? "Positive" : "Negative") << ": "
+			<< pulses.size() << " pulses (" << num_injected << " injected) in "
+			<< 1e3*seconds << " ms, " << num_traces / seconds / 1e6
+			<< " M traces/s, " << num_traces*record_length / seconds / 1e9
+			<< " G samples/s\n";
+	}
+
+	// Nothing to find
+	std::vector<uint16_t> flat(record_length, 100);
+	std::vector<SBCQueens::SiPMPulse> none;
+	ok &= SBCQueens::find_pulses(flat.data(), flat.size(), config, 0, none)
+		== 100.0f && none.empty();
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
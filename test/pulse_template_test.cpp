@@ -0,0 +1,176 @@
+// g++ pulse_template_test.cpp ../src/pulse_template.cpp -O3 -march=native -I../include -o pulse_template_test.exe
+#include "pulse_template.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <vector>
+
+// Counts the allocations, add(...) should not do any
+static size_t num_allocations = 0;
+
+void* operator new(std::size_t size) {
+	num_allocations++;
+	if(void* p = std::malloc(size)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+const uint32_t RecordLength = 2000;
+const uint32_t Trigger = 1000;
+const double Baseline = 2000.0;
+// SiPM like pulse, (1 - e^-x/Rise) e^-x/Decay
+const double Rise = 2.0;
+const double Decay = 8.0;
+const double XPeak = Rise*std::log((Decay + Rise) / Rise);
+
+std::mt19937 gen(4321);
+
+// Height 1 at x = XPeak
+double shape(const double& x) {
+	if(x <= 0.0) {
+		return 0.0;
+	}
+
+	const double norm = (1.0 - std::exp(-XPeak / Rise))
+		*std::exp(-XPeak / Decay);
+	return (1.0 - std::exp(-x / Rise))*std::exp(-x / Decay) / norm;
+}
+
+std::vector<uint16_t> make_trace(const double& start, const double& amplitude) {
+	std::normal_distribution<double> noise(0.0, 2.0);
+	std::vector<uint16_t> out(RecordLength);
+	for(size_t i = 0; i < out.size(); i++) {
+		out[i] = static_cast<uint16_t>(std::lround(Baseline + noise(gen)
+			+ amplitude*shape(i - start)));
+	}
+	return out;
+}
+
+// Largest difference between the template and the true shape, as a
+// fraction of its height. time0 is about where the pulse time is in the
+// shape, the interpolations are biased on a pulse this asymmetric so the
+// best shift around it is used.
+double compare(const SBCQueens::pulseTemplates& templates,
+	const double& amplitude, const double& time0) {
+	const auto& config = templates.GetConfig();
+	const auto result = templates.GetTemplate(3);
+	double best = 1e9;
+	for(double shift = -1.0; shift <= 1.0; shift += 0.01) {
+		double worst = 0.0;
+		for(size_t g = 0; g < result.size(); g++) {
+			const double t = static_cast<double>(g) / config.Oversampling
+				- config.PreSamples;
+			const double truth = amplitude*shape(t + time0 + shift);
+			worst = std::max(worst, std::abs(result[g] - truth) / amplitude);
+		}
+		best = std::min(best, worst);
+	}
+	return best;
+}
+
+int main(int argc, char const *argv[])
+{
+	SBCQueens::PulseFinderConfig pulse_config;
+	pulse_config.Threshold = 20;
+	pulse_config.BaselineSamples = 64;
+
+	SBCQueens::PulseTemplateConfig config;
+	config.Enabled = true;
+	config.MinAmplitude = 30.0f;
+	config.MaxAmplitude = 70.0f;
+	config.Samples = 128;
+	config.PreSamples = 16;
+	config.Oversampling = 4;
+
+	SBCQueens::pulseTemplates templates;
+	templates.configure(config, pulse_config, {3});
+
+	// 1 PE (50 counts) and 2 PE (100 counts) pulses at any fraction of a
+	// sample, only the 1 PE ones go in
+	const double amplitude = 50.0;
+	std::uniform_real_distribution<double> jitter(0.0, 1.0);
+	std::vector<std::vector<uint16_t>> traces;
+	std::vector<std::vector<SBCQueens::SiPMPulse>> pulses(4000);
+	int num_single = 0;
+	for(int i = 0; i < 4000; i++) {
+		const bool two_pe = i % 4 == 0;
+		traces.push_back(make_trace(Trigger + 100.0*jitter(gen),
+			two_pe ? 2.0*amplitude : amplitude));
+		SBCQueens::find_pulses(traces.back().data(), RecordLength,
+			pulse_config, 3, pulses[i]);
+		num_single += !two_pe;
+	}
+
+	num_allocations = 0;
+	int num_added = 0;
+	for(size_t i = 0; i < traces.size(); i++) {
+		num_added += templates.add(3, traces[i].data(), RecordLength,
+			pulses[i].data(), pulses[i].size());
+	}
+	const size_t allocations = num_allocations;
+
+	// The noise moves the peak time of a round peak around, so the
+	// template is smeared
+	const double peak_error = compare(templates, amplitude, XPeak);
+	std::cout << "Peak: " << num_added << " of " << num_single
+		<< " 1 PE pulses added, largest error " << 100.0*peak_error
+		<< "% of the height, " << allocations << " allocations\n";
+	bool ok = num_added > 0.98*num_single && num_added <= num_single
+		&& templates.GetCount(3) == static_cast<uint64_t>(num_added)
+		&& templates.GetCount(0) == 0
+		&& peak_error < 0.15 && allocations == 0;
+
+	// The threshold crossing is at shape(x) = 20/50
+	double x_threshold = 0.0;
+	while(amplitude*shape(x_threshold) < pulse_config.Threshold) {
+		x_threshold += 1e-4;
+	}
+
+	config.Alignment = SBCQueens::TemplateAlignment::Threshold;
+	templates.configure(config, pulse_config, {3});
+	for(size_t i = 0; i < traces.size(); i++) {
+		templates.add(3, traces[i].data(), RecordLength, pulses[i].data(),
+			pulses[i].size());
+	}
+
+	const double threshold_error = compare(templates, amplitude, x_threshold);
+	std::cout << "Threshold: largest error " << 100.0*threshold_error
+		<< "% of the height\n";
+	ok &= threshold_error < 0.04;
+
+	// For the optimal filter, 256 samples with the time at 32
+	const auto sampled = templates.GetSampledTemplate(3, 256, 32);
+	float peak = 0.0f;
+	for(const auto& x : sampled) {
+		peak = std::max(peak, x);
+	}
+	ok &= sampled.size() == 256 && std::abs(peak - 1.0f) < 1e-6
+		&& sampled[25] < 0.05f && sampled[36] > 0.9f;
+
+	// Speed, the same traces again
+	templates.reset();
+	ok &= templates.GetCount(3) == 0;
+	auto start = std::chrono::steady_clock::now();
+	const int repeats = 5;
+	for(int r = 0; r < repeats; r++) {
+		for(size_t i = 0; i < traces.size(); i++) {
+			templates.add(3, traces[i].data(), RecordLength, pulses[i].data(),
+				pulses[i].size());
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "Added " << repeats*traces.size()
+		/ std::chrono::duration<double>(end - start).count() / 1e6
+		<< " M traces/s\n";
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+// g++ roi_codec_test.cpp -O3 -I../include -o roi_codec_test.exe
+#include "roi_codec.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Makes a trace with a pulse at pulse_at on top of noise, or only
+// noise if pulse_at < 0
+std::vector<uint16_t> make_trace(std::mt19937& gen, const size_t& n,
+	const int& pulse_at) {
+	std::normal_distribution<double> noise(0.0, 3.0);
+	const double baseline = 0x3000;
+
+	std::vector<uint16_t> trace(n);
+	for(size_t i = 0; i < n; i++) {
+		double t = static_cast<double>(i) - pulse_at;
+		double pulse = pulse_at < 0 || t < 0 ?
+			0.0 : 500.0*(std::exp(-t/40.0) - std::exp(-t/4.0));
+		trace[i] = static_cast<uint16_t>(baseline - pulse + noise(gen));
+	}
+
+	return trace;
+}
+
+int main(int argc, char const *argv[])
+{
+	std::mt19937 gen(1234);
+	const SBCQueens::ROIConfig config;
+	const size_t record_length = 5000;
+	bool ok = true;
+
+	std::vector<char> buffer(SBCQueens::roi_max_size(record_length));
+	std::vector<uint16_t> decoded(record_length);
+
+	auto encode = [&](const std::vector<uint16_t>& trace) {
+		return SBCQueens::roi_encode(trace.data(), trace.size(), config,
+			buffer.data());
+	};
+
+	auto decode = [&](const size_t& n, const size_t& samples) {
+		return SBCQueens::roi_decode(buffer.data(), n, decoded.data(),
+			samples) == n;
+	};
+
+	// An empty channel is only the header and no regions
+	auto noise = make_trace(gen, record_length, -1);
+	auto n = encode(noise);
+	if(n != SBCQueens::ROIHeaderSize
+		|| SBCQueens::roi_num_regions(buffer.data(), n) != 0
+		|| !decode(n, record_length)
+		|| std::abs(decoded[100] - 0x3000) > 3) {
+		std::cout << "Empty channel failed\n";
+		ok = false;
+	}
+
+	// A pulse is kept exactly and the rest is the baseline
+	auto pulse = make_trace(gen, record_length, 2500);
+	n = encode(pulse);
+	if(SBCQueens::roi_num_regions(buffer.data(), n) != 1
+		|| !decode(n, record_length)) {
+		std::cout << "Pulse failed\n";
+		ok = false;
+	} else {
+		for(size_t i = 2505; i < 2600; i++) {
+			if(decoded[i] != pulse[i]) {
+				std::cout << "Pulse sample " << i << " is different\n";
+				ok = false;
+				break;
+			}
+		}
+	}
+
+	// Random data is saved whole and never bigger than roi_max_size
+	for(size_t len : {0, 1, 7, 8, 9, 100, 1200}) {
+		std::uniform_int_distribution<uint16_t> all_bits(0, 0xFFFF);
+		std::vector<uint16_t> trace(len);
+		for(auto& s : trace) {
+			s = all_bits(gen);
+		}
+
+		n = encode(trace);
+		if(n > SBCQueens::roi_max_size(len) || !decode(n, len)
+			|| !std::equal(trace.begin(), trace.end(), decoded.begin())) {
+			std::cout << "Random trace of " << len << " samples failed\n";
+			ok = false;
+		}
+	}
+
+	// Bad data
+	if(SBCQueens::roi_decode(buffer.data(), 3, decoded.data(), 10) != 0) {
+		std::cout << "Truncated data was decoded\n";
+		ok = false;
+	}
+
+	// Size and speed with 1 in 4 channels with a pulse
+	std::vector<std::vector<uint16_t>> traces;
+	for(size_t i = 0; i < 64; i++) {
+		traces.push_back(make_trace(gen, record_length,
+			i % 4 == 0 ? 1000 : -1));
+	}
+
+	const size_t num_traces = 20000;
+	size_t total_encoded = 0;
+	auto start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < num_traces; i++) {
+		total_encoded += encode(traces[i % traces.size()]);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double raw_mb = num_traces*record_length*sizeof(uint16_t)/1e6;
+	double enc_s = std::chrono::duration<double>(end - start).count();
+	std::cout << "ratio " << raw_mb*1e6/total_encoded
+		<< ", encode " << raw_mb/std::max(enc_s, 1e-9) << " MB/s\n";
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+// g++ run_catalog_test.cpp -O3 -I../include -o run_catalog_test.exe
+#include "run_catalog.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+int main(int argc, char const *argv[])
+{
+	const std::string dir = "run_catalog_test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	const std::string file_name = SBCQueens::catalog_name(dir);
+
+	// Five years of runs, 3 a day
+	const uint64_t num_runs = 5*365*3;
+	const uint64_t t_start = 1600000000000;
+	const uint64_t run_length = 8*3600*1000;
+	const std::string sipms[] = {"VUV4 3OV", "VUV4 4OV", "HD3 4OV"};
+
+	auto start = std::chrono::steady_clock::now();
+	bool ok = true;
+	for(uint64_t i = 0; i < num_runs; i++) {
+		SBCQueens::RunCatalogEntry run;
+		run.StartTime = t_start + i*run_length;
+		run.ConfigHash = i % 7 + 1;
+		run.SiPMParameters = sipms[i % 3];
+		run.FilePrefix = std::to_string(i);
+		run.Parameters = {{"PeltierTempSetpoint", -100.0 + (i % 5)},
+			{"NTempSetpoint", -120.0}};
+		ok &= SBCQueens::catalog_add_start(file_name, run);
+
+		// The last run never stops
+		if(i == num_runs - 1) {
+			break;
+		}
+
+		run.EndTime = run.StartTime + run_length - 1000;
+		run.Events = 1000*i;
+		run.Segments = {{run.FilePrefix + ".bin", 1000*i, 1000000*i}};
+		run.Results = {{"Gain0", 300.0 + i}};
+		ok &= SBCQueens::catalog_add_stop(file_name, run);
+	}
+	auto mid = std::chrono::steady_clock::now();
+
+	// A record cut by a crash
+	{
+		std::ofstream file(file_name, std::ofstream::binary
+			| std::ofstream::app);
+		const uint32_t size = 100;
+		file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+		file.write("abc", 3);
+	}
+
+	SBCQueens::runCatalog catalog;
+	ok = ok && catalog.open(file_name);
+
+	// The VUV4 4OV runs at -100 C in the first year
+	SBCQueens::RunCatalogQuery query;
+	query.SiPM = "VUV4 4OV";
+	query.Parameters.push_back({"PeltierTempSetpoint", -100.5, -99.5});
+	query.To = t_start + 365ull*24*3600*1000;
+	query.OnlyStopped = true;
+	auto runs = catalog.query(query);
+	auto end = std::chrono::steady_clock::now();
+
+	// i % 3 == 1 and i % 5 == 0 -> i = 10, 25, ... until 1095
+	ok = ok && !catalog.GetError().empty()
+		&& catalog.GetRuns().size() == num_runs
+		&& !catalog.GetRuns().back().IsStopped()
+		&& runs.size() == 73 && runs[0]->FilePrefix == dir + "/10"
+		&& runs[0]->Events == 10000 && runs[0]->Segments.size() == 1
+		&& runs[0]->Segments[0].FileName == dir + "/10.bin"
+		&& *runs[0]->GetParameter("NTempSetpoint") == -120.0
+		&& *runs[0]->GetParameter("Gain0") == 310.0;
+
+	std::cout << "Wrote " << num_runs << " runs ("
+		<< std::filesystem::file_size(file_name) / 1024 << " kB) in "
+		<< std::chrono::duration<double, std::milli>(mid - start).count()
+		<< " ms, read and queried in "
+		<< std::chrono::duration<double, std::milli>(end - mid).count()
+		<< " ms\n";
+
+	std::filesystem::remove_all(dir);
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,284 @@
+// g++ sbc_reader_test.cpp -O3 -pthread -I../include -o sbc_reader_test.exe
+#include "sbc_reader.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace SBCQueens;
+
+const size_t NumChannels = 2;
+const size_t NumSamples = 64;
+
+// Sample s of channel ch of line i
+uint16_t sample(const uint64_t& i, const size_t& ch, const size_t& s) {
+	return static_cast<uint16_t>(1000 + (i*7 + ch*3 + s) % 50);
+}
+
+struct fixtureConfig {
+	// uint16 or bitpack16
+	std::string Type = "uint16";
+	uint64_t NumLines = 10;
+	// Lines per block, 0 = not framed
+	uint32_t BlockLines = 0;
+	// 0 = no index
+	uint32_t IndexInterval = 0;
+	// Lines in the header, -1 = NumLines
+	int32_t StoredLines = -1;
+	// Dimensions of sipm_traces in the header
+	std::string Dims = std::to_string(NumSamples) + ","
+		+ std::to_string(NumChannels);
+};
+
+// Writes a SBC file like the ones of sbc_init_file and sbc_save_func,
+// the run constants are only the sample rate
+void write_fixture(const std::string& fileName, const fixtureConfig& config) {
+	auto append = [](std::string& out, auto num) {
+		out.append(reinterpret_cast<const char*>(&num), sizeof(num));
+	};
+
+	const std::string header = "sample_rate;double;1;time_stamp;uint32;1;"
+		"sipm_traces;" + config.Type + ";" + config.Dims + ";";
+
+	std::string out;
+	append(out, uint32_t(0x01020304));
+	append(out, static_cast<uint16_t>(header.size()));
+	out += header;
+	append(out, config.StoredLines < 0 ?
+		static_cast<int32_t>(config.NumLines) : config.StoredLines);
+
+	// Offsets in the index do not count the block headers
+	uint64_t logical = out.size();
+	std::string block;
+	uint32_t block_items = 0;
+	std::string index;
+	uint64_t num_entries = 0;
+	for(uint64_t i = 0; i < config.NumLines; i++) {
+		if(config.IndexInterval > 0 && i % config.IndexInterval == 0) {
+			append(index, i);
+			append(index, logical);
+			append(index, 100*i);
+			num_entries++;
+		}
+
+		std::string line;
+		append(line, 250e6);
+		append(line, static_cast<uint32_t>(100*i));
+
+		std::vector<uint16_t> traces(NumChannels*NumSamples);
+		for(size_t ch = 0; ch < NumChannels; ch++) {
+			for(size_t s = 0; s < NumSamples; s++) {
+				traces[ch*NumSamples + s] = sample(i, ch, s);
+			}
+		}
+
+		if(config.Type == "bitpack16") {
+			std::string encoded(NumChannels*bitpack16_max_size(NumSamples),
+				'\0');
+			size_t size = 0;
+			for(size_t ch = 0; ch < NumChannels; ch++) {
+				size += bitpack16_encode(traces.data() + ch*NumSamples,
+					NumSamples, encoded.data() + size);
+			}
+			append(line, static_cast<uint32_t>(size));
+			line.append(encoded.data(), size);
+		} else {
+			line.append(reinterpret_cast<const char*>(traces.data()),
+				traces.size()*sizeof(uint16_t));
+		}
+
+		logical += line.size();
+		if(config.BlockLines == 0) {
+			out += line;
+			continue;
+		}
+
+		block += line;
+		block_items++;
+		if(block_items == config.BlockLines || i + 1 == config.NumLines) {
+			out += block_frame_header(block.data(),
+				static_cast<uint32_t>(block.size()), block_items);
+			out += block;
+			block.clear();
+			block_items = 0;
+		}
+	}
+
+	if(config.IndexInterval > 0) {
+		out += index;
+		append(out, num_entries);
+		append(out, config.NumLines);
+		append(out, config.IndexInterval);
+		append(out, uint32_t(0x49434253));
+	}
+
+	std::ofstream file(fileName, std::ofstream::binary);
+	file.write(out.data(), out.size());
+}
+
+// Everything the reader gives back has to be what write_fixture wrote
+bool check(const sbcReader& reader, const fixtureConfig& config) {
+	bool ok = reader.IsOpen() && reader.NumLines() == config.NumLines
+		&& reader.IsFramed() == (config.BlockLines > 0)
+		&& reader.GetIndexInterval() == config.IndexInterval;
+
+	auto time_stamp = reader.column<uint32_t>("time_stamp");
+	ok &= time_stamp.IsValid();
+	for(const auto& entry : reader.GetIndex()) {
+		// The offsets do not count the block headers
+		ok &= entry.Event < reader.NumLines()
+			&& (config.BlockLines > 0
+				|| reader.LineOffset(entry.Event) == entry.Offset)
+			&& time_stamp[entry.Event] == entry.TimeStamp;
+	}
+
+	// Views and decode_traces have to agree
+	auto traces = reader.column<uint16_t>("sipm_traces");
+	std::vector<uint16_t> decoded;
+	for(uint64_t i = 0; ok && i < reader.NumLines(); i++) {
+		ok &= time_stamp[i] == 100*i && reader.decode_traces(i, decoded)
+			&& decoded.size() == NumChannels*NumSamples;
+		for(size_t ch = 0; ok && ch < NumChannels; ch++) {
+			for(size_t s = 0; s < NumSamples; s++) {
+				ok &= decoded[ch*NumSamples + s] == sample(i, ch, s)
+					&& (!traces.IsValid()
+						|| traces[i][ch][s] == sample(i, ch, s));
+			}
+		}
+	}
+
+	return ok;
+}
+
+int main(int argc, char const *argv[])
+{
+	bool ok = true;
+	const std::string file_name = "sbc_reader_test.bin";
+
+	std::vector<std::pair<std::string, fixtureConfig>> cases;
+	cases.push_back({"Raw", fixtureConfig()});
+
+	fixtureConfig config;
+	config.Type = "bitpack16";
+	config.NumLines = 23;
+	cases.push_back({"BitPacked", config});
+
+	config.IndexInterval = 4;
+	cases.push_back({"BitPacked with index", config});
+
+	config = fixtureConfig();
+	config.NumLines = 23;
+	config.BlockLines = 5;
+	config.IndexInterval = 4;
+	cases.push_back({"Framed", config});
+
+	config.Type = "bitpack16";
+	cases.push_back({"Framed BitPacked", config});
+
+	for(const auto& [name, c] : cases) {
+		write_fixture(file_name, c);
+		sbcReader reader(file_name);
+		const bool good = check(reader, c) && !reader.IsTruncated();
+		std::cout << name << ": " << reader.NumLines() << " lines, "
+			<< reader.GetIndex().size() << " index entries"
+			<< (good ? "" : " FAILED") << "\n";
+		ok &= good;
+	}
+
+	// A file that was not closed has 0 lines in its header, and one
+	// cut short has fewer lines than it says
+	for(const int32_t stored : {0, 30}) {
+		config = fixtureConfig();
+		config.StoredLines = stored;
+		write_fixture(file_name, config);
+		sbcReader reader(file_name);
+		ok &= check(reader, config) && reader.IsTruncated();
+	}
+
+	// With an index, the lines are found when they are used. A line
+	// with a wrong size only breaks the lines after it up to the next
+	// index entry.
+	config = fixtureConfig();
+	config.Type = "bitpack16";
+	config.NumLines = 23;
+	config.IndexInterval = 4;
+	write_fixture(file_name, config);
+	uint64_t size_offset = 0;
+	{
+		sbcReader reader(file_name);
+		size_offset = reader.LineOffset(21)
+			+ reader.FindColumn("sipm_traces")->Offset;
+	}
+	{
+		std::fstream file(file_name, std::fstream::binary
+			| std::fstream::in | std::fstream::out);
+		const uint32_t wrong = 0xFFFFFF;
+		file.seekp(size_offset);
+		file.write(reinterpret_cast<const char*>(&wrong), sizeof(wrong));
+	}
+	{
+		sbcReader reader(file_name);
+		std::vector<uint16_t> decoded;
+		ok &= reader.NumLines() == 23 && reader.decode_traces(19, decoded)
+			&& decoded[0] == sample(19, 0, 0)
+			&& reader.LineOffset(22) == reader.LineOffset(20);
+	}
+
+	// Big files open without reading them, and the lines can be found
+	// from any thread
+	config = fixtureConfig();
+	config.Type = "bitpack16";
+	config.NumLines = 200000;
+	for(const uint32_t interval : {0u, 1000u}) {
+		config.IndexInterval = interval;
+		write_fixture(file_name, config);
+
+		auto start = std::chrono::steady_clock::now();
+		sbcReader reader(file_name);
+		auto opened = std::chrono::steady_clock::now();
+
+		std::vector<uint64_t> offsets(reader.NumLines());
+		std::vector<std::thread> threads;
+		for(size_t t = 0; t < 4; t++) {
+			threads.emplace_back([&, t]() {
+				for(uint64_t i = t; i < offsets.size(); i += 4) {
+					offsets[i] = reader.LineOffset(i);
+				}
+			});
+		}
+		for(auto& thread : threads) {
+			thread.join();
+		}
+
+		bool good = reader.NumLines() == config.NumLines;
+		for(uint64_t i = 1; good && i < offsets.size(); i++) {
+			good = offsets[i] > offsets[i - 1];
+		}
+		good &= check(reader, config);
+		std::cout << config.NumLines << " lines " << (interval > 0 ?
+			"with" : "without") << " index opened in "
+			<< std::chrono::duration<double, std::milli>(opened - start).count()
+			<< " ms" << (good ? "" : " FAILED") << "\n";
+		ok &= good;
+	}
+
+	// A damaged header is an error, not an exception
+	config = fixtureConfig();
+	config.Dims = "64,x";
+	write_fixture(file_name, config);
+	{
+		sbcReader reader(file_name);
+		ok &= !reader.IsOpen() && !reader.GetError().empty();
+		std::cout << "Damaged header: " << reader.GetError() << "\n";
+	}
+
+	std::filesystem::remove(file_name);
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
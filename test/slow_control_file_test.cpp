@@ -0,0 +1,87 @@
+// g++ slow_control_file_test.cpp -O3 -I../include -o slow_control_file_test.exe
+#include "slow_control_file.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+struct RTDs {
+	double time;
+	double RTD_1;
+	double RTD_2;
+};
+
+const SBCQueens::SlowControlSchema<RTDs> schema {
+	{"time", [](const RTDs& r) { return r.time; }},
+	{"RTD_1", [](const RTDs& r) { return r.RTD_1; }},
+	{"RTD_2", [](const RTDs& r) { return r.RTD_2; }}
+};
+
+int main(int argc, char const *argv[])
+{
+	const std::string file_name = "slow_control_test.bin";
+	std::filesystem::remove(file_name);
+
+	// Three weeks of RTDs every 100 ms, saved every 30 s
+	const uint64_t num_lines = 3ull*7*24*3600*10;
+	const double t_start = 1.6e12;
+	SBCQueens::SlowControlIndex index;
+	index.Interval = 1000;
+
+	auto start = std::chrono::steady_clock::now();
+	{
+		std::ofstream out(file_name, std::ofstream::binary);
+		out << SBCQueens::sc_init_file(schema, index);
+
+		std::vector<RTDs> data;
+		for(uint64_t i = 0; i < num_lines; i++) {
+			const double t = t_start + 100.0*i;
+			data.push_back(RTDs{t, -100.0 + 1e-9*i, 20.0 + 1e-9*i});
+			if(data.size() == 300 || i == num_lines - 1) {
+				out << SBCQueens::sc_save_func(data, schema, index);
+				data.clear();
+			}
+		}
+
+		out << SBCQueens::sc_index_footer(index);
+	}
+	bool ok = SBCQueens::sc_finalize_file(file_name, index);
+	auto mid = std::chrono::steady_clock::now();
+
+	SBCQueens::slowControlReader reader(file_name);
+	std::vector<double> temps, times;
+	ok = ok && reader.IsOpen() && reader.NumLines() == num_lines
+		&& reader.Reader().GetIndex().size() == (num_lines + 999) / 1000
+		&& reader.read_time_range("RTD_1", t_start + 100.0*123456 - 50.0,
+			t_start + 100.0*123466, temps, &times);
+	auto end = std::chrono::steady_clock::now();
+
+	// 123456 to 123466, both included
+	ok = ok && temps.size() == 11 && times.size() == 11
+		&& times[0] == t_start + 100.0*123456
+		&& temps[10] == -100.0 + 1e-9*123466;
+
+	// Before the start, after the end and a time exactly in the index
+	ok = ok && reader.FindLines(0, t_start - 1).second == 0
+		&& reader.FindLines(t_start + 100.0*num_lines, 1e300).first
+			== num_lines
+		&& reader.FindLines(t_start + 100.0*5000,
+			t_start + 100.0*5000).first == 5000;
+
+	std::cout << "Wrote " << num_lines << " lines in "
+		<< std::chrono::duration<double>(mid - start).count() << " s, "
+		<< "opened and searched in "
+		<< std::chrono::duration<double, std::milli>(end - mid).count()
+		<< " ms\n";
+
+	if(!ok) {
+		std::cout << reader.GetError() << "\n";
+	}
+
+	std::filesystem::remove(file_name);
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+// g++ text_format_test.cpp -O3 -I../include -I../deps/spdlog/include -o text_format_test.exe
+#include "text_format.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+struct BMEs {
+	double time;
+	double Temperature;
+	double Pressure;
+	double Humidity;
+};
+
+const SBCQueens::SlowControlSchema<BMEs> schema {
+	{"time", [](const BMEs& b) { return b.time; }},
+	{"Temperature", [](const BMEs& b) { return b.Temperature; }},
+	{"Pressure", [](const BMEs& b) { return b.Pressure; }},
+	{"Humidity", [](const BMEs& b) { return b.Humidity; }}
+};
+
+// What the Teensy files used to have
+std::string old_format(const BMEs& b) {
+	return std::to_string(b.time) + "," + std::to_string(b.Temperature)
+		+ "," + std::to_string(b.Pressure) + ","
+		+ std::to_string(b.Humidity) + "\n";
+}
+
+int main(int argc, char const *argv[])
+{
+	std::mt19937 gen(1234);
+	std::uniform_real_distribution<double> dist(-1e5, 1e5);
+
+	std::vector<BMEs> data(300);
+	for(size_t i = 0; i < data.size(); i++) {
+		data[i] = BMEs{1.6e12 + 114.0*i, dist(gen), dist(gen), dist(gen)};
+	}
+	data[0].Temperature = -0.0000004;
+	data[1].Pressure = 1e200;
+
+	// Precision 6 has to be the same as std::to_string
+	SBCQueens::csvFormatter<BMEs> text(schema);
+	std::string expected;
+	for(const auto& b : data) {
+		expected += old_format(b);
+	}
+
+	bool ok = text(data) == expected
+		&& text.header() == "time,Temperature,Pressure,Humidity\n";
+
+	text.Precision = 2;
+	ok = ok && text(data).substr(0, 17) == "1600000000000.00,";
+
+	const int num_saves = 2000;
+	text.Precision = 6;
+	size_t total = 0;
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < num_saves; i++) {
+		total += text(data).size();
+	}
+	auto mid = std::chrono::steady_clock::now();
+	for(int i = 0; i < num_saves; i++) {
+		std::string out;
+		for(const auto& b : data) {
+			out += old_format(b);
+		}
+		total -= out.size();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	std::cout << "csvFormatter: "
+		<< std::chrono::duration<double, std::milli>(mid - start).count()
+		<< " ms, std::to_string: "
+		<< std::chrono::duration<double, std::milli>(end - mid).count()
+		<< " ms\n";
+
+	ok = ok && total == 0;
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+// g++ trace_codec_test.cpp -O3 -I../include -o trace_codec_test.exe
+// g++ trace_codec_test.cpp -O3 -mavx2 -I../include -o trace_codec_test.exe
+#include "trace_codec.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Makes a trace that looks like a SiPM pulse on top of noise
+std::vector<uint16_t> make_trace(std::mt19937& gen, const size_t& n,
+	const uint16_t& max_val) {
+	std::normal_distribution<double> noise(0.0, 3.0);
+	std::uniform_real_distribution<double> amplitude(0.0, 800.0);
+
+	const double baseline = 0.8*max_val;
+	const double amp = amplitude(gen);
+
+	std::vector<uint16_t> trace(n);
+	for(size_t i = 0; i < n; i++) {
+		double t = static_cast<double>(i) - n/2.0;
+		double pulse = t < 0 ? 0.0 : amp*(std::exp(-t/40.0) - std::exp(-t/4.0));
+		double val = baseline - pulse + noise(gen);
+		trace[i] = static_cast<uint16_t>(std::clamp(val, 0.0,
+			static_cast<double>(max_val)));
+	}
+
+	return trace;
+}
+
+bool round_trip(const std::vector<uint16_t>& trace, size_t& encoded_size) {
+	std::vector<char> buffer(SBCQueens::bitpack16_max_size(trace.size()));
+	std::vector<uint16_t> decoded(trace.size());
+
+	encoded_size = SBCQueens::bitpack16_encode(trace.data(), trace.size(),
+		buffer.data());
+	auto used = SBCQueens::bitpack16_decode(buffer.data(), encoded_size,
+		decoded.data(), decoded.size());
+
+	return used == encoded_size && decoded == trace;
+}
+
+int main(int argc, char const *argv[])
+{
+	std::mt19937 gen(1234);
+	size_t encoded_size = 0;
+	bool ok = true;
+
+	// Edge cases: empty, less than a block, not a multiple of the block
+	// and random uint16 which uses every bit.
+	for(size_t n : {0, 1, 7, 31, 32, 33, 100, 1200}) {
+		std::uniform_int_distribution<uint16_t> all_bits(0, 0xFFFF);
+		std::vector<uint16_t> trace(n);
+		for(auto& s : trace) {
+			s = all_bits(gen);
+		}
+
+		if(!round_trip(trace, encoded_size)) {
+			std::cout << "Random trace of " << n << " samples failed\n";
+			ok = false;
+		}
+
+		std::vector<uint16_t> flat(n, 0x3FFF);
+		if(!round_trip(flat, encoded_size)) {
+			std::cout << "Flat trace of " << n << " samples failed\n";
+			ok = false;
+		}
+	}
+
+	// Compression ratio and throughput with realistic traces
+	const size_t num_traces = 20000;
+	const size_t record_length = 1200;
+	for(uint16_t max_val : {0x0FFF, 0x3FFF}) {
+		std::vector<std::vector<uint16_t>> traces;
+		for(size_t i = 0; i < 64; i++) {
+			traces.push_back(make_trace(gen, record_length, max_val));
+		}
+
+		std::vector<char> buffer(SBCQueens::bitpack16_max_size(record_length));
+		std::vector<uint16_t> decoded(record_length);
+
+		size_t total_encoded = 0;
+		auto start = std::chrono::steady_clock::now();
+		for(size_t i = 0; i < num_traces; i++) {
+			total_encoded += SBCQueens::bitpack16_encode(
+				traces[i % traces.size()].data(), record_length, buffer.data());
+		}
+		auto mid = std::chrono::steady_clock::now();
+		for(size_t i = 0; i < num_traces; i++) {
+			auto n = SBCQueens::bitpack16_encode(
+				traces[i % traces.size()].data(), record_length, buffer.data());
+			SBCQueens::bitpack16_decode(buffer.data(), n, decoded.data(),
+				record_length);
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		for(auto& trace : traces) {
+			if(!round_trip(trace, encoded_size)) {
+				std::cout << "Pulse trace failed\n";
+				ok = false;
+			}
+		}
+
+		double raw_mb = num_traces*record_length*sizeof(uint16_t)/1e6;
+		double enc_s = std::chrono::duration<double>(mid - start).count();
+		double dec_s = std::chrono::duration<double>(end - mid).count()
+			- enc_s;
+
+		std::cout << "max value " << max_val
+			<< ": ratio " << raw_mb*1e6/total_encoded
+			<< ", encode " << raw_mb/enc_s << " MB/s"
+			<< ", decode " << raw_mb/std::max(dec_s, 1e-9) << " MB/s\n";
+	}
+
+	std::cout << (ok ? "All good" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
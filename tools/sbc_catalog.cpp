@@ -0,0 +1,242 @@
+// Finds runs in the run catalogs (see run_catalog.h) without opening
+// their files.
+//
+// sbc_catalog catalog.sbcr|directory... [options]
+//	--sipm text 			SiPM parameters that contain text
+//	--param name=min:max 	parameter or result (ex: Gain0) in
+//							[min, max], or name=value
+//							(to 0.01%, the setpoints are floats)
+//	--from date 			started at or after date (YYYYmmdd[HHMM])
+//	--to date 				started before the end of date
+//	--hash hex 				with this digitizer configuration hash
+//	--stopped 				only runs that were stopped properly
+//	--files 				lists the files of each run
+//
+// Directories are searched for catalog.sbcr, so giving it RunDir finds
+// the runs of every RunName. Each run is printed in one line:
+//
+//	start, duration, events, config hash, SiPM parameters, parameters
+//	and results
+//
+// ex: all the runs of a VUV4 at -100 C in March
+//	sbc_catalog RunDir --sipm VUV4 --param PeltierTempSetpoint=-100
+//		--from 20220301 --to 20220331
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// 3rd party includes
+#include <spdlog/spdlog.h>
+
+// my includes
+#include "run_catalog.h"
+
+using namespace SBCQueens;
+
+namespace {
+
+	void print_usage() {
+		spdlog::info("Usage: sbc_catalog catalog.sbcr|directory... "
+			"[--sipm text] [--param name=min:max]... [--from YYYYmmdd[HHMM]] "
+			"[--to YYYYmmdd[HHMM]] [--hash hex] [--stopped] [--files]");
+	}
+
+	// Local date YYYYmmdd[HHMM] to unix ms. If end, the last ms of the
+	// day or minute. Returns false if it is not a date.
+	bool parse_date(const std::string& date, const bool& end,
+		uint64_t& out) {
+		if((date.size() != 8 && date.size() != 12)
+			|| date.find_first_not_of("0123456789") != std::string::npos) {
+			return false;
+		}
+
+		std::tm tm = {};
+		tm.tm_year = std::stoi(date.substr(0, 4)) - 1900;
+		tm.tm_mon = std::stoi(date.substr(4, 2)) - 1;
+		tm.tm_mday = std::stoi(date.substr(6, 2));
+		tm.tm_isdst = -1;
+		int64_t length = 24*3600;
+		if(date.size() == 12) {
+			tm.tm_hour = std::stoi(date.substr(8, 2));
+			tm.tm_min = std::stoi(date.substr(10, 2));
+			length = 60;
+		}
+
+		const std::time_t t = std::mktime(&tm);
+		if(t < 0) {
+			return false;
+		}
+
+		out = 1000*static_cast<uint64_t>(t) + (end ? 1000*length - 1 : 0);
+		return true;
+	}
+
+	// name=min:max or name=value
+	bool parse_range(const std::string& arg, RunCatalogQuery::Range& out) {
+		const auto equal = arg.find('=');
+		if(equal == std::string::npos || equal == 0) {
+			return false;
+		}
+
+		out.Name = arg.substr(0, equal);
+		const std::string values = arg.substr(equal + 1);
+		const auto colon = values.find(':');
+		try {
+			if(colon == std::string::npos) {
+				const double val = std::stod(values);
+				const double tolerance = 1e-4*std::max(std::abs(val), 1.0);
+				out.Min = val - tolerance;
+				out.Max = val + tolerance;
+			} else {
+				if(colon > 0) {
+					out.Min = std::stod(values.substr(0, colon));
+				}
+				if(colon + 1 < values.size()) {
+					out.Max = std::stod(values.substr(colon + 1));
+				}
+			}
+		} catch(...) {
+			return false;
+		}
+
+		return true;
+	}
+
+	std::string local_time(const uint64_t& ms) {
+		const std::time_t t = static_cast<std::time_t>(ms / 1000);
+		char out[32];
+		std::strftime(out, sizeof(out), "%Y-%m-%d %H:%M:%S",
+			std::localtime(&t));
+		return out;
+	}
+
+	void print_run(const RunCatalogEntry& run, const bool& files) {
+		std::string duration = "not stopped";
+		if(run.IsStopped()) {
+			duration = fmt::format("{0:.1f} min",
+				(run.EndTime - run.StartTime) / 60000.0);
+		}
+
+		std::string parameters;
+		for(const auto* pars : {&run.Parameters, &run.Results}) {
+			for(const auto& par : *pars) {
+				parameters += fmt::format(" {0}={1}", par.Name, par.Value);
+			}
+		}
+
+		fmt::print("{0}, {1}, {2} events, {3:016x}, \"{4}\",{5}\n",
+			local_time(run.StartTime), duration, run.Events, run.ConfigHash,
+			run.SiPMParameters, parameters);
+
+		if(files) {
+			for(const auto& seg : run.Segments) {
+				fmt::print("\t{0} ({1} events, {2:.1f} MB)\n", seg.FileName,
+					seg.Events, seg.Bytes / 1e6);
+			}
+		}
+	}
+
+} // namespace
+
+int main(int argc, char const *argv[])
+{
+	std::vector<std::string> paths;
+	RunCatalogQuery query;
+	bool files = false;
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+		bool ok = true;
+		if(arg == "--sipm" && has_value) {
+			query.SiPM = argv[++i];
+		} else if(arg == "--param" && has_value) {
+			RunCatalogQuery::Range range;
+			ok = parse_range(argv[++i], range);
+			query.Parameters.push_back(range);
+		} else if(arg == "--from" && has_value) {
+			ok = parse_date(argv[++i], false, query.From);
+		} else if(arg == "--to" && has_value) {
+			ok = parse_date(argv[++i], true, query.To);
+		} else if(arg == "--hash" && has_value) {
+			try {
+				query.ConfigHash = std::stoull(argv[++i], nullptr, 16);
+			} catch(...) {
+				ok = false;
+			}
+		} else if(arg == "--stopped") {
+			query.OnlyStopped = true;
+		} else if(arg == "--files") {
+			files = true;
+		} else if(arg == "-h" || arg == "--help") {
+			print_usage();
+			return 0;
+		} else if(arg.rfind("--", 0) == 0) {
+			ok = false;
+		} else {
+			paths.push_back(arg);
+		}
+
+		if(!ok) {
+			spdlog::error("Could not understand {0}", arg == argv[i]
+				? arg : arg + " " + argv[i]);
+			print_usage();
+			return 1;
+		}
+	}
+
+	if(paths.empty()) {
+		print_usage();
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	runCatalog catalog;
+	size_t num_catalogs = 0;
+	auto open = [&](const std::string& file_name) {
+		if(!catalog.open(file_name)) {
+			spdlog::warn(catalog.GetError());
+			return;
+		}
+
+		num_catalogs++;
+		if(!catalog.GetError().empty()) {
+			spdlog::warn("{0}, the rest of it was skipped.",
+				catalog.GetError());
+		}
+	};
+
+	for(const auto& path : paths) {
+		std::error_code ec;
+		if(!std::filesystem::is_directory(path, ec)) {
+			open(path);
+			continue;
+		}
+
+		for(const auto& entry
+			: std::filesystem::recursive_directory_iterator(path, ec)) {
+			if(entry.is_regular_file()
+				&& entry.path().filename() == "catalog.sbcr") {
+				open(entry.path().string());
+			}
+		}
+	}
+
+	const auto runs = catalog.query(query);
+	auto end = std::chrono::steady_clock::now();
+
+	for(const auto* run : runs) {
+		print_run(*run, files);
+	}
+
+	spdlog::info("{0} of {1} runs in {2} catalogs match ({3:.2f} ms)",
+		runs.size(), catalog.GetRuns().size(), num_catalogs,
+		std::chrono::duration<double, std::milli>(end - start).count());
+	return 0;
+}
@@ -0,0 +1,542 @@
+// Converts SBC binary files (.bin) into other formats.
+//
+// sbc_convert input.bin [options]
+//	-o, --output DIR 		where to save the files. Default: input name
+//	-f, --format FORMAT 	npy: one .npy per column (default)
+// 							chunks: one folder per column with a .npy
+// 							every --chunk-events events
+// 							csv: one .csv with all the small columns
+//	-t, --threads N 		number of threads. Default: all cores
+//	-c, --columns a,b,... 	only these columns. Default: all
+//	--chunk-events N 		events per chunk. Default: 100000
+//
+// The input is split in ranges of events and each thread reads its range
+// (memory mapped) and writes it directly to its final position in the
+// output files, so it goes as fast as the disks allow.
+//
+// It also works with the slow control files (Peltiers.bin, RTDs.bin...),
+// ex: sbc_convert RTDs.bin -f csv gives the same columns as the old .txt
+
+// STD includes
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// 3rd party includes
+#include <spdlog/spdlog.h>
+
+// my includes
+#include "sbc_reader.h"
+
+using namespace SBCQueens;
+
+namespace {
+
+	// Output file that several threads can write to at the same time
+	// as long as they write to different places.
+	class positionalFile {
+#ifdef _WIN32
+		HANDLE _file = INVALID_HANDLE_VALUE;
+#else
+		int _fd = -1;
+#endif
+		bool _error = false;
+
+public:
+		positionalFile(const std::string& fileName, const uint64_t& size) {
+#ifdef _WIN32
+			_file = CreateFileA(fileName.c_str(), GENERIC_WRITE, 0, nullptr,
+				CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			_error = _file == INVALID_HANDLE_VALUE;
+#else
+			_fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			_error = _fd < 0;
+#endif
+			if(_error) {
+				spdlog::error("Could not create {0}", fileName);
+				return;
+			}
+
+			// Setting the final size first lets the filesystem
+			// allocate it in one go
+			std::error_code ec;
+			std::filesystem::resize_file(fileName, size, ec);
+		}
+
+		positionalFile(const positionalFile&) = delete;
+
+		~positionalFile() {
+#ifdef _WIN32
+			if(_file != INVALID_HANDLE_VALUE) {
+				CloseHandle(_file);
+			}
+#else
+			if(_fd >= 0) {
+				::close(_fd);
+			}
+#endif
+		}
+
+		bool HasError() const { return _error; }
+
+		void write_at(const char* data, size_t size, uint64_t offset) {
+			if(_error) {
+				return;
+			}
+
+			while(size > 0) {
+#ifdef _WIN32
+				OVERLAPPED ov = {};
+				ov.Offset = static_cast<DWORD>(offset);
+				ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+				DWORD written = 0;
+				DWORD chunk = static_cast<DWORD>(
+					std::min<size_t>(size, 1u << 30));
+				if(!WriteFile(_file, data, chunk, &written, &ov)) {
+					_error = true;
+					return;
+				}
+#else
+				auto written = pwrite(_fd, data, size,
+					static_cast<off_t>(offset));
+				if(written < 0) {
+					if(errno == EINTR) {
+						continue;
+					}
+					_error = true;
+					return;
+				}
+#endif
+				data += written;
+				size -= written;
+				offset += written;
+			}
+		}
+	};
+
+	struct options {
+		std::string Input;
+		std::string Output;
+		std::string Format = "npy";
+		unsigned int NumThreads = 0;
+		std::vector<std::string> Columns;
+		uint64_t ChunkEvents = 100000;
+	};
+
+	// numpy dtype of a SBC type. Empty if there is none.
+	std::string npy_descr(const std::string& type) {
+		if(type == "char") return "|S1";
+		if(type == "int8") return "|i1";
+		if(type == "uint8") return "|u1";
+		if(type == "int16") return "<i2";
+		if(type == "uint16" || sbc_is_encoded_type(type)) return "<u2";
+		if(type == "int32") return "<i4";
+		if(type == "uint32") return "<u4";
+		if(type == "int64") return "<i8";
+		if(type == "uint64") return "<u8";
+		if(type == "single" || type == "float32") return "<f4";
+		if(type == "double" || type == "float64") return "<f8";
+		return "";
+	}
+
+	// Bytes of a column in one line once it is converted
+	size_t output_line_size(const SBCColumnInfo& col) {
+		return col.NumElements*(sbc_is_encoded_type(col.Type) ? 2 : col.TypeSize);
+	}
+
+	// .npy (version 1.0) header for num_lines lines of col.
+	// Same shape as ReadBinary.py
+	std::string npy_header(const SBCColumnInfo& col, const uint64_t& num_lines) {
+		std::ostringstream shape;
+		shape << "(" << num_lines << ",";
+		if(!(col.Dims.size() == 1 && col.Dims[0] == 1)) {
+			for(auto d : col.Dims) {
+				shape << " " << d << ",";
+			}
+		}
+		shape << ")";
+
+		std::string dict = "{'descr': '" + npy_descr(col.Type)
+			+ "', 'fortran_order': False, 'shape': " + shape.str() + ", }";
+
+		// magic (6) + version (2) + length (2) + dict + \n, aligned to 64
+		const size_t unpadded = 10 + dict.size() + 1;
+		dict.append((64 - unpadded % 64) % 64, ' ');
+		dict += '\n';
+
+		std::string header("\x93NUMPY\x01\x00", 8);
+		const auto len = static_cast<uint16_t>(dict.size());
+		header.append(reinterpret_cast<const char*>(&len), sizeof(len));
+		return header + dict;
+	}
+
+	// Copies (or decodes) col of the lines [first, last) into out
+	bool gather(const sbcReader& reader, const SBCColumnInfo& col,
+		const uint64_t& first, const uint64_t& last, std::vector<char>& out) {
+
+		const size_t line_size = output_line_size(col);
+		out.resize((last - first)*line_size);
+
+		std::vector<uint16_t> traces;
+		for(uint64_t i = first; i < last; i++) {
+			char* dst = out.data() + (i - first)*line_size;
+			if(sbc_is_encoded_type(col.Type)) {
+				if(!reader.decode_traces(i, traces, col.Name)) {
+					spdlog::error("Could not decode {0} in line {1}",
+						col.Name, i);
+					return false;
+				}
+				std::memcpy(dst, traces.data(), line_size);
+			} else {
+				std::memcpy(dst, reader.LinePtr(i) + col.Offset, line_size);
+			}
+		}
+
+		return true;
+	}
+
+	// Calls f(first, last) for every range of lines using num_threads
+	bool parallel_ranges(const uint64_t& num_lines, const uint64_t& range_size,
+		const unsigned int& num_threads,
+		const std::function<bool(uint64_t, uint64_t)>& f) {
+
+		const uint64_t num_ranges = (num_lines + range_size - 1) / range_size;
+		std::atomic<uint64_t> next(0);
+		std::atomic<bool> ok(true);
+
+		std::vector<std::thread> threads;
+		for(unsigned int t = 0; t < num_threads; t++) {
+			threads.emplace_back([&]() {
+				uint64_t r;
+				while(ok && (r = next++) < num_ranges) {
+					const uint64_t first = r*range_size;
+					if(!f(first, std::min(first + range_size, num_lines))) {
+						ok = false;
+					}
+				}
+			});
+		}
+
+		for(auto& t : threads) {
+			t.join();
+		}
+
+		return ok;
+	}
+
+	bool convert_npy(const sbcReader& reader,
+		const std::vector<const SBCColumnInfo*>& columns, const options& opts) {
+
+		const uint64_t n = reader.NumLines();
+
+		std::vector<std::unique_ptr<positionalFile>> files;
+		std::vector<uint64_t> data_start;
+		for(auto col : columns) {
+			const auto header = npy_header(*col, n);
+			auto file = std::make_unique<positionalFile>(
+				opts.Output + "/" + col->Name + ".npy",
+				header.size() + n*output_line_size(*col));
+			file->write_at(header.data(), header.size(), 0);
+
+			data_start.push_back(header.size());
+			files.push_back(std::move(file));
+		}
+
+		// Ranges of ~4MB of input so every write is big
+		const size_t line_size = std::max<uint64_t>(
+			reader.NumLines() > 0 ?
+			(reader.LineOffset(n - 1) - reader.LineOffset(0)) / n : 1, 1);
+		const uint64_t range_size = std::max<uint64_t>((4 << 20) / line_size, 1);
+
+		bool ok = parallel_ranges(n, range_size, opts.NumThreads,
+			[&](uint64_t first, uint64_t last) {
+				std::vector<char> buffer;
+				for(size_t c = 0; c < columns.size(); c++) {
+					if(!gather(reader, *columns[c], first, last, buffer)) {
+						return false;
+					}
+
+					files[c]->write_at(buffer.data(), buffer.size(),
+						data_start[c] + first*output_line_size(*columns[c]));
+				}
+				return true;
+		});
+
+		for(auto& file : files) {
+			ok &= !file->HasError();
+		}
+
+		return ok;
+	}
+
+	bool convert_chunks(const sbcReader& reader,
+		const std::vector<const SBCColumnInfo*>& columns, const options& opts) {
+
+		for(auto col : columns) {
+			std::filesystem::create_directories(opts.Output + "/" + col->Name);
+		}
+
+		const uint64_t n = reader.NumLines();
+		return parallel_ranges(n, opts.ChunkEvents, opts.NumThreads,
+			[&](uint64_t first, uint64_t last) {
+				std::ostringstream name;
+				name << std::setw(6) << std::setfill('0')
+					<< first / opts.ChunkEvents << ".npy";
+
+				std::vector<char> buffer;
+				for(auto col : columns) {
+					if(!gather(reader, *col, first, last, buffer)) {
+						return false;
+					}
+
+					const auto header = npy_header(*col, last - first);
+					positionalFile file(opts.Output + "/" + col->Name
+						+ "/" + name.str(), header.size() + buffer.size());
+					file.write_at(header.data(), header.size(), 0);
+					file.write_at(buffer.data(), buffer.size(), header.size());
+
+					if(file.HasError()) {
+						return false;
+					}
+				}
+				return true;
+		});
+	}
+
+	template<typename V>
+	void csv_value(std::string& out, const char* ptr) {
+		V val;
+		std::memcpy(&val, ptr, sizeof(V));
+		if constexpr (std::is_floating_point_v<V>) {
+			std::ostringstream s;
+			s << std::setprecision(std::numeric_limits<V>::max_digits10) << val;
+			out += s.str();
+		} else {
+			out += std::to_string(val);
+		}
+	}
+
+	void csv_line(std::string& out, const sbcReader& reader,
+		const std::vector<const SBCColumnInfo*>& columns, const uint64_t& i) {
+		bool first = true;
+		for(auto col : columns) {
+			const char* ptr = reader.LinePtr(i) + col->Offset;
+			for(size_t k = 0; k < col->NumElements; k++) {
+				if(!first) {
+					out += ',';
+				}
+				first = false;
+
+				const char* p = ptr + k*col->TypeSize;
+				const auto& t = col->Type;
+				if(t == "char") out += *p;
+				else if(t == "int8") csv_value<int8_t>(out, p);
+				else if(t == "uint8") csv_value<uint8_t>(out, p);
+				else if(t == "int16") csv_value<int16_t>(out, p);
+				else if(t == "uint16") csv_value<uint16_t>(out, p);
+				else if(t == "int32") csv_value<int32_t>(out, p);
+				else if(t == "uint32") csv_value<uint32_t>(out, p);
+				else if(t == "int64") csv_value<int64_t>(out, p);
+				else if(t == "uint64") csv_value<uint64_t>(out, p);
+				else if(t == "single" || t == "float32") csv_value<float>(out, p);
+				else csv_value<double>(out, p);
+			}
+		}
+		out += '\n';
+	}
+
+	bool convert_csv(const sbcReader& reader,
+		std::vector<const SBCColumnInfo*> columns, const options& opts) {
+
+		// Only the small columns, the traces do not belong in a csv
+		columns.erase(std::remove_if(columns.begin(), columns.end(),
+			[](auto col) {
+				return col->NumElements > 64 || col->TypeSize == 0
+					|| col->TypeSize > 8;
+			}), columns.end());
+
+		std::string header;
+		for(auto col : columns) {
+			for(size_t k = 0; k < col->NumElements; k++) {
+				header += header.empty() ? "" : ",";
+				header += col->NumElements == 1 ?
+					col->Name : col->Name + "_" + std::to_string(k);
+			}
+		}
+		header += '\n';
+
+		const auto name = opts.Output + "/"
+			+ std::filesystem::path(opts.Input).stem().string() + ".csv";
+		positionalFile file(name, 0);
+		file.write_at(header.data(), header.size(), 0);
+
+		// The size of each line is not known until it is written, so
+		// every batch of ranges is formatted in parallel and then written
+		// in order.
+		const uint64_t n = reader.NumLines();
+		const uint64_t range_size = 50000;
+		const uint64_t batch = range_size*opts.NumThreads*2;
+		uint64_t offset = header.size();
+
+		for(uint64_t start = 0; start < n; start += batch) {
+			const uint64_t end = std::min(start + batch, n);
+			std::vector<std::string> parts((end - start + range_size - 1)
+				/ range_size);
+
+			parallel_ranges(end - start, range_size, opts.NumThreads,
+				[&](uint64_t first, uint64_t last) {
+					auto& out = parts[first / range_size];
+					for(uint64_t i = start + first; i < start + last; i++) {
+						csv_line(out, reader, columns, i);
+					}
+					return true;
+			});
+
+			for(const auto& part : parts) {
+				file.write_at(part.data(), part.size(), offset);
+				offset += part.size();
+			}
+		}
+
+		return !file.HasError();
+	}
+
+	std::vector<std::string> split(const std::string& str, const char& sep) {
+		std::vector<std::string> out;
+		std::stringstream ss(str);
+		std::string item;
+		while(std::getline(ss, item, sep)) {
+			if(!item.empty()) {
+				out.push_back(item);
+			}
+		}
+		return out;
+	}
+
+	void print_usage() {
+		spdlog::info("Usage: sbc_convert input.bin [-o dir] "
+			"[-f npy|chunks|csv] [-t threads] [-c col1,col2] "
+			"[--chunk-events N]");
+	}
+
+} // namespace
+
+int main(int argc, char const *argv[])
+{
+	options opts;
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto next = [&]() -> std::string {
+			return i + 1 < argc ? argv[++i] : "";
+		};
+
+		if(arg == "-o" || arg == "--output") {
+			opts.Output = next();
+		} else if(arg == "-f" || arg == "--format") {
+			opts.Format = next();
+		} else if(arg == "-t" || arg == "--threads") {
+			opts.NumThreads = std::stoul("0" + next());
+		} else if(arg == "-c" || arg == "--columns") {
+			opts.Columns = split(next(), ',');
+		} else if(arg == "--chunk-events") {
+			opts.ChunkEvents = std::max(std::stoull("0" + next()), 1ull);
+		} else if(arg == "-h" || arg == "--help") {
+			print_usage();
+			return 0;
+		} else {
+			opts.Input = arg;
+		}
+	}
+
+	if(opts.Input.empty()) {
+		print_usage();
+		return 1;
+	}
+
+	if(opts.NumThreads == 0) {
+		opts.NumThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	if(opts.Output.empty()) {
+		auto path = std::filesystem::path(opts.Input);
+		opts.Output = (path.parent_path() / path.stem()).string();
+	}
+	std::filesystem::create_directories(opts.Output);
+
+	sbcReader reader(opts.Input);
+	if(!reader.IsOpen()) {
+		spdlog::error(reader.GetError());
+		return 1;
+	}
+
+	if(reader.IsTruncated()) {
+		spdlog::warn("{0} was not closed properly, converting the {1} "
+			"complete events.", opts.Input, reader.NumLines());
+	}
+
+	std::vector<const SBCColumnInfo*> columns;
+	for(const auto& col : reader.GetColumns()) {
+		bool wanted = opts.Columns.empty() || std::find(opts.Columns.begin(),
+			opts.Columns.end(), col.Name) != opts.Columns.end();
+
+		if(!wanted) {
+			continue;
+		}
+
+		if(npy_descr(col.Type).empty()) {
+			spdlog::warn("Skipping {0}, type {1} is not supported.",
+				col.Name, col.Type);
+			continue;
+		}
+
+		columns.push_back(&col);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	bool ok = false;
+	if(opts.Format == "npy") {
+		ok = convert_npy(reader, columns, opts);
+	} else if(opts.Format == "chunks") {
+		ok = convert_chunks(reader, columns, opts);
+	} else if(opts.Format == "csv") {
+		ok = convert_csv(reader, columns, opts);
+	} else {
+		spdlog::error("Unknown format {0}", opts.Format);
+		print_usage();
+		return 1;
+	}
+
+	std::chrono::duration<double> elapsed
+		= std::chrono::steady_clock::now() - start;
+
+	if(!ok) {
+		spdlog::error("Conversion of {0} failed.", opts.Input);
+		return 1;
+	}
+
+	spdlog::info("Converted {0} events of {1} into {2} in {3:.2f} s "
+		"using {4} threads.", reader.NumLines(), opts.Input, opts.Output,
+		elapsed.count(), opts.NumThreads);
+
+	return 0;
+}
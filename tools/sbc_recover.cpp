@@ -0,0 +1,276 @@
+// Recovers a SBC binary file (.bin) that was not closed properly,
+// ex: the program or the PC died in the middle of a run.
+//
+// sbc_recover file.bin [options]
+//	-n, --dry-run 	only says what it would do
+//
+// Files saved in blocks (BlockFraming = true) are scanned block by block
+// checking their CRCs. Every good block is kept and the file is cut
+// right after the last one. Files without blocks are cut after their
+// last complete line, as long as all lines are the same size.
+// Then the number of lines in the header is written.
+//
+// The index at the end of the file is lost if the file was cut.
+// Compressed files must be decompressed first (zstd -d).
+
+// STD includes
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// 3rd party includes
+#include <spdlog/spdlog.h>
+
+// my includes
+#include "block_framing.h"
+#include "crc32c.h"
+#include "sbc_reader.h"
+
+using namespace SBCQueens;
+
+namespace {
+
+	struct scanResult {
+		// Where the good data ends
+		uint64_t End = 0;
+		uint64_t NumLines = 0;
+		uint64_t NumBlocks = 0;
+		// Why it stopped, empty if it got to the end
+		std::string Stop;
+	};
+
+	// Size of the index footer at the end of the file, 0 if none
+	uint64_t index_footer_size(std::ifstream& file, const uint64_t& start,
+		const uint64_t& fileSize) {
+		const uint64_t trailer_size = 2*sizeof(uint64_t) + 2*sizeof(uint32_t);
+		if(fileSize < start + trailer_size) {
+			return 0;
+		}
+
+		uint64_t num_entries = 0;
+		uint32_t magic = 0;
+		file.seekg(fileSize - trailer_size);
+		file.read(reinterpret_cast<char*>(&num_entries), sizeof(uint64_t));
+		file.seekg(fileSize - sizeof(uint32_t));
+		file.read(reinterpret_cast<char*>(&magic), sizeof(uint32_t));
+		if(!file || magic != 0x49434253
+			|| num_entries > (fileSize - start) / (3*sizeof(uint64_t))) {
+			file.clear();
+			return 0;
+		}
+
+		return trailer_size + num_entries*3*sizeof(uint64_t);
+	}
+
+	scanResult scan_blocks(std::ifstream& file, const uint64_t& start,
+		const uint64_t& end, const size_t& lineSize) {
+
+		scanResult result;
+		result.End = start;
+
+		std::vector<char> payload;
+		uint64_t pos = start;
+		while(pos < end) {
+			char raw[BlockFrameHeaderSize];
+			BlockFrameHeader block;
+			file.seekg(pos);
+			file.read(raw, BlockFrameHeaderSize);
+			if(!file || !read_block_frame_header(raw, end - pos, block)) {
+				result.Stop = "block header is incomplete or corrupted";
+				break;
+			}
+
+			payload.resize(block.Size);
+			file.read(payload.data(), payload.size());
+			if(!file) {
+				result.Stop = "block is incomplete";
+				break;
+			}
+
+			if(block_crc(payload.data(), block.Size, block.Items)
+				!= block.CRC) {
+				result.Stop = "block CRC does not match";
+				break;
+			}
+
+			if(lineSize > 0 && block.Size != block.Items*lineSize) {
+				result.Stop = "block size does not match its lines";
+				break;
+			}
+
+			pos += BlockFrameHeaderSize + block.Size;
+			result.End = pos;
+			result.NumLines += block.Items;
+			result.NumBlocks++;
+		}
+
+		file.clear();
+		return result;
+	}
+
+	void print_usage() {
+		spdlog::info("Usage: sbc_recover file.bin [-n | --dry-run]");
+	}
+
+} // namespace
+
+int main(int argc, char const *argv[])
+{
+	std::string file_name;
+	bool dry_run = false;
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if(arg == "-n" || arg == "--dry-run") {
+			dry_run = true;
+		} else if(arg == "-h" || arg == "--help") {
+			print_usage();
+			return 0;
+		} else {
+			file_name = arg;
+		}
+	}
+
+	if(file_name.empty()) {
+		print_usage();
+		return 1;
+	}
+
+	std::error_code ec;
+	const uint64_t file_size = std::filesystem::file_size(file_name, ec);
+	std::ifstream file(file_name, std::ifstream::binary);
+	if(ec || !file.is_open()) {
+		spdlog::error("Could not open {0}", file_name);
+		return 1;
+	}
+
+	uint32_t endianness = 0;
+	uint16_t header_length = 0;
+	file.read(reinterpret_cast<char*>(&endianness), sizeof(uint32_t));
+	file.read(reinterpret_cast<char*>(&header_length), sizeof(uint16_t));
+	if(!file || endianness != 0x01020304) {
+		spdlog::error("{0} is not a SBC file (is it compressed?)", file_name);
+		return 1;
+	}
+
+	std::string header(header_length, '\0');
+	int32_t stored_lines = 0;
+	file.read(header.data(), header.size());
+	file.read(reinterpret_cast<char*>(&stored_lines), sizeof(int32_t));
+	if(!file) {
+		spdlog::error("{0} header is incomplete, it cannot be recovered.",
+			file_name);
+		return 1;
+	}
+
+	const uint64_t count_offset = sizeof(uint32_t) + sizeof(uint16_t)
+		+ header_length;
+	const uint64_t data_start = count_offset + sizeof(int32_t);
+
+	const auto columns = sbc_parse_columns(header);
+	if(columns.empty()) {
+		spdlog::error("{0} header is not valid, it cannot be recovered.",
+			file_name);
+		return 1;
+	}
+
+	// 0 if the lines are not all the same size
+	size_t line_size = 0;
+	for(const auto& col : columns) {
+		if(col.TypeSize == 0) {
+			line_size = 0;
+			break;
+		}
+		line_size += col.TypeSize*col.NumElements;
+	}
+
+	uint32_t first_word = 0;
+	file.seekg(data_start);
+	file.read(reinterpret_cast<char*>(&first_word), sizeof(uint32_t));
+	file.clear();
+	const bool is_framed = first_word == SBCBlockMagic;
+
+	const auto start_time = std::chrono::steady_clock::now();
+
+	scanResult result;
+	const uint64_t footer_size = index_footer_size(file, data_start,
+		file_size);
+	if(is_framed) {
+		result = scan_blocks(file, data_start, file_size, line_size);
+	} else if(line_size > 0) {
+		const uint64_t data_end = file_size - footer_size;
+		result.NumLines = (data_end - data_start) / line_size;
+		result.End = data_start + result.NumLines*line_size;
+		if(result.End != data_end) {
+			result.Stop = "last line is incomplete";
+		}
+	} else {
+		spdlog::error("{0} is not saved in blocks and its lines are not all "
+			"the same size, it cannot be recovered.", file_name);
+		return 1;
+	}
+
+	std::chrono::duration<double> elapsed
+		= std::chrono::steady_clock::now() - start_time;
+	spdlog::info("Scanned {0:.2f} MB in {1:.2f} s ({2:.0f} MB/s, CRC32C in "
+		"{3}).", (result.End - data_start) / 1e6, elapsed.count(),
+		(result.End - data_start) / 1e6 / std::max(elapsed.count(), 1e-9),
+		crc32c_is_hardware() ? "hardware" : "software");
+
+	// A good file ends with the index, or right after the last line
+	const bool is_intact = result.End == file_size
+		|| (footer_size > 0 && result.End + footer_size == file_size);
+	if(is_intact && stored_lines > 0
+		&& static_cast<uint64_t>(stored_lines) == result.NumLines) {
+		spdlog::info("{0} is fine: {1} lines{2}.", file_name,
+			result.NumLines, is_framed ?
+				" in " + std::to_string(result.NumBlocks) + " blocks" : "");
+		return 0;
+	}
+
+	if(!is_intact) {
+		spdlog::warn("Stopped at byte {0}: {1}.", result.End,
+			result.Stop.empty() ? "unknown data after the lines"
+				: result.Stop);
+	}
+
+	spdlog::info("Keeping {0} lines{1}, removing {2} bytes.",
+		result.NumLines, is_framed ?
+			" in " + std::to_string(result.NumBlocks) + " blocks" : "",
+		is_intact ? 0 : file_size - result.End);
+
+	if(dry_run) {
+		return 0;
+	}
+	file.close();
+
+	if(!is_intact) {
+		std::filesystem::resize_file(file_name, result.End, ec);
+		if(ec) {
+			spdlog::error("Could not cut {0}: {1}", file_name, ec.message());
+			return 1;
+		}
+	}
+
+	if(result.NumLines > static_cast<uint64_t>(INT32_MAX)) {
+		spdlog::warn("Too many lines for the header, it is left as 0.");
+		return 0;
+	}
+
+	const auto num_lines = static_cast<int32_t>(result.NumLines);
+	std::fstream out(file_name,
+		std::fstream::in | std::fstream::out | std::fstream::binary);
+	out.seekp(count_offset);
+	out.write(reinterpret_cast<const char*>(&num_lines), sizeof(int32_t));
+	if(!out) {
+		spdlog::error("Could not write the number of lines of {0}",
+			file_name);
+		return 1;
+	}
+
+	spdlog::info("{0} recovered.", file_name);
+	return 0;
+}